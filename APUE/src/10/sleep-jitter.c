@@ -0,0 +1,129 @@
+/*
+* 睡眠唤醒抖动测试：原来 sleep_us 用的 select vs lib/deadline.c
+* 对每个睡眠时长，各方法睡 NITER 次，统计实际醒来比预期晚了多少微秒（平均、p50、p99、最大）
+* select：原来的 sleep_us，相对时间
+* dl_sleep：clock_nanosleep(TIMER_ABSTIME)，默认的定时器余量（timer slack，一般 50us）
+* dl_sleep/slack=1：把本线程的余量设为 1ns 再睡
+* dl_wait：先睡到截止时间前 余量+自旋窗口，剩下的自旋等待
+* 最后测周期性任务的累计漂移：每次 select 睡一个周期 vs 用 dl_advance 推进绝对截止时间
+* 用法：./a.out [每种测试的次数]
+*/
+#include "apue.h"
+#include "deadline.h"
+#include <sys/select.h>
+
+#define NITER 2000
+#define NTICK 1000
+#define PERIOD 1000000 // 周期性任务的周期，ns
+#define WORK 200000 // 每个周期里模拟的工作量，ns
+
+enum { M_SELECT, M_SLEEP, M_NOSLACK, M_WAIT, NMETHOD };
+
+static const char *names[NMETHOD] = { "select", "dl_sleep", "dl_sleep/slack=1", "dl_wait" };
+static const long long intervals[] = { 5000, 50000, 1000000 };
+
+static int cmpll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void select_ns(long long ns)
+{
+    struct timeval tv;
+
+    tv.tv_sec = ns / 1000000000;
+    tv.tv_usec = ns % 1000000000 / 1000;
+    select(0, NULL, NULL, NULL, &tv);
+}
+
+// 睡 ns 纳秒，返回比预期晚了多少纳秒
+static long long late(int method, long long ns)
+{
+    struct timespec dl;
+
+    dl_after(&dl, ns);
+    switch (method) {
+    case M_SELECT:
+        select_ns(ns);
+        break;
+    case M_SLEEP:
+    case M_NOSLACK:
+        dl_sleep(&dl);
+        break;
+    case M_WAIT:
+        dl_wait(&dl);
+        break;
+    }
+    return -dl_remaining(&dl);
+}
+
+// 忙等 ns 纳秒，模拟每个周期的工作
+static void work(long long ns)
+{
+    struct timespec dl;
+
+    dl_after(&dl, ns);
+    while (dl_remaining(&dl) > 0)
+        ;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, m, k, niter;
+    long long *lat, sum;
+    unsigned long slack;
+    struct timespec start, dl;
+
+    niter = argc > 1 ? atoi(argv[1]) : NITER;
+    if (niter <= 0) {
+        err_quit("usage: %s [iterations]", argv[0]);
+    }
+    if ((lat = malloc(niter * sizeof(long long))) == NULL) {
+        err_sys("malloc error");
+    }
+    slack = dl_getslack();
+    printf("timer slack %lu ns, spin window %d ns\n", slack, DL_SPIN);
+    printf("%-18s %8s %8s %8s %8s %8s   (us late)\n", "", "interval", "mean", "p50", "p99", "max");
+
+    for (k = 0; k < (int)(sizeof(intervals) / sizeof(intervals[0])); k++) {
+        for (m = 0; m < NMETHOD; m++) {
+            if (m == M_NOSLACK && dl_setslack(1) < 0) {
+                err_sys("dl_setslack error");
+            }
+            for (sum = 0, i = 0; i < niter; i++) {
+                lat[i] = late(m, intervals[k]);
+                sum += lat[i];
+            }
+            if (m == M_NOSLACK) {
+                dl_setslack(slack);
+            }
+            qsort(lat, niter, sizeof(long long), cmpll);
+            printf("%-18s %8.0f %8.2f %8.2f %8.2f %8.2f\n", names[m], intervals[k] / 1e3,
+                   sum / 1e3 / niter, lat[niter / 2] / 1e3, lat[niter * 99 / 100] / 1e3,
+                   lat[niter - 1] / 1e3);
+        }
+    }
+
+    // 周期性任务：每个周期先工作 WORK 纳秒，再睡到下一个周期
+    // 相对睡眠每次都把工作时间和醒来的延迟加进周期里，绝对截止时间则不会漂移
+    dl_after(&start, 0);
+    for (i = 0; i < NTICK; i++) {
+        work(WORK);
+        select_ns(PERIOD - WORK);
+    }
+    dl = start;
+    dl_advance(&dl, (long long)NTICK * PERIOD);
+    printf("\n%d ticks of %d us: select drifted %.0f us", NTICK, PERIOD / 1000,
+           -dl_remaining(&dl) / 1e3);
+    dl_after(&start, 0);
+    dl = start;
+    for (i = 0; i < NTICK; i++) {
+        work(WORK);
+        dl_advance(&dl, PERIOD);
+        dl_sleep(&dl);
+    }
+    printf(", dl_advance drifted %.0f us\n", -dl_remaining(&dl) / 1e3);
+    exit(0);
+}
@@ -0,0 +1,181 @@
+/*
+* 消息队列吞吐测试：11-15.c 的互斥量 + 条件变量 LIFO 栈 vs lib/bmq.c 的有界批量 FIFO 队列
+* NPROD 个生产者各发送 NMSGS 条消息，NCONS 个消费者处理，
+* 输出每秒处理的消息数；对 11-15.c 的版本再统计每次持有互斥量的平均时间，
+* 对 bmq 统计生产者（队列满）和消费者（队列空）各睡眠了多少次
+* 用法：./a.out [每个生产者的消息数] [生产者数] [消费者数] [批量大小] [队列容量]
+*/
+#include "apue.h"
+#include "bmq.h"
+#include <pthread.h>
+#include <time.h>
+
+#define NMSGS 200000
+#define NPROD 2
+#define NCONS 2
+#define BATCH 16
+#define QCAP 1024
+
+struct msg {
+    struct msg *m_next;
+    long m_seq;
+};
+
+/*
+* 11-15.c 的版本，统计持有互斥量的时间
+*/
+static struct msg *workq;
+static pthread_cond_t qready = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t qlock = PTHREAD_MUTEX_INITIALIZER;
+static double hold_total; // 持有 qlock 的总时间（在 qlock 保护下累加）
+static long hold_count;
+static long remaining; // 还没被处理的消息数，由 qlock 保护
+
+static struct bmq bq;
+static long nmsgs, batch;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *old_producer(void *arg)
+{
+    long i;
+    double t;
+    struct msg *msgs = arg;
+
+    for (i = 0; i < nmsgs; i++) {
+        pthread_mutex_lock(&qlock);
+        t = now();
+        msgs[i].m_next = workq;
+        workq = &msgs[i];
+        hold_total += now() - t;
+        hold_count++;
+        pthread_mutex_unlock(&qlock);
+        pthread_cond_signal(&qready);
+    }
+    return(0);
+}
+
+static void *old_consumer(void *arg)
+{
+    double t;
+
+    for (;;) {
+        pthread_mutex_lock(&qlock);
+        while (workq == NULL && remaining > 0)
+            pthread_cond_wait(&qready, &qlock);
+        if (remaining == 0) { // 全部处理完毕，叫醒其它消费者一起退出
+            pthread_mutex_unlock(&qlock);
+            pthread_cond_broadcast(&qready);
+            return(0);
+        }
+        t = now();
+        workq = workq->m_next;
+        remaining--;
+        hold_total += now() - t;
+        hold_count++;
+        pthread_mutex_unlock(&qlock);
+        /* 现在可以处理消息了 */
+    }
+}
+
+static void *bmq_producer(void *arg)
+{
+    long i, j, n;
+    struct msg *msgs = arg;
+
+    // 每 batch 条消息串成一个链表，一次入队
+    for (i = 0; i < nmsgs; i += n) {
+        n = min(batch, nmsgs - i);
+        for (j = 0; j < n - 1; j++)
+            msgs[i + j].m_next = &msgs[i + j + 1];
+        msgs[i + n - 1].m_next = NULL;
+        bmq_enqueue_n(&bq, (struct bmq_msg *)&msgs[i], n);
+    }
+    return(0);
+}
+
+static struct msg stop; // 生产者全部结束后放入的结束标记
+
+static void *bmq_consumer(void *arg)
+{
+    int done = 0;
+    struct bmq_msg *mp;
+
+    while (!done) {
+        for (mp = bmq_dequeue_all(&bq, 1, NULL); mp != NULL; mp = mp->m_next) {
+            if (mp == (struct bmq_msg *)&stop)
+                done = 1;
+            /* 处理消息 */
+        }
+    }
+    bmq_enqueue(&bq, (struct bmq_msg *)&stop); // 放回去，让其它消费者也能看到
+    return(0);
+}
+
+static void run(int use_bmq, int nprod, int ncons, long qcap)
+{
+    int i, err;
+    double t;
+    pthread_t prod[64], cons[64];
+    struct msg *msgs;
+
+    if ((msgs = calloc(nprod * nmsgs, sizeof(struct msg))) == NULL)
+        err_sys("calloc error");
+    remaining = nprod * nmsgs;
+    hold_total = 0;
+    hold_count = 0;
+    if (use_bmq && (err = bmq_init(&bq, qcap)) != 0)
+        err_exit(err, "bmq_init error");
+
+    t = now();
+    for (i = 0; i < ncons; i++)
+        if ((err = pthread_create(&cons[i], NULL,
+                                  use_bmq ? bmq_consumer : old_consumer, NULL)) != 0)
+            err_exit(err, "can't create thread");
+    for (i = 0; i < nprod; i++)
+        if ((err = pthread_create(&prod[i], NULL,
+                                  use_bmq ? bmq_producer : old_producer,
+                                  msgs + i * nmsgs)) != 0)
+            err_exit(err, "can't create thread");
+    for (i = 0; i < nprod; i++)
+        pthread_join(prod[i], NULL);
+    if (use_bmq)
+        bmq_enqueue(&bq, (struct bmq_msg *)&stop);
+    for (i = 0; i < ncons; i++)
+        pthread_join(cons[i], NULL);
+    t = now() - t;
+
+    if (use_bmq) {
+        printf("bmq      %12.0f msgs/sec  producer sleeps %lu  consumer sleeps %lu\n",
+               nprod * nmsgs / t, bq.q_nfull, bq.q_nempty);
+        bmq_destroy(&bq);
+    } else {
+        printf("11-15.c  %12.0f msgs/sec  lock held %.0f ns on average over %ld acquisitions\n",
+               nprod * nmsgs / t, hold_total * 1e9 / hold_count, hold_count);
+    }
+    free(msgs);
+}
+
+int main(int argc, char *argv[])
+{
+    int nprod, ncons;
+    long qcap;
+
+    nmsgs = (argc > 1) ? atol(argv[1]) : NMSGS;
+    nprod = (argc > 2) ? atoi(argv[2]) : NPROD;
+    ncons = (argc > 3) ? atoi(argv[3]) : NCONS;
+    batch = (argc > 4) ? atol(argv[4]) : BATCH;
+    qcap = (argc > 5) ? atol(argv[5]) : QCAP;
+    if (nprod < 1 || nprod > 64 || ncons < 1 || ncons > 64 || batch < 1)
+        err_quit("usage: %s [nmsgs] [nprod 1-64] [ncons 1-64] [batch] [qcap]", argv[0]);
+
+    run(0, nprod, ncons, qcap);
+    run(1, nprod, ncons, qcap);
+    exit(0);
+}
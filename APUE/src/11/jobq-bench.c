@@ -0,0 +1,187 @@
+/*
+* 作业分派的竞争测试：11-14.c 的读写锁单链表 vs lib/jobq.c 的每线程队列
+* 主线程把 NJOBS 个作业轮流分给各个工作线程，工作线程取出自己的作业并处理，
+* 分别在 1、2、4、...、64 个工作线程下测量每秒处理的作业数
+* 用法：./a.out [作业数] [最大线程数]
+*/
+#include "apue.h"
+#include "jobq.h"
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define NJOBS 200000
+#define MAXTHR 64
+
+/*
+* 11-14.c 的作业队列：一把读写锁保护一个双向链表
+*/
+struct rwjob {
+    struct rwjob *j_next;
+    struct rwjob *j_prev;
+    pthread_t j_id;
+};
+
+struct rwqueue {
+    struct rwjob *q_head;
+    struct rwjob *q_tail;
+    pthread_rwlock_t q_lock;
+};
+
+static void rw_append(struct rwqueue *qp, struct rwjob *jp)
+{
+    pthread_rwlock_wrlock(&qp->q_lock);
+    jp->j_next = NULL;
+    jp->j_prev = qp->q_tail;
+    if (qp->q_tail != NULL)
+        qp->q_tail->j_next = jp;
+    else
+        qp->q_head = jp;
+    qp->q_tail = jp;
+    pthread_rwlock_unlock(&qp->q_lock);
+}
+
+static void rw_remove(struct rwqueue *qp, struct rwjob *jp)
+{
+    pthread_rwlock_wrlock(&qp->q_lock);
+    if (jp->j_prev != NULL)
+        jp->j_prev->j_next = jp->j_next;
+    else
+        qp->q_head = jp->j_next;
+    if (jp->j_next != NULL)
+        jp->j_next->j_prev = jp->j_prev;
+    else
+        qp->q_tail = jp->j_prev;
+    pthread_rwlock_unlock(&qp->q_lock);
+}
+
+static struct rwjob *rw_find(struct rwqueue *qp, pthread_t id)
+{
+    struct rwjob *jp;
+
+    pthread_rwlock_rdlock(&qp->q_lock);
+    for (jp = qp->q_head; jp != NULL; jp = jp->j_next)
+        if (pthread_equal(jp->j_id, id))
+            break;
+    pthread_rwlock_unlock(&qp->q_lock);
+    return(jp);
+}
+
+static struct rwqueue rwq;
+static struct dispatch disp;
+static long njobs_per; // 每个工作线程要处理的作业数
+static pthread_barrier_t ready;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 11-14.c 的方式：读锁下扫描整个链表找自己的作业，再用写锁删除
+static void *rw_worker(void *arg)
+{
+    long done = 0;
+    struct rwjob *jp;
+
+    pthread_barrier_wait(&ready);
+    while (done < njobs_per) {
+        if ((jp = rw_find(&rwq, pthread_self())) == NULL) {
+            sched_yield(); // 11-14.c 没有等待机制，只能轮询
+            continue;
+        }
+        rw_remove(&rwq, jp);
+        done++;
+    }
+    return(0);
+}
+
+// 每线程队列：一次取走所有属于自己的作业
+static void *jobq_worker(void *arg)
+{
+    long done = 0;
+    struct job *jp;
+    struct workq *wq;
+
+    if ((wq = dispatch_register(&disp, pthread_self())) == NULL)
+        err_sys("dispatch_register error");
+    pthread_barrier_wait(&ready);
+    while (done < njobs_per) {
+        for (jp = job_takeall(wq, 1); jp != NULL; jp = jp->j_next)
+            done++;
+    }
+    return(0);
+}
+
+static void run(int nthr, long njobs, int use_jobq)
+{
+    int i, err;
+    long j;
+    double t;
+    pthread_t tid[MAXTHR];
+    struct rwjob *rwjobs = NULL;
+    struct job *jobs = NULL;
+
+    njobs_per = njobs / nthr;
+    njobs = njobs_per * nthr;
+    pthread_barrier_init(&ready, NULL, nthr + 1);
+    if (use_jobq) {
+        if ((err = dispatch_init(&disp, nthr)) != 0)
+            err_exit(err, "dispatch_init error");
+        if ((jobs = calloc(njobs, sizeof(struct job))) == NULL)
+            err_sys("calloc error");
+    } else {
+        rwq.q_head = rwq.q_tail = NULL;
+        pthread_rwlock_init(&rwq.q_lock, NULL);
+        if ((rwjobs = calloc(njobs, sizeof(struct rwjob))) == NULL)
+            err_sys("calloc error");
+    }
+    for (i = 0; i < nthr; i++)
+        if ((err = pthread_create(&tid[i], NULL,
+                                  use_jobq ? jobq_worker : rw_worker, NULL)) != 0)
+            err_exit(err, "can't create thread");
+    pthread_barrier_wait(&ready); // 所有工作线程都就绪（已注册）之后再开始计时
+
+    t = now();
+    for (j = 0; j < njobs; j++) {
+        if (use_jobq) {
+            jobs[j].j_id = tid[j % nthr];
+            job_dispatch(&disp, &jobs[j]);
+        } else {
+            rwjobs[j].j_id = tid[j % nthr];
+            rw_append(&rwq, &rwjobs[j]);
+        }
+    }
+    for (i = 0; i < nthr; i++)
+        pthread_join(tid[i], NULL);
+    t = now() - t;
+    printf("%-8s %3d threads  %8.3f s  %12.0f jobs/sec\n",
+           use_jobq ? "jobq" : "rwlock", nthr, t, njobs / t);
+
+    pthread_barrier_destroy(&ready);
+    if (use_jobq) {
+        dispatch_destroy(&disp);
+        free(jobs);
+    } else {
+        pthread_rwlock_destroy(&rwq.q_lock);
+        free(rwjobs);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int n, maxthr;
+    long njobs;
+
+    njobs = (argc > 1) ? atol(argv[1]) : NJOBS;
+    maxthr = (argc > 2) ? atoi(argv[2]) : MAXTHR;
+    if (maxthr > MAXTHR)
+        maxthr = MAXTHR;
+    for (n = 1; n <= maxthr; n *= 2) {
+        run(n, njobs, 0);
+        run(n, njobs, 1);
+    }
+    exit(0);
+}
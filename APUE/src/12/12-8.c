@@ -1,64 +1,54 @@
 #include "apue.h"
-#include <pthread.h>
-
-int quitflag;   // 由线程设置，主程序读取
-sigset_t mask;  // 信号屏蔽字
-
-pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; // 互斥量
-pthread_cond_t waitloc = PTHREAD_COND_INITIALIZER; // 条件变量
+#include "sigfd.h"
+#include <errno.h>
+#include <sys/epoll.h>
+
+// 原来的做法：专门开一个线程 sigwait，收到 SIGQUIT 后用互斥量 + 条件变量通知主线程
+// 现在用 lib/sigfd.c：SIGINT、SIGQUIT 被阻塞，改由 signalfd 送达；
+// 主线程的 epoll 循环在它可读时调用 sigfd_dispatch，处理函数就在主循环里运行，
+// 不在信号处理程序的上下文里，所以不用考虑异步信号安全，也不需要额外的线程和同步
+// 连续来了多个同样的信号，处理函数只调用一次，count 是这次到达的个数
+int quitflag; // 由 SIGQUIT 的处理函数设置，主循环读取
+
+static void on_int(int signo, int count, const struct signalfd_siginfo *si, void *arg)
+{
+    printf("\ninterrupt (%d)\n", count);
+}
 
-void *
-thr_fn(void *arg)
+static void on_quit(int signo, int count, const struct signalfd_siginfo *si, void *arg)
 {
-    int err, signo;
-    for (;;) {
-        err = sigwait(&mask, &signo); // 等待信号
-        if (err != 0)
-            err_exit(err, "sigwait failed");
-        switch (signo) {
-        case SIGINT:
-            printf("\ninterrupt\n");
-            break;
-        case SIGQUIT:
-            pthread_mutex_lock(&lock); // 获取互斥量
-            quitflag = 1;
-            pthread_mutex_unlock(&lock); // 释放互斥量
-            pthread_cond_signal(&waitloc); // 发送条件变量
-            return (0);
-        default:
-            printf("unexpected signal %d\n", signo);
-            exit(1);
-        }
-    }
+    *(int *)arg = 1;
 }
 
 int main(void)
 {
-    int err;
-    sigset_t oldmask;
-    pthread_t tid;
-
-    sigemptyset(&mask); // 清空信号集
-    sigaddset(&mask, SIGINT); // 添加信号
-    sigaddset(&mask, SIGQUIT); // 添加信号
-    if ((err = pthread_sigmask(SIG_BLOCK, &mask, &oldmask)) != 0) // 设置信号屏蔽字
-        err_exit(err, "SIG_BLOCK error");
-
-    err = pthread_create(&tid, NULL, thr_fn, 0); // 创建线程
-    if (err != 0)
-        err_exit(err, "can't create thread");
-
-    pthread_mutex_lock(&lock); // 获取互斥量
-    while (quitflag == 0)
-        pthread_cond_wait(&waitloc, &lock); // 等待条件变量
-    pthread_mutex_unlock(&lock); // 释放互斥量
-
-    /* SIGQUIT has been caught and is now blocked; do whatever */
-    quitflag = 0;
-
-    /* reset signal mask which unblocks SIGQUIT */
-    if (sigprocmask(SIG_SETMASK, &oldmask, NULL) < 0) // 设置信号屏蔽字
-        err_sys("SIG_SETMASK error");
+    int efd, sfd, n;
+    struct epoll_event ev;
+
+    // 要在创建任何线程之前阻塞信号，这样新线程也会继承屏蔽字
+    if (sigfd_handle(SIGINT, on_int, NULL) < 0 || sigfd_handle(SIGQUIT, on_quit, &quitflag) < 0)
+        err_sys("sigfd_handle error");
+    if ((sfd = sigfd_open()) < 0)
+        err_sys("sigfd_open error");
+    if ((efd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        err_sys("epoll_create1 error");
+    ev.events = EPOLLIN;
+    ev.data.fd = sfd;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, sfd, &ev) < 0)
+        err_sys("epoll_ctl error");
+
+    // 真正的程序在这里还会监听别的描述符
+    while (quitflag == 0) {
+        if ((n = epoll_wait(efd, &ev, 1, -1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            err_sys("epoll_wait error");
+        }
+        if (n > 0 && ev.data.fd == sfd && sigfd_dispatch() < 0)
+            err_sys("sigfd_dispatch error");
+    }
 
+    /* SIGQUIT has been caught; give the signals back to their default actions */
+    sigfd_close();
     exit(0);
-}
\ No newline at end of file
+}
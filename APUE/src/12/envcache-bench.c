@@ -0,0 +1,154 @@
+// 环境变量查找的多线程测试：12-5.c 的 getenv_r（递归互斥量 + 线性扫描 environ）
+// vs lib/envcache.c 的 env_get（不加锁，查不可变快照里的散列表）
+// 环境中先放 NENV 个变量，模拟配置层；每个线程反复查其中几个（有的靠前，有的靠后，有一个不存在）
+// -w：另开一个线程每毫秒用 env_set 改一次变量，看写者对读者的影响
+// 用法：./a.out [-w] [每线程次数] [最大线程数]
+#include "apue.h"
+#include "envcache.h"
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#define NENV 100
+#define NLOOPS 1000000
+#define MAXTHR 64
+
+extern char **environ;
+
+static const char *names[] = { "APP_CONF_3", "APP_CONF_50", "APP_CONF_97", "HOME", "NO_SUCH_VAR" };
+#define NNAMES (sizeof(names) / sizeof(names[0]))
+
+static long nloops;
+static int stop;
+
+// 12-5.c 的 getenv_r
+static pthread_mutex_t env_mutex;
+static pthread_once_t init_done = PTHREAD_ONCE_INIT;
+
+static void thread_init(void)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&env_mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static int getenv_r(const char *name, char *buf, int buflen)
+{
+    int i, len, olen;
+
+    pthread_once(&init_done, thread_init);
+    len = strlen(name);
+    pthread_mutex_lock(&env_mutex);
+    for (i = 0; environ[i] != NULL; i++) {
+        if ((strncmp(name, environ[i], len) == 0) && (environ[i][len] == '=')) {
+            olen = strlen(&environ[i][len + 1]);
+            if (olen >= buflen) {
+                pthread_mutex_unlock(&env_mutex);
+                return ENOSPC;
+            }
+            strcpy(buf, &environ[i][len + 1]);
+            pthread_mutex_unlock(&env_mutex);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&env_mutex);
+    return ENOENT;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *reader(void *arg)
+{
+    int (*get)(const char *, char *, int) = (int (*)(const char *, char *, int))arg;
+    long i;
+    char buf[MAXLINE];
+
+    for (i = 0; i < nloops; i++)
+        if (get(names[i % NNAMES], buf, sizeof(buf)) == ENOSPC)
+            err_quit("value too long");
+    return NULL;
+}
+
+// 写者：env_set 会同时改 environ，所以 getenv_r 那一轮不开写者（它和 setenv 之间没有同步）
+static void *writer(void *arg)
+{
+    long n = 0;
+    char val[32];
+    struct timespec ts = { 0, 1000000 };
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        snprintf(val, sizeof(val), "%ld", n++);
+        if (env_set("APP_CONF_50", val, 1) < 0)
+            err_sys("env_set error");
+        nanosleep(&ts, NULL);
+    }
+    *(long *)arg = n;
+    return NULL;
+}
+
+static void run(const char *what, int (*get)(const char *, char *, int), int nthr, int withwriter)
+{
+    int i, err;
+    long nwrites = 0;
+    double t;
+    pthread_t tid[MAXTHR], wtid;
+
+    stop = 0;
+    if (withwriter && (err = pthread_create(&wtid, NULL, writer, &nwrites)) != 0)
+        err_exit(err, "can't create writer");
+    t = now();
+    for (i = 0; i < nthr; i++)
+        if ((err = pthread_create(&tid[i], NULL, reader, (void *)get)) != 0)
+            err_exit(err, "can't create thread");
+    for (i = 0; i < nthr; i++)
+        pthread_join(tid[i], NULL);
+    t = now() - t;
+    if (withwriter) {
+        __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+        pthread_join(wtid, NULL);
+    }
+    printf("%-10s %3d threads  %12.0f lookups/sec", what, nthr, nthr * nloops / t);
+    if (withwriter)
+        printf("  (%ld updates)", nwrites);
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int i, nthr, maxthr, withwriter = 0;
+    char name[32], val[64];
+
+    if (argc > 1 && strcmp(argv[1], "-w") == 0) {
+        withwriter = 1;
+        argc--;
+        argv++;
+    }
+    nloops = (argc > 1) ? atol(argv[1]) : NLOOPS;
+    maxthr = (argc > 2) ? atoi(argv[2]) : 8;
+    if (maxthr > MAXTHR)
+        maxthr = MAXTHR;
+    for (i = 0; i < NENV; i++) {
+        snprintf(name, sizeof(name), "APP_CONF_%d", i);
+        snprintf(val, sizeof(val), "value-of-configuration-item-%d", i);
+        if (setenv(name, val, 1) < 0)
+            err_sys("setenv error");
+    }
+    if (env_refresh() < 0)
+        err_sys("env_refresh error");
+
+    for (nthr = 1; nthr <= maxthr; nthr *= 2) {
+        if (!withwriter)
+            run("getenv_r", getenv_r, nthr, 0);
+        run("env_get", env_get, nthr, withwriter);
+    }
+    exit(0);
+}
@@ -0,0 +1,143 @@
+// 多线程父进程里 fork 的测试：12-9.c 的 pthread_atfork 做法推广到 lib/forklock.c 的锁登记表
+// NTHR 个工作线程不停地拿一把"内存池"互斥量做一点工作，并通过 lib/bstream.c 写日志、通过 err_msg 走 asynclog，
+// 主线程不停下工作线程，直接 fork NFORK 次；子进程拿内存池的锁、写一行 bstream，然后退出
+// 如果 fork 时某个锁正被别的线程持有，子进程里这把锁永远不会被释放，子进程会死锁
+// 父进程等每个子进程最多 TIMEOUT 纳秒，超时就算死锁并杀掉它
+// 输出 fork() 本身的耗时（prepare 处理程序要等临界区结束）、子进程完成的耗时、死锁的子进程数
+// -n：不登记内存池的锁（asynclog 和 bstream 的锁总是登记的），用来对照
+// 用法：./a.out [-n] [fork 次数] [线程数]
+#include "apue.h"
+#include "forklock.h"
+#include "bstream.h"
+#include "deadline.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#define NFORK 500
+#define NTHR 4
+#define MAXTHR 64
+#define TIMEOUT 200000000LL // ns
+
+static pthread_mutex_t pool = PTHREAD_MUTEX_INITIALIZER;
+static struct bstream *bp;
+static volatile unsigned long pooled;
+
+static int cmpll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void *worker(void *arg)
+{
+    unsigned long i;
+    volatile int k;
+
+    for (i = 0;; i++) {
+        pthread_mutex_lock(&pool);
+        for (k = 0; k < 200; k++) // 模拟在锁里分配内存
+            ;
+        pooled++;
+        pthread_mutex_unlock(&pool);
+        if (i % 64 == 0) {
+            bs_printf(bp, "worker %ld: %lu allocations\n", (long)arg, i);
+        }
+        if (i % 1024 == 0) {
+            err_msg("worker %ld still running", (long)arg);
+        }
+    }
+    return NULL;
+}
+
+// 等子进程结束，超时返回 -1
+static int waitchild(pid_t pid)
+{
+    struct timespec dl, tick;
+
+    dl_after(&dl, TIMEOUT);
+    while (waitpid(pid, NULL, WNOHANG) == 0) {
+        if (dl_remaining(&dl) <= 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            return -1;
+        }
+        dl_after(&tick, 100000);
+        dl_sleep(&tick);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, err, nfork, nthr, reg, hung, fd;
+    long long *tfork, *tdone;
+    pid_t pid;
+    pthread_t tid;
+    struct timespec t0;
+
+    reg = 1;
+    if (argc > 1 && strcmp(argv[1], "-n") == 0) {
+        reg = 0;
+        argc--;
+        argv++;
+    }
+    nfork = argc > 1 ? atoi(argv[1]) : NFORK;
+    nthr = argc > 2 ? atoi(argv[2]) : NTHR;
+    if (nfork <= 0 || nthr <= 0 || nthr > MAXTHR) {
+        err_quit("usage: forklock-bench [-n] [nforks] [nthreads]");
+    }
+    if ((tfork = malloc(nfork * sizeof(long long))) == NULL ||
+        (tdone = malloc(nfork * sizeof(long long))) == NULL) {
+        err_sys("malloc error");
+    }
+    if ((fd = open("/dev/null", O_WRONLY)) < 0) {
+        err_sys("open error");
+    }
+    if (reg && fl_register(&pool, FL_MUTEX, FL_RANK_USER, NULL) < 0) {
+        err_sys("fl_register error");
+    }
+    if ((bp = bs_open(fd, 4096, BS_SIZE, 0)) == NULL) {
+        err_sys("bs_open error");
+    }
+    if ((err = alog_open(fd)) != 0) {
+        err_exit(err, "alog_open error");
+    }
+    for (i = 0; i < nthr; i++) {
+        if ((err = pthread_create(&tid, NULL, worker, (void *)(long)i)) != 0) {
+            err_exit(err, "can't create thread");
+        }
+    }
+
+    hung = 0;
+    for (i = 0; i < nfork; i++) {
+        dl_after(&t0, 0);
+        if ((pid = fork()) < 0) {
+            err_sys("fork error");
+        } else if (pid == 0) {
+            pthread_mutex_lock(&pool);
+            pooled++;
+            pthread_mutex_unlock(&pool);
+            bs_printf(bp, "child %ld\n", (long)getpid());
+            bs_flush(bp);
+            _exit(0);
+        }
+        tfork[i] = -dl_remaining(&t0);
+        if (waitchild(pid) < 0) {
+            hung++;
+        }
+        tdone[i] = -dl_remaining(&t0);
+    }
+
+    qsort(tfork, nfork, sizeof(long long), cmpll);
+    qsort(tdone, nfork, sizeof(long long), cmpll);
+    printf("%d forks with %d busy threads, pool lock %sregistered\n", nfork, nthr, reg ? "" : "not ");
+    printf("fork() us:      p50 %8.1f  p99 %8.1f  max %8.1f\n", tfork[nfork / 2] / 1e3,
+           tfork[nfork * 99 / 100] / 1e3, tfork[nfork - 1] / 1e3);
+    printf("child done us:  p50 %8.1f  p99 %8.1f  max %8.1f\n", tdone[nfork / 2] / 1e3,
+           tdone[nfork * 99 / 100] / 1e3, tdone[nfork - 1] / 1e3);
+    printf("deadlocked children: %d\n", hung);
+    exit(0);
+}
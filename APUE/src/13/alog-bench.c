@@ -0,0 +1,89 @@
+/*
+* lib/asynclog.c 的调用方开销：每次 log_msg 调用花多少纳秒，目标是 50 ns 左右
+* log_to_stderr 为 0 时消息交给 syslog（syslog 列），非 0 时写 stderr（stderr 列）
+* 1. 同步：没有 alog_open，log_msg 在调用线程里直接调 syslog 或写 stderr
+* 2. 异步：交给 syslog 的消息带着优先级放进本线程的一个环，由后台线程调 syslog；
+*    写 stderr 的放进另一个环，由后台线程 writev
+* 参数还是由调用方格式化（va_list 留不到以后），所以分别测没有转换说明的消息（直接复制）
+* 和带 %d %s 的消息（vsnprintf，带 % 的列），两者之差就是 vsnprintf 的开销
+* 每批 BURST 次调用计时一次，批与批之间 alog_flush 清空环（不计时），免得环满了退回同步写
+* stderr 重定向到 /dev/null，syslogd 不在的话 syslog 也会很快失败，同步的数字只是下限
+* 用法：./a.out [批数]
+*/
+#include "apue.h"
+#include <fcntl.h>
+#include <syslog.h>
+#include <time.h>
+
+#define NBURST 2000
+#define BURST 100
+
+int log_to_stderr; // lib/errorlog.c 要求调用方定义
+
+enum { T_CONST, T_ARGS };
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// 返回每次调用的平均纳秒数
+static double bench(int tostderr, int type, long nburst)
+{
+    int i;
+    long b;
+    double t, total;
+
+    log_to_stderr = tostderr;
+    total = 0;
+    for (b = 0; b < nburst; b++) {
+        t = now();
+        for (i = 0; i < BURST; i++) {
+            if (type == T_CONST) {
+                log_msg("request served from the cache");
+            } else {
+                log_msg("request %d from %s served in %ld us", i, "127.0.0.1", b);
+            }
+        }
+        total += now() - t;
+        alog_flush();
+    }
+    return total / (nburst * BURST);
+}
+
+static void report(const char *what, long nburst)
+{
+    printf("%-24s %8.1f %8.1f %8.1f %8.1f\n", what,
+           bench(0, T_CONST, nburst), bench(0, T_ARGS, nburst),
+           bench(1, T_CONST, nburst), bench(1, T_ARGS, nburst));
+}
+
+int main(int argc, char *argv[])
+{
+    int fd, err;
+    long nburst;
+
+    nburst = argc > 1 ? atol(argv[1]) : NBURST;
+    if (nburst <= 0) {
+        err_quit("usage: alog-bench [nbursts]");
+    }
+    if ((fd = open("/dev/null", O_WRONLY)) < 0) {
+        err_sys("can't open /dev/null");
+    }
+    if (dup2(fd, STDERR_FILENO) < 0) {
+        err_sys("dup2 error");
+    }
+    openlog("alog-bench", LOG_NDELAY, LOG_USER);
+    printf("ns per call, %d calls per burst (target ~50 ns)\n", BURST);
+    printf("%-24s %8s %8s %8s %8s\n", "", "syslog", "syslog%", "stderr", "stderr%");
+    report("synchronous", nburst / 10 > 0 ? nburst / 10 : 1);
+    if ((err = alog_open(STDERR_FILENO)) != 0) {
+        err_exit(err, "alog_open error");
+    }
+    report("asynchronous", nburst);
+    alog_close();
+    exit(0);
+}
@@ -0,0 +1,213 @@
+/*
+* 守护进程启动到就绪的耗时：原来逐个 close 到 RLIMIT_NOFILE 的 daemonize vs 用 close_range 的 daemonize
+* vs lib/daemonize.c 的 daemon_start + daemon_ready（启动它的进程等守护进程就绪才退出，再加 pid 文件锁）
+* 对每个描述符上限各启动 NRUN 次守护进程；守护进程在就绪时把时间写到共享内存里然后退出，
+* 就绪时间从共享内存里读；daemon_start 的启动进程在守护进程就绪之后才退出，所以 shell 或监控进程看到的也是这个时间
+* 守护进程就绪前先"预热缓存" WARM 微秒，模拟加载配置、填充缓存
+* 最后演示第二个副本启动时发现 pid 文件被锁住
+* 上限提高到超过硬限制（比如 1M）需要特权，失败的话那一行会被跳过
+* 用法：./a.out [次数]
+*/
+#include "apue.h"
+#include "daemon.h"
+#include "deadline.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define NRUN 20
+#define WARM 2000 // us
+#define PIDFILE "/tmp/daemon-bench.pid"
+
+enum { M_LOOP, M_DAEMONIZE, M_START, NMETHOD };
+
+static const char *names[NMETHOD] = { "close() loop", "daemonize", "daemon_start" };
+static const rlim_t limits[] = { 1024, 16384, 1048576 };
+
+struct shared {
+    volatile int ready;
+    struct timespec when;
+};
+
+static struct shared *shm;
+
+// 原来的 daemonize：逐个关闭描述符
+static void daemonize_loop(const char *cmd)
+{
+    int i;
+    pid_t pid;
+    struct rlimit rl;
+
+    umask(0);
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        err_quit("%s: can't get file limit", cmd);
+    }
+    if ((pid = fork()) < 0) {
+        err_quit("%s: can't fork", cmd);
+    } else if (pid != 0) {
+        exit(0);
+    }
+    setsid();
+    signal(SIGHUP, SIG_IGN);
+    if ((pid = fork()) < 0) {
+        err_quit("%s: can't fork", cmd);
+    } else if (pid != 0) {
+        exit(0);
+    }
+    chdir("/");
+    if (rl.rlim_max == RLIM_INFINITY) {
+        rl.rlim_max = 1024;
+    }
+    for (i = 0; i < (int)rl.rlim_max; i++) {
+        close(i);
+    }
+    open("/dev/null", O_RDWR);
+    dup(0);
+    dup(0);
+    openlog(cmd, LOG_CONS, LOG_DAEMON);
+}
+
+static void warm(void)
+{
+    struct timespec dl;
+
+    dl_after(&dl, WARM * 1000LL);
+    dl_wait(&dl);
+}
+
+static int cmpd(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// 启动一次守护进程，返回就绪用了多少毫秒
+static double run(int method)
+{
+    pid_t pid;
+    int status, fd;
+    struct timespec t0;
+    struct dmn_conf conf = { "daemon-bench", PIDFILE, NULL, DMN_WAIT, -1 };
+
+    shm->ready = 0;
+    fflush(stdout);
+    dl_after(&t0, 0);
+    if ((pid = fork()) < 0) {
+        err_sys("fork error");
+    } else if (pid == 0) {
+        if (method == M_LOOP) {
+            daemonize_loop("daemon-bench");
+        } else if (method == M_DAEMONIZE) {
+            daemonize("daemon-bench");
+        } else if (daemon_start(&conf) < 0) {
+            _exit(1);
+        }
+        warm();
+        clock_gettime(CLOCK_MONOTONIC, &shm->when);
+        __atomic_store_n(&shm->ready, 1, __ATOMIC_RELEASE);
+        if (method == M_START) {
+            daemon_ready();
+        }
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        err_sys("waitpid error");
+    }
+    if (method == M_START) {
+        // 启动进程退出时守护进程已经就绪；等它退出、释放 pid 文件的锁，再开始下一次
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !shm->ready) {
+            err_quit("daemon_start failed");
+        }
+        if ((fd = open(PIDFILE, O_RDWR)) < 0 || writew_lock(fd, 0, SEEK_SET, 0) < 0) {
+            err_sys("can't lock %s", PIDFILE);
+        }
+        close(fd);
+    }
+    while (!__atomic_load_n(&shm->ready, __ATOMIC_ACQUIRE)) {
+        usleep(100);
+    }
+    return ((shm->when.tv_sec - t0.tv_sec) * 1e9 + (shm->when.tv_nsec - t0.tv_nsec)) / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, k, m, nrun, status;
+    double *t;
+    pid_t pid;
+    struct rlimit rl;
+    struct dmn_conf conf = { "daemon-bench", PIDFILE, NULL, DMN_WAIT, -1 };
+
+    nrun = argc > 1 ? atoi(argv[1]) : NRUN;
+    if (nrun <= 0) {
+        err_quit("usage: %s [runs]", argv[0]);
+    }
+    if ((t = malloc(nrun * sizeof(double))) == NULL) {
+        err_sys("malloc error");
+    }
+    shm = mmap(NULL, sizeof(struct shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shm == MAP_FAILED) {
+        err_sys("mmap error");
+    }
+
+    printf("time to ready, ms, including %d us of warm-up\n", WARM);
+    printf("%-10s %-14s %8s %8s %8s\n", "nofile", "", "p50", "p90", "max");
+    for (k = 0; k < (int)(sizeof(limits) / sizeof(limits[0])); k++) {
+        // 只改软限制，硬限制降下去就升不回来了
+        if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+            err_sys("getrlimit error");
+        }
+        rl.rlim_cur = limits[k];
+        if (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < limits[k]) {
+            rl.rlim_max = limits[k];
+        }
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+            printf("%-10lu skipped: %s\n", (unsigned long)limits[k], strerror(errno));
+            continue;
+        }
+        for (m = 0; m < NMETHOD; m++) {
+            for (i = 0; i < nrun; i++) {
+                t[i] = run(m);
+            }
+            qsort(t, nrun, sizeof(double), cmpd);
+            printf("%-10lu %-14s %8.2f %8.2f %8.2f\n", (unsigned long)limits[k], names[m],
+                   t[nrun / 2], t[nrun * 9 / 10], t[nrun - 1]);
+        }
+    }
+
+    // 第一个副本拿着 pid 文件的锁不退出，第二个副本应当启动失败并说明原因
+    shm->ready = 0;
+    fflush(stdout);
+    if ((pid = fork()) < 0) {
+        err_sys("fork error");
+    } else if (pid == 0) {
+        if (daemon_start(&conf) < 0) {
+            _exit(1);
+        }
+        daemon_ready();
+        while (!__atomic_load_n(&shm->ready, __ATOMIC_ACQUIRE)) {
+            usleep(1000);
+        }
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    printf("\nsecond copy: ");
+    fflush(stdout);
+    if ((pid = fork()) < 0) {
+        err_sys("fork error");
+    } else if (pid == 0) {
+        dup2(STDOUT_FILENO, STDERR_FILENO);
+        if (daemon_start(&conf) < 0) {
+            _exit(1);
+        }
+        daemon_ready();
+        _exit(0);
+    }
+    waitpid(pid, &status, 0);
+    printf("exit status %d\n", WEXITSTATUS(status));
+    shm->ready = 1;
+    exit(0);
+}
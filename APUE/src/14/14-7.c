@@ -1,15 +1,37 @@
 #include "apue.h"
+#include "rlock.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/wait.h>
 
-static void lockabyte(const char *name, int fd, off_t offset)
+// 死锁检测：父子进程以相反的顺序给两个字节加写锁
+// 原来用 writew_lock 直接调 fcntl，两个进程会互相等待；
+// 现在用 lib/rlock.c 的 rl_lock：rl_init(NULL) 建一张 fork 后父子共享的等待图，
+// 谁的等待会形成环，谁的 rl_lock 就返回 EDEADLK，它放掉已经拿到的锁，另一方就能继续
+// 注意 rl_lock 用的是 OFD 锁，锁属于打开文件描述，所以 fork 之后父子进程要各自 open 文件
+static int lockabyte(const char *name, int fd, off_t offset)
 {
-    if (writew_lock(fd, offset, SEEK_SET, 1) < 0) {
-        err_sys("%s: writew_lock error", name);
+    if (rl_lock(fd, F_WRLCK, offset, 1, RL_WAIT) < 0) {
+        if (errno != EDEADLK) {
+            err_sys("%s: rl_lock error", name);
+        }
+        printf("%s: deadlock detected, byte %lld\n", name, (long long)offset);
+        return -1;
     }
     printf("%s: got the lock, byte %lld\n", name, (long long)offset);
+    return 0;
+}
+
+static void prstats(const char *name)
+{
+    struct rl_stats st;
+
+    rl_getstats(&st);
+    printf("%s: %ld locks (%ld without a system call), %ld fcntl calls, "
+           "%ld waits for another process, %ld deadlocks\n",
+           name, st.rs_lock, st.rs_local, st.rs_syscall, st.rs_kwait, st.rs_deadlock);
 }
 
-// 死锁
 int main(void)
 {
     int fd;
@@ -22,23 +44,38 @@ int main(void)
     if (write(fd, "ab", 2) != 2) {
         err_sys("write error");
     }
+    close(fd);
 
-    TELL_WAIT(); // 创建一个文件锁
+    if (rl_init(NULL) < 0) { // 等待图放在匿名共享内存里，子进程继承
+        err_sys("rl_init error");
+    }
+    TELL_WAIT();
 
     // 创建一个子进程
     if ((pid = fork()) < 0) {
         err_sys("fork error");
-    } else if (pid == 0) { // 子进程
+    }
+    if ((fd = open("templock", O_RDWR)) < 0) { // 父子各自打开
+        err_sys("open error");
+    }
+    if (pid == 0) { // 子进程
         lockabyte("child", fd, 0); // 加锁
         TELL_PARENT(getppid()); // 通知父进程
         WAIT_PARENT(); // 等待父进程通知
-        lockabyte("child", fd, 1); // 加锁
+        if (lockabyte("child", fd, 1) < 0) { // 加锁，可能会检测到死锁
+            rl_unlock(fd, 0, 1); // 放掉字节 0，让父进程继续
+        }
+        prstats("child");
     } else { // 父进程
         lockabyte("parent", fd, 1); // 加锁
         TELL_CHILD(pid); // 通知子进程
         WAIT_CHILD(); // 等待子进程通知
-        lockabyte("parent", fd, 0); // 加锁
+        if (lockabyte("parent", fd, 0) < 0) { // 加锁，可能会检测到死锁
+            rl_unlock(fd, 1, 1); // 放掉字节 1，让子进程继续
+        }
+        prstats("parent");
+        waitpid(pid, NULL, 0);
     }
 
     exit(0);
-}
\ No newline at end of file
+}
@@ -0,0 +1,197 @@
+// 文件复制引擎（lib/fcopy.c）的吞吐测试，与 3-9/copy_file.c 的 4KB read/write 循环、
+// 14-27.c 的 mmap + memcpy 对比，输出每种方式的 GB/s
+// 用法：./a.out <临时目录> [文件大小MB] [线程数]
+// 源文件中间留一个洞，用来检查稀疏文件是否保持稀疏（看输出中的 blocks）
+// 每种方式复制完都逐字节比较目标和源文件，再用 SEEK_DATA/SEEK_HOLE 比较两者的数据区段：
+// 内容不同就退出；lib/fcopy.c 的方式（FICLONE 除外，它连洞一起克隆）没保住洞也退出
+#include "apue.h"
+#include "fcopy.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define FILEMB 256
+#define BUFFSIZE 4096
+#define CMPSIZE (1024 * 1024)
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 3-9/copy_file.c：固定 4KB 缓冲区的 read/write 循环
+static void copy_4k(int fdin, int fdout)
+{
+    int n;
+    char buf[BUFFSIZE];
+
+    while ((n = read(fdin, buf, BUFFSIZE)) > 0)
+        if (write(fdout, buf, n) != n)
+            err_sys("write error");
+    if (n < 0)
+        err_sys("read error");
+}
+
+// 14-27.c：一次映射源和目标，memcpy
+static void copy_memcpy(int fdin, int fdout, off_t size)
+{
+    void *src, *dst;
+
+    if (ftruncate(fdout, size) < 0)
+        err_sys("ftruncate error");
+    if ((src = mmap(0, size, PROT_READ, MAP_SHARED, fdin, 0)) == MAP_FAILED)
+        err_sys("mmap error for input");
+    if ((dst = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fdout, 0)) == MAP_FAILED)
+        err_sys("mmap error for output");
+    memcpy(dst, src, size);
+    munmap(src, size);
+    munmap(dst, size);
+}
+
+// 逐块比较两个文件的内容，返回第一个不同的偏移，相同返回 -1
+static off_t differ(int fda, int fdb, off_t size)
+{
+    static char a[CMPSIZE], b[CMPSIZE];
+    off_t off;
+    ssize_t n;
+    size_t i;
+
+    for (off = 0; off < size; off += n) {
+        if ((n = pread(fda, a, CMPSIZE, off)) < 0 || pread(fdb, b, CMPSIZE, off) != n)
+            return off;
+        if (n == 0)
+            break;
+        if (memcmp(a, b, n) != 0) {
+            for (i = 0; a[i] == b[i]; i++)
+                ;
+            return off + i;
+        }
+    }
+    return -1;
+}
+
+// 下一个数据区段 [*datap, *holep)，从 off 开始找；后面没有数据了返回 0
+static int next_data(int fd, off_t off, off_t size, off_t *datap, off_t *holep)
+{
+    if (off >= size || (*datap = lseek(fd, off, SEEK_DATA)) < 0)
+        return 0;
+    if ((*holep = lseek(fd, *datap, SEEK_HOLE)) < 0 || *holep > size)
+        *holep = size;
+    return 1;
+}
+
+// 两个文件的数据区段是否一样
+static int same_layout(int fda, int fdb, off_t size)
+{
+    int ma, mb;
+    off_t da, ha, db, hb, off;
+
+    for (off = 0;; off = ha) {
+        ma = next_data(fda, off, size, &da, &ha);
+        mb = next_data(fdb, off, size, &db, &hb);
+        if (!ma || !mb)
+            return ma == mb;
+        if (da != db || ha != hb)
+            return 0;
+    }
+}
+
+// 生成测试文件：前后各一半数据，中间 1/8 是洞
+static void make_file(const char *path, off_t size)
+{
+    int fd;
+    off_t off, n;
+    char buf[1024 * 1024];
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, FILE_MODE)) < 0)
+        err_sys("can't create %s", path);
+    memset(buf, 'x', sizeof(buf));
+    for (off = 0; off < size; off += sizeof(buf)) {
+        if (off >= size / 2 && off < size / 2 + size / 8)
+            continue; // 留洞
+        n = min((off_t)sizeof(buf), size - off);
+        if (pwrite(fd, buf, n, off) != n)
+            err_sys("pwrite error");
+    }
+    if (ftruncate(fd, size) < 0)
+        err_sys("ftruncate error");
+    fsync(fd);
+    close(fd);
+}
+
+static void run(const char *src, const char *dst, int how, int nthreads, off_t size)
+{
+    int fdin, fdout, used = how, kept;
+    double t;
+    off_t off;
+    struct stat sbuf;
+    const char *name;
+
+    if ((fdin = open(src, O_RDONLY)) < 0)
+        err_sys("can't open %s", src);
+    if ((fdout = open(dst, O_RDWR | O_CREAT | O_TRUNC, FILE_MODE)) < 0)
+        err_sys("can't create %s", dst);
+
+    t = now();
+    if (how == -1) {
+        copy_4k(fdin, fdout);
+        name = "4KB read/write (3-9)";
+    } else if (how == -2) {
+        copy_memcpy(fdin, fdout, size);
+        name = "mmap+memcpy (14-27)";
+    } else {
+        if ((used = fcopy(fdin, fdout, how, nthreads)) < 0)
+            err_sys("fcopy error");
+        name = fcopy_name(used);
+    }
+    t = now() - t;
+
+    if (fstat(fdout, &sbuf) < 0)
+        err_sys("fstat error");
+    if (sbuf.st_size != size)
+        err_quit("%s: copied %lld bytes of %lld", name, (long long)sbuf.st_size, (long long)size);
+    if ((off = differ(fdin, fdout, size)) >= 0)
+        err_quit("%s: destination differs from source at byte %lld", name, (long long)off);
+    kept = same_layout(fdin, fdout, size);
+    printf("%-22s %-16s %8.3f s  %6.2f GB/s  %8lld blocks  holes %s\n",
+           how < 0 ? "" : fcopy_name(how), name, t, size / t / 1e9,
+           (long long)sbuf.st_blocks, kept ? "kept" : "filled");
+    if (!kept && how >= 0 && used != FCOPY_REFLINK)
+        err_quit("%s: the holes were not kept", name);
+    close(fdin);
+    close(fdout);
+}
+
+int main(int argc, char *argv[])
+{
+    int how, nthreads;
+    off_t size;
+    char src[MAXLINE], dst[MAXLINE];
+    struct stat sbuf;
+
+    if (argc < 2)
+        err_quit("usage: %s <dir> [MB] [threads]", argv[0]);
+    size = (off_t)((argc > 2) ? atol(argv[2]) : FILEMB) * 1024 * 1024;
+    nthreads = (argc > 3) ? atoi(argv[3]) : sysconf(_SC_NPROCESSORS_ONLN);
+    snprintf(src, sizeof(src), "%s/fcopy.src", argv[1]);
+    snprintf(dst, sizeof(dst), "%s/fcopy.dst", argv[1]);
+
+    make_file(src, size);
+    if (stat(src, &sbuf) < 0)
+        err_sys("stat error");
+    printf("source: %lld bytes, %lld blocks; page cache hot\n",
+           (long long)size, (long long)sbuf.st_blocks);
+    printf("%-22s %-16s\n", "asked for", "used");
+
+    run(src, dst, -1, 1, size);
+    run(src, dst, -2, 1, size);
+    for (how = FCOPY_AUTO; how <= FCOPY_RW; how++)
+        run(src, dst, how, nthreads, size);
+
+    unlink(src);
+    unlink(dst);
+    exit(0);
+}
@@ -0,0 +1,187 @@
+// 共享内存通道（lib/shmchan.c）与 TELL_WAIT 的管道版（15-7.c）、信号版（10-24.c）对比
+// 1. 延迟：按 15-33.c 的方式，父子进程轮流给共享计数器加 1，测量每一步的平均耗时
+// 2. 吞吐：父进程连续发送 64 字节消息，子进程接收，对比共享内存通道与管道
+// 用法：./a.out [次数]
+#include "apue.h"
+#include "shmchan.h"
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define NLOOPS 100000
+#define MSGSZ 64
+#define NSLOTS 1024
+
+static int pfd1[2], pfd2[2]; // 管道版 TELL_WAIT 使用的两个管道
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 管道版 TELL_WAIT，与 15-7.c 相同，改名以免与库中的信号版冲突
+static void pipe_tell_wait(void)
+{
+    if (pipe(pfd1) < 0 || pipe(pfd2) < 0)
+        err_sys("pipe error");
+}
+
+static void pipe_tell(int fd)
+{
+    if (write(fd, "x", 1) != 1)
+        err_sys("write error");
+}
+
+static void pipe_wait(int fd)
+{
+    char c;
+
+    if (read(fd, &c, 1) != 1)
+        err_sys("read error");
+}
+
+static void report(const char *what, long n, double secs)
+{
+    printf("%-28s %8.3f s  %10.0f steps/sec  %8.2f us/step\n",
+           what, secs, n / secs, secs * 1e6 / n);
+}
+
+static void check(const char *who, long got, long want)
+{
+    if (got != want)
+        err_quit("%s: expected %ld, got %ld", who, want, got);
+}
+
+int main(int argc, char *argv[])
+{
+    long i, nloops, counter;
+    double t;
+    pid_t pid;
+    long *area;
+    char msg[MSGSZ];
+    struct shmchan *tochild, *toparent;
+
+    nloops = (argc > 1) ? atol(argv[1]) : NLOOPS;
+
+    if ((area = mmap(0, sizeof(long), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        err_sys("mmap error");
+
+    // 1a. 管道版 TELL_WAIT
+    *area = 0;
+    pipe_tell_wait();
+    t = now();
+    if ((pid = fork()) < 0) {
+        err_sys("fork error");
+    } else if (pid == 0) {
+        for (i = 1; i < 2 * nloops; i += 2) {
+            pipe_wait(pfd2[0]);
+            check("child", (*area)++, i);
+            pipe_tell(pfd1[1]);
+        }
+        _exit(0);
+    }
+    for (i = 0; i < 2 * nloops; i += 2) {
+        check("parent", (*area)++, i);
+        pipe_tell(pfd2[1]);
+        pipe_wait(pfd1[0]);
+    }
+    waitpid(pid, NULL, 0);
+    report("TELL_WAIT (pipe)", 2 * nloops, now() - t);
+
+    // 1b. 信号版 TELL_WAIT（libapue 中的 tellwait.c）
+    // WAIT_XXX 返回前会恢复原来的信号屏蔽字，所以每一步都要重新 TELL_WAIT，否则可能丢失信号
+    *area = 0;
+    TELL_WAIT();
+    t = now();
+    if ((pid = fork()) < 0) {
+        err_sys("fork error");
+    } else if (pid == 0) {
+        for (i = 1; i < 2 * nloops; i += 2) {
+            WAIT_PARENT();
+            TELL_WAIT();
+            check("child", (*area)++, i);
+            TELL_PARENT(getppid());
+        }
+        _exit(0);
+    }
+    for (i = 0; i < 2 * nloops; i += 2) {
+        check("parent", (*area)++, i);
+        TELL_CHILD(pid);
+        WAIT_CHILD();
+        TELL_WAIT();
+    }
+    waitpid(pid, NULL, 0);
+    report("TELL_WAIT (signal)", 2 * nloops, now() - t);
+
+    // 1c. 共享内存通道：每个方向一条通道，消息就是计数器的当前值
+    if ((tochild = chan_open(NULL, sizeof(long), 1)) == NULL ||
+        (toparent = chan_open(NULL, sizeof(long), 1)) == NULL)
+        err_sys("chan_open error");
+    t = now();
+    if ((pid = fork()) < 0) {
+        err_sys("fork error");
+    } else if (pid == 0) {
+        for (i = 1; i < 2 * nloops; i += 2) {
+            chan_recv(tochild, &counter);
+            check("child", counter, i);
+            counter++;
+            chan_send(toparent, &counter);
+        }
+        _exit(0);
+    }
+    for (i = 0, counter = 0; i < 2 * nloops; i += 2) {
+        check("parent", counter, i);
+        counter++;
+        chan_send(tochild, &counter);
+        chan_recv(toparent, &counter);
+    }
+    waitpid(pid, NULL, 0);
+    report("shmchan ping-pong", 2 * nloops, now() - t);
+    chan_close(tochild);
+    chan_close(toparent);
+
+    // 2a. 吞吐：管道
+    if (pipe(pfd1) < 0)
+        err_sys("pipe error");
+    memset(msg, 'a', sizeof(msg));
+    t = now();
+    if ((pid = fork()) < 0) {
+        err_sys("fork error");
+    } else if (pid == 0) {
+        close(pfd1[1]);
+        for (i = 0; i < 10 * nloops; i++)
+            if (readn(pfd1[0], msg, MSGSZ) != MSGSZ)
+                err_sys("readn error");
+        _exit(0);
+    }
+    close(pfd1[0]);
+    for (i = 0; i < 10 * nloops; i++)
+        if (writen(pfd1[1], msg, MSGSZ) != MSGSZ)
+            err_sys("writen error");
+    waitpid(pid, NULL, 0);
+    close(pfd1[1]);
+    report("pipe 64B stream", 10 * nloops, now() - t);
+
+    // 2b. 吞吐：共享内存通道
+    if ((tochild = chan_open(NULL, MSGSZ, NSLOTS)) == NULL)
+        err_sys("chan_open error");
+    t = now();
+    if ((pid = fork()) < 0) {
+        err_sys("fork error");
+    } else if (pid == 0) {
+        for (i = 0; i < 10 * nloops; i++)
+            chan_recv(tochild, msg);
+        _exit(0);
+    }
+    for (i = 0; i < 10 * nloops; i++)
+        chan_send(tochild, msg);
+    waitpid(pid, NULL, 0);
+    report("shmchan 64B stream", 10 * nloops, now() - t);
+    chan_close(tochild);
+
+    exit(0);
+}
@@ -0,0 +1,126 @@
+// 基于 futex 的进程共享信号量（lib/fsem.c）与 System V 信号量（semop）的性能对比
+// 1. 无竞争：同一进程内反复 P/V，fsem 完全在用户态完成，semop 每次都是一次系统调用
+// 2. 乒乓：父子进程通过两个信号量轮流唤醒对方，测量每秒往返次数
+// 用法：./a.out [次数]
+#include "apue.h"
+#include "fsem.h"
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define NLOOPS 200000
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sysv_op(int id, int member, int value)
+{
+    struct sembuf op;
+
+    op.sem_num = member;
+    op.sem_op = value;
+    op.sem_flg = 0;
+    if (semop(id, &op, 1) < 0)
+        err_sys("semop error");
+}
+
+static void report(const char *what, long n, double secs)
+{
+    printf("%-24s %10ld ops  %8.3f s  %12.0f ops/sec\n", what, n, secs, n / secs);
+}
+
+int main(int argc, char *argv[])
+{
+    long i, nloops;
+    int id, created;
+    double t;
+    pid_t pid;
+    struct fsem *sems; // sems[0]：父 -> 子，sems[1]：子 -> 父
+    union semun {
+        int val;
+        struct semid_ds *buf;
+        unsigned short *array;
+    } arg;
+
+    nloops = (argc > 1) ? atol(argv[1]) : NLOOPS;
+
+    // 匿名共享映射，fork 之后父子进程都能看到
+    if ((sems = psync_map(NULL, 2 * sizeof(struct fsem), &created)) == NULL)
+        err_sys("psync_map error");
+    fsem_init(&sems[0], 1);
+    fsem_init(&sems[1], 0);
+
+    // 创建两个成员的 System V 信号量集
+    if ((id = semget(IPC_PRIVATE, 2, 0600 | IPC_CREAT)) < 0)
+        err_sys("semget error");
+    arg.val = 1;
+    if (semctl(id, 0, SETVAL, arg) < 0)
+        err_sys("semctl error");
+    arg.val = 0;
+    if (semctl(id, 1, SETVAL, arg) < 0)
+        err_sys("semctl error");
+
+    // 无竞争的 P/V
+    t = now();
+    for (i = 0; i < nloops; i++) {
+        fsem_wait(&sems[0]);
+        fsem_post(&sems[0]);
+    }
+    report("fsem uncontended", 2 * nloops, now() - t);
+
+    t = now();
+    for (i = 0; i < nloops; i++) {
+        sysv_op(id, 0, -1);
+        sysv_op(id, 0, 1);
+    }
+    report("semop uncontended", 2 * nloops, now() - t);
+
+    // 乒乓：fsem
+    t = now();
+    if ((pid = fork()) < 0) {
+        err_sys("fork error");
+    } else if (pid == 0) {
+        for (i = 0; i < nloops; i++) {
+            fsem_wait(&sems[1]);
+            fsem_post(&sems[0]);
+        }
+        _exit(0);
+    }
+    for (i = 0; i < nloops; i++) {
+        fsem_wait(&sems[0]);
+        fsem_post(&sems[1]);
+    }
+    if (waitpid(pid, NULL, 0) < 0)
+        err_sys("waitpid error");
+    report("fsem ping-pong", nloops, now() - t);
+
+    // 乒乓：semop
+    t = now();
+    if ((pid = fork()) < 0) {
+        err_sys("fork error");
+    } else if (pid == 0) {
+        for (i = 0; i < nloops; i++) {
+            sysv_op(id, 1, -1);
+            sysv_op(id, 0, 1);
+        }
+        _exit(0);
+    }
+    for (i = 0; i < nloops; i++) {
+        sysv_op(id, 0, -1);
+        sysv_op(id, 1, 1);
+    }
+    if (waitpid(pid, NULL, 0) < 0)
+        err_sys("waitpid error");
+    report("semop ping-pong", nloops, now() - t);
+
+    if (semctl(id, 0, IPC_RMID, 0) < 0)
+        err_sys("semctl IPC_RMID error");
+    psync_unmap(sems, 2 * sizeof(struct fsem));
+    exit(0);
+}
@@ -0,0 +1,150 @@
+// ruptimed 的压力测试：同时保持多个请求，统计每秒完成的请求数
+// TCP：非阻塞 connect，读到 EOF 算一次请求完成，然后马上发起下一个连接（和 16-16.c 的客户端一样的协议）
+// UDP（-u）：每个并发槽一个已连接的 UDP 套接字，发 1 字节的请求，收到回复后再发（和 16-19.c 一样）；
+//           超过 200ms 没有回复就认为丢了，重发
+// 可以对 16-17.c、16-18.c、16-20.c 和 ruptimed-epoll.c 分别测
+// 用法：./a.out [-u] [-c 并发数] [-t 秒数] <主机> <端口>
+#include "apue.h"
+#include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define BUFLEN 128
+#define MAXCONC 4096
+#define UDP_TIMEOUT 0.2
+
+static struct addrinfo *target;
+static int efd, udp;
+static long ndone, nerr, nlost;
+
+struct slot {
+    int fd;
+    int got;       // TCP：已经读到的字节数
+    double sent;   // UDP：上次发请求的时间
+};
+static struct slot slots[MAXCONC];
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void start(int i)
+{
+    struct epoll_event ev;
+    struct slot *sp = &slots[i];
+
+    for (;;) {
+        if ((sp->fd = socket(target->ai_family, (udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK, 0)) < 0)
+            err_sys("socket error");
+        if (connect(sp->fd, target->ai_addr, target->ai_addrlen) == 0 || errno == EINPROGRESS)
+            break;
+        nerr++; // 比如服务器的监听队列满了
+        close(sp->fd);
+    }
+    sp->got = 0;
+    if (udp) {
+        send(sp->fd, "", 1, 0);
+        sp->sent = now();
+    }
+    ev.events = EPOLLIN;
+    ev.data.u32 = i;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, sp->fd, &ev) < 0)
+        err_sys("epoll_ctl error");
+}
+
+static void finish(int i, int ok)
+{
+    close(slots[i].fd); // 关闭时自动从 epoll 中删除
+    if (ok)
+        ndone++;
+    else
+        nerr++;
+}
+
+int main(int argc, char *argv[])
+{
+    int c, i, n, err, conc = 64;
+    double secs = 5, t0, t, last;
+    ssize_t nr;
+    char buf[BUFLEN];
+    struct addrinfo hint;
+    struct epoll_event events[256];
+
+    while ((c = getopt(argc, argv, "c:t:u")) != -1) {
+        switch (c) {
+        case 'c':
+            conc = atoi(optarg);
+            break;
+        case 't':
+            secs = atof(optarg);
+            break;
+        case 'u':
+            udp = 1;
+            break;
+        default:
+            err_quit("usage: ruptime-load [-u] [-c conc] [-t secs] host port");
+        }
+    }
+    if (optind != argc - 2)
+        err_quit("usage: ruptime-load [-u] [-c conc] [-t secs] host port");
+    if (conc < 1 || conc > MAXCONC)
+        err_quit("concurrency must be 1 to %d", MAXCONC);
+    memset(&hint, 0, sizeof(hint));
+    hint.ai_socktype = udp ? SOCK_DGRAM : SOCK_STREAM;
+    if ((err = getaddrinfo(argv[optind], argv[optind + 1], &hint, &target)) != 0)
+        err_quit("getaddrinfo error: %s", gai_strerror(err));
+    if ((efd = epoll_create1(0)) < 0)
+        err_sys("epoll_create1 error");
+
+    t0 = last = now();
+    for (i = 0; i < conc; i++)
+        start(i);
+    while ((t = now()) - t0 < secs) {
+        if ((n = epoll_wait(efd, events, 256, 100)) < 0) {
+            if (errno == EINTR)
+                continue;
+            err_sys("epoll_wait error");
+        }
+        for (c = 0; c < n; c++) {
+            i = events[c].data.u32;
+            if (udp) {
+                if (recv(slots[i].fd, buf, BUFLEN, 0) > 0) {
+                    ndone++;
+                    send(slots[i].fd, "", 1, 0);
+                    slots[i].sent = now();
+                }
+                continue;
+            }
+            // TCP：一直读到 EOF
+            while ((nr = read(slots[i].fd, buf, BUFLEN)) > 0)
+                slots[i].got += nr;
+            if (nr < 0 && errno == EAGAIN)
+                continue;
+            finish(i, nr == 0 && slots[i].got > 0);
+            start(i);
+        }
+        if (udp && t - last > UDP_TIMEOUT) { // 丢了的请求重发
+            for (i = 0; i < conc; i++)
+                if (t - slots[i].sent > UDP_TIMEOUT) {
+                    nlost++;
+                    send(slots[i].fd, "", 1, 0);
+                    slots[i].sent = t;
+                }
+            last = t;
+        }
+    }
+    t = now() - t0;
+    printf("%s, %d concurrent: %ld requests in %.2f s, %.0f requests/sec", udp ? "UDP" : "TCP", conc,
+           ndone, t, ndone / t);
+    if (nerr > 0 || nlost > 0)
+        printf(" (%ld errors, %ld lost)", nerr, nlost);
+    printf("\n");
+    exit(0);
+}
@@ -0,0 +1,248 @@
+// 事件驱动的 ruptimed：一个 epoll 循环同时服务面向连接（16-17.c、16-18.c）和无连接（16-20.c）的客户端
+// 原来的服务器每个请求都要 fork + exec /usr/bin/uptime 再 waitpid，一秒只能处理几百个请求，
+// 而且 16-18.c 在子进程结束之前不会 accept 下一个连接
+// 这里不再运行 uptime：直接读 /proc/uptime、/proc/loadavg，用户数从 utmp 数，
+// 拼成和 uptime 一样的一行；这一行每秒最多生成一次，同一秒内的请求直接发送缓存的结果
+// TCP：accept4 非阻塞地一次接受所有排队的连接，每个连接发一行就关闭（一行远小于套接字缓冲区）
+// 监听套接字是边沿触发的，描述符用完（EMFILE/ENFILE）时不能就此返回：排队的连接不会再有新的事件。
+// 所以留一个打开 /dev/null 的备用描述符，用完时先关掉它，腾出来接受并回复排队的连接
+// UDP：recvmmsg 一次收一批请求，sendmmsg 一次回一批
+// 成为守护进程时拿 pid 文件的锁（已有一个在运行就启动失败），绑定好地址后才让启动它的进程退出
+// 用法：./a.out [-f] [-p 端口]   -f：不成为守护进程；默认用 ruptime 服务的端口
+#include "apue.h"
+#include "daemon.h"
+#include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <time.h>
+#include <utmpx.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define BUFLEN 128
+#define QLEN 1024 // 突发的连接不要被拒绝
+#define MAXSOCK 16
+#define MAXEVENTS 64
+#define BATCH 64  // 一次 recvmmsg/sendmmsg 的个数
+#define MAXADDRLEN 128
+
+extern int initserver(int, const struct sockaddr *, socklen_t, int);
+
+static char resp[BUFLEN]; // 缓存的回复
+static int sparefd = -1; // 备用描述符，描述符用完时腾出来 accept
+static int resplen;
+static time_t resptime;
+static int uptimefd, loadfd;
+
+// 读 /proc 下的文件：描述符一直开着，每次从偏移 0 重新读
+static int readproc(int fd, char *buf, size_t size)
+{
+    ssize_t n;
+
+    if ((n = pread(fd, buf, size - 1, 0)) < 0)
+        return -1;
+    buf[n] = 0;
+    return 0;
+}
+
+// 和 uptime 输出的格式一样
+static void refresh(void)
+{
+    time_t now;
+    struct tm tm;
+    double up = 0, load[3] = { 0, 0, 0 };
+    long days, hours, mins;
+    int users, n;
+    struct utmpx *ut;
+    char buf[BUFLEN], upbuf[64];
+
+    if ((now = time(NULL)) == resptime)
+        return; // 同一秒内，直接用缓存的
+    resptime = now;
+    if (readproc(uptimefd, buf, sizeof(buf)) == 0)
+        sscanf(buf, "%lf", &up);
+    if (readproc(loadfd, buf, sizeof(buf)) == 0)
+        sscanf(buf, "%lf %lf %lf", &load[0], &load[1], &load[2]);
+    users = 0;
+    setutxent();
+    while ((ut = getutxent()) != NULL)
+        if (ut->ut_type == USER_PROCESS)
+            users++;
+    endutxent();
+
+    days = (long)up / 86400;
+    hours = (long)up / 3600 % 24;
+    mins = (long)up / 60 % 60;
+    n = 0;
+    if (days > 0)
+        n = snprintf(upbuf, sizeof(upbuf), "%ld day%s, ", days, days > 1 ? "s" : "");
+    if (hours > 0)
+        snprintf(upbuf + n, sizeof(upbuf) - n, "%2ld:%02ld", hours, mins);
+    else
+        snprintf(upbuf + n, sizeof(upbuf) - n, "%ld min", mins);
+    localtime_r(&now, &tm);
+    resplen = snprintf(resp, sizeof(resp),
+                       " %02d:%02d:%02d up %s,  %d user%s,  load average: %.2f, %.2f, %.2f\n",
+                       tm.tm_hour, tm.tm_min, tm.tm_sec, upbuf, users, users > 1 ? "s" : "",
+                       load[0], load[1], load[2]);
+    if (resplen >= (int)sizeof(resp))
+        resplen = sizeof(resp) - 1;
+}
+
+static void serve_tcp(int sockfd)
+{
+    int clfd;
+
+    // 边沿触发：把排队的连接全部接受完
+    for (;;) {
+        if (sparefd < 0)
+            sparefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        clfd = accept4(sockfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clfd < 0 && (errno == EMFILE || errno == ENFILE) && sparefd >= 0) {
+            // 描述符用完了：关掉备用的再接受，每个连接回复一行就关闭，所以照样能回复
+            close(sparefd);
+            sparefd = -1;
+            clfd = accept4(sockfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        }
+        if (clfd < 0 && (errno == ECONNABORTED || errno == EINTR))
+            continue; // 排在后面的连接还要接受
+        if (clfd < 0)
+            break;
+        refresh();
+        send(clfd, resp, resplen, MSG_NOSIGNAL);
+        close(clfd);
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+        syslog(LOG_ERR, "ruptimed: accept error: %s", strerror(errno));
+    if (sparefd < 0)
+        sparefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+static void serve_udp(int sockfd)
+{
+    int i, n;
+    char req[BATCH][BUFLEN];
+    char addr[BATCH][MAXADDRLEN];
+    struct iovec riov[BATCH], siov[BATCH];
+    struct mmsghdr rmsg[BATCH], smsg[BATCH];
+
+    for (;;) {
+        memset(rmsg, 0, sizeof(rmsg));
+        for (i = 0; i < BATCH; i++) {
+            riov[i].iov_base = req[i];
+            riov[i].iov_len = BUFLEN;
+            rmsg[i].msg_hdr.msg_iov = &riov[i];
+            rmsg[i].msg_hdr.msg_iovlen = 1;
+            rmsg[i].msg_hdr.msg_name = addr[i];
+            rmsg[i].msg_hdr.msg_namelen = MAXADDRLEN;
+        }
+        if ((n = recvmmsg(sockfd, rmsg, BATCH, MSG_DONTWAIT, NULL)) <= 0) {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                syslog(LOG_ERR, "ruptimed: recvmmsg error: %s", strerror(errno));
+            return;
+        }
+        refresh();
+        memset(smsg, 0, n * sizeof(struct mmsghdr));
+        for (i = 0; i < n; i++) { // 回复发给各自的请求者
+            siov[i].iov_base = resp;
+            siov[i].iov_len = resplen;
+            smsg[i].msg_hdr.msg_iov = &siov[i];
+            smsg[i].msg_hdr.msg_iovlen = 1;
+            smsg[i].msg_hdr.msg_name = addr[i];
+            smsg[i].msg_hdr.msg_namelen = rmsg[i].msg_hdr.msg_namelen;
+        }
+        if (sendmmsg(sockfd, smsg, n, MSG_DONTWAIT) < 0 && errno != EAGAIN)
+            syslog(LOG_ERR, "ruptimed: sendmmsg error: %s", strerror(errno));
+        if (n < BATCH)
+            return;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct addrinfo *ailist, *aip;
+    struct addrinfo hint;
+    struct epoll_event ev, events[MAXEVENTS];
+    int c, i, n, err, efd, fd, nsock = 0, foreground = 0;
+    int types[2] = { SOCK_STREAM, SOCK_DGRAM };
+    const char *service = "ruptime";
+    struct dmn_conf conf = DMN_CONF("ruptimed"); // pid 文件等配置在编译时用 -DDAEMON_PIDDIR=... 等指定
+
+    while ((c = getopt(argc, argv, "fp:")) != -1) {
+        switch (c) {
+        case 'f':
+            foreground = 1;
+            break;
+        case 'p':
+            service = optarg;
+            break;
+        default:
+            err_quit("usage: ruptimed [-f] [-p port]");
+        }
+    }
+    if (!foreground) { // daemon_start 会关掉所有描述符，所以之后再打开；启动它的进程等到下面 daemon_ready 才退出
+        if (daemon_start(&conf) < 0)
+            err_sys("can't become a daemon");
+    } else
+        openlog("ruptimed", LOG_PERROR, LOG_DAEMON);
+    if ((uptimefd = open("/proc/uptime", O_RDONLY | O_CLOEXEC)) < 0 ||
+        (loadfd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC)) < 0) {
+        syslog(LOG_ERR, "ruptimed: can't open /proc: %s", strerror(errno));
+        exit(1);
+    }
+    if ((efd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        syslog(LOG_ERR, "ruptimed: epoll_create1 error: %s", strerror(errno));
+        exit(1);
+    }
+
+    // 同一个服务名，TCP 和 UDP 的地址都绑定上，全部放进同一个 epoll
+    for (i = 0; i < 2; i++) {
+        memset(&hint, 0, sizeof(hint));
+        hint.ai_flags = AI_PASSIVE;
+        hint.ai_socktype = types[i];
+        if ((err = getaddrinfo(NULL, service, &hint, &ailist)) != 0) {
+            syslog(LOG_ERR, "ruptimed: getaddrinfo error: %s", gai_strerror(err));
+            exit(1);
+        }
+        for (aip = ailist; aip != NULL && nsock < MAXSOCK; aip = aip->ai_next) {
+            if ((fd = initserver(types[i], aip->ai_addr, aip->ai_addrlen, QLEN)) < 0)
+                continue;
+            set_cloexec(fd);
+            set_fl(fd, O_NONBLOCK);
+            ev.events = EPOLLIN | EPOLLET;
+            ev.data.u64 = (uint64_t)fd << 32 | (unsigned)types[i];
+            if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                syslog(LOG_ERR, "ruptimed: epoll_ctl error: %s", strerror(errno));
+                exit(1);
+            }
+            nsock++;
+        }
+        freeaddrinfo(ailist);
+    }
+    if (nsock == 0) {
+        syslog(LOG_ERR, "ruptimed: can't bind any address for %s", service);
+        exit(1);
+    }
+    // 先生成一次回复，套接字都已绑定，这时才算就绪
+    if (!foreground) {
+        refresh();
+        daemon_ready();
+    }
+
+    for (;;) {
+        if ((n = epoll_wait(efd, events, MAXEVENTS, -1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "ruptimed: epoll_wait error: %s", strerror(errno));
+            exit(1);
+        }
+        for (i = 0; i < n; i++) {
+            fd = events[i].data.u64 >> 32;
+            if ((int)(events[i].data.u64 & 0xffffffff) == SOCK_STREAM)
+                serve_tcp(fd);
+            else
+                serve_udp(fd);
+        }
+    }
+}
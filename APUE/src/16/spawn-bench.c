@@ -0,0 +1,157 @@
+// 每秒能运行多少次命令：lib/popen.c（fork + exec）与 lib/spopen.c（posix_spawn）对比
+// 先把进程的常驻内存撑到指定大小，模拟大内存的服务器：fork 要复制页表，内存越大越慢；
+// posix_spawn 共享父进程内存（vfork 方式），与内存大小无关
+// 另外测：sp_start 同时跑多个子进程、用 poll 等 pidfd 的事件循环方式，
+// 以及 sp_cached 带 1 秒缓存（uptime 这种命令，1 秒内的结果可以直接重用）
+// 用法：./a.out [常驻内存MB] [每项秒数] [命令]
+#include "apue.h"
+#include "spopen.h"
+#include <poll.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define INFLIGHT 16
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void drain(FILE *fp)
+{
+    char buf[MAXLINE];
+
+    while (fgets(buf, MAXLINE, fp) != NULL)
+        ;
+}
+
+static void report(const char *what, long n, double secs)
+{
+    printf("%-28s %8ld runs  %7.3f s  %10.0f runs/sec\n", what, n, secs, n / secs);
+}
+
+static void bench_popen(const char *cmd, double secs)
+{
+    long n;
+    double t0, t;
+    FILE *fp;
+
+    t0 = now();
+    for (n = 0; (t = now() - t0) < secs; n++) {
+        if ((fp = popen(cmd, "r")) == NULL)
+            err_sys("popen error");
+        drain(fp);
+        if (pclose(fp) < 0)
+            err_sys("pclose error");
+    }
+    report("popen (fork)", n, t);
+}
+
+static void bench_spopen(const char *cmd, double secs)
+{
+    long n;
+    double t0, t;
+    FILE *fp;
+
+    t0 = now();
+    for (n = 0; (t = now() - t0) < secs; n++) {
+        if ((fp = spopen(cmd, "r")) == NULL)
+            err_sys("spopen error");
+        drain(fp);
+        if (spclose(fp) < 0)
+            err_sys("spclose error");
+    }
+    report("spopen (posix_spawn)", n, t);
+}
+
+// 同时保持 INFLIGHT 个子进程，poll 管道和 pidfd：管道读到 EOF、pidfd 可读之后回收，再启动新的
+static void bench_inflight(const char *cmd, double secs)
+{
+    int i, nrun = 0;
+    long n = 0;
+    double t0, t;
+    char buf[MAXLINE];
+    struct spproc sp[INFLIGHT];
+    struct pollfd pfd[INFLIGHT];
+
+    t0 = now();
+    for (i = 0; i < INFLIGHT; i++) {
+        if (sp_start(&sp[i], cmd, "r") < 0)
+            err_sys("sp_start error");
+        if (sp[i].sp_pidfd < 0)
+            err_quit("no pidfd_open() in this kernel");
+        pfd[i].fd = sp[i].sp_fd; // 先等管道，读完再等 pidfd
+        pfd[i].events = POLLIN;
+        nrun++;
+    }
+    while (nrun > 0) {
+        if (poll(pfd, INFLIGHT, -1) < 0)
+            err_sys("poll error");
+        for (i = 0; i < INFLIGHT; i++) {
+            if (pfd[i].fd < 0 || pfd[i].revents == 0)
+                continue;
+            if (pfd[i].fd == sp[i].sp_fd) {
+                if (read(sp[i].sp_fd, buf, sizeof(buf)) > 0)
+                    continue;
+                close(sp[i].sp_fd);
+                pfd[i].fd = sp[i].sp_pidfd;
+                continue;
+            }
+            if (sp_reap(&sp[i], 0) < 0) // pidfd 可读了，不会阻塞
+                err_sys("sp_reap error");
+            n++;
+            if (now() - t0 < secs) {
+                if (sp_start(&sp[i], cmd, "r") < 0)
+                    err_sys("sp_start error");
+                pfd[i].fd = sp[i].sp_fd;
+            } else {
+                pfd[i].fd = -1;
+                nrun--;
+            }
+        }
+    }
+    t = now() - t0;
+    report("sp_start x16 + pidfd poll", n, t);
+}
+
+static void bench_cached(const char *cmd, double secs)
+{
+    long n;
+    double t0, t;
+    char buf[MAXLINE];
+
+    t0 = now();
+    for (n = 0; (t = now() - t0) < secs; n++)
+        if (sp_cached(cmd, 1000, buf, sizeof(buf)) < 0)
+            err_sys("sp_cached error");
+    report("sp_cached, 1 s TTL", n, t);
+}
+
+int main(int argc, char *argv[])
+{
+    long mb;
+    double secs;
+    char *mem;
+    const char *cmd;
+
+    mb = (argc > 1) ? atol(argv[1]) : 1024;
+    secs = (argc > 2) ? atof(argv[2]) : 2;
+    cmd = (argc > 3) ? argv[3] : "/usr/bin/uptime";
+
+    if (mb > 0) { // 写一遍，让这些页真正占着页表
+        if ((mem = malloc(mb * 1024 * 1024)) == NULL)
+            err_sys("malloc error");
+        // 服务器的堆一般是零散的 4KB 页；大页的话页表小得多，fork 的代价就看不出来了
+        madvise((void *)((unsigned long)mem & ~4095UL), mb * 1024 * 1024, MADV_NOHUGEPAGE);
+        memset(mem, 1, mb * 1024 * 1024);
+    }
+    printf("%ld MB resident, running \"%s\"\n", mb, cmd);
+    bench_popen(cmd, secs);
+    bench_spopen(cmd, secs);
+    bench_inflight(cmd, secs);
+    bench_cached(cmd, secs);
+    exit(0);
+}
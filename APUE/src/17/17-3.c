@@ -1,89 +1,52 @@
 /*
-创建消息队列和 UNIX 域套接字，并为每个消息队列开启了一个线程。然后在一个无限循环中用 poll 来轮询选择一个套接字端点。
-当某个套接字可用时，程序可以从套接字中读取数据并把消息打印在标准输出上。
+创建消息队列，在一个无限循环中等待所有队列，把收到的消息打印在标准输出上。
+原来的版本用 XSI 消息队列：它不是文件描述符，不能 poll，只好为每个队列开一个线程阻塞在 msgrcv 里，
+再把消息写进 UNIX 域套接字让主线程 poll 和 read，每条消息多两次复制、两次系统调用。
+现在改用 POSIX 消息队列（Linux 上它就是文件描述符），由 lib/mqbus.c 直接 poll 所有队列，
+把就绪的队列一批一批地读进同一块缓冲区，不再需要辅助线程和套接字
+用 17-4.c 发送消息：./sendmsg 0x123 hello
 */
 
 #include "apue.h"
-#include <poll.h>
-#include <pthread.h>
-#include <sys/msg.h>
-#include <sys/socket.h>
+#include "mqbus.h"
+#include <errno.h>
 
 #define NQ 3 // 队列数量
 #define MAXMSZ 512 // 消息最大尺寸
-#define KEY 0x123 // 消息队列键
-
-struct threadinfo {
-    int qid;
-    int fd;
-};
-
-struct mymesg {
-    long mtype;
-    char mtext[MAXMSZ];
-};
-
-void *helper(void *arg)
-{
-    int n;
-    struct mymesg m;
-    struct threadinfo *tip = arg;
-
-    for (;;) {
-        memset(&m, 0, sizeof(m));
-        if ((n = msgrcv(tip->qid, &m, MAXMSZ, 0, MSG_NOERROR)) < 0) {
-            err_sys("msgrcv error");
-        }
-        if (write(tip->fd, m.mtext, n) < 0) {
-            err_sys("write error");
-        }
-    }
-}
+#define MAXMSG 10 // 每个队列最多的消息数（非特权进程的默认上限）
+#define KEY 0x123 // 消息队列键，队列名是 "/mq.0x123" 这样的形式
 
 int main()
 {
-    int i, n, err;
-    int fd[2];
-    int qid[NQ];
-    struct pollfd pfd[NQ];
-    struct threadinfo ti[NQ];
-    pthread_t tid[NQ];
-    char buf[MAXMSZ];
+    int i, n;
+    char name[NQ][32];
+    const char *names[NQ];
+    struct mqbus *bp;
+    struct mqb_msg *msgs;
 
     // 创建队列
     for (i = 0; i < NQ; i++) {
-        if ((qid[i] = msgget((KEY + i), IPC_CREAT | 0666)) < 0) {
-            err_sys("msgget error");
-        }
-        printf("queue ID %d is %d\n", i, qid[i]);
-
-        // 创建 UNIX 域套接字
-        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fd) < 0) {
-            err_sys("socketpair error");
-        }
-        pfd[i].fd = fd[0]; // 读端
-        pfd[i].events = POLLIN; // 可读事件
-
-        ti[i].qid = qid[i];
-        ti[i].fd = fd[1]; // 写端
-        if ((err = pthread_create(&tid[i], NULL, helper, &ti[i])) != 0) {
-            err_exit(err, "pthread_create error");
-        }
+        snprintf(name[i], sizeof(name[i]), "/mq.%#x", KEY + i);
+        names[i] = name[i];
+    }
+    if ((bp = mqb_open(names, NQ, MAXMSG, MAXMSZ, 0)) == NULL) {
+        err_sys("mqb_open error");
+    }
+    for (i = 0; i < NQ; i++) {
+        printf("queue %d is %s\n", i, names[i]);
     }
 
     for (;;) {
-        if (poll(pfd, NQ, -1) < 0) {
-            err_sys("poll error");
-        }
-        for (i = 0; i < NQ; i++) {
-            if (pfd[i].revents & POLLIN) {
-                if ((n = read(pfd[i].fd, buf, sizeof(buf))) < 0) {
-                    err_sys("read error");
-                }
-                buf[n] = 0;
-                printf("queue id %d, message %s\n", qid[i], buf);
+        if ((n = mqb_recv(bp, -1, &msgs)) < 0) { // 一次拿到所有队列里已到达的消息
+            if (errno == EINTR) {
+                continue;
             }
+            err_sys("mqb_recv error");
+        }
+        for (i = 0; i < n; i++) {
+            printf("queue %s, message %.*s\n", names[msgs[i].m_queue],
+                   (int)msgs[i].m_len, msgs[i].m_data);
         }
     }
     exit(0);
-}
\ No newline at end of file
+}
@@ -1,22 +1,20 @@
 /*
 给 17.3 发送数据
+17-3.c 改用了 POSIX 消息队列，这里按同样的规则由 KEY 得到队列名，再用 mq_send 发送
 */
 #include "apue.h"
-#include <sys/msg.h>
+#include <fcntl.h>
+#include <mqueue.h>
 
 #define MAXMSZ 512
 
-struct mymesg {
-    long mtype;
-    char mtext[MAXMSZ];
-};
-
 int main(int argc, char *argv[])
 {
-    key_t key;
-    long qid;
+    long key;
+    mqd_t mq;
     size_t nbytes;
-    struct mymesg m;
+    char name[32];
+    char mtext[MAXMSZ];
 
     if (argc != 3) {
         fprintf(stderr, "usage: sendmsg KEY message\n");
@@ -24,15 +22,15 @@ int main(int argc, char *argv[])
     }
 
     key = strtol(argv[1], NULL, 0); // 将字符串转换为长整型数
-    if ((qid = msgget(key, 0)) < 0) {
-        err_sys("can't open queue key %s", argv[1]);
+    snprintf(name, sizeof(name), "/mq.%#lx", key);
+    if ((mq = mq_open(name, O_WRONLY)) == (mqd_t)-1) {
+        err_sys("can't open queue %s", name);
     }
-    memset(&m, 0, sizeof(m));
-    strncpy(m.mtext, argv[2], MAXMSZ - 1);
-    nbytes = strlen(m.mtext);
-    m.mtype = 1;
-    if (msgsnd(qid, &m, nbytes, 0) < 0) {
+    memset(mtext, 0, sizeof(mtext));
+    strncpy(mtext, argv[2], MAXMSZ - 1);
+    nbytes = strlen(mtext);
+    if (mq_send(mq, mtext, nbytes, 0) < 0) {
         err_sys("can't send message");
     }
     exit(0);
-}
\ No newline at end of file
+}
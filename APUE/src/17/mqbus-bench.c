@@ -0,0 +1,220 @@
+/*
+* 消息队列汇聚的吞吐测试：17-3.c 原来的辅助线程方案 vs lib/mqbus.c
+* helper：每个 XSI 消息队列一个辅助线程，msgrcv 之后写进 UNIX 域数据报套接字，主线程 poll + read
+* mqbus：POSIX 消息队列，主线程直接 poll 所有队列，批量 mq_receive
+* 每个队列一个生产者线程，各发送 NMSGS 条 MSGSZ 字节的消息，输出主线程每秒收到的消息数；
+* 对 mqbus 再统计平均每次 mqb_recv 拿到多少条消息、每条消息用了多少次系统调用
+* 用法：./a.out [每个队列的消息数] [队列数] [消息字节数]
+*/
+#include "apue.h"
+#include "mqbus.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/msg.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define NMSGS 100000
+#define NQ 3
+#define MSGSZ 64
+#define MAXQ 64
+#define MAXMSZ 512
+#define MAXMSG 10 // 非特权进程 POSIX 消息队列的默认上限
+
+struct mymesg {
+    long mtype;
+    char mtext[MAXMSZ];
+};
+
+struct qinfo {
+    int qid; // XSI 队列
+    int fd; // 辅助线程写的套接字
+    char name[32]; // POSIX 队列名
+};
+
+static struct qinfo qi[MAXQ];
+static long nmsgs, msgsz;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xsi_producer(void *arg)
+{
+    long i;
+    struct qinfo *qp = arg;
+    struct mymesg m;
+
+    memset(&m, 'x', sizeof(m));
+    m.mtype = 1;
+    for (i = 0; i < nmsgs; i++) {
+        if (msgsnd(qp->qid, &m, msgsz, 0) < 0) {
+            err_sys("msgsnd error");
+        }
+    }
+    return NULL;
+}
+
+// 17-3.c 的辅助线程，队列被删除时退出
+static void *helper(void *arg)
+{
+    int n;
+    struct qinfo *qp = arg;
+    struct mymesg m;
+
+    for (;;) {
+        if ((n = msgrcv(qp->qid, &m, MAXMSZ, 0, MSG_NOERROR)) < 0) {
+            if (errno == EIDRM || errno == EINVAL) {
+                return NULL;
+            }
+            err_sys("msgrcv error");
+        }
+        if (write(qp->fd, m.mtext, n) < 0) {
+            err_sys("write error");
+        }
+    }
+}
+
+static double run_helper(int nq)
+{
+    int i, n, fd[2], err;
+    long left;
+    double t;
+    char buf[MAXMSZ];
+    struct pollfd pfd[MAXQ];
+    pthread_t prod[MAXQ], help[MAXQ];
+
+    for (i = 0; i < nq; i++) {
+        if ((qi[i].qid = msgget(IPC_PRIVATE, IPC_CREAT | 0600)) < 0) {
+            err_sys("msgget error");
+        }
+        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fd) < 0) {
+            err_sys("socketpair error");
+        }
+        pfd[i].fd = fd[0];
+        pfd[i].events = POLLIN;
+        qi[i].fd = fd[1];
+        if ((err = pthread_create(&help[i], NULL, helper, &qi[i])) != 0) {
+            err_exit(err, "pthread_create error");
+        }
+    }
+
+    t = now();
+    for (i = 0; i < nq; i++) {
+        if ((err = pthread_create(&prod[i], NULL, xsi_producer, &qi[i])) != 0) {
+            err_exit(err, "pthread_create error");
+        }
+    }
+    for (left = nq * nmsgs; left > 0;) {
+        if (poll(pfd, nq, -1) < 0) {
+            err_sys("poll error");
+        }
+        for (i = 0; i < nq; i++) {
+            if (pfd[i].revents & POLLIN) {
+                if ((n = read(pfd[i].fd, buf, sizeof(buf))) < 0) {
+                    err_sys("read error");
+                }
+                left--;
+            }
+        }
+    }
+    t = now() - t;
+
+    for (i = 0; i < nq; i++) {
+        pthread_join(prod[i], NULL);
+        msgctl(qi[i].qid, IPC_RMID, NULL); // 让辅助线程的 msgrcv 出错返回
+        pthread_join(help[i], NULL);
+        close(pfd[i].fd);
+        close(qi[i].fd);
+    }
+    return t;
+}
+
+static void *posix_producer(void *arg)
+{
+    long i;
+    mqd_t mq;
+    char buf[MAXMSZ];
+    struct qinfo *qp = arg;
+
+    if ((mq = mq_open(qp->name, O_WRONLY)) == (mqd_t)-1) {
+        err_sys("mq_open error");
+    }
+    memset(buf, 'x', sizeof(buf));
+    for (i = 0; i < nmsgs; i++) {
+        if (mq_send(mq, buf, msgsz, 0) < 0) {
+            err_sys("mq_send error");
+        }
+    }
+    mq_close(mq);
+    return NULL;
+}
+
+static double run_mqbus(int nq)
+{
+    int i, n, err;
+    long left;
+    double t;
+    const char *names[MAXQ] = { NULL };
+    struct mqbus *bp;
+    struct mqb_msg *msgs;
+    pthread_t prod[MAXQ];
+
+    for (i = 0; i < nq; i++) {
+        snprintf(qi[i].name, sizeof(qi[i].name), "/mqbench.%ld.%d", (long)getpid(), i);
+        names[i] = qi[i].name;
+    }
+    if ((bp = mqb_open(names, nq, MAXMSG, MAXMSZ, 0)) == NULL) {
+        err_sys("mqb_open error");
+    }
+
+    t = now();
+    for (i = 0; i < nq; i++) {
+        if ((err = pthread_create(&prod[i], NULL, posix_producer, &qi[i])) != 0) {
+            err_exit(err, "pthread_create error");
+        }
+    }
+    for (left = nq * nmsgs; left > 0; left -= n) {
+        if ((n = mqb_recv(bp, -1, &msgs)) < 0) {
+            err_sys("mqb_recv error");
+        }
+    }
+    t = now() - t;
+
+    for (i = 0; i < nq; i++) {
+        pthread_join(prod[i], NULL);
+        mq_unlink(names[i]);
+    }
+    printf("mqbus:  %.1f messages per mqb_recv, %.2f system calls per message "
+           "(%lu poll, %lu mq_receive)\n",
+           (double)bp->b_nmsg / bp->b_npoll, (double)(bp->b_npoll + bp->b_nrecv) / bp->b_nmsg,
+           bp->b_npoll, bp->b_nrecv);
+    mqb_close(bp);
+    return t;
+}
+
+int main(int argc, char *argv[])
+{
+    int nq;
+    double t;
+
+    nmsgs = argc > 1 ? atol(argv[1]) : NMSGS;
+    nq = argc > 2 ? atoi(argv[2]) : NQ;
+    msgsz = argc > 3 ? atol(argv[3]) : MSGSZ;
+    if (nmsgs <= 0 || nq <= 0 || nq > MAXQ || msgsz <= 0 || msgsz > MAXMSZ) {
+        err_quit("usage: %s [nmsgs] [nqueues (1-%d)] [msgsize (1-%d)]", argv[0], MAXQ, MAXMSZ);
+    }
+    printf("%d queues, %ld messages of %ld bytes each\n", nq, nmsgs, msgsz);
+
+    t = run_helper(nq);
+    printf("helper: %10.0f messages/sec\n", nq * nmsgs / t);
+    t = run_mqbus(nq);
+    printf("mqbus:  %10.0f messages/sec\n", nq * nmsgs / t);
+    exit(0);
+}
@@ -0,0 +1,161 @@
+/*
+* 命令行切分的吞吐测试：原来 buf_args 用的 strtok vs strtok_r vs lib/tokenize.c 的 tok_split
+* 生成 NLINES 行类似 open 服务器收到的请求（命令名、路径、打开方式，再加一些参数），
+* 其中 QUOTED% 的行带引号或反斜杠；每种方法把每一行复制到工作缓冲区再切分，输出每秒处理的行数
+* 同时核对三种方法切出的参数个数是否一致（没有引号的行）
+* 用法：./a.out [行数] [带引号的行所占百分比] [重复次数]
+*/
+#include "apue.h"
+#include "tokenize.h"
+#include <time.h>
+
+#define NLINES 100000
+#define QUOTED 10
+#define NREP 10
+#define MAXARGC 50
+#define WHITE " \t\n"
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 原来 buf_args 的切分部分
+static int split_strtok(char *buf, char **argv)
+{
+    char *ptr;
+    int argc;
+
+    if (strtok(buf, WHITE) == NULL) {
+        return -1;
+    }
+    argv[argc = 0] = buf;
+    while ((ptr = strtok(NULL, WHITE)) != NULL) {
+        if (++argc >= MAXARGC - 1) {
+            return -1;
+        }
+        argv[argc] = ptr;
+    }
+    argv[++argc] = NULL;
+    return argc;
+}
+
+static int split_strtok_r(char *buf, char **argv)
+{
+    char *ptr, *save;
+    int argc;
+
+    if ((ptr = strtok_r(buf, WHITE, &save)) == NULL) {
+        return -1;
+    }
+    argv[argc = 0] = ptr;
+    while ((ptr = strtok_r(NULL, WHITE, &save)) != NULL) {
+        if (++argc >= MAXARGC - 1) {
+            return -1;
+        }
+        argv[argc] = ptr;
+    }
+    argv[++argc] = NULL;
+    return argc;
+}
+
+static int split_tok(char *buf, char **argv)
+{
+    int i, argc;
+    struct tok tv[MAXARGC - 1];
+
+    if ((argc = tok_split(buf, strlen(buf), tv, MAXARGC - 1)) <= 0) {
+        return -1;
+    }
+    for (i = 0; i < argc; i++) {
+        argv[i] = tv[i].t_ptr;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+static const char *words[] = {
+    "open", "/home/user/projects/apue/src/lib/tokenize.c", "/etc/passwd", "0", "2",
+    "-v", "--output=/var/tmp/result.txt", "x", "0x1234", "/usr/share/dict/words",
+};
+
+// 生成一行，带引号的行里有一个带空格的路径和一个转义
+static void genline(char *buf, size_t size, int quoted)
+{
+    int i, n;
+    size_t len;
+
+    n = 3 + rand() % 6;
+    len = 0;
+    for (i = 0; i < n; i++) {
+        len += snprintf(buf + len, size - len, "%s%s", i ? (rand() % 4 ? " " : " \t ") : "",
+                        words[rand() % (sizeof(words) / sizeof(words[0]))]);
+    }
+    if (quoted) {
+        len += snprintf(buf + len, size - len, " \"/tmp/My Documents/a \\\"b\\\".txt\" it\\'s");
+    }
+    snprintf(buf + len, size - len, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int i, r, m, nlines, quoted, nrep, n;
+    long total;
+    double t;
+    char **lines, work[MAXLINE], *av[MAXARGC];
+    int (*split[])(char *, char **) = { split_strtok, split_strtok_r, split_tok };
+    const char *names[] = { "strtok", "strtok_r", "tok_split" };
+    long counts[3];
+
+    nlines = argc > 1 ? atoi(argv[1]) : NLINES;
+    quoted = argc > 2 ? atoi(argv[2]) : QUOTED;
+    nrep = argc > 3 ? atoi(argv[3]) : NREP;
+    if (nlines <= 0 || quoted < 0 || quoted > 100 || nrep <= 0) {
+        err_quit("usage: %s [nlines] [quoted%%] [nrep]", argv[0]);
+    }
+    if ((lines = malloc(nlines * sizeof(char *))) == NULL) {
+        err_sys("malloc error");
+    }
+    srand(1);
+    for (i = 0; i < nlines; i++) {
+        genline(work, sizeof(work), rand() % 100 < quoted);
+        if ((lines[i] = strdup(work)) == NULL) {
+            err_sys("strdup error");
+        }
+    }
+
+    // 没有引号的行三种方法的结果应该一样
+    for (i = 0; i < nlines; i++) {
+        if (strpbrk(lines[i], "\"'\\") != NULL) {
+            continue;
+        }
+        for (m = 0; m < 3; m++) {
+            strcpy(work, lines[i]);
+            counts[m] = split[m](work, av);
+        }
+        if (counts[0] != counts[1] || counts[0] != counts[2]) {
+            err_quit("line %d: %ld/%ld/%ld arguments", i, counts[0], counts[1], counts[2]);
+        }
+    }
+
+    printf("%d lines, %d%% quoted\n", nlines, quoted);
+    for (m = 0; m < 3; m++) {
+        total = 0;
+        t = now();
+        for (r = 0; r < nrep; r++) {
+            for (i = 0; i < nlines; i++) {
+                strcpy(work, lines[i]);
+                if ((n = split[m](work, av)) > 0) {
+                    total += n;
+                }
+            }
+        }
+        t = now() - t;
+        printf("%-10s %12.0f lines/sec (%ld arguments)\n", names[m],
+               (double)nlines * nrep / t, total / nrep);
+    }
+    exit(0);
+}
@@ -0,0 +1,296 @@
+/*
+* lib/urpc.c 的延迟测试：fork 出一个服务器进程，客户端测量每次调用的微秒数
+* 1. 同步调用：一次一个请求，输出平均值和 p50/p99
+* 2. 流水线：一次发出 DEPTH 个请求再读回应答，靠关联 id 对上号；
+*    再一次发出 DEEP 个请求，远超过套接字缓冲区和服务器的输出上限，
+*    客户端发送被阻塞时要边发边把应答读进缓冲区，否则双方互相等待
+* 3. 多客户端：NCONN 个连接轮流发请求，服务器一个 epoll 循环处理所有连接
+* 4. 大数据：BIGSZ 字节的数据放在 memfd 里传递，服务器映射后求和
+* SOCK_STREAM 和 SOCK_SEQPACKET 各测一遍。SOCK_SEQPACKET 的每条消息都是一个记录，
+* 接收队列里最多 net.unix.max_dgram_qlen（默认 10）个记录，流水线再深发送方也会被阻塞
+* 每个连接在服务器和客户端里各占一个描述符，RLIMIT_NOFILE 的软限制会先提高到硬限制，
+* 连接数超过限制允许的数目时减少连接数（服务器描述符用完时会暂停 accept，等有连接关闭）
+* 用法：./a.out [调用次数] [连接数]
+*/
+#include "apue.h"
+#include "urpc.h"
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define SOCKNAME "/tmp/urpc-bench.socket"
+#define NCALL 20000
+#define NCONN 1000
+#define DEPTH 64
+#define DEEP 100000
+#define MSGSZ 32
+#define BIGSZ (8 * 1024 * 1024)
+#define NBIG 20
+
+#define OP_ECHO 1 // 原样返回
+#define OP_SUM 2 // 返回数据的和
+#define OP_STOP 3 // 让服务器退出
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void handler(struct urpc_conn *c, struct urpc_msg *req, void *arg)
+{
+    size_t i;
+    uint64_t sum;
+    struct urpc_server *s = arg;
+
+    switch (req->m_op) {
+    case OP_ECHO:
+        urpc_reply(c, req, 0, req->m_data, req->m_len);
+        break;
+    case OP_SUM:
+        for (sum = 0, i = 0; i < req->m_len; i++) {
+            sum += ((unsigned char *)req->m_data)[i];
+        }
+        urpc_reply(c, req, 0, &sum, sizeof(sum));
+        break;
+    case OP_STOP:
+        urpc_reply(c, req, 0, NULL, 0);
+        urpc_stop(s);
+        break;
+    default:
+        urpc_reply(c, req, EINVAL, NULL, 0);
+    }
+}
+
+static struct urpc_server *server;
+
+static void serve(int type)
+{
+    if ((server = urpc_listen(SOCKNAME, type, handler, NULL)) == NULL) {
+        err_sys("urpc_listen error");
+    }
+    server->s_arg = server;
+    TELL_PARENT(getppid());
+    if (urpc_run(server) < 0) {
+        err_sys("urpc_run error");
+    }
+    printf("  server: %lu calls, %.1f calls per epoll_wait\n",
+           server->s_ncall, (double)server->s_ncall / server->s_nwake);
+    urpc_shutdown(server);
+    unlink(SOCKNAME);
+}
+
+static int cmpdouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void call(struct urpc_conn *c, int op, void *data, size_t len, int fd, struct urpc_msg *rep)
+{
+    struct urpc_msg m;
+
+    m.m_op = op;
+    m.m_status = 0;
+    m.m_data = data;
+    m.m_len = len;
+    m.m_fd = fd;
+    if (urpc_call(c, &m, rep) < 0) {
+        err_sys("urpc_call error");
+    }
+    if (rep->m_status != 0) {
+        err_quit("call failed: %s", strerror(rep->m_status));
+    }
+}
+
+static void bench(int type, long ncall, int nconn)
+{
+    int i, j, fd;
+    long n;
+    double t, *lat;
+    char buf[MSGSZ];
+    void *big;
+    uint64_t sum, want;
+    pid_t pid;
+    struct urpc_msg m, rep;
+    struct urpc_conn *c, **conns;
+
+    printf("%s:\n", type == SOCK_STREAM ? "SOCK_STREAM" : "SOCK_SEQPACKET");
+    fflush(stdout);
+    TELL_WAIT();
+    if ((pid = fork()) < 0) {
+        err_sys("fork error");
+    } else if (pid == 0) {
+        serve(type);
+        exit(0);
+    }
+    WAIT_CHILD();
+    if ((c = urpc_connect(SOCKNAME, type)) == NULL) {
+        err_sys("urpc_connect error");
+    }
+    memset(buf, 'x', sizeof(buf));
+
+    // 1. 同步调用
+    if ((lat = malloc(ncall * sizeof(double))) == NULL) {
+        err_sys("malloc error");
+    }
+    for (n = 0; n < ncall; n++) {
+        t = now();
+        call(c, OP_ECHO, buf, sizeof(buf), -1, &rep);
+        lat[n] = (now() - t) * 1e6;
+    }
+    qsort(lat, ncall, sizeof(double), cmpdouble);
+    for (t = 0, n = 0; n < ncall; n++) {
+        t += lat[n];
+    }
+    printf("  call:      %6.2f us/call (p50 %.2f, p99 %.2f)\n",
+           t / ncall, lat[ncall / 2], lat[ncall * 99 / 100]);
+    free(lat);
+
+    // 2. 流水线：DEPTH 个请求一起发，应答的 id 必须能对上
+    t = now();
+    for (n = 0; n < ncall; n += DEPTH) {
+        for (i = 0; i < DEPTH; i++) {
+            m.m_id = 0;
+            m.m_op = OP_ECHO;
+            m.m_status = 0;
+            m.m_data = buf;
+            m.m_len = sizeof(buf);
+            m.m_fd = -1;
+            if (urpc_send(c, &m) < 0) {
+                err_sys("urpc_send error");
+            }
+        }
+        for (i = 0; i < DEPTH; i++) {
+            if (urpc_recv(c, &rep) < 0) {
+                err_sys("urpc_recv error");
+            }
+            if (rep.m_id != m.m_id - DEPTH + 1 + i) {
+                err_quit("reply %llu out of order", (unsigned long long)rep.m_id);
+            }
+        }
+    }
+    t = now() - t;
+    printf("  pipelined: %6.2f us/call (depth %d)\n", t * 1e6 / n, DEPTH);
+
+    // 深流水线：先把 DEEP 个请求全部发出去，再读应答
+    t = now();
+    for (i = 0; i < DEEP; i++) {
+        m.m_id = 0;
+        m.m_op = OP_ECHO;
+        m.m_status = 0;
+        m.m_data = buf;
+        m.m_len = sizeof(buf);
+        m.m_fd = -1;
+        if (urpc_send(c, &m) < 0) {
+            err_sys("urpc_send error");
+        }
+    }
+    if (urpc_flush(c) < 0) {
+        err_sys("urpc_flush error");
+    }
+    for (i = 0; i < DEEP; i++) {
+        if (urpc_recv(c, &rep) < 0) {
+            err_sys("urpc_recv error");
+        }
+        if (rep.m_id != m.m_id - DEEP + 1 + i) {
+            err_quit("reply %llu out of order", (unsigned long long)rep.m_id);
+        }
+    }
+    t = now() - t;
+    printf("  pipelined: %6.2f us/call (depth %d)\n", t * 1e6 / DEEP, DEEP);
+
+    // 3. 多客户端
+    if ((conns = malloc(nconn * sizeof(struct urpc_conn *))) == NULL) {
+        err_sys("malloc error");
+    }
+    for (j = 0; j < nconn; j++) {
+        if ((conns[j] = urpc_connect(SOCKNAME, type)) == NULL) {
+            err_sys("urpc_connect error (%d connections)", j);
+        }
+    }
+    t = now();
+    for (n = 0; n < ncall; n += nconn) {
+        for (j = 0; j < nconn; j++) {
+            m.m_id = 0;
+            m.m_op = OP_ECHO;
+            m.m_data = buf;
+            m.m_len = sizeof(buf);
+            m.m_fd = -1;
+            if (urpc_send(conns[j], &m) < 0 || urpc_flush(conns[j]) < 0) {
+                err_sys("urpc_send error");
+            }
+        }
+        for (j = 0; j < nconn; j++) {
+            if (urpc_recv(conns[j], &rep) < 0) {
+                err_sys("urpc_recv error");
+            }
+        }
+    }
+    t = now() - t;
+    printf("  %d conns: %6.2f us/call\n", nconn, t * 1e6 / n);
+    for (j = 0; j < nconn; j++) {
+        urpc_close(conns[j]);
+    }
+    free(conns);
+
+    // 4. 大数据放在 memfd 里，直接在映射里填数据，不经过套接字复制
+    if ((fd = urpc_memfd(BIGSZ, &big)) < 0) {
+        err_sys("urpc_memfd error");
+    }
+    memset(big, 3, BIGSZ);
+    want = 3ULL * BIGSZ;
+    t = now();
+    for (i = 0; i < NBIG; i++) {
+        call(c, OP_SUM, big, BIGSZ, fd, &rep);
+        memcpy(&sum, rep.m_data, sizeof(sum));
+        if (sum != want) {
+            err_quit("sum %llu, want %llu", (unsigned long long)sum, (unsigned long long)want);
+        }
+    }
+    t = now() - t;
+    printf("  memfd:     %6.0f us/call, %.0f MB/s (%d MB)\n",
+           t * 1e6 / NBIG, (double)NBIG * BIGSZ / t / 1e6, BIGSZ >> 20);
+    m.m_data = big;
+    m.m_len = BIGSZ;
+    m.m_fd = fd;
+    urpc_release(&m);
+
+    fflush(stdout); // 先输出客户端的结果，再等服务器输出统计
+    call(c, OP_STOP, NULL, 0, -1, &rep);
+    urpc_close(c);
+    waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char *argv[])
+{
+    long ncall;
+    int nconn;
+    struct rlimit rl;
+
+    ncall = argc > 1 ? atol(argv[1]) : NCALL;
+    nconn = argc > 2 ? atoi(argv[2]) : NCONN;
+    if (ncall <= 0 || nconn <= 0) {
+        err_quit("usage: %s [ncalls] [nconns]", argv[0]);
+    }
+    // 每个连接在两个进程里各占一个描述符，再留一些给 memfd、epoll 和标准输入输出
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        if (rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+            getrlimit(RLIMIT_NOFILE, &rl);
+        }
+        if (rl.rlim_cur != RLIM_INFINITY && (rlim_t)nconn + 32 > rl.rlim_cur) {
+            nconn = rl.rlim_cur > 64 ? (int)rl.rlim_cur - 32 : 32;
+            fprintf(stderr, "RLIMIT_NOFILE is %lu: using %d connections\n",
+                    (unsigned long)rl.rlim_cur, nconn);
+        }
+    }
+    bench(SOCK_STREAM, ncall, nconn);
+    bench(SOCK_SEQPACKET, ncall, nconn);
+    exit(0);
+}
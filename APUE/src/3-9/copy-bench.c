@@ -0,0 +1,192 @@
+// 复制循环的吞吐测试：
+//   getc/putc（5-8/std.c、1-5/demo1.c）、fgets/fputs（5-8/rwrow.c）、
+//   read/write 在 1B ~ 1MB 各种缓冲区大小下（copy_file.c 固定用 4096），
+//   以及根据 st_blksize 选择缓冲区大小的 copy_fd（lib/copyfd.c）
+// 每种方式分别测：目标是文件且源在页缓存中（热）、源被 POSIX_FADV_DONTNEED 赶出页缓存（冷）、目标是管道
+// 用法：./a.out <临时目录> [文件大小MB ...]
+#include "../h/apue.h"
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define MAXBUF (1024 * 1024)
+
+enum { HOT, COLD, PIPE, NMODES };
+static const char *modes[NMODES] = { "file/hot", "file/cold", "pipe/hot" };
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void copy_getc(int fdin, int fdout)
+{
+    int c;
+    FILE *in, *out;
+
+    if ((in = fdopen(dup(fdin), "r")) == NULL || (out = fdopen(dup(fdout), "w")) == NULL)
+        err_sys("fdopen error");
+    while ((c = getc(in)) != EOF)
+        if (putc(c, out) == EOF)
+            err_sys("output error");
+    if (ferror(in))
+        err_sys("input error");
+    fclose(in);
+    fclose(out);
+}
+
+static void copy_fgets(int fdin, int fdout)
+{
+    char buf[MAXLINE];
+    FILE *in, *out;
+
+    if ((in = fdopen(dup(fdin), "r")) == NULL || (out = fdopen(dup(fdout), "w")) == NULL)
+        err_sys("fdopen error");
+    while (fgets(buf, MAXLINE, in) != NULL)
+        if (fputs(buf, out) == EOF)
+            err_sys("output error");
+    if (ferror(in))
+        err_sys("input error");
+    fclose(in);
+    fclose(out);
+}
+
+static void copy_rw(int fdin, int fdout, size_t bufsize)
+{
+    static char buf[MAXBUF];
+    ssize_t n;
+
+    while ((n = read(fdin, buf, bufsize)) > 0)
+        if (write(fdout, buf, n) != n)
+            err_sys("write error");
+    if (n < 0)
+        err_sys("read error");
+}
+
+// 生成测试文件：80 字节一行的文本，fgets 才有意义
+static void make_file(const char *path, off_t size)
+{
+    int fd;
+    off_t off;
+    char buf[80 * 1024];
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, FILE_MODE)) < 0)
+        err_sys("can't create %s", path);
+    memset(buf, 'x', sizeof(buf));
+    for (off = 79; off < (off_t)sizeof(buf); off += 80)
+        buf[off] = '\n';
+    for (off = 0; off < size; off += sizeof(buf))
+        if (write(fd, buf, min((off_t)sizeof(buf), size - off)) < 0)
+            err_sys("write error");
+    fsync(fd); // 写回磁盘之后 DONTNEED 才能真正丢掉这些页
+    close(fd);
+}
+
+// how: -2 getc/putc，-1 fgets/fputs，0 copy_fd，>0 read/write 的缓冲区大小
+static double run(int how, int mode, const char *src, const char *dst, off_t size)
+{
+    int fdin, fdout, pfd[2];
+    double t;
+    pid_t pid = 0;
+    char buf[65536];
+
+    if ((fdin = open(src, O_RDONLY)) < 0)
+        err_sys("can't open %s", src);
+    if (mode == COLD) {
+        posix_fadvise(fdin, 0, 0, POSIX_FADV_DONTNEED);
+    } else { // 先读一遍，保证源文件在页缓存中
+        if ((fdout = open("/dev/null", O_WRONLY)) < 0)
+            err_sys("can't open /dev/null");
+        copy_rw(fdin, fdout, MAXBUF);
+        close(fdout);
+        lseek(fdin, 0, SEEK_SET);
+    }
+
+    if (mode == PIPE) {
+        if (pipe(pfd) < 0)
+            err_sys("pipe error");
+        if ((pid = fork()) < 0) {
+            err_sys("fork error");
+        } else if (pid == 0) { // 子进程把管道读空
+            close(pfd[1]);
+            while (read(pfd[0], buf, sizeof(buf)) > 0)
+                ;
+            _exit(0);
+        }
+        close(pfd[0]);
+        fdout = pfd[1];
+    } else if ((fdout = open(dst, O_WRONLY | O_CREAT | O_TRUNC, FILE_MODE)) < 0) {
+        err_sys("can't create %s", dst);
+    }
+
+    t = now();
+    if (how == -2)
+        copy_getc(fdin, fdout);
+    else if (how == -1)
+        copy_fgets(fdin, fdout);
+    else if (how == 0) {
+        if (copy_fd(fdin, fdout, mode == COLD) != size)
+            err_sys("copy_fd error");
+    } else
+        copy_rw(fdin, fdout, how);
+    close(fdout);
+    if (pid > 0)
+        waitpid(pid, NULL, 0);
+    t = now() - t;
+    close(fdin);
+    return size / t / (1024 * 1024);
+}
+
+int main(int argc, char *argv[])
+{
+    int i, how, mode, fd;
+    off_t size;
+    long sizes[8] = { 1, 64 };
+    int nsizes = 2;
+    char src[MAXLINE], dst[MAXLINE], name[32];
+
+    if (argc < 2)
+        err_quit("usage: %s <dir> [MB ...]", argv[0]);
+    if (argc > 2)
+        for (nsizes = 0; nsizes < 8 && nsizes + 2 < argc; nsizes++)
+            sizes[nsizes] = atol(argv[nsizes + 2]);
+    snprintf(src, sizeof(src), "%s/copy.src", argv[1]);
+    snprintf(dst, sizeof(dst), "%s/copy.dst", argv[1]);
+
+    for (i = 0; i < nsizes; i++) {
+        size = (off_t)sizes[i] * 1024 * 1024;
+        make_file(src, size);
+        if ((fd = open(src, O_RDONLY)) < 0)
+            err_sys("open error");
+        printf("\n%ld MB file, copy_fd picks a %zu byte buffer; MB/s\n",
+               sizes[i], copy_bufsize(fd, STDOUT_FILENO));
+        close(fd);
+        printf("%-16s", "");
+        for (mode = 0; mode < NMODES; mode++)
+            printf("%12s", modes[mode]);
+        printf("\n");
+
+        for (how = -2; how <= MAXBUF; how = (how <= 0) ? how + 1 : how * 4) {
+            if (how == -2)
+                strcpy(name, "getc/putc");
+            else if (how == -1)
+                strcpy(name, "fgets/fputs");
+            else if (how == 0)
+                strcpy(name, "copy_fd");
+            else
+                snprintf(name, sizeof(name), "read/write %d", how);
+            if (how > 0 && how < 64 && size > 4 * 1024 * 1024) // 太慢，跳过
+                continue;
+            printf("%-16s", name);
+            for (mode = 0; mode < NMODES; mode++)
+                printf("%12.0f", run(how, mode, src, dst, size));
+            printf("\n");
+        }
+    }
+    unlink(src);
+    unlink(dst);
+    exit(0);
+}
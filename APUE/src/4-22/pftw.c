@@ -0,0 +1,580 @@
+// ftw.c 的多线程版本：统计各种类型文件的数量和百分比
+// 用 lib/pwalk.c 遍历：每个线程一个目录队列，空闲时从别的线程偷目录；
+// 目录用 openat 相对父目录的描述符打开，getdents64 大缓冲区读取，
+// 靠 d_type 判断类型，不再对每个文件 lstat 一次
+// 计数器每个线程一份（按 cache line 对齐，避免伪共享），遍历结束后再汇总
+//
+// 增量模式（-i 快照文件）：上一次遍历的结果存成一个紧凑的快照文件
+// （每个文件的 inode、mtime、ctime、大小、类型，目录另外记名字），启动时直接 mmap，不用解析。
+// 一个目录的 mtime 和 ctime 都没变，说明它里面的名字没有增删改，就不再读这个目录，
+// 直接用快照里它的内容，只按名字把它的子目录排进队列（子目录里面的变化不会改父目录的 mtime）；
+// 变了的目录重新读，里面的文件用 statx 只取需要的几个字段，和快照比较，输出增、删、改的个数
+// 和各类型数量的变化。遍历完写一个新快照替换旧的。
+// 注意：没变的目录里的普通文件被就地改写不会被发现，这不影响类型统计
+//
+// 用法：./a.out [-j 线程数] [-s] [-i 快照文件] <起始路径>   -s：每个文件都 fstatat，和 ftw.c 一样
+#include "apue.h"
+#include "pwalk.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+
+enum { REG, DIR_, BLK, CHR, FIFO, SLINK, SOCK, NOREAD, NOSTAT, NCOUNT };
+
+struct counts {
+    long n[NCOUNT];
+} __attribute__((aligned(64)));
+
+// ---------------- 快照文件格式 ----------------
+// 文件头 | 目录表（按 dev、ino 排序）| 文件表（按父目录 dev、ino，再按自己的 dev、ino 排序）| 名字
+// 某个目录里的文件在文件表中是连续的一段：sd_first 开始的 sd_nent 个
+#define SNAP_MAGIC "FTWSNAP"
+#define SNAP_VERSION 1
+
+struct snaphdr {
+    char sh_magic[8];
+    uint32_t sh_version;
+    uint32_t sh_root;    // 起始路径在名字表中的偏移
+    uint64_t sh_ndir;
+    uint64_t sh_nent;
+    uint64_t sh_namesz;
+    int64_t sh_start;    // 这次遍历开始的时间（ns）
+    int64_t sh_count[NCOUNT];
+};
+
+struct snapdir {
+    uint64_t sd_dev;
+    uint64_t sd_ino;
+    int64_t sd_mtime;
+    int64_t sd_ctime;
+    uint64_t sd_first;
+    uint32_t sd_nent;
+    uint32_t sd_name;    // 在父目录中的名字；起始目录是起始路径
+};
+
+struct snapent {
+    uint64_t se_dev;
+    uint64_t se_ino;
+    int64_t se_mtime;
+    int64_t se_ctime;
+    int64_t se_size;
+    uint32_t se_mode;    // 只有 S_IFMT 位
+    uint32_t se_pad;
+};
+
+// 遍历时每个文件记一条，最后排序、写成快照
+struct rec {
+    uint64_t pdev, pino;  // 父目录，起始路径是 0, 0
+    struct snapent e;
+    char *name;           // 只有目录有
+    int flags;
+};
+#define R_REREAD 1        // 重新读过的目录
+#define R_REUSED 2        // 没变、沿用快照的目录
+
+struct dkey {             // 放在 pe_data 里，子项通过 pe_pdata 拿到父目录是谁
+    uint64_t dev, ino;
+    struct dkey *next;
+};
+
+struct tstate {           // 每个线程一份
+    struct counts c;
+    struct rec *recs;
+    size_t nrec, maxrec;
+    struct dkey *keys;
+    long nreread, nreused;
+} __attribute__((aligned(64)));
+
+static const struct snaphdr *ohdr; // mmap 的旧快照，NULL 表示没有
+static const struct snapdir *odirs;
+static const struct snapent *oents;
+static const char *onames;
+static size_t omaplen;
+
+static int counter(const struct pw_ent *ep, void *arg)
+{
+    struct counts *cp = (struct counts *)arg + ep->pe_thread;
+
+    switch (ep->pe_type) {
+    case PW_F:
+        switch (ep->pe_mode) {
+        case S_IFREG:  cp->n[REG]++;   break;
+        case S_IFBLK:  cp->n[BLK]++;   break;
+        case S_IFCHR:  cp->n[CHR]++;   break;
+        case S_IFIFO:  cp->n[FIFO]++;  break;
+        case S_IFLNK:  cp->n[SLINK]++; break;
+        case S_IFSOCK: cp->n[SOCK]++;  break;
+        case S_IFDIR:
+            err_dump("for S_IFDIR for %s", ep->pe_name); // 目录应该是 PW_D
+        }
+        break;
+    case PW_D:
+        cp->n[DIR_]++;
+        break;
+    case PW_DNR:
+        cp->n[DIR_]++;
+        cp->n[NOREAD]++;
+        break;
+    case PW_NS:
+        cp->n[NOSTAT]++;
+        break;
+    default:
+        err_dump("unknown type %d for %s", ep->pe_type, ep->pe_name);
+    }
+    return 0;
+}
+
+static int typeidx(uint32_t mode)
+{
+    switch (mode) {
+    case S_IFREG:  return REG;
+    case S_IFDIR:  return DIR_;
+    case S_IFBLK:  return BLK;
+    case S_IFCHR:  return CHR;
+    case S_IFIFO:  return FIFO;
+    case S_IFLNK:  return SLINK;
+    case S_IFSOCK: return SOCK;
+    }
+    return -1;
+}
+
+static int64_t nsec(const struct timespec *tp)
+{
+    return (int64_t)tp->tv_sec * 1000000000 + tp->tv_nsec;
+}
+
+// 按 dev、ino 二分查找旧快照中的目录
+static const struct snapdir *olddir(uint64_t dev, uint64_t ino)
+{
+    size_t lo = 0, hi, mid;
+
+    if (ohdr == NULL)
+        return NULL;
+    hi = ohdr->sh_ndir;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (odirs[mid].sd_dev < dev || (odirs[mid].sd_dev == dev && odirs[mid].sd_ino < ino))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < ohdr->sh_ndir && odirs[lo].sd_dev == dev && odirs[lo].sd_ino == ino)
+        return &odirs[lo];
+    return NULL;
+}
+
+static void openold(const char *path, const char *root)
+{
+    int fd;
+    struct stat sbuf;
+    void *p;
+    const struct snaphdr *hp;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return; // 第一次，没有快照
+    if (fstat(fd, &sbuf) < 0 || sbuf.st_size < (off_t)sizeof(struct snaphdr)) {
+        close(fd);
+        return;
+    }
+    if ((p = mmap(0, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        err_sys("mmap error for %s", path);
+    close(fd);
+    hp = p;
+    if (memcmp(hp->sh_magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) != 0 || hp->sh_version != SNAP_VERSION ||
+        sizeof(struct snaphdr) + hp->sh_ndir * sizeof(struct snapdir) + hp->sh_nent * sizeof(struct snapent) +
+        hp->sh_namesz != (uint64_t)sbuf.st_size || hp->sh_namesz == 0) {
+        err_msg("%s: not a snapshot, doing a full scan", path);
+        munmap(p, sbuf.st_size);
+        return;
+    }
+    odirs = (const struct snapdir *)(hp + 1);
+    oents = (const struct snapent *)(odirs + hp->sh_ndir);
+    onames = (const char *)(oents + hp->sh_nent);
+    if (onames[hp->sh_namesz - 1] != 0 || hp->sh_root >= hp->sh_namesz || strcmp(onames + hp->sh_root, root) != 0) {
+        err_msg("%s: snapshot of some other tree, doing a full scan", path);
+        munmap(p, sbuf.st_size);
+        return;
+    }
+    ohdr = hp;
+    omaplen = sbuf.st_size;
+}
+
+static struct rec *addrec(struct tstate *tp, const struct dkey *parent, const struct snapent *ep, const char *name)
+{
+    struct rec *rp;
+
+    if (tp->nrec == tp->maxrec) {
+        tp->maxrec = (tp->maxrec == 0) ? 4096 : tp->maxrec * 2;
+        if ((tp->recs = realloc(tp->recs, tp->maxrec * sizeof(struct rec))) == NULL)
+            err_sys("realloc error");
+    }
+    rp = &tp->recs[tp->nrec++];
+    rp->pdev = (parent == NULL) ? 0 : parent->dev;
+    rp->pino = (parent == NULL) ? 0 : parent->ino;
+    rp->e = *ep;
+    rp->name = NULL;
+    if (name != NULL && (rp->name = strdup(name)) == NULL)
+        err_sys("strdup error");
+    rp->flags = 0;
+    return rp;
+}
+
+static void stat2ent(const struct stat *sp, struct snapent *ep)
+{
+    memset(ep, 0, sizeof(*ep));
+    ep->se_dev = sp->st_dev;
+    ep->se_ino = sp->st_ino;
+    ep->se_mtime = nsec(&sp->st_mtim);
+    ep->se_ctime = nsec(&sp->st_ctim);
+    ep->se_size = sp->st_size;
+    ep->se_mode = sp->st_mode & S_IFMT;
+}
+
+// 增量模式的回调：只记录，数量最后从记录里统计
+static int recorder(const struct pw_ent *ep, void *arg)
+{
+    struct tstate *tp = (struct tstate *)arg + ep->pe_thread;
+    const struct dkey *parent = ep->pe_pdata;
+    struct dkey *kp;
+    struct snapent ent;
+    struct statx stx;
+    const struct snapdir *od;
+    const struct snapent *oe, *end;
+    size_t ri;
+
+    switch (ep->pe_type) {
+    case PW_F:
+        if (ep->pe_stat != NULL) {
+            stat2ent(ep->pe_stat, &ent);
+        } else {
+            // 只要这几个字段：有的文件系统上 statx 能少做很多事
+            if (statx(ep->pe_dirfd, ep->pe_name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                      STATX_TYPE | STATX_INO | STATX_MTIME | STATX_CTIME | STATX_SIZE, &stx) < 0) {
+                tp->c.n[NOSTAT]++;
+                break;
+            }
+            memset(&ent, 0, sizeof(ent));
+            ent.se_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+            ent.se_ino = stx.stx_ino;
+            ent.se_mtime = (int64_t)stx.stx_mtime.tv_sec * 1000000000 + stx.stx_mtime.tv_nsec;
+            ent.se_ctime = (int64_t)stx.stx_ctime.tv_sec * 1000000000 + stx.stx_ctime.tv_nsec;
+            ent.se_size = stx.stx_size;
+            ent.se_mode = stx.stx_mode & S_IFMT;
+        }
+        addrec(tp, parent, &ent, NULL);
+        break;
+
+    case PW_DNR:
+        stat2ent(ep->pe_stat, &ent);
+        addrec(tp, parent, &ent, ep->pe_name); // 记下名字，下次还能按名字再试
+        tp->c.n[NOREAD]++;
+        break;
+
+    case PW_D:
+        stat2ent(ep->pe_stat, &ent);
+        ri = tp->nrec;
+        addrec(tp, parent, &ent, ep->pe_name);
+        if ((kp = malloc(sizeof(struct dkey))) == NULL)
+            err_sys("malloc error");
+        kp->dev = ent.se_dev;
+        kp->ino = ent.se_ino;
+        kp->next = tp->keys;
+        tp->keys = kp;
+        *ep->pe_data = kp;
+
+        // mtime、ctime 都没变，并且上次读它的时候它已经不会再在同一个时间戳内被改了
+        od = olddir(ent.se_dev, ent.se_ino);
+        if (od == NULL || od->sd_mtime != ent.se_mtime || od->sd_ctime != ent.se_ctime ||
+            od->sd_ctime >= ohdr->sh_start - 1000000000) {
+            tp->recs[ri].flags = R_REREAD;
+            tp->nreread++;
+            return 0;
+        }
+        tp->recs[ri].flags = R_REUSED; // addrec 可能 realloc，之后不能再用指针
+        tp->nreused++;
+        for (oe = oents + od->sd_first, end = oe + od->sd_nent; oe < end; oe++) {
+            if (oe->se_mode == S_IFDIR) { // 子目录：按名字排队，打开它的时候再记录
+                if ((od = olddir(oe->se_dev, oe->se_ino)) != NULL && pwalk_queue(ep, onames + od->sd_name) < 0)
+                    err_sys("pwalk_queue error");
+            } else {
+                addrec(tp, kp, oe, NULL);
+            }
+        }
+        return PW_SKIP;
+
+    case PW_NS:
+        tp->c.n[NOSTAT]++;
+        break;
+
+    default:
+        err_dump("unknown type %d for %s", ep->pe_type, ep->pe_name);
+    }
+    return 0;
+}
+
+static int cmpent(const void *a, const void *b) // 父目录，再自己
+{
+    const struct rec *x = a, *y = b;
+
+    if (x->pdev != y->pdev)
+        return x->pdev < y->pdev ? -1 : 1;
+    if (x->pino != y->pino)
+        return x->pino < y->pino ? -1 : 1;
+    if (x->e.se_dev != y->e.se_dev)
+        return x->e.se_dev < y->e.se_dev ? -1 : 1;
+    if (x->e.se_ino != y->e.se_ino)
+        return x->e.se_ino < y->e.se_ino ? -1 : 1;
+    return 0;
+}
+
+static int cmpdir(const void *a, const void *b)
+{
+    const struct rec *x = *(struct rec *const *)a, *y = *(struct rec *const *)b;
+
+    if (x->e.se_dev != y->e.se_dev)
+        return x->e.se_dev < y->e.se_dev ? -1 : 1;
+    if (x->e.se_ino != y->e.se_ino)
+        return x->e.se_ino < y->e.se_ino ? -1 : 1;
+    return 0;
+}
+
+static int samekey(const struct snapent *a, const struct snapent *b)
+{
+    return a->se_dev == b->se_dev && a->se_ino == b->se_ino;
+}
+
+static int before(const struct snapent *a, const struct snapent *b)
+{
+    return a->se_dev < b->se_dev || (a->se_dev == b->se_dev && a->se_ino < b->se_ino);
+}
+
+static void writeall(int fd, const void *buf, size_t n)
+{
+    if (writen(fd, buf, n) != (ssize_t)n)
+        err_sys("write error");
+}
+
+// 合并所有线程的记录，和旧快照比较，写新快照；返回各类型数量
+static void incremental_done(struct tstate *ts, int nthreads, const char *snap, const char *root,
+                             int64_t start, long total[2 * NCOUNT])
+{
+    int i, k, fd;
+    size_t n, nrec, ndir, namesz, d, e, len;
+    struct rec *recs, **dirs;
+    struct snaphdr hdr;
+    struct snapdir sd;
+    const struct snapdir *od;
+    const struct snapent *oe, *oend;
+    long nreread = 0, nreused = 0, nadd = 0, ndel = 0, nchg = 0;
+    char tmp[PATH_MAX];
+
+    for (nrec = 0, i = 0; i < nthreads; i++)
+        nrec += ts[i].nrec;
+    if ((recs = malloc((nrec + 1) * sizeof(struct rec))) == NULL)
+        err_sys("malloc error");
+    for (n = 0, i = 0; i < nthreads; i++) {
+        memcpy(recs + n, ts[i].recs, ts[i].nrec * sizeof(struct rec));
+        n += ts[i].nrec;
+        nreread += ts[i].nreread;
+        nreused += ts[i].nreused;
+        total[NOREAD] += ts[i].c.n[NOREAD];
+        total[NOSTAT] += ts[i].c.n[NOSTAT];
+        free(ts[i].recs);
+    }
+    qsort(recs, nrec, sizeof(struct rec), cmpent);
+
+    if ((dirs = malloc((nrec + 1) * sizeof(struct rec *))) == NULL)
+        err_sys("malloc error");
+    namesz = 1 + strlen(root) + 1; // 偏移 0 是空串，然后是起始路径
+    for (ndir = 0, n = 0; n < nrec; n++) {
+        if ((k = typeidx(recs[n].e.se_mode)) >= 0)
+            total[k]++;
+        if (recs[n].name != NULL) {
+            dirs[ndir++] = &recs[n];
+            if (recs[n].pdev != 0 || recs[n].pino != 0) // 起始目录的名字就是起始路径
+                namesz += strlen(recs[n].name) + 1;
+        }
+    }
+    qsort(dirs, ndir, sizeof(struct rec *), cmpdir);
+
+    // 写新快照：先写临时文件再 rename，中途出错旧快照还在
+    snprintf(tmp, sizeof(tmp), "%s.tmp", snap);
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, FILE_MODE)) < 0)
+        err_sys("can't create %s", tmp);
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.sh_magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+    hdr.sh_version = SNAP_VERSION;
+    hdr.sh_root = 1;
+    hdr.sh_ndir = ndir;
+    hdr.sh_nent = nrec;
+    hdr.sh_namesz = namesz;
+    hdr.sh_start = start;
+    for (k = 0; k < NCOUNT; k++)
+        hdr.sh_count[k] = total[k];
+    writeall(fd, &hdr, sizeof(hdr));
+
+    // 目录表：目录按 dev、ino 排序，文件表按父目录排序，两边同时往前走就能找到每个目录的那一段
+    namesz = 1 + strlen(root) + 1;
+    for (d = 0, e = 0; d < ndir; d++) {
+        memset(&sd, 0, sizeof(sd));
+        sd.sd_dev = dirs[d]->e.se_dev;
+        sd.sd_ino = dirs[d]->e.se_ino;
+        sd.sd_mtime = dirs[d]->e.se_mtime;
+        sd.sd_ctime = dirs[d]->e.se_ctime;
+        while (e < nrec && (recs[e].pdev < sd.sd_dev || (recs[e].pdev == sd.sd_dev && recs[e].pino < sd.sd_ino)))
+            e++;
+        sd.sd_first = e;
+        while (e < nrec && recs[e].pdev == sd.sd_dev && recs[e].pino == sd.sd_ino)
+            e++;
+        sd.sd_nent = e - sd.sd_first;
+        if (dirs[d]->pdev == 0 && dirs[d]->pino == 0) {
+            sd.sd_name = 1;
+        } else {
+            sd.sd_name = namesz;
+            namesz += strlen(dirs[d]->name) + 1;
+        }
+        writeall(fd, &sd, sizeof(sd));
+
+        // 重新读过的目录，和旧快照里的内容比较（两边都按 dev、ino 排好了序）
+        if (ohdr == NULL || !(dirs[d]->flags & R_REREAD))
+            continue;
+        if ((od = olddir(sd.sd_dev, sd.sd_ino)) == NULL) {
+            nadd += sd.sd_nent;
+            continue;
+        }
+        oe = oents + od->sd_first;
+        oend = oe + od->sd_nent;
+        for (n = sd.sd_first; n < sd.sd_first + sd.sd_nent || oe < oend;) {
+            if (oe == oend || (n < sd.sd_first + sd.sd_nent && before(&recs[n].e, oe))) {
+                nadd++;
+                n++;
+            } else if (n == sd.sd_first + sd.sd_nent || !samekey(&recs[n].e, oe)) {
+                ndel++;
+                oe++;
+            } else {
+                if (recs[n].e.se_mode != oe->se_mode || recs[n].e.se_mtime != oe->se_mtime ||
+                    recs[n].e.se_ctime != oe->se_ctime || recs[n].e.se_size != oe->se_size)
+                    nchg++;
+                n++;
+                oe++;
+            }
+        }
+    }
+    for (n = 0; n < nrec; n++)
+        writeall(fd, &recs[n].e, sizeof(struct snapent));
+    writeall(fd, "", 1);
+    writeall(fd, root, strlen(root) + 1);
+    for (d = 0; d < ndir; d++) {
+        if (dirs[d]->pdev == 0 && dirs[d]->pino == 0)
+            continue;
+        len = strlen(dirs[d]->name) + 1;
+        writeall(fd, dirs[d]->name, len);
+    }
+    if (close(fd) < 0)
+        err_sys("close error");
+    if (rename(tmp, snap) < 0)
+        err_sys("can't rename %s to %s", tmp, snap);
+
+    printf("re-read %ld directories, reused %ld from the snapshot\n", nreread, nreused);
+    if (ohdr != NULL) {
+        printf("in re-read directories: %ld added, %ld removed, %ld changed\n", nadd, ndel, nchg);
+        for (k = 0; k < NCOUNT; k++) // 上次的数量，打印变化用
+            total[NCOUNT + k] = ohdr->sh_count[k];
+        munmap((void *)ohdr, omaplen);
+    }
+    for (n = 0; n < nrec; n++)
+        free(recs[n].name);
+    free(recs);
+    free(dirs);
+}
+
+static void print1(const char *name, long *total, int k, long ntot, int delta)
+{
+    printf("%-16s= %7ld, %5.2f %%", name, total[k], total[k] * 100.0 / ntot);
+    if (delta)
+        printf("  (%+ld)", total[k] - total[NCOUNT + k]);
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int c, i, k, nthreads, flags = 0, delta = 0;
+    long ntot, total[2 * NCOUNT] = { 0 }; // 后一半是上次快照里的数量
+    char *snap = NULL;
+    void *arg;
+    struct counts *cnt = NULL;
+    struct tstate *ts = NULL;
+    struct dkey *kp;
+    struct timespec t0, t1, now;
+
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN) * 2; // 线程多一些，可以同时等多个目录的磁盘 I/O
+    while ((c = getopt(argc, argv, "i:j:s")) != -1) {
+        switch (c) {
+        case 'i':
+            snap = optarg;
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            break;
+        case 's':
+            flags |= PW_STAT;
+            break;
+        default:
+            err_quit("usage: pftw [-j nthreads] [-s] [-i snapshot] <starting-pathname>");
+        }
+    }
+    if (optind != argc - 1)
+        err_quit("usage: pftw [-j nthreads] [-s] [-i snapshot] <starting-pathname>");
+    if (nthreads < 1)
+        nthreads = 1;
+    if (snap != NULL) {
+        openold(snap, argv[optind]);
+        delta = (ohdr != NULL);
+        if ((ts = calloc(nthreads, sizeof(struct tstate))) == NULL)
+            err_sys("calloc error");
+        arg = ts;
+    } else {
+        if ((cnt = calloc(nthreads, sizeof(struct counts))) == NULL)
+            err_sys("calloc error");
+        arg = cnt;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now); // 和文件时间戳比较用
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (pwalk(argv[optind], nthreads, flags, snap ? recorder : counter, arg) < 0)
+        err_sys("pwalk error");
+    if (snap != NULL) {
+        incremental_done(ts, nthreads, snap, argv[optind], nsec(&now), total);
+        for (i = 0; i < nthreads; i++)
+            while ((kp = ts[i].keys) != NULL) {
+                ts[i].keys = kp->next;
+                free(kp);
+            }
+        free(ts);
+    } else {
+        for (i = 0; i < nthreads; i++) // 汇总每个线程的计数
+            for (k = 0; k < NCOUNT; k++)
+                total[k] += cnt[i].n[k];
+        free(cnt);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    ntot = total[REG] + total[DIR_] + total[BLK] + total[CHR] + total[FIFO] + total[SLINK] + total[SOCK];
+    if (ntot == 0)
+        ntot = 1; // 避免 0 整除
+    print1("regular files", total, REG, ntot, delta);
+    print1("directories", total, DIR_, ntot, delta);
+    print1("block special", total, BLK, ntot, delta);
+    print1("char special", total, CHR, ntot, delta);
+    print1("FIFOs", total, FIFO, ntot, delta);
+    print1("symbolic links", total, SLINK, ntot, delta);
+    print1("sockets", total, SOCK, ntot, delta);
+    if (total[NOREAD] > 0 || total[NOSTAT] > 0)
+        printf("can't read %ld directories, can't stat %ld files\n", total[NOREAD], total[NOSTAT]);
+    fprintf(stderr, "%d threads, %.3f s\n", nthreads,
+            (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    exit(0);
+}
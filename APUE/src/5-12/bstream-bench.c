@@ -0,0 +1,140 @@
+/*
+* 守护进程日志输出的缓冲测试：stdio 行缓冲 / 全缓冲 vs lib/bstream.c 的各种刷新策略
+* 父进程向管道写 NLINES 行短日志（和守护进程的 stdout 接到管道或终端时一样，stdio 默认是行缓冲），
+* 子进程把管道读空；输出每秒写的行数，bstream 还输出刷新次数、每次刷新的平均字节数、阻塞在 write 里的时间
+* BS_TIME 每隔 TICK 行调用一次 bs_tick，模拟事件循环
+* 最后用 print_buf 的办法打印 stdio 自己的缓冲状态，对照 bs_getstats 看到的内容
+* 用法：./a.out [行数] [缓冲区大小]
+*/
+#include "apue.h"
+#include "bstream.h"
+#include <stdio_ext.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define NLINES 200000
+#define BUFSIZE 8192
+#define INTERVAL 1000000 // BS_TIME 的最长延迟，ns
+#define TICK 64
+
+enum { M_LINEBUF, M_FULLBUF, M_BSLINE, M_BSSIZE, M_BSTIME, M_BSFILE, NMETHOD };
+
+static const char *names[NMETHOD] = {
+    "stdio _IOLBF", "stdio _IOFBF", "bstream BS_LINE", "bstream BS_SIZE", "bstream BS_TIME",
+    "bs_fdopen BS_SIZE",
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 子进程：读空管道直到对端关闭
+static void drain(int fd)
+{
+    char buf[65536];
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    _exit(0);
+}
+
+static double run(int method, int nlines, size_t size, struct bs_stats *st)
+{
+    int i, fd[2], wfd;
+    pid_t pid;
+    double t;
+    FILE *fp;
+    struct bstream *bp;
+
+    if (pipe(fd) < 0) {
+        err_sys("pipe error");
+    }
+    fflush(stdout);
+    if ((pid = fork()) < 0) {
+        err_sys("fork error");
+    } else if (pid == 0) {
+        close(fd[1]);
+        drain(fd[0]);
+    }
+    close(fd[0]);
+    wfd = fd[1];
+    memset(st, 0, sizeof(*st));
+
+    t = now();
+    if (method == M_LINEBUF || method == M_FULLBUF) {
+        if ((fp = fdopen(wfd, "w")) == NULL) {
+            err_sys("fdopen error");
+        }
+        setvbuf(fp, NULL, method == M_LINEBUF ? _IOLBF : _IOFBF, size);
+        for (i = 0; i < nlines; i++) {
+            fprintf(fp, "worker %d: request %d done in %d us\n", i % 8, i, i % 1000);
+        }
+        fclose(fp);
+    } else {
+        bp = bs_open(wfd, size, method == M_BSLINE ? BS_LINE : method == M_BSTIME ? BS_TIME : BS_SIZE,
+                     INTERVAL);
+        if (bp == NULL) {
+            err_sys("bs_open error");
+        }
+        fp = method == M_BSFILE ? bs_fdopen(bp) : NULL;
+        for (i = 0; i < nlines; i++) {
+            if (fp != NULL) {
+                fprintf(fp, "worker %d: request %d done in %d us\n", i % 8, i, i % 1000);
+            } else {
+                bs_printf(bp, "worker %d: request %d done in %d us\n", i % 8, i, i % 1000);
+            }
+            if (method == M_BSTIME && i % TICK == 0) {
+                bs_tick();
+            }
+        }
+        bs_flush(bp);
+        bs_getstats(bp, st);
+        if (fp != NULL) {
+            fclose(fp); // 同时关闭 bp
+        } else {
+            bs_close(bp);
+        }
+        close(wfd);
+    }
+    t = now() - t;
+    if (waitpid(pid, NULL, 0) < 0) {
+        err_sys("waitpid error");
+    }
+    return t;
+}
+
+int main(int argc, char *argv[])
+{
+    int m, nlines;
+    size_t size;
+    double t;
+    struct bs_stats st;
+
+    nlines = argc > 1 ? atoi(argv[1]) : NLINES;
+    size = argc > 2 ? (size_t)atol(argv[2]) : BUFSIZE;
+    if (nlines <= 0 || size == 0) {
+        err_quit("usage: %s [nlines] [bufsize]", argv[0]);
+    }
+
+    printf("%d lines to a pipe, %zu-byte buffers\n", nlines, size);
+    printf("%-18s %12s %9s %11s %11s\n", "", "lines/sec", "flushes", "bytes/flush", "blocked ms");
+    for (m = 0; m < NMETHOD; m++) {
+        t = run(m, nlines, size, &st);
+        printf("%-18s %12.0f", names[m], nlines / t);
+        if (st.st_flushes > 0) {
+            printf(" %9lu %11.0f %11.2f", st.st_flushes, (double)st.st_bytes / st.st_flushes,
+                   st.st_blocked / 1e6);
+        }
+        printf("\n");
+    }
+
+    // stdio 自己能告诉我们的只有这些
+    printf("\nstdout: %s, buffer size %zu, %zu bytes pending\n",
+           __flbf(stdout) ? "line buffered" : "not line buffered", __fbufsize(stdout),
+           __fpending(stdout));
+    exit(0);
+}
@@ -38,13 +38,32 @@ void pr_stdio(const char *name, FILE *fp) {
         printf("line buffered");
     else
         printf("fully buffered");
-    printf(", buffer sie = %n\n", buffer_size(fp));
+    printf(", buffer size = %d\n", buffer_size(fp));
 }
 
 /*
 下面函数不具有可移植性
+glibc、musl 和 Solaris 提供了 <stdio_ext.h> 里的 __fbufsize、__flbf 等函数，优先用它们，不用去看 FILE 的内部标志
+要改变缓冲策略并统计刷新的开销，见 lib/bstream.c
 */
-#if defined(_IO_UNBUFFERED)
+#if defined(__GLIBC__)
+#include <stdio_ext.h>
+
+int is_unbuffered(FILE *fp)
+{
+    return (__fbufsize(fp) <= 1); // 无缓冲的流只有 1 字节的缓冲区
+}
+
+int is_linebuffered(FILE *fp)
+{
+    return (__flbf(fp));
+}
+
+int buffer_size(FILE *fp)
+{
+    return (__fbufsize(fp));
+}
+#elif defined(_IO_UNBUFFERED)
 
 int is_unbuffered(FILE *fp)
 {
@@ -92,7 +111,7 @@ int is_unbuffered(FILE *fp)
 
 int is_linebuffered(FILE *fp)
 {
-    retunr (fp->_flags & _IOLBF);
+    return (fp->_flags & _IOLBF);
 }
 
 int buffer_size(FILE *fp)
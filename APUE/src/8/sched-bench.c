@@ -0,0 +1,152 @@
+/*
+* 调度策略对吞吐和尾延迟的影响，8-16.c 的 nice 实验的扩展，用 lib/schedctl.c 设置调度策略和 CPU 亲和性
+* 和 8-16 一样让两个进程争用同一个 CPU：
+*   batch 进程：忙循环增加计数器（8-16 里的两个进程），计数速率就是吞吐
+*   latency 进程：模拟事件循环，每 PERIOD 纳秒醒来一次（绝对截止时间），做 WORK 纳秒的工作，
+*   统计每次醒来比截止时间晚了多少（p50、p99、最大）
+* 每组实验给两个进程设置不同的策略（normal、nice、SCHED_BATCH、SCHED_IDLE、SCHED_FIFO），
+* 都绑定到同一个 CPU 上（默认是没有在处理设备中断的第一个 CPU），各跑若干秒
+* 没有权限设置的策略（比如非 root 的 fifo、负的 nice 值）会被跳过
+* 用法：./a.out [每组秒数] [CPU 列表]
+*/
+#include "apue.h"
+#include "schedctl.h"
+#include "deadline.h"
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define SECS 2
+#define PERIOD 1000000 // ns
+#define WORK 50000     // ns
+#define MAXTICK 100000
+
+struct result {
+    volatile unsigned long long count; // batch 进程的计数器
+    int nlat;                          // latency 进程醒来的次数
+    int err;                           // 子进程 sc_apply 失败时的 errno
+    char desc[64];                     // latency 进程实际的调度策略
+    long long lat[MAXTICK];
+};
+
+static const char *scenarios[][2] = {
+    // latency 进程, batch 进程
+    { "normal", "normal" },
+    { "normal", "normal:10" },
+    { "normal", "bulk" },
+    { "normal", "idle" },
+    { "interactive", "normal" },
+    { "fifo:10", "normal" },
+};
+
+static int cmpll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void spin(long long ns)
+{
+    struct timespec dl;
+
+    dl_after(&dl, ns);
+    while (dl_remaining(&dl) > 0)
+        ;
+}
+
+static pid_t start(struct result *res, const char *spec, int latency, int secs)
+{
+    pid_t pid;
+    struct timespec dl, end;
+
+    fflush(stdout);
+    if ((pid = fork()) < 0) {
+        err_sys("fork error");
+    } else if (pid > 0) {
+        return pid;
+    }
+    if (sc_apply(0, spec) < 0) {
+        res->err = errno;
+        _exit(1);
+    }
+    if (!latency) {
+        for (;;) {
+            res->count++;
+        }
+    }
+    sc_describe(0, res->desc, sizeof(res->desc));
+    dl_after(&end, (long long)secs * 1000000000);
+    dl_after(&dl, 0);
+    while (res->nlat < MAXTICK && dl_remaining(&end) > 0) {
+        dl_advance(&dl, PERIOD);
+        dl_sleep(&dl);
+        res->lat[res->nlat++] = -dl_remaining(&dl);
+        spin(WORK);
+    }
+    _exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    int i, secs, n;
+    char cpus[256], spec[2][300], buf[256];
+    pid_t lpid, bpid;
+    cpu_set_t set;
+    struct result *lres, *bres;
+
+    secs = argc > 1 ? atoi(argv[1]) : SECS;
+    if (secs <= 0) {
+        err_quit("usage: %s [seconds] [cpulist]", argv[0]);
+    }
+    if (argc > 2) {
+        if (sc_parsecpus(argv[2], &set) < 0) {
+            err_quit("bad cpu list %s", argv[2]);
+        }
+    } else if (sc_quietcpus(&set) < 0) {
+        err_sys("sc_quietcpus error");
+    }
+    for (i = 0; !CPU_ISSET(i, &set); i++)
+        ;
+    snprintf(cpus, sizeof(cpus), "%d", i);
+    if (sc_irqcpus(SC_IRQPCT, &set) >= 0) {
+        printf("interrupt-heavy cpus: %s\n", sc_fmtcpus(&set, buf, sizeof(buf)));
+    }
+    printf("both processes on cpu %s, %d s each, wakeup every %d us with %d us of work\n", cpus,
+           secs, PERIOD / 1000, WORK / 1000);
+    printf("%-12s %-10s %14s %8s %8s %8s %8s\n", "latency", "batch", "batch count/s", "ticks",
+           "p50 us", "p99 us", "max us");
+
+    lres = mmap(NULL, sizeof(struct result), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    bres = mmap(NULL, sizeof(struct result), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (lres == MAP_FAILED || bres == MAP_FAILED) {
+        err_sys("mmap error");
+    }
+    for (i = 0; i < (int)(sizeof(scenarios) / sizeof(scenarios[0])); i++) {
+        memset(lres, 0, sizeof(struct result));
+        memset(bres, 0, sizeof(struct result));
+        snprintf(spec[0], sizeof(spec[0]), "%s@%s", scenarios[i][0], cpus);
+        snprintf(spec[1], sizeof(spec[1]), "%s@%s", scenarios[i][1], cpus);
+        bpid = start(bres, spec[1], 0, secs);
+        lpid = start(lres, spec[0], 1, secs);
+        if (waitpid(lpid, NULL, 0) < 0) {
+            err_sys("waitpid error");
+        }
+        kill(bpid, SIGKILL);
+        if (waitpid(bpid, NULL, 0) < 0) {
+            err_sys("waitpid error");
+        }
+        printf("%-12s %-10s ", scenarios[i][0], scenarios[i][1]);
+        if (lres->err != 0 || bres->err != 0) {
+            printf("skipped: %s\n", strerror(lres->err ? lres->err : bres->err));
+            continue;
+        }
+        n = lres->nlat;
+        qsort(lres->lat, n, sizeof(long long), cmpll);
+        printf("%14.0f %8d %8.1f %8.1f %8.1f  (%s)\n", bres->count / (double)secs, n,
+               n ? lres->lat[n / 2] / 1e3 : 0, n ? lres->lat[n * 99 / 100] / 1e3 : 0,
+               n ? lres->lat[n - 1] / 1e3 : 0, lres->desc);
+    }
+    exit(0);
+}
@@ -25,6 +25,7 @@
 #include <string.h>		/* for convenience */
 #include <unistd.h>		/* for convenience */
 #include <signal.h>		/* for SIG_ERR */
+#include <stdarg.h>		/* for va_list */
 
 #define	MAXLINE	4096			/* max line length */
 
@@ -63,6 +64,8 @@ void	 daemonize(const char *);			/* {Prog daemoninit} */
 void	 sleep_us(unsigned int);			/* {Ex sleepus} */
 ssize_t	 readn(int, void *, size_t);		/* {Prog readn_writen} */
 ssize_t	 writen(int, const void *, size_t);	/* {Prog readn_writen} */
+ssize_t	 copy_fd(int, int, int);			/* {Prog copyfd} */
+size_t	 copy_bufsize(int, int);			/* {Prog copyfd} */
 
 int		 fd_pipe(int *);					/* {Prog sock_fdpipe} */
 int		 recv_fd(int, ssize_t (*func)(int,
@@ -71,8 +74,10 @@ int		 send_fd(int, int);					/* {Prog sendfd_sockets} */
 int		 send_err(int, int,
 		          const char *);			/* {Prog senderr} */
 int		 serv_listen(const char *);			/* {Prog servlisten_sockets} */
+int		 serv_listen_type(const char *, int);	/* {Prog servlisten_sockets} */
 int		 serv_accept(int, uid_t *);			/* {Prog servaccept_sockets} */
 int		 cli_conn(const char *);			/* {Prog cliconn_sockets} */
+int		 cli_conn_type(const char *, int);	/* {Prog cliconn_sockets} */
 int		 buf_args(char *, int (*func)(int,
 		          char **));				/* {Prog bufargs} */
 
@@ -109,20 +114,50 @@ pid_t	lock_test(int, int, off_t, int, off_t);		/* {Prog locktest} */
 #define	is_write_lockable(fd, offset, whence, len) \
 			(lock_test((fd), F_WRLCK, (offset), (whence), (len)) == 0)
 
-void	err_msg(const char *, ...);			/* {App misc_source} */
-void	err_dump(const char *, ...) __attribute__((noreturn));
-void	err_quit(const char *, ...) __attribute__((noreturn));
-void	err_cont(int, const char *, ...);
-void	err_exit(int, const char *, ...) __attribute__((noreturn));
-void	err_ret(const char *, ...);
-void	err_sys(const char *, ...) __attribute__((noreturn));
+/*
+ * The err_XXX and log_XXX routines check their format strings at compile
+ * time, like printf().
+ */
+#define	PRINTFLIKE(f, a)	__attribute__((format(printf, f, a)))
+
+void	err_msg(const char *, ...) PRINTFLIKE(1, 2);	/* {App misc_source} */
+void	err_dump(const char *, ...) PRINTFLIKE(1, 2) __attribute__((noreturn));
+void	err_quit(const char *, ...) PRINTFLIKE(1, 2) __attribute__((noreturn));
+void	err_cont(int, const char *, ...) PRINTFLIKE(2, 3);
+void	err_exit(int, const char *, ...) PRINTFLIKE(2, 3) __attribute__((noreturn));
+void	err_ret(const char *, ...) PRINTFLIKE(1, 2);
+void	err_sys(const char *, ...) PRINTFLIKE(1, 2) __attribute__((noreturn));
 
-void	log_msg(const char *, ...);			/* {App misc_source} */
+void	log_msg(const char *, ...) PRINTFLIKE(1, 2);	/* {App misc_source} */
 void	log_open(const char *, int, int);
-void	log_quit(const char *, ...) __attribute__((noreturn));
-void	log_ret(const char *, ...);
-void	log_sys(const char *, ...) __attribute__((noreturn));
-void	log_exit(int, const char *, ...) __attribute__((noreturn));
+void	log_quit(const char *, ...) PRINTFLIKE(1, 2) __attribute__((noreturn));
+void	log_ret(const char *, ...) PRINTFLIKE(1, 2);
+void	log_sys(const char *, ...) PRINTFLIKE(1, 2) __attribute__((noreturn));
+void	log_exit(int, const char *, ...) PRINTFLIKE(2, 3) __attribute__((noreturn));
+
+int		alog_open(int);						/* asynchronous back end */
+int		alog_active(void);
+int		alog_doit(int, int, int, const char *, va_list);
+void	alog_flush(void);
+void	alog_close(void);
+
+#ifdef	__linux__
+struct timespec;
+int		futex_wait(unsigned int *, unsigned int,
+		           const struct timespec *);	/* {Prog futex} */
+int		futex_wake(unsigned int *, int);	/* {Prog futex} */
+#endif
+
+/*
+ * Hint to the CPU that we're in a spin-wait loop.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define	cpu_relax()	__builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define	cpu_relax()	__asm__ __volatile__("yield" ::: "memory")
+#else
+#define	cpu_relax()	do { } while (0)
+#endif
 
 void	TELL_WAIT(void);		/* parent/child from {Sec race_conditions} */
 void	TELL_PARENT(pid_t);
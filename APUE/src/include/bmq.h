@@ -0,0 +1,38 @@
+/*
+ * Bounded FIFO message queue with batch enqueue and dequeue.
+ * Replaces the unbounded LIFO work queue of {Prog condvar}.
+ */
+#ifndef	_BMQ_H
+#define	_BMQ_H
+
+#include <pthread.h>
+
+#define	BMQ_CACHELINE	64
+
+struct bmq_msg {
+	struct bmq_msg	*m_next;
+	/* ... more stuff here ... */
+};
+
+struct bmq {
+	struct bmq_msg	*q_in;		/* pushed messages, newest first */
+	char			 q_pad1[BMQ_CACHELINE - sizeof(struct bmq_msg *)];
+	unsigned long	 q_count;	/* messages queued or being queued */
+	unsigned long	 q_cap;		/* most messages we allow */
+	char			 q_pad2[BMQ_CACHELINE - 2 * sizeof(unsigned long)];
+	unsigned int	 q_pwait;	/* producers waiting for room */
+	unsigned int	 q_cwait;	/* consumers waiting for messages */
+	unsigned long	 q_nfull;	/* times a producer had to wait */
+	unsigned long	 q_nempty;	/* times a consumer had to wait */
+	pthread_mutex_t	 q_lock;	/* only for sleeping and waking */
+	pthread_cond_t	 q_notfull;
+	pthread_cond_t	 q_notempty;
+};
+
+int				 bmq_init(struct bmq *, unsigned long);	/* {Prog bmq} */
+void			 bmq_destroy(struct bmq *);
+void			 bmq_enqueue(struct bmq *, struct bmq_msg *);
+void			 bmq_enqueue_n(struct bmq *, struct bmq_msg *, unsigned long);
+struct bmq_msg	*bmq_dequeue_all(struct bmq *, int, unsigned long *);
+
+#endif	/* _BMQ_H */
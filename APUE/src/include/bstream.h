@@ -0,0 +1,54 @@
+/*
+ * Output streams with a per-stream buffer size and flush policy, and
+ * statistics on how they flush.  Goes with the stdio buffering of
+ * {Prog buf}.
+ */
+#ifndef	_BSTREAM_H
+#define	_BSTREAM_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define	BS_SIZE		0	/* flush when the buffer is full */
+#define	BS_LINE		1	/* ... or when a newline is written, like stdio */
+#define	BS_TIME		2	/* ... or when the oldest byte has waited long enough */
+#define	BS_EXPLICIT	3	/* only on bs_flush(); the buffer grows instead */
+
+struct bs_stats {
+	unsigned long		st_writes;	/* bs_write() and bs_printf() calls */
+	unsigned long		st_flushes;	/* write() and writev() calls */
+	unsigned long long	st_bytes;	/* bytes written */
+	size_t				st_maxflush;	/* most bytes in one flush */
+	unsigned long		st_full;	/* flushes because the buffer filled */
+	unsigned long		st_line;	/* ... because of a newline */
+	unsigned long		st_timer;	/* ... because data got old */
+	unsigned long		st_explicit;	/* ... because of bs_flush() */
+	unsigned long		st_direct;	/* large writes sent without copying */
+	long long			st_blocked;	/* ns spent in write() and writev() */
+};
+
+struct bstream {
+	pthread_mutex_t		 bs_lock;
+	int					 bs_fd;
+	int					 bs_policy;
+	long long			 bs_interval;	/* BS_TIME: ns */
+	char				*bs_buf;
+	size_t				 bs_size;
+	size_t				 bs_len;		/* bytes waiting */
+	long long			 bs_since;		/* when the oldest arrived */
+	int					 bs_err;		/* first write error, sticky */
+	struct bs_stats		 bs_stats;
+	struct bstream		*bs_next;		/* all open streams */
+};
+
+struct bstream	*bs_open(int, size_t, int, long long);	/* {Prog bstream} */
+int				 bs_write(struct bstream *, const void *, size_t);
+int				 bs_printf(struct bstream *, const char *, ...);
+int				 bs_flush(struct bstream *);
+long long		 bs_tick(void);
+void			 bs_getstats(struct bstream *, struct bs_stats *);
+int				 bs_close(struct bstream *);
+FILE			*bs_fdopen(struct bstream *);
+
+#endif	/* _BSTREAM_H */
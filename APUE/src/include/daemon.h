@@ -0,0 +1,51 @@
+/*
+ * Starting a daemon that tells whoever started it when it is ready to
+ * serve.  Extends daemonize() of {Prog daemoninit}.
+ */
+#ifndef	_DAEMON_H
+#define	_DAEMON_H
+
+#include <sys/types.h>
+
+#define	DMN_WAIT	0x01	/* the starting process exits when we're ready */
+#define	DMN_NOCHDIR	0x02	/* stay in the current directory */
+
+struct dmn_conf {
+	const char	*d_ident;		/* for syslog */
+	const char	*d_pidfile;		/* locked, holds our pid; NULL for none */
+	const char	*d_dir;			/* working directory; NULL for "/" */
+	int			 d_flags;		/* DMN_XXX */
+	int			 d_notifyfd;	/* supervisor's readiness descriptor, or -1 */
+};
+
+/*
+ * Defaults, to be overridden with -D when the daemon is compiled.
+ */
+#ifndef	DAEMON_DIR
+#define	DAEMON_DIR		"/"
+#endif
+#ifndef	DAEMON_PIDDIR
+#define	DAEMON_PIDDIR	"/var/run"
+#endif
+#ifndef	DAEMON_FLAGS
+#define	DAEMON_FLAGS	DMN_WAIT
+#endif
+#ifndef	DAEMON_NOTIFYFD
+#define	DAEMON_NOTIFYFD	(-1)
+#endif
+
+/*
+ * The compiled-in configuration for a daemon named by a string literal.
+ */
+#define	DMN_CONF(ident) \
+	{ ident, DAEMON_PIDDIR "/" ident ".pid", DAEMON_DIR, DAEMON_FLAGS, \
+	  DAEMON_NOTIFYFD }
+
+#ifndef	lockfile
+#define	lockfile(fd)	write_lock((fd), 0, SEEK_SET, 0)
+#endif
+
+int		daemon_start(const struct dmn_conf *);	/* {Prog daemoninit} */
+int		daemon_ready(void);
+
+#endif	/* _DAEMON_H */
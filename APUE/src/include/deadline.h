@@ -0,0 +1,21 @@
+/*
+ * Waiting until an absolute time on CLOCK_MONOTONIC, with the kernel's
+ * timer slack taken into account.  Underlies sleep_us() and sleep().
+ */
+#ifndef	_DEADLINE_H
+#define	_DEADLINE_H
+
+#include <time.h>
+
+#define	DL_SPIN		10000		/* default spin window, nanoseconds */
+
+void		 dl_after(struct timespec *, long long);	/* {Prog deadline} */
+void		 dl_advance(struct timespec *, long long);
+long long	 dl_remaining(const struct timespec *);
+int			 dl_sleep(const struct timespec *);
+void		 dl_wait(const struct timespec *);
+void		 dl_setspin(long long);
+int			 dl_setslack(unsigned long);
+unsigned long dl_getslack(void);
+
+#endif	/* _DEADLINE_H */
@@ -0,0 +1,13 @@
+/*
+ * Lock-free lookups in a snapshot of the environment, for threads that
+ * read it far more often than anyone changes it.
+ */
+#ifndef	_ENVCACHE_H
+#define	_ENVCACHE_H
+
+int		env_get(const char *, char *, int);			/* {Prog envcache} */
+int		env_set(const char *, const char *, int);
+int		env_unset(const char *);
+int		env_refresh(void);
+
+#endif	/* _ENVCACHE_H */
@@ -0,0 +1,21 @@
+/*
+ * File copy engine: picks the cheapest way the kernel offers to copy
+ * one regular file to another.
+ */
+#ifndef	_FCOPY_H
+#define	_FCOPY_H
+
+/*
+ * Strategies, in the order FCOPY_AUTO tries them.
+ */
+#define	FCOPY_AUTO		0
+#define	FCOPY_REFLINK	1	/* ioctl(FICLONE): share the blocks */
+#define	FCOPY_RANGE		2	/* copy_file_range(): copy inside the kernel */
+#define	FCOPY_SENDFILE	3	/* sendfile(): copy inside the kernel */
+#define	FCOPY_MMAP		4	/* threads, each pwrite()s from a mapped chunk */
+#define	FCOPY_RW		5	/* plain read() and write() */
+
+int			 fcopy(int, int, int, int);		/* {Prog fcopy} */
+const char	*fcopy_name(int);
+
+#endif	/* _FCOPY_H */
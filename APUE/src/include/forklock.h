@@ -0,0 +1,38 @@
+/*
+ * Locks that are safe across fork(): each is taken before the fork and
+ * released on both sides, in one global order.  Generalizes the
+ * pthread_atfork() handlers of {Prog atfork}.
+ */
+#ifndef	_FORKLOCK_H
+#define	_FORKLOCK_H
+
+#include <pthread.h>
+
+#define	FL_MUTEX	0		/* pthread_mutex_t */
+#define	FL_RWLOCK	1		/* pthread_rwlock_t, write locked; default attributes */
+#define	FL_SPIN		2		/* pthread_spinlock_t */
+
+/*
+ * Ranks: a lock may only be taken while holding locks of lower rank.
+ * Applications rank their locks from FL_RANK_USER, below the library's:
+ * a program may hold its own locks across calls into the library, say
+ * an ACL lookup through pwc_getpwnam() with a request lock held, but
+ * none of the library's locks is held across a call out of it.  The
+ * logger is taken while holding almost anything, so it comes last.
+ */
+#define	FL_RANK_USER	100		/* for applications: FL_RANK_USER + n */
+#define	FL_RANK_ENV		200		/* envcache */
+#define	FL_RANK_BSLIST	300		/* the list of bstreams */
+#define	FL_RANK_BSTREAM	310		/* one bstream */
+#define	FL_RANK_SPOPEN	400		/* spopen's pid table and output cache */
+#define	FL_RANK_PWC		410		/* pwcache's passwd and group indexes */
+#define	FL_RANK_RLHASH	500		/* rlock's descriptor hash */
+#define	FL_RANK_RLFILE	510		/* one rlock file */
+#define	FL_RANK_RLGRAPH	520		/* rlock's wait-for graph between threads */
+#define	FL_RANK_QUEUE	600		/* a bmq or dispatch; nothing is taken inside */
+#define	FL_RANK_ALOG	900		/* the asynchronous logger */
+
+int		fl_register(void *, int, int, void (*)(void));	/* {Prog forklock} */
+int		fl_unregister(void *);
+
+#endif	/* _FORKLOCK_H */
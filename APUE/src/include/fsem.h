@@ -0,0 +1,33 @@
+/*
+ * Process-shared semaphore and mutex that live in shared memory.
+ * Replaces the System V semaphore wrapper in lib/semaph.c.
+ */
+#ifndef	_FSEM_H
+#define	_FSEM_H
+
+#include <pthread.h>
+
+/*
+ * A counting semaphore.  The count itself is the futex word, so P and V
+ * are a single atomic operation when nobody has to sleep.
+ */
+struct fsem {
+	unsigned int	value;		/* units available */
+	unsigned int	nwait;		/* number of sleepers */
+};
+
+void	*psync_map(const char *, size_t, int *);	/* {Prog fsem} */
+void	 psync_ready(void *);
+int		 psync_unmap(void *, size_t);
+
+void	 fsem_init(struct fsem *, unsigned int);
+void	 fsem_wait(struct fsem *);					/* P */
+int		 fsem_trywait(struct fsem *);
+void	 fsem_post(struct fsem *);					/* V */
+void	 fsem_op(struct fsem *, int);
+
+int		 fmutex_init(pthread_mutex_t *);
+int		 fmutex_lock(pthread_mutex_t *);
+int		 fmutex_unlock(pthread_mutex_t *);
+
+#endif	/* _FSEM_H */
@@ -0,0 +1,47 @@
+/*
+ * Job dispatch: one queue per worker thread, keyed by thread ID.
+ * Replaces the single rwlock-protected job list of {Prog job_queue}.
+ */
+#ifndef	_JOBQ_H
+#define	_JOBQ_H
+
+#include <pthread.h>
+
+#define	JOBQ_CACHELINE	64
+
+struct job {
+	struct job	*j_next;
+	pthread_t	 j_id;		/* tells which thread handles this job */
+	/* ... more stuff here ... */
+};
+
+/*
+ * One worker's queue, on its own cache line.  The master pushes onto
+ * wq_head with compare-and-swap; the worker takes the whole list at once.
+ */
+struct workq {
+	struct job		*wq_head;	/* newest first */
+	pthread_t		 wq_tid;	/* owning worker */
+	unsigned int	 wq_seq;	/* futex word; bumped to wake the worker */
+	unsigned int	 wq_sleep;	/* worker is (about to be) asleep */
+	char			 wq_pad[JOBQ_CACHELINE - sizeof(struct job *) -
+					   sizeof(pthread_t) - 2 * sizeof(unsigned int)];
+};
+
+struct dispatch {
+	struct workq	*d_queues;	/* d_max of them */
+	int				*d_hash;	/* thread ID -> queue index + 1 */
+	unsigned int	 d_hashmask;
+	int				 d_max;
+	int				 d_nworkers;
+	pthread_mutex_t	 d_lock;	/* serializes dispatch_register() */
+};
+
+int			 dispatch_init(struct dispatch *, int);		/* {Prog jobq} */
+void		 dispatch_destroy(struct dispatch *);
+struct workq *dispatch_register(struct dispatch *, pthread_t);
+struct workq *dispatch_find(struct dispatch *, pthread_t);
+int			 job_dispatch(struct dispatch *, struct job *);
+struct job	*job_takeall(struct workq *, int);
+
+#endif	/* _JOBQ_H */
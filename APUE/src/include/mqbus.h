@@ -0,0 +1,40 @@
+/*
+ * Fan-in from several POSIX message queues, polled directly and drained
+ * in batches.  Replaces the helper threads and socketpairs of {Prog 17-3}.
+ */
+#ifndef	_MQBUS_H
+#define	_MQBUS_H
+
+#include <mqueue.h>
+#include <poll.h>
+
+/*
+ * One received message.  m_data points into the bus's buffer and stays
+ * valid until the next mqb_recv().
+ */
+struct mqb_msg {
+	int				 m_queue;	/* index of the queue it came from */
+	unsigned int	 m_prio;
+	size_t			 m_len;
+	char			*m_data;
+};
+
+struct mqbus {
+	int				 b_nq;		/* number of queues */
+	int				 b_batch;	/* most messages per queue per call */
+	long			 b_msgsz;	/* largest mq_msgsize of the queues */
+	mqd_t			*b_mq;
+	struct pollfd	*b_pfd;
+	char			*b_ready;	/* queue may still hold messages */
+	char			*b_buf;		/* b_nq * b_batch * b_msgsz bytes */
+	struct mqb_msg	*b_msgs;	/* b_nq * b_batch entries */
+	unsigned long	 b_npoll;	/* poll() calls */
+	unsigned long	 b_nrecv;	/* mq_receive() calls, EAGAIN included */
+	unsigned long	 b_nmsg;	/* messages received */
+};
+
+struct mqbus	*mqb_open(const char *const [], int, long, long, int);	/* {Prog mqbus} */
+int				 mqb_recv(struct mqbus *, int, struct mqb_msg **);
+void			 mqb_close(struct mqbus *);
+
+#endif	/* _MQBUS_H */
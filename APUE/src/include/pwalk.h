@@ -0,0 +1,46 @@
+/*
+ * Parallel file tree walk, for the file type statistics of {Prog ftw8}
+ * on trees too big to walk with one thread.
+ */
+#ifndef	_PWALK_H
+#define	_PWALK_H
+
+#include <sys/stat.h>
+
+#define	PW_F	1		/* file other than a directory */
+#define	PW_D	2		/* directory */
+#define	PW_DNR	3		/* directory that can't be read */
+#define	PW_NS	4		/* file that we can't stat */
+
+#define	PW_STAT	0x01	/* always fstatat(), even if d_type tells the type */
+
+#define	PW_SKIP	(-1)	/* from a PW_D callback: don't descend */
+
+/*
+ * What the callback is told about each file.  The file is "name" in the
+ * directory open on "dirfd"; there are no full pathnames.  For the root,
+ * dirfd is AT_FDCWD and name is the pathname given to pwalk().
+ */
+struct pw_ent {
+	int					 pe_dirfd;
+	const char			*pe_name;
+	int					 pe_type;	/* PW_XXX */
+	mode_t				 pe_mode;	/* S_IFMT bits; 0 if unknown (PW_NS) */
+	const struct stat	*pe_stat;	/* NULL if we didn't need to stat */
+	int					 pe_depth;	/* 0 for the root */
+	int					 pe_thread;	/* 0 .. nthreads-1, for per-thread data */
+	void				*pe_pdata;	/* what the parent's PW_D callback left */
+	void			   **pe_data;	/* PW_D only: for the children's pe_pdata */
+	void				*pe_priv;	/* PW_D only: for pwalk_queue() */
+};
+
+/*
+ * Called once for every file, from nthreads threads at once.  Return 0
+ * to go on, PW_SKIP (for PW_D) to prune, or anything else to stop.
+ */
+typedef int	Pwfunc(const struct pw_ent *, void *);
+
+int		pwalk(const char *, int, int, Pwfunc *, void *);	/* {Prog pwalk} */
+int		pwalk_queue(const struct pw_ent *, const char *);	/* {Prog pwalk} */
+
+#endif	/* _PWALK_H */
@@ -0,0 +1,17 @@
+/*
+ * Indexed lookups in /etc/passwd and /etc/group, for programs that look
+ * users and groups up on every request.
+ */
+#ifndef	_PWCACHE_H
+#define	_PWCACHE_H
+
+#include <grp.h>
+#include <pwd.h>
+#include <sys/types.h>
+
+int		pwc_getpwnam(const char *, struct passwd *, char *, size_t);	/* {Prog pwcache} */
+int		pwc_getpwuid(uid_t, struct passwd *, char *, size_t);
+int		pwc_getgrnam(const char *, struct group *, char *, size_t);
+int		pwc_getgrgid(gid_t, struct group *, char *, size_t);
+
+#endif	/* _PWCACHE_H */
@@ -0,0 +1,31 @@
+/*
+ * Byte-range locks arbitrated inside the process, with open file
+ * description locks between processes and deadlock detection.
+ */
+#ifndef	_RLOCK_H
+#define	_RLOCK_H
+
+#include <sys/types.h>
+
+#define	RL_WAIT		0x01		/* wait for the lock instead of EAGAIN */
+
+/*
+ * Totals over all threads since the process started.
+ */
+struct rl_stats {
+	long	rs_lock;		/* rl_lock() calls */
+	long	rs_local;		/* granted without a system call */
+	long	rs_syscall;		/* fcntl()s we made */
+	long	rs_wait;		/* waits for another thread */
+	long	rs_kwait;		/* waits for another process */
+	long	rs_deadlock;	/* EDEADLK returns */
+	long	rs_unlock;		/* rl_unlock() calls */
+};
+
+int		rl_init(const char *);						/* {Prog rlock} */
+int		rl_lock(int, int, off_t, off_t, int);
+int		rl_unlock(int, off_t, off_t);
+int		rl_close(int);
+void	rl_getstats(struct rl_stats *);
+
+#endif	/* _RLOCK_H */
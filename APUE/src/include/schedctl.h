@@ -0,0 +1,24 @@
+/*
+ * Where and how threads run: CPU affinity from CPU lists, NUMA nodes and
+ * interrupt load, and scheduling classes.  Goes with the nice
+ * experiment of {Prog nice}.
+ */
+#ifndef	_SCHEDCTL_H
+#define	_SCHEDCTL_H
+
+#include <sched.h>
+#include <sys/types.h>
+
+#define	SC_IRQPCT	25		/* a CPU taking this % of device interrupts is busy */
+
+int		sc_parsecpus(const char *, cpu_set_t *);		/* {Prog schedctl} */
+char	*sc_fmtcpus(const cpu_set_t *, char *, size_t);
+int		sc_nodecpus(int, cpu_set_t *);
+int		sc_irqcpus(int, cpu_set_t *);
+int		sc_quietcpus(cpu_set_t *);
+int		sc_pin(pid_t, const cpu_set_t *);
+int		sc_setclass(pid_t, int, int);
+int		sc_apply(pid_t, const char *);
+char	*sc_describe(pid_t, char *, size_t);
+
+#endif	/* _SCHEDCTL_H */
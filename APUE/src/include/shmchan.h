@@ -0,0 +1,36 @@
+/*
+ * Single-producer, single-consumer message channel in shared memory,
+ * for parent/child or peer-to-peer IPC without a system call per message.
+ */
+#ifndef	_SHMCHAN_H
+#define	_SHMCHAN_H
+
+#define	CHAN_CACHELINE	64
+
+/*
+ * Lives at the front of the shared mapping, followed by the slots.
+ * head and tail are free-running counters and double as futex words;
+ * each sits on its own cache line so the two sides don't false-share.
+ */
+struct shmchan {
+	unsigned int	head;		/* next slot to fill; producer writes */
+	unsigned int	rsleep;		/* consumer is (about to be) asleep */
+	unsigned int	wspin;		/* producer's current spin budget */
+	char			pad1[CHAN_CACHELINE - 3 * sizeof(unsigned int)];
+	unsigned int	tail;		/* next slot to drain; consumer writes */
+	unsigned int	wsleep;		/* producer is (about to be) asleep */
+	unsigned int	rspin;		/* consumer's current spin budget */
+	char			pad2[CHAN_CACHELINE - 3 * sizeof(unsigned int)];
+	unsigned int	nslots;		/* power of 2 */
+	unsigned int	msgsz;		/* bytes per slot */
+	char			pad3[CHAN_CACHELINE - 2 * sizeof(unsigned int)];
+};
+
+struct shmchan	*chan_open(const char *, unsigned int, unsigned int);	/* {Prog shmchan} */
+int				 chan_close(struct shmchan *);
+int				 chan_send(struct shmchan *, const void *);
+int				 chan_trysend(struct shmchan *, const void *);
+int				 chan_recv(struct shmchan *, void *);
+int				 chan_tryrecv(struct shmchan *, void *);
+
+#endif	/* _SHMCHAN_H */
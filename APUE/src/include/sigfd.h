@@ -0,0 +1,29 @@
+/*
+ * Signals delivered through a descriptor, for event loops: the handlers
+ * run from the loop, not in signal context.
+ */
+#ifndef	_SIGFD_H
+#define	_SIGFD_H
+
+#include <signal.h>
+#include <sys/signalfd.h>
+
+/*
+ * Called once per dispatch for each signal that arrived, however many
+ * times it did; si is the last one.
+ */
+typedef	void	Sigfdfunc(int, int, const struct signalfd_siginfo *, void *);
+
+/*
+ * Called for each child reaped; si is filled in by waitid().
+ */
+typedef	void	Childfunc(const siginfo_t *, void *);
+
+int		sigfd_open(void);							/* {Prog sigfd} */
+int		sigfd_handle(int, Sigfdfunc *, void *);
+int		sigfd_children(Childfunc *, void *);
+int		sigfd_watch(pid_t);
+int		sigfd_dispatch(void);
+void	sigfd_close(void);
+
+#endif	/* _SIGFD_H */
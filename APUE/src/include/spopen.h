@@ -0,0 +1,33 @@
+/*
+ * popen() without fork(): children started with posix_spawn(), watched
+ * through a pidfd, with an optional cache for commands whose output we
+ * can reuse for a while.
+ */
+#ifndef	_SPOPEN_H
+#define	_SPOPEN_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * A child started by sp_start().  For an event loop, wait for sp_fd to
+ * be readable (or writable) and for sp_pidfd to be readable, which it
+ * becomes when the child exits; then call sp_reap().
+ */
+struct spproc {
+	pid_t	sp_pid;
+	int		sp_pidfd;		/* -1 if the kernel has no pidfd_open() */
+	int		sp_fd;			/* our end of the pipe, nonblocking */
+	int		sp_status;		/* from waitpid(), once reaped */
+};
+
+int		sp_start(struct spproc *, const char *, const char *);	/* {Prog spopen} */
+int		sp_reap(struct spproc *, int);
+FILE	*spopen(const char *, const char *);
+int		 spclose(FILE *);
+
+ssize_t	sp_cached(const char *, long, char *, size_t);
+ssize_t	sp_cache_get(const char *, long, char *, size_t);
+void	sp_cache_put(const char *, const char *, size_t);
+
+#endif	/* _SPOPEN_H */
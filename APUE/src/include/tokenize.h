@@ -0,0 +1,21 @@
+/*
+ * Reentrant splitting of a line into arguments, in place.
+ * Replaces the strtok() loop of {Prog bufargs}.
+ */
+#ifndef	_TOKENIZE_H
+#define	_TOKENIZE_H
+
+#include <stddef.h>
+
+/*
+ * One argument: a view into the caller's buffer, which tok_split() has
+ * unquoted and null terminated in place.
+ */
+struct tok {
+	char	*t_ptr;
+	size_t	 t_len;
+};
+
+int		tok_split(char *, size_t, struct tok *, int);	/* {Prog tokenize} */
+
+#endif	/* _TOKENIZE_H */
@@ -0,0 +1,106 @@
+/*
+ * Request/reply messaging over UNIX domain sockets, on top of
+ * serv_listen(), serv_accept() and cli_conn().
+ */
+#ifndef	_URPC_H
+#define	_URPC_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define	URPC_INLINE	16384		/* larger payloads travel in a memfd */
+
+/*
+ * On the wire each message is a header followed by h_len bytes of
+ * payload, unless URPC_FD is set: then the payload is in a memfd that
+ * travels with the header as SCM_RIGHTS.
+ */
+struct urpc_hdr {
+	uint64_t	h_id;		/* correlation id, echoed by the reply */
+	uint64_t	h_len;		/* bytes of payload */
+	uint32_t	h_op;		/* procedure number */
+	uint32_t	h_flags;
+	int32_t		h_status;	/* replies: 0 or an error number */
+	uint32_t	h_pad;
+};
+
+#define	URPC_FD		0x1
+
+/*
+ * A message as the caller sees it.  For a received message m_data points
+ * into the connection's buffer, valid until the next urpc_recv(), or
+ * urpc_send() or urpc_flush() on a blocking socket, or, if
+ * m_fd isn't -1, at a mapping of the memfd; urpc_release() frees that.
+ */
+struct urpc_msg {
+	uint64_t	 m_id;		/* 0 on send: assign the next id */
+	uint32_t	 m_op;
+	int32_t		 m_status;
+	void		*m_data;
+	size_t		 m_len;
+	int			 m_fd;		/* memfd holding the payload, or -1 */
+};
+
+struct urpc_wfd {
+	uint64_t	 w_pos;		/* where its frame starts in the output */
+	int			 w_fd;
+};
+
+struct urpc_conn {
+	int				 c_fd;
+	int				 c_type;	/* SOCK_STREAM or SOCK_SEQPACKET */
+	uid_t			 c_uid;		/* server side: the client's user ID */
+	uint64_t		 c_nextid;
+	char			*c_rbuf;	/* input; c_rbeg to c_rend not yet parsed */
+	size_t			 c_rsize, c_rbeg, c_rend;
+	size_t			 c_rneed;	/* bytes the next frame needs */
+	char			*c_wbuf;	/* output; c_wbeg to c_wend not yet sent */
+	size_t			 c_wsize, c_wbeg, c_wend;
+	uint64_t		 c_wsent;	/* bytes ever sent */
+	int				*c_rfds;	/* descriptors received, not yet claimed */
+	int				 c_nrfd, c_maxrfd;
+	struct urpc_wfd	*c_wfds;	/* descriptors to send, in frame order */
+	int				 c_nwfd, c_maxwfd;
+	int				 c_events;	/* server side: what epoll watches */
+	struct urpc_conn *c_next;	/* server side: all connections */
+};
+
+/*
+ * Called by the server for each request; replies with urpc_reply(),
+ * now or never.  The request is released when it returns.
+ */
+typedef	void	Urpcfunc(struct urpc_conn *, struct urpc_msg *, void *);
+
+struct urpc_server {
+	int				 s_lfd;		/* listening socket */
+	int				 s_epfd;
+	int				 s_type;	/* SOCK_STREAM or SOCK_SEQPACKET */
+	Urpcfunc		*s_func;
+	void			*s_arg;
+	volatile int	 s_stop;
+	int				 s_full;	/* out of descriptors: not accepting */
+	struct urpc_conn *s_conns;
+	unsigned long	 s_nconn;	/* connections open */
+	unsigned long	 s_ncall;	/* requests handled */
+	unsigned long	 s_nwake;	/* epoll_wait() returns */
+};
+
+struct urpc_conn	*urpc_connect(const char *, int);	/* {Prog urpc} */
+void				 urpc_close(struct urpc_conn *);
+int					 urpc_send(struct urpc_conn *, struct urpc_msg *);
+int					 urpc_flush(struct urpc_conn *);
+int					 urpc_recv(struct urpc_conn *, struct urpc_msg *);
+int					 urpc_call(struct urpc_conn *, struct urpc_msg *,
+					   struct urpc_msg *);
+int					 urpc_memfd(size_t, void **);
+void				 urpc_release(struct urpc_msg *);
+
+struct urpc_server	*urpc_listen(const char *, int, Urpcfunc *, void *);
+int					 urpc_run(struct urpc_server *);
+void				 urpc_stop(struct urpc_server *);
+void				 urpc_shutdown(struct urpc_server *);
+int					 urpc_reply(struct urpc_conn *, const struct urpc_msg *,
+					   int, const void *, size_t);
+
+#endif	/* _URPC_H */
@@ -0,0 +1,448 @@
+/*
+ * Asynchronous back end for the err_XXX and log_XXX routines.
+ *
+ * Every thread that logs gets its own byte ring.  The thread formats
+ * its message on its own stack and copies it into the ring; there is no
+ * lock and no system call on this path, only a pair of atomic loads and
+ * one release store.  A single background thread collects whatever is
+ * pending in all the rings and hands it to the kernel with one writev()
+ * per pass, so a slow terminal or disk can no longer stall the threads
+ * doing real work.  log_XXX messages bound for syslog() go to a second
+ * ring per thread, each record carrying its priority, and the flusher
+ * calls syslog() for them, so a stalled syslogd stalls only the flusher.
+ *
+ * The arguments are still formatted by the caller, since a va_list
+ * can't be kept for later, but straight into the ring when there's room;
+ * that vsnprintf() is most of what a call costs.  A message with no
+ * conversions is just copied.  13/alog-bench.c measures the cost.
+ *
+ * Each ring has exactly one producer (its thread) and one consumer (the
+ * flusher), so head and tail need no compare-and-swap.  If a ring fills
+ * up faster than it can be drained, alog_doit() says so and the caller
+ * writes that message synchronously, the way it always used to.
+ *
+ *	alog_open(fd);		# start the flusher, writing to fd
+ *	alog_flush();		# synchronously write out everything pending
+ *	alog_close();		# drain, stop the flusher (also run at exit)
+ *
+ * alog_lock is registered with {Prog forklock}, so a fork() never copies
+ * it held by the flusher.  The flusher isn't copied either: the child
+ * logs synchronously until it calls alog_open() itself, and leaves what
+ * the parent's threads had queued for the parent to write.
+ */
+
+#include "apue.h"
+#include "forklock.h"
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#define	ALOG_RINGSZ		(64 * 1024)	/* bytes per thread, power of 2 */
+#define	ALOG_SYSRINGSZ	(16 * 1024)	/* same, for syslog() records */
+#define	ALOG_PERIOD_NS	10000000L	/* flusher wakes at least every 10 ms */
+#define	ALOG_CACHELINE	64
+
+#ifndef	IOV_MAX
+#define	IOV_MAX	1024
+#endif
+
+struct alog_ring {
+	unsigned long		 head;		/* next byte producer writes */
+	char				 pad1[ALOG_CACHELINE - sizeof(unsigned long)];
+	unsigned long		 tail;		/* next byte flusher writes out */
+	char				 pad2[ALOG_CACHELINE - sizeof(unsigned long)];
+	unsigned long		 shead;		/* the same for sbuf */
+	char				 pad3[ALOG_CACHELINE - sizeof(unsigned long)];
+	unsigned long		 stail;
+	char				 pad4[ALOG_CACHELINE - sizeof(unsigned long)];
+	int					 dead;		/* owning thread has exited */
+	struct alog_ring	*next;
+	char				 buf[ALOG_RINGSZ];
+	char				 sbuf[ALOG_SYSRINGSZ];	/* alog_rec, text, ... */
+};
+
+/*
+ * Each message in sbuf is one of these followed by r_len bytes of text.
+ */
+struct alog_rec {
+	int					 r_pri;		/* for syslog() */
+	unsigned int		 r_len;
+};
+
+static int					 alog_fd = -1;
+static int					 alog_running;
+static int					 alog_stop;
+static pthread_t			 alog_tid;
+static struct alog_ring		*alog_rings;	/* list of all rings */
+static pthread_mutex_t		 alog_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		 alog_cond = PTHREAD_COND_INITIALIZER;
+static pthread_key_t		 alog_key;
+static pthread_once_t		 alog_once = PTHREAD_ONCE_INIT;
+static __thread struct alog_ring	*alog_mine;
+
+/*
+ * Thread exit: the flusher frees the ring once it has been drained.
+ */
+static void
+alog_thread_exit(void *arg)
+{
+	struct alog_ring	*rp = arg;
+
+	__atomic_store_n(&rp->dead, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * In the child of a fork(): only the forking thread and its ring are
+ * left, and no flusher.
+ */
+static void
+alog_child(void)
+{
+	struct alog_ring	*rp;
+
+	alog_running = 0;
+	pthread_cond_init(&alog_cond, NULL);	/* the flusher waited on it */
+	for (rp = alog_rings; rp != NULL; rp = rp->next) {
+		rp->tail = rp->head;
+		rp->stail = rp->shead;
+		if (rp != alog_mine)
+			rp->dead = 1;
+	}
+}
+
+static void
+alog_init(void)
+{
+	pthread_key_create(&alog_key, alog_thread_exit);
+	fl_register(&alog_lock, FL_MUTEX, FL_RANK_ALOG, alog_child);
+	atexit(alog_close);
+}
+
+/*
+ * Find or create the calling thread's ring.
+ */
+static struct alog_ring *
+alog_ring(void)
+{
+	struct alog_ring	*rp;
+
+	if ((rp = alog_mine) != NULL)
+		return(rp);
+	if ((rp = calloc(1, sizeof(struct alog_ring))) == NULL)
+		return(NULL);
+	pthread_setspecific(alog_key, rp);
+	pthread_mutex_lock(&alog_lock);
+	rp->next = alog_rings;
+	alog_rings = rp;
+	pthread_mutex_unlock(&alog_lock);
+	alog_mine = rp;
+	return(rp);
+}
+
+/*
+ * Copy n bytes in at h, or out from t, of a ring of size bytes.
+ */
+static inline void
+alog_put(char *ring, unsigned long size, unsigned long h, const void *p,
+  unsigned long n)
+{
+	unsigned long	off;
+
+	off = h & (size - 1);
+	if (off + n > size) {
+		memcpy(ring + off, p, size - off);
+		memcpy(ring, (const char *)p + (size - off), n - (size - off));
+	} else {
+		memcpy(ring + off, p, n);
+	}
+}
+
+static void
+alog_get(const char *ring, unsigned long size, unsigned long t, void *p,
+  unsigned long n)
+{
+	unsigned long	off;
+
+	off = t & (size - 1);
+	if (off + n > size) {
+		memcpy(p, ring + off, size - off);
+		memcpy((char *)p + (size - off), ring, n - (size - off));
+	} else {
+		memcpy(p, ring + off, n);
+	}
+}
+
+/*
+ * Hand the syslog() records pending in a ring to syslog().
+ */
+static void
+alog_syslog(struct alog_ring *rp)
+{
+	unsigned long	h, t;
+	struct alog_rec	rec;
+	char			buf[MAXLINE];
+
+	h = __atomic_load_n(&rp->shead, __ATOMIC_ACQUIRE);
+	for (t = rp->stail; t != h; t += sizeof(rec) + rec.r_len) {
+		alog_get(rp->sbuf, ALOG_SYSRINGSZ, t, &rec, sizeof(rec));
+		alog_get(rp->sbuf, ALOG_SYSRINGSZ, t + sizeof(rec), buf, rec.r_len);
+		buf[rec.r_len] = 0;
+		syslog(rec.r_pri, "%s", buf);
+	}
+	__atomic_store_n(&rp->stail, t, __ATOMIC_RELEASE);
+}
+
+/*
+ * Write out everything pending in every ring.  Caller must hold
+ * alog_lock, which serializes consumers (the flusher and alog_flush).
+ */
+static void
+alog_drain(void)
+{
+	struct iovec		 iov[IOV_MAX];
+	struct alog_ring	*rp, **rpp;
+	unsigned long		 head[IOV_MAX];
+	struct alog_ring	*which[IOV_MAX];
+	unsigned long		 h, t, off, n;
+	int					 i, niov, nring, more;
+	ssize_t				 nw;
+
+	for (rp = alog_rings; rp != NULL; rp = rp->next)
+		if (rp->stail != __atomic_load_n(&rp->shead, __ATOMIC_ACQUIRE))
+			alog_syslog(rp);
+again:
+	niov = nring = 0;
+	for (rp = alog_rings; rp != NULL && niov + 2 <= IOV_MAX - 1;
+	  rp = rp->next) {
+		h = __atomic_load_n(&rp->head, __ATOMIC_ACQUIRE);
+		t = rp->tail;
+		if (h == t)
+			continue;
+		off = t & (ALOG_RINGSZ - 1);
+		n = h - t;
+		if (off + n > ALOG_RINGSZ) {	/* wraps: two pieces */
+			iov[niov].iov_base = rp->buf + off;
+			iov[niov++].iov_len = ALOG_RINGSZ - off;
+			iov[niov].iov_base = rp->buf;
+			iov[niov++].iov_len = n - (ALOG_RINGSZ - off);
+		} else {
+			iov[niov].iov_base = rp->buf + off;
+			iov[niov++].iov_len = n;
+		}
+		head[nring] = h;
+		which[nring++] = rp;
+	}
+	more = (rp != NULL);
+
+	/*
+	 * One writev() for the whole batch; pick up where a short
+	 * write left off.
+	 */
+	i = 0;
+	while (i < niov) {
+		if ((nw = writev(alog_fd, &iov[i], niov - i)) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;		/* nowhere to report it; discard the batch */
+		}
+		while (i < niov && (size_t)nw >= iov[i].iov_len)
+			nw -= iov[i++].iov_len;
+		if (i < niov) {
+			iov[i].iov_base = (char *)iov[i].iov_base + nw;
+			iov[i].iov_len -= nw;
+		}
+	}
+	for (i = 0; i < nring; i++)
+		__atomic_store_n(&which[i]->tail, head[i], __ATOMIC_RELEASE);
+
+	/*
+	 * Free the rings of threads that have exited, now that they're empty.
+	 */
+	for (rpp = &alog_rings; (rp = *rpp) != NULL; ) {
+		if (__atomic_load_n(&rp->dead, __ATOMIC_ACQUIRE) &&
+		  __atomic_load_n(&rp->head, __ATOMIC_ACQUIRE) == rp->tail &&
+		  __atomic_load_n(&rp->shead, __ATOMIC_ACQUIRE) == rp->stail) {
+			*rpp = rp->next;
+			free(rp);
+		} else {
+			rpp = &rp->next;
+		}
+	}
+	if (more)
+		goto again;		/* ran out of iovecs; more rings to go */
+}
+
+static void *
+alog_flusher(void *arg)
+{
+	struct timespec	ts;
+
+	(void)arg;
+	pthread_mutex_lock(&alog_lock);
+	while (!alog_stop) {
+		alog_drain();
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += ALOG_PERIOD_NS;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&alog_cond, &alog_lock, &ts);
+	}
+	alog_drain();
+	pthread_mutex_unlock(&alog_lock);
+	return(0);
+}
+
+/*
+ * Start the background flusher, writing to fd.
+ * Returns 0 if OK, else an error number.
+ */
+int
+alog_open(int fd)
+{
+	int		err;
+
+	pthread_once(&alog_once, alog_init);
+	if (alog_running)
+		return(EBUSY);
+	alog_fd = fd;
+	alog_stop = 0;
+	if ((err = pthread_create(&alog_tid, NULL, alog_flusher, NULL)) != 0)
+		return(err);
+	__atomic_store_n(&alog_running, 1, __ATOMIC_RELEASE);
+	return(0);
+}
+
+/*
+ * Nonzero if messages are being routed through the flusher.
+ */
+int
+alog_active(void)
+{
+	return(__atomic_load_n(&alog_running, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Write out everything logged so far before returning.
+ * Used before abort(), and by anyone who must know the data is out.
+ */
+void
+alog_flush(void)
+{
+	if (!alog_active())
+		return;
+	pthread_mutex_lock(&alog_lock);
+	alog_drain();
+	pthread_mutex_unlock(&alog_lock);
+}
+
+/*
+ * Drain the rings and stop the flusher.  Registered with atexit(),
+ * so the fatal err_XXX and log_XXX routines don't lose their message.
+ */
+void
+alog_close(void)
+{
+	if (!alog_active())
+		return;
+	__atomic_store_n(&alog_running, 0, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&alog_lock);
+	alog_stop = 1;
+	pthread_cond_signal(&alog_cond);
+	pthread_mutex_unlock(&alog_lock);
+	if (pthread_equal(pthread_self(), alog_tid) == 0)
+		pthread_join(alog_tid, NULL);
+	pthread_mutex_lock(&alog_lock);
+	alog_drain();		/* anything logged while we were stopping */
+	pthread_mutex_unlock(&alog_lock);
+}
+
+/*
+ * Format a message the way err_doit() and log_doit() do and queue it
+ * on the calling thread's ring: for syslog() with priority, or for the
+ * descriptor if priority is -1.  Returns -1 if the message could not be
+ * queued (no ring, or the ring is full), else 0.
+ */
+int
+alog_doit(int priority, int errnoflag, int error, const char *fmt,
+  va_list ap)
+{
+	struct alog_ring	*rp;
+	struct alog_rec		 rec;
+	char				 buf[MAXLINE];
+	char				*ring, *p;
+	unsigned long		 h, t, n, size, hdr, off, *headp, *tailp;
+	int					 len;
+
+	if ((rp = alog_ring()) == NULL)
+		return(-1);
+	if (priority >= 0) {
+		ring = rp->sbuf;
+		size = ALOG_SYSRINGSZ;
+		headp = &rp->shead;
+		tailp = &rp->stail;
+		hdr = sizeof(rec);
+	} else {
+		ring = rp->buf;
+		size = ALOG_RINGSZ;
+		headp = &rp->head;
+		tailp = &rp->tail;
+		hdr = 0;
+	}
+	h = *headp;			/* only we write head */
+	t = __atomic_load_n(tailp, __ATOMIC_ACQUIRE);
+
+	/*
+	 * Format straight into the ring if the longest message would fit
+	 * there without wrapping, else on the stack and copy it in.
+	 */
+	off = (h + hdr) & (size - 1);
+	if (off + MAXLINE <= size && size - (h - t) >= hdr + MAXLINE)
+		p = ring + off;
+	else
+		p = buf;
+	if (strchr(fmt, '%') == NULL) {
+		len = strlen(fmt);
+		if (len > MAXLINE-2)
+			len = MAXLINE-2;
+		memcpy(p, fmt, len);
+	} else if ((len = vsnprintf(p, MAXLINE-1, fmt, ap)) < 0) {
+		return(-1);
+	} else if (len > MAXLINE-2) {
+		len = MAXLINE-2;
+	}
+	if (errnoflag) {
+		len += snprintf(p+len, MAXLINE-len-1, ": %s", strerror(error));
+		if (len > MAXLINE-2)
+			len = MAXLINE-2;
+	}
+	p[len++] = '\n';
+	n = len;
+
+	if (size - (h - t) < hdr + n) {
+		pthread_cond_signal(&alog_cond);
+		return(-1);
+	}
+	if (hdr != 0) {
+		rec.r_pri = priority;
+		rec.r_len = n;
+		alog_put(ring, size, h, &rec, hdr);
+	}
+	if (p == buf)
+		alog_put(ring, size, h + hdr, buf, n);
+	n += hdr;
+	__atomic_store_n(headp, h + n, __ATOMIC_RELEASE);
+
+	/*
+	 * Nudge the flusher early if the ring is getting full; otherwise
+	 * it picks the message up on its next periodic pass.
+	 */
+	if (h + n - t > size / 2)
+		pthread_cond_signal(&alog_cond);
+	return(0);
+}
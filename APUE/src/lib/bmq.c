@@ -0,0 +1,193 @@
+/*
+ * A bounded FIFO message queue with batch operations.
+ *
+ * The work queue of {Prog condvar} is a stack: enqueue_msg() pushes one
+ * message and signals one waiter, process_msg() pops one message per
+ * lock acquisition.  Messages come out newest first, every message costs
+ * a lock round trip on each side, and nothing stops producers from
+ * running arbitrarily far ahead of the consumers.
+ *
+ * Here producers push onto a lock-free list with compare-and-swap, a whole
+ * pre-linked batch at a time if they like (bmq_enqueue_n()).  A consumer
+ * takes everything queued with one atomic exchange (bmq_dequeue_all())
+ * and turns it back into arrival order, so the queue is FIFO.  The queue
+ * holds at most "cap" messages: a producer reserves room in q_count before
+ * pushing and waits while the queue is full.
+ *
+ * The mutex and condition variables are only for sleeping.  A side that
+ * must wait says so in q_pwait or q_cwait before its final check; the
+ * other side only takes the mutex to wake it when that count is nonzero,
+ * so a queue that is neither full nor empty never locks at all.  q_nfull
+ * and q_nempty count how often each side had to sleep.
+ */
+
+#include "apue.h"
+#include "bmq.h"
+#include "forklock.h"
+#include <errno.h>
+
+/*
+ * Initialize a queue that holds at most cap messages.
+ * Returns 0 if OK, else an error number.
+ */
+int
+bmq_init(struct bmq *qp, unsigned long cap)
+{
+	int		err;
+
+	if (cap == 0)
+		return(EINVAL);
+	memset(qp, 0, sizeof(struct bmq));
+	qp->q_cap = cap;
+	if ((err = pthread_mutex_init(&qp->q_lock, NULL)) != 0)
+		return(err);
+	if ((err = pthread_cond_init(&qp->q_notfull, NULL)) != 0) {
+		pthread_mutex_destroy(&qp->q_lock);
+		return(err);
+	}
+	if ((err = pthread_cond_init(&qp->q_notempty, NULL)) != 0) {
+		pthread_cond_destroy(&qp->q_notfull);
+		pthread_mutex_destroy(&qp->q_lock);
+		return(err);
+	}
+	if (fl_register(&qp->q_lock, FL_MUTEX, FL_RANK_QUEUE, NULL) < 0) {
+		err = errno;
+		pthread_cond_destroy(&qp->q_notempty);
+		pthread_cond_destroy(&qp->q_notfull);
+		pthread_mutex_destroy(&qp->q_lock);
+		return(err);
+	}
+	return(0);
+}
+
+void
+bmq_destroy(struct bmq *qp)
+{
+	fl_unregister(&qp->q_lock);
+	pthread_cond_destroy(&qp->q_notempty);
+	pthread_cond_destroy(&qp->q_notfull);
+	pthread_mutex_destroy(&qp->q_lock);
+}
+
+/*
+ * Wake everyone sleeping on cond if *nwaitp says anyone is.
+ */
+static void
+bmq_wake(struct bmq *qp, unsigned int *nwaitp, pthread_cond_t *cond)
+{
+	if (__atomic_load_n(nwaitp, __ATOMIC_SEQ_CST) != 0) {
+		pthread_mutex_lock(&qp->q_lock);
+		pthread_cond_broadcast(cond);
+		pthread_mutex_unlock(&qp->q_lock);
+	}
+}
+
+/*
+ * Reserve room for n messages, waiting while the queue is too full.
+ * A batch bigger than the whole queue is let into an empty queue, so
+ * that it can't wait forever.
+ */
+static void
+bmq_reserve(struct bmq *qp, unsigned long n)
+{
+	unsigned long	c;
+
+	c = __atomic_load_n(&qp->q_count, __ATOMIC_RELAXED);
+	for (;;) {
+		if (c + n <= qp->q_cap || c == 0) {
+			if (__atomic_compare_exchange_n(&qp->q_count, &c, c + n, 1,
+			  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+				return;
+			continue;	/* c was reloaded for us */
+		}
+		pthread_mutex_lock(&qp->q_lock);
+		__atomic_fetch_add(&qp->q_pwait, 1, __ATOMIC_SEQ_CST);
+		qp->q_nfull++;
+		while ((c = __atomic_load_n(&qp->q_count, __ATOMIC_SEQ_CST)) + n >
+		  qp->q_cap && c != 0)
+			pthread_cond_wait(&qp->q_notfull, &qp->q_lock);
+		__atomic_fetch_sub(&qp->q_pwait, 1, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&qp->q_lock);
+	}
+}
+
+/*
+ * Add a list of n messages, linked through m_next and oldest first,
+ * to the end of the queue.  The batch stays together and in order.
+ * Waits while there isn't room.
+ */
+void
+bmq_enqueue_n(struct bmq *qp, struct bmq_msg *list, unsigned long n)
+{
+	struct bmq_msg	*mp, *next, *rev, *last, *head;
+
+	if (n == 0 || list == NULL)
+		return;
+	bmq_reserve(qp, n);
+
+	/*
+	 * The pushed list is newest first, so push the batch reversed.
+	 */
+	last = list;
+	for (rev = NULL, mp = list; mp != NULL; mp = next) {
+		next = mp->m_next;
+		mp->m_next = rev;
+		rev = mp;
+	}
+	head = __atomic_load_n(&qp->q_in, __ATOMIC_RELAXED);
+	do {
+		last->m_next = head;
+	} while (!__atomic_compare_exchange_n(&qp->q_in, &head, rev, 1,
+	  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+	bmq_wake(qp, &qp->q_cwait, &qp->q_notempty);
+}
+
+void
+bmq_enqueue(struct bmq *qp, struct bmq_msg *mp)
+{
+	mp->m_next = NULL;
+	bmq_enqueue_n(qp, mp, 1);
+}
+
+/*
+ * Take every message in the queue, oldest first, linked through m_next.
+ * If wait is nonzero, sleep until there is at least one; otherwise
+ * return NULL if the queue is empty.  If np isn't NULL, the number of
+ * messages is stored there.
+ */
+struct bmq_msg *
+bmq_dequeue_all(struct bmq *qp, int wait, unsigned long *np)
+{
+	struct bmq_msg	*mp, *next, *list;
+	unsigned long	 n;
+
+	for (;;) {
+		if ((mp = __atomic_exchange_n(&qp->q_in, NULL,
+		  __ATOMIC_ACQUIRE)) != NULL)
+			break;
+		if (!wait) {
+			if (np != NULL)
+				*np = 0;
+			return(NULL);
+		}
+		pthread_mutex_lock(&qp->q_lock);
+		__atomic_fetch_add(&qp->q_cwait, 1, __ATOMIC_SEQ_CST);
+		qp->q_nempty++;
+		while (__atomic_load_n(&qp->q_in, __ATOMIC_SEQ_CST) == NULL)
+			pthread_cond_wait(&qp->q_notempty, &qp->q_lock);
+		__atomic_fetch_sub(&qp->q_cwait, 1, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&qp->q_lock);
+	}
+
+	for (n = 0, list = NULL; mp != NULL; mp = next, n++) {
+		next = mp->m_next;
+		mp->m_next = list;
+		list = mp;
+	}
+	__atomic_fetch_sub(&qp->q_count, n, __ATOMIC_SEQ_CST);
+	bmq_wake(qp, &qp->q_pwait, &qp->q_notfull);
+	if (np != NULL)
+		*np = n;
+	return(list);
+}
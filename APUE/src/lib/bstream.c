@@ -0,0 +1,445 @@
+/*
+ * Buffered output streams we can tune and look inside.
+ *
+ * {Prog buf} can tell whether a stdio stream is unbuffered, line buffered
+ * or fully buffered, and only by peeking at implementation flags.  It
+ * can't change when a stream is flushed beyond those three choices, and
+ * nothing says what the choice costs.  A daemon whose log goes to a pipe
+ * or a terminal gets a line-buffered stdout and makes a write() per line;
+ * with many short lines that is most of its system calls.
+ *
+ * A bstream buffers writes to a descriptor, with a buffer size and flush
+ * policy of its own:
+ *
+ *	BS_SIZE		flush only when the buffer is full
+ *	BS_LINE		also at every newline, as stdio does for terminals
+ *	BS_TIME		also when the oldest buffered byte is interval ns old,
+ *			so output is never more than that late
+ *	BS_EXPLICIT	only when bs_flush() is called; the buffer grows
+ *
+ * Writes never split: a write that doesn't fit goes out in one writev()
+ * together with what is buffered, without being copied, and so does a
+ * write as large as the buffer.  Each stream counts its flushes, the
+ * bytes they carried, why they happened and the time spent blocked in
+ * write() and writev(), so a stream that flushes a few bytes at a time
+ * shows up in bs_getstats().
+ *
+ * A time-flushed stream only notices its data is old when it is written
+ * to again.  A daemon calls bs_tick() from its event loop; it flushes
+ * whatever is due and returns the nanoseconds until the next stream is,
+ * for the poll timeout.  bs_flush(NULL) flushes every stream, and is
+ * done at exit.  The locks are registered with {Prog forklock}, so a
+ * child can write to a stream a busy thread was in.  bs_fdopen() puts a
+ * FILE in front of a stream, so code that uses fprintf() keeps doing so.
+ *
+ *	bp = bs_open(fd, 0, BS_TIME, 100000000);	# 0: st_blksize
+ *	bs_printf(bp, "%s: %d\n", name, n);
+ *	timeout = bs_tick();				# -1: nothing waiting
+ *	bs_getstats(bp, &st);
+ */
+
+#include "apue.h"
+#include "bstream.h"
+#include "forklock.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+static struct bstream	*bs_all;		/* every open stream */
+static pthread_mutex_t	 bs_alllock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t	 bs_once = PTHREAD_ONCE_INIT;
+
+static long long
+bs_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+static void
+bs_exit(void)
+{
+	bs_flush(NULL);
+}
+
+static void
+bs_init(void)
+{
+	fl_register(&bs_alllock, FL_MUTEX, FL_RANK_BSLIST, NULL);
+	atexit(bs_exit);
+}
+
+/*
+ * Write what is buffered followed by the n bytes at ext, with one
+ * writev() unless the descriptor takes less.  Counts the flush in *why.
+ * Called with the stream locked.  Returns 0, or -1 on error, which sticks
+ * to the stream; the data is dropped either way.
+ */
+static int
+bs_out(struct bstream *bp, const void *ext, size_t n, unsigned long *why)
+{
+	int				i, cnt;
+	ssize_t			nw;
+	size_t			total;
+	long long		t;
+	struct iovec	iov[2];
+	struct pollfd	pfd;
+
+	if ((total = bp->bs_len + n) == 0)
+		return(0);
+	(*why)++;
+	iov[0].iov_base = bp->bs_buf;
+	iov[0].iov_len = bp->bs_len;
+	iov[1].iov_base = (void *)ext;
+	iov[1].iov_len = n;
+	i = bp->bs_len == 0;
+	cnt = n == 0 ? 1 : 2 - i;
+	bp->bs_len = 0;
+
+	t = bs_now();
+	while (cnt > 0) {
+		bp->bs_stats.st_flushes++;
+		if ((nw = writev(bp->bs_fd, &iov[i], cnt)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {		/* nonblocking: wait for room */
+				pfd.fd = bp->bs_fd;
+				pfd.events = POLLOUT;
+				poll(&pfd, 1, -1);
+				continue;
+			}
+			bp->bs_err = errno;
+			bp->bs_stats.st_blocked += bs_now() - t;
+			return(-1);
+		}
+		while (cnt > 0 && (size_t)nw >= iov[i].iov_len) {
+			nw -= iov[i].iov_len;
+			i++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov[i].iov_base = (char *)iov[i].iov_base + nw;
+			iov[i].iov_len -= nw;
+		}
+	}
+	bp->bs_stats.st_blocked += bs_now() - t;
+	bp->bs_stats.st_bytes += total;
+	if (total > bp->bs_stats.st_maxflush)
+		bp->bs_stats.st_maxflush = total;
+	return(0);
+}
+
+/*
+ * Make room for n more bytes in a BS_EXPLICIT stream.
+ */
+static int
+bs_grow(struct bstream *bp, size_t n)
+{
+	size_t	size;
+	char	*buf;
+
+	for (size = bp->bs_size; size < bp->bs_len + n; size *= 2)
+		;
+	if ((buf = realloc(bp->bs_buf, size)) == NULL)
+		return(-1);
+	bp->bs_buf = buf;
+	bp->bs_size = size;
+	return(0);
+}
+
+/*
+ * The n bytes at p have just been added to the buffer: flush if the
+ * policy says so.
+ */
+static int
+bs_policy(struct bstream *bp, const char *p, size_t n)
+{
+	long long	now;
+
+	switch (bp->bs_policy) {
+	case BS_LINE:
+		if (memchr(p, '\n', n) != NULL)
+			return(bs_out(bp, NULL, 0, &bp->bs_stats.st_line));
+		break;
+
+	case BS_TIME:
+		now = bs_now();
+		if (bp->bs_len == n)
+			bp->bs_since = now;		/* the buffer was empty */
+		else if (now - bp->bs_since >= bp->bs_interval)
+			return(bs_out(bp, NULL, 0, &bp->bs_stats.st_timer));
+		break;
+	}
+	if (bp->bs_len == bp->bs_size && bp->bs_policy != BS_EXPLICIT)
+		return(bs_out(bp, NULL, 0, &bp->bs_stats.st_full));
+	return(0);
+}
+
+/*
+ * Buffer or write n bytes; called with the stream locked.
+ */
+static int
+bs_put(struct bstream *bp, const void *p, size_t n)
+{
+	if (bp->bs_len + n > bp->bs_size) {
+		if (bp->bs_policy == BS_EXPLICIT) {
+			if (bs_grow(bp, n) < 0)
+				return(-1);
+		} else if (n >= bp->bs_size) {
+			return(bs_out(bp, p, n, &bp->bs_stats.st_direct));
+		} else {
+			return(bs_out(bp, p, n, &bp->bs_stats.st_full));
+		}
+	}
+	memcpy(bp->bs_buf + bp->bs_len, p, n);
+	bp->bs_len += n;
+	return(bs_policy(bp, p, n));
+}
+
+/*
+ * Open a stream on fd with a buffer of size bytes (0 for the file's
+ * preferred I/O size) and the given flush policy; interval is for
+ * BS_TIME, in nanoseconds.  The descriptor stays the caller's.
+ */
+struct bstream *
+bs_open(int fd, size_t size, int policy, long long interval)
+{
+	struct bstream	*bp;
+	struct stat		sb;
+
+	if (policy < BS_SIZE || policy > BS_EXPLICIT ||
+	  (policy == BS_TIME && interval <= 0)) {
+		errno = EINVAL;
+		return(NULL);
+	}
+	if (size == 0)
+		size = (fstat(fd, &sb) == 0 && sb.st_blksize > 0) ?
+		  sb.st_blksize : BUFSIZ;
+	if ((bp = calloc(1, sizeof(struct bstream))) == NULL)
+		return(NULL);
+	if ((bp->bs_buf = malloc(size)) == NULL) {
+		free(bp);
+		return(NULL);
+	}
+	pthread_mutex_init(&bp->bs_lock, NULL);
+	bp->bs_fd = fd;
+	bp->bs_policy = policy;
+	bp->bs_interval = interval;
+	bp->bs_size = size;
+
+	pthread_once(&bs_once, bs_init);
+	fl_register(&bp->bs_lock, FL_MUTEX, FL_RANK_BSTREAM, NULL);
+	pthread_mutex_lock(&bs_alllock);
+	bp->bs_next = bs_all;
+	bs_all = bp;
+	pthread_mutex_unlock(&bs_alllock);
+	return(bp);
+}
+
+/*
+ * Returns 0, or -1 if this or an earlier flush failed.
+ */
+int
+bs_write(struct bstream *bp, const void *p, size_t n)
+{
+	int		rv;
+
+	pthread_mutex_lock(&bp->bs_lock);
+	bp->bs_stats.st_writes++;
+	if (bp->bs_err != 0) {
+		errno = bp->bs_err;
+		rv = -1;
+	} else {
+		rv = bs_put(bp, p, n);
+	}
+	pthread_mutex_unlock(&bp->bs_lock);
+	return(rv);
+}
+
+/*
+ * Format straight into the buffer when it fits.  Returns the number of
+ * bytes written, or -1.
+ */
+int
+bs_printf(struct bstream *bp, const char *fmt, ...)
+{
+	int		n, rv;
+	size_t	room;
+	char	*tmp;
+	va_list	ap;
+
+	pthread_mutex_lock(&bp->bs_lock);
+	bp->bs_stats.st_writes++;
+	if (bp->bs_err != 0) {
+		errno = bp->bs_err;
+		n = -1;
+		goto done;
+	}
+	room = bp->bs_size - bp->bs_len;
+	va_start(ap, fmt);
+	n = vsnprintf(bp->bs_buf + bp->bs_len, room, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		goto done;
+	if ((size_t)n < room) {
+		bp->bs_len += n;
+		rv = bs_policy(bp, bp->bs_buf + bp->bs_len - n, n);
+	} else if (bp->bs_policy == BS_EXPLICIT ||
+	  (size_t)n < bp->bs_size / 2) {
+		/*
+		 * Make room and format again: grow, or flush what's
+		 * there if that leaves plenty of space.
+		 */
+		if (bp->bs_policy == BS_EXPLICIT)
+			rv = bs_grow(bp, n + 1);
+		else
+			rv = bs_out(bp, NULL, 0, &bp->bs_stats.st_full);
+		if (rv == 0) {
+			va_start(ap, fmt);
+			vsnprintf(bp->bs_buf + bp->bs_len, n + 1, fmt, ap);
+			va_end(ap);
+			bp->bs_len += n;
+			rv = bs_policy(bp, bp->bs_buf + bp->bs_len - n, n);
+		}
+	} else {
+		if ((tmp = malloc(n + 1)) == NULL) {
+			n = -1;
+			goto done;
+		}
+		va_start(ap, fmt);
+		vsnprintf(tmp, n + 1, fmt, ap);
+		va_end(ap);
+		rv = bs_put(bp, tmp, n);
+		free(tmp);
+	}
+	if (rv < 0)
+		n = -1;
+done:
+	pthread_mutex_unlock(&bp->bs_lock);
+	return(n);
+}
+
+/*
+ * Write out whatever is buffered; with a null pointer, for every stream.
+ */
+int
+bs_flush(struct bstream *bp)
+{
+	int		rv;
+
+	if (bp == NULL) {
+		rv = 0;
+		pthread_mutex_lock(&bs_alllock);
+		for (bp = bs_all; bp != NULL; bp = bp->bs_next)
+			if (bs_flush(bp) < 0)
+				rv = -1;
+		pthread_mutex_unlock(&bs_alllock);
+		return(rv);
+	}
+	pthread_mutex_lock(&bp->bs_lock);
+	if (bp->bs_err != 0) {
+		errno = bp->bs_err;
+		rv = -1;
+	} else {
+		rv = bs_out(bp, NULL, 0, &bp->bs_stats.st_explicit);
+	}
+	pthread_mutex_unlock(&bp->bs_lock);
+	return(rv);
+}
+
+/*
+ * Flush each BS_TIME stream whose oldest data is due.  Returns the
+ * nanoseconds until the next one is, or -1 if none has data waiting.
+ */
+long long
+bs_tick(void)
+{
+	long long		now, left, next;
+	struct bstream	*bp;
+
+	next = -1;
+	now = bs_now();
+	pthread_mutex_lock(&bs_alllock);
+	for (bp = bs_all; bp != NULL; bp = bp->bs_next) {
+		if (bp->bs_policy != BS_TIME)
+			continue;
+		pthread_mutex_lock(&bp->bs_lock);
+		if (bp->bs_len > 0 && bp->bs_err == 0) {
+			left = bp->bs_since + bp->bs_interval - now;
+			if (left <= 0)
+				bs_out(bp, NULL, 0, &bp->bs_stats.st_timer);
+			else if (next < 0 || left < next)
+				next = left;
+		}
+		pthread_mutex_unlock(&bp->bs_lock);
+	}
+	pthread_mutex_unlock(&bs_alllock);
+	return(next);
+}
+
+void
+bs_getstats(struct bstream *bp, struct bs_stats *sp)
+{
+	pthread_mutex_lock(&bp->bs_lock);
+	*sp = bp->bs_stats;
+	pthread_mutex_unlock(&bp->bs_lock);
+}
+
+/*
+ * Flush and free the stream; the descriptor is left open.
+ */
+int
+bs_close(struct bstream *bp)
+{
+	int				rv;
+	struct bstream	**bpp;
+
+	pthread_mutex_lock(&bs_alllock);
+	for (bpp = &bs_all; *bpp != NULL; bpp = &(*bpp)->bs_next) {
+		if (*bpp == bp) {
+			*bpp = bp->bs_next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&bs_alllock);
+	rv = bs_flush(bp);
+	fl_unregister(&bp->bs_lock);
+	pthread_mutex_destroy(&bp->bs_lock);
+	free(bp->bs_buf);
+	free(bp);
+	return(rv);
+}
+
+static ssize_t
+bs_cwrite(void *cookie, const char *buf, size_t n)
+{
+	return(bs_write(cookie, buf, n) < 0 ? -1 : (ssize_t)n);
+}
+
+static int
+bs_cclose(void *cookie)
+{
+	return(bs_close(cookie));
+}
+
+/*
+ * A write-only FILE in front of the stream.  stdio does no buffering of
+ * its own on it, so each fputs() or fprintf() is one bs_write().
+ * fclose() closes the stream.
+ */
+FILE *
+bs_fdopen(struct bstream *bp)
+{
+	FILE					*fp;
+	cookie_io_functions_t	io = { NULL, bs_cwrite, NULL, bs_cclose };
+
+	if ((fp = fopencookie(bp, "w", io)) == NULL)
+		return(NULL);
+	setvbuf(fp, NULL, _IONBF, 0);
+	return(fp);
+}
@@ -1,30 +1,35 @@
 #include "apue.h"
+#include "tokenize.h"
+#include <errno.h>
 
 #define	MAXARGC		50	/* max number of arguments in buf */
-#define	WHITE	" \t\n"	/* white space for tokenizing arguments */
 
 /*
- * buf[] contains white-space-separated arguments.  We convert it to an
- * argv-style array of pointers, and call the user's function (optfunc)
- * to process the array.  We return -1 if there's a problem parsing buf,
- * else we return whatever optfunc() returns.  Note that user's buf[]
- * array is modified (nulls placed after each token).
+ * buf[] contains white-space-separated arguments, which may be quoted
+ * as in the shell.  We convert it to an argv-style array of pointers, and
+ * call the user's function (optfunc) to process the array.  We return -1
+ * if there's a problem parsing buf (errno E2BIG for too many arguments,
+ * EINVAL for none or a bad quote), else we return whatever optfunc()
+ * returns.  Note that user's buf[] array is modified (unquoted, with
+ * nulls placed after each token).  Unlike strtok(), tok_split() keeps no
+ * state between calls, so we may be called from any number of threads.
  */
 int
 buf_args(char *buf, int (*optfunc)(int, char **))
 {
-	char	*ptr, *argv[MAXARGC];
-	int		argc;
+	char		*argv[MAXARGC];
+	struct tok	tv[MAXARGC-1];	/* -1 for room for NULL at end */
+	int			argc, i;
 
-	if (strtok(buf, WHITE) == NULL)		/* an argv[0] is required */
+	if ((argc = tok_split(buf, strlen(buf), tv, MAXARGC-1)) < 0)
+		return(-1);
+	if (argc == 0) {			/* an argv[0] is required */
+		errno = EINVAL;
 		return(-1);
-	argv[argc = 0] = buf;
-	while ((ptr = strtok(NULL, WHITE)) != NULL) {
-		if (++argc >= MAXARGC-1)	/* -1 for room for NULL at end */
-			return(-1);
-		argv[argc] = ptr;
 	}
-	argv[++argc] = NULL;
+	for (i = 0; i < argc; i++)
+		argv[i] = tv[i].t_ptr;
+	argv[argc] = NULL;
 
 	/*
 	 * Since argv[] pointers point into the user's buf[],
@@ -12,25 +12,37 @@
  */
 int
 cli_conn(const char *name)
+{
+	return(cli_conn_type(name, SOCK_STREAM));
+}
+
+/*
+ * Same, for a socket of the given type: SOCK_STREAM or SOCK_SEQPACKET.
+ * Each connection binds its own name, so that a process can hold
+ * any number of them.
+ */
+int
+cli_conn_type(const char *name, int type)
 {
 	int					fd, len, err, rval;
 	struct sockaddr_un	un, sun;
 	int					do_unlink = 0;
+	static unsigned int	seq;		/* tells our connections apart */
 
 	if (strlen(name) >= sizeof(un.sun_path)) {
 		errno = ENAMETOOLONG;
 		return(-1);
 	}
 
-	/* create a UNIX domain stream socket */
-	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	/* create a UNIX domain socket */
+	if ((fd = socket(AF_UNIX, type, 0)) < 0)
 		return(-1);
 
 	/* fill socket address structure with our address */
 	memset(&un, 0, sizeof(un));
 	un.sun_family = AF_UNIX;
-	sprintf(un.sun_path, "%s%05ld", CLI_PATH, (long)getpid());
-printf("file is %s\n", un.sun_path);
+	sprintf(un.sun_path, "%s%05ld.%u", CLI_PATH, (long)getpid(),
+	  __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED));
 	len = offsetof(struct sockaddr_un, sun_path) + strlen(un.sun_path);
 
 	unlink(un.sun_path);		/* in case it already exists */
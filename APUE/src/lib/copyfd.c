@@ -0,0 +1,95 @@
+#include "apue.h"
+#include <errno.h>
+#include <fcntl.h>
+
+/*
+ * Copy everything from one descriptor to another, with a buffer sized
+ * for the descriptors involved instead of a fixed BUFFSIZE.
+ *
+ * Measuring the read/write loop across buffer sizes shows throughput
+ * climbing steeply up to a few dozen times the file system's block size
+ * and flat after that: 4096 bytes costs several times the system calls
+ * for nothing.  So we use COPY_BLKMULT times the larger st_blksize of
+ * the two descriptors, kept between COPY_MINBUF and COPY_MAXBUF.
+ *
+ * For a regular input file we also tell the kernel we'll read it
+ * sequentially, which lets it read ahead further, and (if dropbehind is
+ * nonzero) that we won't need what we've read again, so copying a big
+ * file doesn't push everything else out of the page cache.
+ *
+ * Returns the number of bytes copied, or -1 on error.
+ */
+
+#define	COPY_BLKMULT	32
+#define	COPY_MINBUF		(16 * 1024)
+#define	COPY_MAXBUF		(1024 * 1024)
+#define	COPY_DROPEVERY	(8 * 1024 * 1024)	/* fadvise DONTNEED granularity */
+
+size_t
+copy_bufsize(int fdin, int fdout)
+{
+	struct stat	sbuf;
+	size_t		blk;
+
+	blk = 0;
+	if (fstat(fdin, &sbuf) == 0)
+		blk = sbuf.st_blksize;
+	if (fstat(fdout, &sbuf) == 0 && (size_t)sbuf.st_blksize > blk)
+		blk = sbuf.st_blksize;
+	blk *= COPY_BLKMULT;
+	if (blk < COPY_MINBUF)
+		blk = COPY_MINBUF;
+	if (blk > COPY_MAXBUF)
+		blk = COPY_MAXBUF;
+	return(blk);
+}
+
+ssize_t
+copy_fd(int fdin, int fdout, int dropbehind)
+{
+	char		*buf;
+	size_t		 bufsize;
+	ssize_t		 n, total;
+	off_t		 start, dropped;
+	struct stat	 sbuf;
+	int			 isreg;
+
+	bufsize = copy_bufsize(fdin, fdout);
+	if ((buf = malloc(bufsize)) == NULL)
+		return(-1);
+
+	isreg = (fstat(fdin, &sbuf) == 0 && S_ISREG(sbuf.st_mode));
+	start = dropped = 0;
+	if (isreg) {
+		if ((start = lseek(fdin, 0, SEEK_CUR)) < 0)
+			start = 0;
+		dropped = start;
+		posix_fadvise(fdin, start, 0, POSIX_FADV_SEQUENTIAL);
+	}
+
+	total = 0;
+	for (;;) {
+		if ((n = read(fdin, buf, bufsize)) < 0) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return(-1);
+		}
+		if (n == 0)
+			break;
+		if (writen(fdout, buf, n) != n) {
+			free(buf);
+			return(-1);
+		}
+		total += n;
+		if (isreg && dropbehind && start + total - dropped >= COPY_DROPEVERY) {
+			posix_fadvise(fdin, dropped, start + total - dropped,
+			  POSIX_FADV_DONTNEED);
+			dropped = start + total;
+		}
+	}
+	if (isreg && dropbehind)
+		posix_fadvise(fdin, dropped, 0, POSIX_FADV_DONTNEED);
+	free(buf);
+	return(total);
+}
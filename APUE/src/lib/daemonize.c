@@ -1,14 +1,115 @@
+/*
+ * Becoming a daemon.
+ *
+ * daemonize() closed every descriptor up to RLIMIT_NOFILE one close() at
+ * a time, which with a limit of a million is a million system calls
+ * before the daemon does anything.  close_range() closes them all in
+ * one; we fall back to the loop only on kernels without it.
+ *
+ * daemonize() also has the starting process exit at once, so whoever
+ * started the daemon (a shell script, init, a supervisor) can't tell
+ * when it is ready to serve, or whether it died first: a second copy
+ * can't even tell it is one.  daemon_start() leaves the starting
+ * process waiting on a pipe, and the daemon takes the lock on its pid
+ * file, sets itself up, preloads whatever it caches, and calls
+ * daemon_ready(), upon which the starting process exits 0.  If the
+ * daemon fails or exits first, the starting process prints why, if it
+ * knows, and exits 1; so "mydaemon && next" runs next only once the
+ * daemon is serving.  daemon_ready() also tells a supervisor: it writes
+ * a newline to the descriptor in d_notifyfd, the s6 convention, and
+ * sends READY=1 to $NOTIFY_SOCKET, the systemd one.
+ *
+ *	struct dmn_conf	conf = DMN_CONF("mydaemon");	# see daemon.h
+ *	daemon_start(&conf);		# now in the daemon
+ *	... bind sockets, warm caches ...
+ *	daemon_ready();			# starting process exits 0
+ */
+
 #include "apue.h"
+#include "daemon.h"
+#include <errno.h>
 #include <syslog.h>
 #include <fcntl.h>
+#include <time.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int			dmn_readyfd = -1;	/* pipe to the starting process */
+static int			dmn_notifyfd = -1;
+static struct timespec	dmn_start;
+
+/*
+ * Close descriptors lo through hi.
+ */
+static void
+dmn_close(unsigned int lo, unsigned int hi)
+{
+	struct rlimit	rl;
+
+	if (lo > hi || close_range(lo, hi, 0) == 0)
+		return;
+	if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_max == RLIM_INFINITY)
+		rl.rlim_max = 1024;
+	if (hi >= rl.rlim_max)
+		hi = rl.rlim_max - 1;
+	while (lo <= hi)
+		close(lo++);
+}
+
+/*
+ * Move fd out of 0, 1 and 2, which dmn_closeall() points at /dev/null:
+ * started with those closed, as under init or a supervisor, the pipe
+ * and the pid file would land there.  Returns the new descriptor, or
+ * fd itself if it is already above 2; on error fd is closed.
+ */
+static int
+dmn_above2(int fd)
+{
+	int		nfd, err;
+
+	if (fd > 2)
+		return(fd);
+	nfd = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+	err = errno;
+	close(fd);
+	errno = err;
+	return(nfd);
+}
+
+/*
+ * Close every descriptor but the n in keep[], in increasing order
+ * (negative ones are ignored), and attach 0, 1 and 2 to /dev/null.
+ */
+static int
+dmn_closeall(const int *keep, int n)
+{
+	int				i, fd;
+	unsigned int	lo;
+
+	for (lo = 0, i = 0; i < n; i++) {
+		if (keep[i] < 0)
+			continue;
+		if ((unsigned int)keep[i] > lo)
+			dmn_close(lo, keep[i] - 1);
+		lo = keep[i] + 1;
+	}
+	dmn_close(lo, ~0U);
+	if ((fd = open("/dev/null", O_RDWR)) < 0)
+		return(-1);
+	for (i = 0; i < 3; i++)
+		if (fd != i && dup2(fd, i) < 0)
+			return(-1);
+	if (fd > 2)
+		close(fd);
+	return(0);
+}
 
 void
 daemonize(const char *cmd)
 {
-	int i, fd0, fd1, fd2;
+	int fd0, fd1, fd2;
 	pid_t pid;
-	struct rlimit rl;
 	struct sigaction sa;
 
 	/*
@@ -16,12 +117,6 @@ daemonize(const char *cmd)
 	 */
 	umask(0);
 
-	/*
-	 * Get maximum number of file descriptors.
-	 */
-	if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
-		err_quit("%s: can't get file limit", cmd);
-
 	/*
 	 * Become a session leader to lose controlling TTY.
 	 */
@@ -54,10 +149,7 @@ daemonize(const char *cmd)
 	/*
 	 * Close all open file descriptors.
 	 */
-	if (rl.rlim_max == RLIM_INFINITY)
-		rl.rlim_max = 1024;
-	for (i = 0; i < rl.rlim_max; i++)
-		close(i);
+	dmn_close(0, ~0U);
 
 	/*
 	 * Attach file descriptors 0, 1, and 2 to /dev/null.
@@ -76,3 +168,182 @@ daemonize(const char *cmd)
 		exit(1);
 	}
 }
+
+/*
+ * In the daemon, before it is ready: tell the starting process why we
+ * can't go on, and quit.
+ */
+static void
+dmn_fail(const char *ident, const char *what, int err)
+{
+	if (dmn_readyfd >= 0)
+		write(dmn_readyfd, &err, sizeof(err));
+	else
+		syslog(LOG_ERR, "%s: %s: %s", ident, what, strerror(err));
+	_exit(1);
+}
+
+/*
+ * In the starting process: wait for the daemon to be ready, and exit.
+ */
+static void
+dmn_wait(int fd, const char *ident, const char *pidfile)
+{
+	int		err;
+	ssize_t	n;
+
+	while ((n = read(fd, &err, sizeof(err))) < 0 && errno == EINTR)
+		;
+	if (n == sizeof(err) && err == 0)
+		exit(0);
+	if (n != sizeof(err))
+		fprintf(stderr, "%s: exited before it was ready\n", ident);
+	else if (err == EALREADY)
+		fprintf(stderr, "%s: already running (%s is locked)\n", ident,
+		  pidfile);
+	else
+		fprintf(stderr, "%s: can't start: %s\n", ident, strerror(err));
+	exit(1);
+}
+
+/*
+ * Become a daemon as configured.  Returns 0 in the daemon, or -1 with
+ * errno set if we couldn't fork; after that, errors end the daemon
+ * and are reported by the starting process (DMN_WAIT) or to syslog.
+ */
+int
+daemon_start(const struct dmn_conf *cp)
+{
+	int					pfd[2], lockfd, notifyfd, keep[3], t;
+	char				buf[32];
+	pid_t				pid;
+	struct sigaction	sa;
+
+	clock_gettime(CLOCK_MONOTONIC, &dmn_start);
+	umask(0);
+	pfd[0] = pfd[1] = -1;
+	if (cp->d_flags & DMN_WAIT) {
+		if (pipe2(pfd, O_CLOEXEC) < 0)
+			return(-1);
+		if ((pfd[0] = dmn_above2(pfd[0])) < 0) {
+			close(pfd[1]);
+			return(-1);
+		}
+		if ((pfd[1] = dmn_above2(pfd[1])) < 0) {
+			close(pfd[0]);
+			return(-1);
+		}
+	}
+	if ((pid = fork()) < 0) {
+		if (pfd[0] >= 0) {
+			close(pfd[0]);
+			close(pfd[1]);
+		}
+		return(-1);
+	} else if (pid != 0) {
+		if (pfd[0] < 0)
+			exit(0);
+		close(pfd[1]);
+		dmn_wait(pfd[0], cp->d_ident, cp->d_pidfile);
+	}
+	if (pfd[0] >= 0)
+		close(pfd[0]);
+	dmn_readyfd = pfd[1];
+
+	setsid();
+	sa.sa_handler = SIG_IGN;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	if (sigaction(SIGHUP, &sa, NULL) < 0)
+		dmn_fail(cp->d_ident, "can't ignore SIGHUP", errno);
+	if ((pid = fork()) < 0)
+		dmn_fail(cp->d_ident, "can't fork", errno);
+	else if (pid != 0)
+		_exit(0);		/* the pipe lives on in the daemon */
+
+	if (!(cp->d_flags & DMN_NOCHDIR) &&
+	  chdir(cp->d_dir != NULL ? cp->d_dir : "/") < 0)
+		dmn_fail(cp->d_ident, "can't change directory", errno);
+
+	/*
+	 * The lock on the pid file is ours for as long as we live, so
+	 * a second copy finds it taken.  Closing any descriptor for the
+	 * file drops the lock, so it is moved above 2 before we lock it.
+	 */
+	lockfd = -1;
+	if (cp->d_pidfile != NULL) {
+		if ((lockfd = open(cp->d_pidfile, O_RDWR | O_CREAT | O_CLOEXEC,
+		  FILE_MODE)) < 0 || (lockfd = dmn_above2(lockfd)) < 0)
+			dmn_fail(cp->d_ident, cp->d_pidfile, errno);
+		if (lockfile(lockfd) < 0)
+			dmn_fail(cp->d_ident, "already running",
+			  (errno == EACCES || errno == EAGAIN) ? EALREADY : errno);
+		snprintf(buf, sizeof(buf), "%ld\n", (long)getpid());
+		if (ftruncate(lockfd, 0) < 0 ||
+		  write(lockfd, buf, strlen(buf)) != (ssize_t)strlen(buf))
+			dmn_fail(cp->d_ident, cp->d_pidfile, errno);
+	}
+
+	notifyfd = -1;
+	if (cp->d_notifyfd >= 0 && (notifyfd = dmn_above2(cp->d_notifyfd)) < 0)
+		dmn_fail(cp->d_ident, "can't move the notification descriptor",
+		  errno);
+	keep[0] = dmn_readyfd;
+	keep[1] = lockfd;
+	keep[2] = notifyfd;
+	if (keep[0] > keep[1]) {
+		t = keep[0]; keep[0] = keep[1]; keep[1] = t;
+	}
+	if (keep[1] > keep[2]) {
+		t = keep[1]; keep[1] = keep[2]; keep[2] = t;
+	}
+	if (keep[0] > keep[1]) {
+		t = keep[0]; keep[0] = keep[1]; keep[1] = t;
+	}
+	if (dmn_closeall(keep, 3) < 0)
+		dmn_fail(cp->d_ident, "can't open /dev/null", errno);
+	dmn_notifyfd = notifyfd;
+	openlog(cp->d_ident, LOG_CONS, LOG_DAEMON);
+	return(0);
+}
+
+/*
+ * Tell the starting process and any supervisor that we're ready.
+ */
+int
+daemon_ready(void)
+{
+	int					s, ok;
+	const char			*path;
+	struct timespec		now;
+	struct sockaddr_un	un;
+
+	ok = 0;
+	if (dmn_readyfd >= 0) {
+		write(dmn_readyfd, &ok, sizeof(ok));
+		close(dmn_readyfd);
+		dmn_readyfd = -1;
+	}
+	if (dmn_notifyfd >= 0) {
+		write(dmn_notifyfd, "\n", 1);
+		close(dmn_notifyfd);
+		dmn_notifyfd = -1;
+	}
+	if ((path = getenv("NOTIFY_SOCKET")) != NULL &&
+	  strlen(path) < sizeof(un.sun_path) &&
+	  (s = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) >= 0) {
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		strcpy(un.sun_path, path);
+		if (un.sun_path[0] == '@')
+			un.sun_path[0] = 0;		/* abstract namespace */
+		sendto(s, "READY=1", 7, 0, (struct sockaddr *)&un,
+		  offsetof(struct sockaddr_un, sun_path) + strlen(path));
+		close(s);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	syslog(LOG_INFO, "ready %.1f ms after starting",
+	  (now.tv_sec - dmn_start.tv_sec) * 1e3 +
+	  (now.tv_nsec - dmn_start.tv_nsec) / 1e6);
+	return(0);
+}
@@ -0,0 +1,149 @@
+/*
+ * Deadline waits.
+ *
+ * sleep_us() used to be a select() with a timeout, and {Prog sleep} an
+ * alarm() and sigsuspend().  Both take a relative interval, so a signal
+ * that cuts the wait short leaves the caller to work out how much time
+ * is left, and each retry adds the time spent getting back in; the alarm
+ * version also takes over SIGALRM and cancels any alarm the caller set.
+ *
+ * Here a wait is for an absolute time on CLOCK_MONOTONIC, which
+ * clock_nanosleep(TIMER_ABSTIME) sleeps until directly: after EINTR we
+ * just sleep until the same deadline again, and a periodic loop that
+ * advances its deadline by the period (dl_advance()) never drifts, however
+ * late any one wakeup was.
+ *
+ * The kernel may defer a timer wakeup by the thread's timer slack (50us
+ * by default) to batch it with others, on top of the time to schedule
+ * us.  dl_wait() is for waits that must end on time: it sleeps until the
+ * slack plus a spin window before the deadline and spins on the clock
+ * for the rest, and for waits shorter than that it only spins.  The
+ * slack is per thread and can be set with dl_setslack(): lower it for
+ * precise sleeps, raise it to let a background thread's timers coalesce.
+ *
+ *	dl_after(&dl, ns);		# deadline ns from now
+ *	dl_sleep(&dl);			# sleep until it, through signals
+ *	dl_wait(&dl);			# sleep, then spin the last DL_SPIN ns
+ *	dl_advance(&dl, period);	# next tick of a periodic loop
+ */
+
+#include "apue.h"
+#include "deadline.h"
+#include <errno.h>
+#include <sys/prctl.h>
+
+#define	NSEC	1000000000LL
+
+static long long		dl_spin = DL_SPIN;
+static __thread long	dl_slack = -1;	/* our timer slack, once known */
+
+/*
+ * Move *dl ns later (earlier, if ns is negative).
+ */
+void
+dl_advance(struct timespec *dl, long long ns)
+{
+	ns += dl->tv_nsec;
+	dl->tv_sec += ns / NSEC;
+	dl->tv_nsec = ns % NSEC;
+	if (dl->tv_nsec < 0) {
+		dl->tv_nsec += NSEC;
+		dl->tv_sec--;
+	}
+}
+
+/*
+ * Set *dl to ns from now.
+ */
+void
+dl_after(struct timespec *dl, long long ns)
+{
+	clock_gettime(CLOCK_MONOTONIC, dl);
+	dl_advance(dl, ns);
+}
+
+/*
+ * Nanoseconds until the deadline; negative once it has passed.
+ */
+long long
+dl_remaining(const struct timespec *dl)
+{
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((dl->tv_sec - now.tv_sec) * NSEC + (dl->tv_nsec - now.tv_nsec));
+}
+
+/*
+ * Sleep until the deadline, even if signals are caught meanwhile.
+ * Returns 0, or -1 on error.
+ */
+int
+dl_sleep(const struct timespec *dl)
+{
+	int		err;
+
+	while ((err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, dl,
+	  NULL)) == EINTR)
+		;
+	if (err != 0) {
+		errno = err;
+		return(-1);
+	}
+	return(0);
+}
+
+/*
+ * Wait until the deadline, sleeping as long as we can without risking a
+ * late wakeup and spinning the rest of the way.
+ */
+void
+dl_wait(const struct timespec *dl)
+{
+	long long		margin;
+	struct timespec	early;
+
+	margin = dl_spin + dl_getslack();
+	if (dl_remaining(dl) > margin) {
+		early = *dl;
+		dl_advance(&early, -margin);
+		dl_sleep(&early);
+	}
+	while (dl_remaining(dl) > 0)
+		cpu_relax();
+}
+
+/*
+ * How close to the deadline dl_wait() stops sleeping, beyond the slack.
+ */
+void
+dl_setspin(long long ns)
+{
+	dl_spin = ns < 0 ? 0 : ns;
+}
+
+/*
+ * Set the calling thread's timer slack, in nanoseconds; 0 restores the
+ * default.  Returns 0 if OK, -1 on error.
+ */
+int
+dl_setslack(unsigned long ns)
+{
+	if (prctl(PR_SET_TIMERSLACK, ns, 0, 0, 0) < 0)
+		return(-1);
+	dl_slack = ns == 0 ? -1 : (long)ns;
+	return(0);
+}
+
+unsigned long
+dl_getslack(void)
+{
+	int		slack;
+
+	if (dl_slack < 0) {
+		if ((slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0)) < 0)
+			return(0);
+		dl_slack = slack;
+	}
+	return(dl_slack);
+}
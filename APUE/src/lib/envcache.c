@@ -0,0 +1,324 @@
+/*
+ * Thread-safe getenv() without a lock.
+ *
+ * {Prog getenv2} (getenv_r) takes a recursive mutex and compares the
+ * name against every string in environ on every call, so threads that
+ * look things up constantly serialize on the mutex and pay for the
+ * whole scan each time.
+ *
+ * Here we copy the environment into a snapshot that never changes once
+ * built: the strings, and an open-addressed hash table over the names.
+ * A reader finds the current snapshot through one pointer and looks the
+ * name up in O(1), taking no lock and writing nothing shared.  Changes
+ * go through env_set() and env_unset(), which update environ under a
+ * mutex, build a new snapshot from it, and swap the pointer; the old
+ * snapshot is freed once no reader can still be looking at it.
+ *
+ * That last part is a small form of read-copy-update.  Each reading
+ * thread has a slot of its own; while it's inside env_get() the slot
+ * holds the grace-period counter as it was when the reader started, and
+ * outside it holds 0.  After swapping the pointer, the writer advances
+ * the counter and waits until every slot is either 0 or the new value:
+ * any reader that started before the swap has then finished.
+ *
+ *	env_get(name, buf, buflen);	# like getenv_r: 0, ENOSPC, or ENOENT
+ *	env_set(name, value, overwrite);	# like setenv
+ *	env_unset(name);			# like unsetenv
+ *	env_refresh();				# after changing environ some other way
+ */
+
+#include "apue.h"
+#include "envcache.h"
+#include "forklock.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#define	ENV_CACHELINE	64
+#define	ENV_EMPTY		UINT32_MAX
+
+extern char	**environ;
+
+struct env_slot {
+	uint32_t	s_hash;
+	uint32_t	s_off;		/* "name=value" in e_strs, or ENV_EMPTY */
+	uint32_t	s_namelen;
+	uint32_t	s_vallen;
+};
+
+struct env_snap {
+	uint32_t		 e_mask;	/* number of slots - 1 */
+	char			*e_strs;
+	struct env_slot	 e_slots[];
+};
+
+struct env_reader {
+	unsigned long		 r_ctr;		/* 0, or the grace period we started in */
+	int					 r_dead;	/* thread has exited */
+	struct env_reader	*r_next;
+} __attribute__((aligned(ENV_CACHELINE)));
+
+static struct env_snap		*env_snap;		/* current snapshot */
+static unsigned long		 env_gp = 1;	/* grace-period counter */
+static struct env_reader	*env_readers;
+static pthread_mutex_t		 env_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t		 env_key;
+static pthread_once_t		 env_once = PTHREAD_ONCE_INIT;
+static __thread struct env_reader	*env_mine;
+
+static void
+env_thread_exit(void *arg)
+{
+	struct env_reader	*rp = arg;
+
+	__atomic_store_n(&rp->r_dead, 1, __ATOMIC_RELEASE);
+}
+
+static void
+env_init(void)
+{
+	pthread_key_create(&env_key, env_thread_exit);
+	fl_register(&env_lock, FL_MUTEX, FL_RANK_ENV, NULL);
+}
+
+/*
+ * Find or create the calling thread's reader slot.
+ */
+static struct env_reader *
+env_reader(void)
+{
+	struct env_reader	*rp;
+
+	if ((rp = env_mine) != NULL)
+		return(rp);
+	pthread_once(&env_once, env_init);
+	if (posix_memalign((void **)&rp, ENV_CACHELINE,
+	  sizeof(struct env_reader)) != 0)
+		return(NULL);
+	memset(rp, 0, sizeof(struct env_reader));
+	pthread_setspecific(env_key, rp);
+	pthread_mutex_lock(&env_lock);
+	rp->r_next = env_readers;
+	env_readers = rp;
+	pthread_mutex_unlock(&env_lock);
+	env_mine = rp;
+	return(rp);
+}
+
+/*
+ * FNV-1a over the name, which ends at '=' or the end of the string.
+ */
+static uint32_t
+env_hash(const char *name, uint32_t *lenp)
+{
+	uint32_t	h;
+	const char	*p;
+
+	h = 2166136261U;
+	for (p = name; *p != 0 && *p != '='; p++) {
+		h ^= (unsigned char)*p;
+		h *= 16777619U;
+	}
+	*lenp = p - name;
+	return(h);
+}
+
+static struct env_slot *
+env_find(struct env_snap *sp, const char *name, uint32_t h, uint32_t len)
+{
+	uint32_t		 i;
+	struct env_slot	*slp;
+
+	for (i = h & sp->e_mask; ; i = (i + 1) & sp->e_mask) {
+		slp = &sp->e_slots[i];
+		if (slp->s_off == ENV_EMPTY)
+			return(slp);
+		if (slp->s_hash == h && slp->s_namelen == len &&
+		  memcmp(sp->e_strs + slp->s_off, name, len) == 0)
+			return(slp);
+	}
+}
+
+/*
+ * Copy environ into a new snapshot.  Caller holds env_lock.
+ */
+static struct env_snap *
+env_build(void)
+{
+	int				 i, n;
+	size_t			 nslots, size, len;
+	uint32_t		 h, namelen, off;
+	char			*strs;
+	struct env_snap	*sp;
+	struct env_slot	*slp;
+
+	size = 0;
+	for (n = 0; environ[n] != NULL; n++)
+		size += strlen(environ[n]) + 1;
+	if (size >= ENV_EMPTY) {
+		errno = E2BIG;
+		return(NULL);
+	}
+	for (nslots = 16; nslots < 2 * (size_t)n; nslots *= 2)
+		;	/* at most half full */
+	if ((sp = malloc(sizeof(struct env_snap) +
+	  nslots * sizeof(struct env_slot) + size)) == NULL)
+		return(NULL);
+	sp->e_mask = nslots - 1;
+	sp->e_strs = strs = (char *)&sp->e_slots[nslots];
+	for (i = 0; i < (int)nslots; i++)
+		sp->e_slots[i].s_off = ENV_EMPTY;
+
+	off = 0;
+	for (i = 0; i < n; i++) {
+		if (strchr(environ[i], '=') == NULL)
+			continue;			/* not "name=value" */
+		h = env_hash(environ[i], &namelen);
+		slp = env_find(sp, environ[i], h, namelen);
+		if (slp->s_off != ENV_EMPTY)
+			continue;			/* getenv() finds the first one */
+		len = strlen(environ[i]);
+		memcpy(strs + off, environ[i], len + 1);
+		slp->s_hash = h;
+		slp->s_off = off;
+		slp->s_namelen = namelen;
+		slp->s_vallen = len - namelen - 1;
+		off += len + 1;
+	}
+	return(sp);
+}
+
+/*
+ * Make sp the current snapshot and free the old one once every reader
+ * that might have it is done.  Caller holds env_lock.
+ */
+static void
+env_publish(struct env_snap *sp)
+{
+	unsigned long		 gp, ctr;
+	struct env_snap		*old;
+	struct env_reader	*rp, **rpp;
+
+	old = __atomic_exchange_n(&env_snap, sp, __ATOMIC_SEQ_CST);
+	gp = __atomic_add_fetch(&env_gp, 1, __ATOMIC_SEQ_CST);
+	for (rpp = &env_readers; (rp = *rpp) != NULL; ) {
+		while ((ctr = __atomic_load_n(&rp->r_ctr, __ATOMIC_SEQ_CST)) != 0 &&
+		  ctr != gp)
+			sched_yield();	/* it's in env_get(): a few hundred ns */
+		if (__atomic_load_n(&rp->r_dead, __ATOMIC_ACQUIRE)) {
+			*rpp = rp->r_next;
+			free(rp);
+		} else {
+			rpp = &rp->r_next;
+		}
+	}
+	free(old);
+}
+
+/*
+ * Rebuild the snapshot from environ.  Returns 0 if OK, -1 on error.
+ */
+int
+env_refresh(void)
+{
+	struct env_snap	*sp;
+
+	pthread_once(&env_once, env_init);
+	pthread_mutex_lock(&env_lock);
+	if ((sp = env_build()) == NULL) {
+		pthread_mutex_unlock(&env_lock);
+		return(-1);
+	}
+	env_publish(sp);
+	pthread_mutex_unlock(&env_lock);
+	return(0);
+}
+
+int
+env_get(const char *name, char *buf, int buflen)
+{
+	int					 err;
+	uint32_t			 h, len;
+	struct env_snap		*sp;
+	struct env_slot		*slp;
+	struct env_reader	*rp;
+
+	h = env_hash(name, &len);
+	if (name[len] != 0)
+		return(ENOENT);		/* names can't contain '=' */
+	if ((rp = env_reader()) == NULL) {
+		/* out of memory: read under the writers' lock */
+		pthread_mutex_lock(&env_lock);
+		if (env_snap == NULL)
+			env_snap = env_build();
+		sp = env_snap;
+	} else {
+		for (;;) {
+			__atomic_store_n(&rp->r_ctr,
+			  __atomic_load_n(&env_gp, __ATOMIC_RELAXED), __ATOMIC_SEQ_CST);
+			if ((sp = __atomic_load_n(&env_snap, __ATOMIC_SEQ_CST)) != NULL)
+				break;
+			__atomic_store_n(&rp->r_ctr, 0, __ATOMIC_RELEASE);
+			if (env_refresh() < 0)
+				return(ENOMEM);	/* first call, and no snapshot */
+		}
+	}
+
+	if (sp == NULL) {
+		err = ENOMEM;
+	} else if ((slp = env_find(sp, name, h, len))->s_off == ENV_EMPTY) {
+		err = ENOENT;
+	} else if (slp->s_vallen >= (uint32_t)buflen) {
+		err = ENOSPC;
+	} else {
+		memcpy(buf, sp->e_strs + slp->s_off + len + 1, slp->s_vallen + 1);
+		err = 0;
+	}
+
+	if (rp == NULL)
+		pthread_mutex_unlock(&env_lock);
+	else
+		__atomic_store_n(&rp->r_ctr, 0, __ATOMIC_RELEASE);
+	return(err);
+}
+
+/*
+ * Like setenv() and unsetenv(), and then publish the new environment.
+ * Return 0 if OK, -1 with errno set on error.
+ */
+int
+env_set(const char *name, const char *value, int overwrite)
+{
+	int				 ret;
+	struct env_snap	*sp;
+
+	pthread_once(&env_once, env_init);
+	pthread_mutex_lock(&env_lock);
+	if ((ret = setenv(name, value, overwrite)) == 0) {
+		if ((sp = env_build()) == NULL)
+			ret = -1;
+		else
+			env_publish(sp);
+	}
+	pthread_mutex_unlock(&env_lock);
+	return(ret);
+}
+
+int
+env_unset(const char *name)
+{
+	int				 ret;
+	struct env_snap	*sp;
+
+	pthread_once(&env_once, env_init);
+	pthread_mutex_lock(&env_lock);
+	if ((ret = unsetenv(name)) == 0) {
+		if ((sp = env_build()) == NULL)
+			ret = -1;
+		else
+			env_publish(sp);
+	}
+	pthread_mutex_unlock(&env_lock);
+	return(ret);
+}
@@ -76,6 +76,7 @@ err_dump(const char *fmt, ...)
 	va_start(ap, fmt);
 	err_doit(1, errno, fmt, ap);
 	va_end(ap);
+	alog_flush();	/* abort() doesn't run atexit handlers */
 	abort();		/* dump core and terminate */
 	exit(1);		/* shouldn't get here */
 }
@@ -112,12 +113,23 @@ err_quit(const char *fmt, ...)
 /*
  * Print a message and return to caller.
  * Caller specifies "errnoflag".
+ * If the asynchronous back end is running, just queue the message;
+ * fall back to writing it ourselves if it can't be queued.
  */
 static void
 err_doit(int errnoflag, int error, const char *fmt, va_list ap)
 {
 	char	buf[MAXLINE];
-
+	va_list	aq;
+
+	if (alog_active()) {
+		va_copy(aq, ap);
+		if (alog_doit(-1, errnoflag, error, fmt, aq) == 0) {
+			va_end(aq);
+			return;
+		}
+		va_end(aq);
+	}
 	vsnprintf(buf, MAXLINE-1, fmt, ap);
 	if (errnoflag)
 		snprintf(buf+strlen(buf), MAXLINE-strlen(buf)-1, ": %s",
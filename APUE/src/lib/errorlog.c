@@ -102,13 +102,26 @@ log_exit(int error, const char *fmt, ...)
 /*
  * Print a message and return to caller.
  * Caller specifies "errnoflag" and "priority".
+ * With the asynchronous back end running, the message is queued for
+ * the flusher instead, which writes it to stderr or hands it to syslog()
+ * with its priority.
  */
 static void
 log_doit(int errnoflag, int error, int priority, const char *fmt,
          va_list ap)
 {
 	char	buf[MAXLINE];
-
+	va_list	aq;
+
+	if (alog_active()) {
+		va_copy(aq, ap);
+		if (alog_doit(log_to_stderr ? -1 : priority, errnoflag, error, fmt,
+		  aq) == 0) {
+			va_end(aq);
+			return;
+		}
+		va_end(aq);
+	}
 	vsnprintf(buf, MAXLINE-1, fmt, ap);
 	if (errnoflag)
 		snprintf(buf+strlen(buf), MAXLINE-strlen(buf)-1, ": %s",
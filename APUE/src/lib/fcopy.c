@@ -0,0 +1,400 @@
+/*
+ * Copy a regular file, picking the strategy per file.
+ *
+ * {Prog mcopy2} maps 1 GB windows of both files and does one memcpy()
+ * on one thread: every source page and every destination page is
+ * faulted in, with no read-ahead hints, and the copy goes through user
+ * space even when the kernel could do it by itself.  fcopy() tries, in
+ * order:
+ *
+ *	FCOPY_REFLINK	ioctl(FICLONE): on file systems with shared extents
+ *			(btrfs, XFS) the copy is just a metadata update.
+ *	FCOPY_RANGE	copy_file_range(): the kernel copies, or clones,
+ *			without the data ever reaching user space.
+ *	FCOPY_SENDFILE	sendfile(): same, for older kernels.
+ *	FCOPY_MMAP	nthreads threads share the file in FCOPY_CHUNK pieces;
+ *			each maps its source piece with MADV_SEQUENTIAL (and
+ *			MADV_HUGEPAGE where possible) and pwrite()s it out, so
+ *			no destination page is ever faulted in.  The
+ *			destination is preallocated with fallocate().
+ *	FCOPY_RW	read() and write() through a buffer.
+ *
+ * If a strategy isn't supported for this pair of files (EXDEV, EINVAL,
+ * ENOSYS, EOPNOTSUPP and friends), we fall through to the next one.
+ *
+ * Holes are preserved: except for FCOPY_REFLINK, which clones holes
+ * along with everything else, we only copy the data extents found with
+ * SEEK_DATA and SEEK_HOLE, and set the final size with ftruncate().
+ * The destination should be empty (opened with O_TRUNC).
+ */
+
+#include "apue.h"
+#include "fcopy.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>		/* FICLONE */
+
+#define	FCOPY_CHUNK		(64 * 1024 * 1024)	/* unit of work for a thread */
+#define	FCOPY_MAXTHR	64
+#define	FCOPY_BUFSIZE	(128 * 1024)
+#define	FCOPY_MAXSEND	0x7ffff000			/* largest sendfile() at once */
+
+struct fcopy_ext {
+	off_t	e_off;
+	off_t	e_len;
+};
+
+struct fcopy_work {
+	int					 w_fdin;
+	int					 w_fdout;
+	struct fcopy_ext	*w_chunks;
+	long				 w_nchunks;
+	long				 w_next;	/* next chunk to take, atomically */
+	int					 w_err;		/* first error seen, or 0 */
+};
+
+static const char	*fcopy_names[] = {
+	"auto", "reflink", "copy_file_range", "sendfile", "mmap", "read/write"
+};
+
+const char *
+fcopy_name(int how)
+{
+	if (how < 0 || how > FCOPY_RW)
+		return("?");
+	return(fcopy_names[how]);
+}
+
+/*
+ * Errors meaning "this strategy doesn't work for these files";
+ * anything else is a real I/O error.
+ */
+static int
+fcopy_unsupported(int err)
+{
+	return(err == EXDEV || err == EINVAL || err == ENOSYS ||
+	  err == EOPNOTSUPP || err == ENOTTY || err == EBADF || err == EPERM ||
+	  err == ENODEV);
+}
+
+/*
+ * Find the data extents of fd, using SEEK_DATA and SEEK_HOLE.  If the
+ * file system can't tell us, the whole file is one extent.
+ * Returns the number of extents, or -1 on error.
+ */
+static long
+fcopy_extents(int fd, off_t size, struct fcopy_ext **epp)
+{
+	long				 n, nalloc;
+	off_t				 off, data, hole;
+	struct fcopy_ext	*ep, *tmp;
+
+	n = 0;
+	nalloc = 16;
+	if ((ep = malloc(nalloc * sizeof(struct fcopy_ext))) == NULL)
+		return(-1);
+	for (off = 0; off < size; off = hole) {
+		if ((data = lseek(fd, off, SEEK_DATA)) < 0) {
+			if (errno == ENXIO)
+				break;			/* only a hole from here to the end */
+			if (off == 0) {		/* no SEEK_DATA here: no holes either */
+				data = 0;
+				hole = size;
+				goto add;
+			}
+			free(ep);
+			return(-1);
+		}
+		if ((hole = lseek(fd, data, SEEK_HOLE)) < 0) {
+			free(ep);
+			return(-1);
+		}
+		if (hole > size)
+			hole = size;
+add:
+		if (n == nalloc) {
+			nalloc *= 2;
+			if ((tmp = realloc(ep, nalloc * sizeof(struct fcopy_ext))) == NULL) {
+				free(ep);
+				return(-1);
+			}
+			ep = tmp;
+		}
+		ep[n].e_off = data;
+		ep[n++].e_len = hole - data;
+	}
+	*epp = ep;
+	return(n);
+}
+
+static int
+fcopy_range(int fdin, int fdout, off_t off, off_t len)
+{
+	loff_t	inoff, outoff;
+	ssize_t	n;
+
+	inoff = outoff = off;
+	while (len > 0) {
+		if ((n = copy_file_range(fdin, &inoff, fdout, &outoff, len, 0)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return(-1);
+		}
+		if (n == 0)
+			break;		/* source got shorter */
+		len -= n;
+	}
+	return(0);
+}
+
+static int
+fcopy_sendfile(int fdin, int fdout, off_t off, off_t len)
+{
+	off_t	inoff;
+	ssize_t	n;
+
+	inoff = off;
+	if (lseek(fdout, off, SEEK_SET) < 0)
+		return(-1);
+	while (len > 0) {
+		if ((n = sendfile(fdout, fdin, &inoff, min(len, FCOPY_MAXSEND))) < 0) {
+			if (errno == EINTR)
+				continue;
+			return(-1);
+		}
+		if (n == 0)
+			break;
+		len -= n;
+	}
+	return(0);
+}
+
+static int
+fcopy_rw(int fdin, int fdout, off_t off, off_t len)
+{
+	char	*buf;
+	ssize_t	 n;
+
+	if ((buf = malloc(FCOPY_BUFSIZE)) == NULL)
+		return(-1);
+	while (len > 0) {
+		if ((n = pread(fdin, buf, min(len, FCOPY_BUFSIZE), off)) < 0) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return(-1);
+		}
+		if (n == 0)
+			break;
+		if (pwrite(fdout, buf, n, off) != n) {
+			free(buf);
+			return(-1);
+		}
+		off += n;
+		len -= n;
+	}
+	free(buf);
+	return(0);
+}
+
+/*
+ * Copy one chunk: map the source, write it out from the mapping.
+ */
+static int
+fcopy_mmap_chunk(int fdin, int fdout, off_t off, off_t len)
+{
+	char	*src;
+	off_t	 done;
+	ssize_t	 n;
+
+	src = mmap(0, len, PROT_READ, MAP_SHARED, fdin, off);
+	if (src == MAP_FAILED)
+		return(-1);
+	madvise(src, len, MADV_SEQUENTIAL);
+#ifdef	MADV_HUGEPAGE
+	madvise(src, len, MADV_HUGEPAGE);	/* only a hint; may fail */
+#endif
+	for (done = 0; done < len; done += n) {
+		if ((n = pwrite(fdout, src + done, len - done, off + done)) < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			munmap(src, len);
+			return(-1);
+		}
+	}
+	munmap(src, len);
+	return(0);
+}
+
+static void *
+fcopy_thread(void *arg)
+{
+	struct fcopy_work	*wp = arg;
+	long				 i;
+
+	while ((i = __atomic_fetch_add(&wp->w_next, 1, __ATOMIC_RELAXED)) <
+	  wp->w_nchunks) {
+		if (__atomic_load_n(&wp->w_err, __ATOMIC_RELAXED) != 0)
+			break;
+		if (fcopy_mmap_chunk(wp->w_fdin, wp->w_fdout, wp->w_chunks[i].e_off,
+		  wp->w_chunks[i].e_len) < 0) {
+			__atomic_store_n(&wp->w_err, errno, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	return(0);
+}
+
+/*
+ * Split the extents into FCOPY_CHUNK pieces (page aligned, since each
+ * is mmap()ed on its own) and let nthreads threads copy them.
+ */
+static int
+fcopy_mmap(int fdin, int fdout, struct fcopy_ext *ep, long next, int nthreads)
+{
+	long				 i, n, nalloc;
+	off_t				 off, end, pagemask;
+	int					 t, err;
+	pthread_t			 tid[FCOPY_MAXTHR];
+	struct fcopy_work	 work;
+
+	pagemask = sysconf(_SC_PAGESIZE) - 1;
+	for (i = 0, nalloc = 0; i < next; i++)
+		nalloc += ep[i].e_len / FCOPY_CHUNK + 2;
+	if ((work.w_chunks = malloc(nalloc * sizeof(struct fcopy_ext))) == NULL)
+		return(-1);
+	for (i = 0, n = 0; i < next; i++) {
+		/* SEEK_DATA offsets are block aligned, but be sure */
+		off = ep[i].e_off & ~pagemask;
+		end = ep[i].e_off + ep[i].e_len;
+		fallocate(fdout, 0, off, end - off);	/* only a hint; may fail */
+		for (; off < end; off += FCOPY_CHUNK) {
+			work.w_chunks[n].e_off = off;
+			work.w_chunks[n++].e_len = min(end - off, FCOPY_CHUNK);
+		}
+	}
+	work.w_fdin = fdin;
+	work.w_fdout = fdout;
+	work.w_nchunks = n;
+	work.w_next = 0;
+	work.w_err = 0;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > FCOPY_MAXTHR)
+		nthreads = FCOPY_MAXTHR;
+	if (nthreads > n)
+		nthreads = n;
+	for (t = 1; t < nthreads; t++) {
+		if ((err = pthread_create(&tid[t], NULL, fcopy_thread, &work)) != 0)
+			break;		/* make do with the threads we have */
+	}
+	nthreads = t;
+	fcopy_thread(&work);	/* the caller works too */
+	for (t = 1; t < nthreads; t++)
+		pthread_join(tid[t], NULL);
+	free(work.w_chunks);
+	if (work.w_err != 0) {
+		errno = work.w_err;
+		return(-1);
+	}
+	return(0);
+}
+
+/*
+ * Copy every extent with one strategy.  Returns 0 if OK, -1 if the
+ * strategy isn't supported here (and nothing was written), or -2 on an
+ * I/O error.
+ */
+static int
+fcopy_with(int how, int fdin, int fdout, struct fcopy_ext *ep, long next,
+  int nthreads)
+{
+	long	i;
+	int		r;
+
+	if (how == FCOPY_MMAP) {
+		if (fcopy_mmap(fdin, fdout, ep, next, nthreads) == 0)
+			return(0);
+		return(fcopy_unsupported(errno) ? -1 : -2);
+	}
+	for (i = 0; i < next; i++) {
+		if (how == FCOPY_RANGE)
+			r = fcopy_range(fdin, fdout, ep[i].e_off, ep[i].e_len);
+		else if (how == FCOPY_SENDFILE)
+			r = fcopy_sendfile(fdin, fdout, ep[i].e_off, ep[i].e_len);
+		else
+			r = fcopy_rw(fdin, fdout, ep[i].e_off, ep[i].e_len);
+		if (r < 0) {
+			/*
+			 * Only the first extent can tell us the strategy doesn't
+			 * apply; after that we've written data and must not start
+			 * over with another one.
+			 */
+			if (i == 0 && how != FCOPY_RW && fcopy_unsupported(errno))
+				return(-1);
+			return(-2);
+		}
+	}
+	return(0);
+}
+
+/*
+ * Copy the regular file open on fdin to the empty file open on fdout.
+ * "how" is FCOPY_AUTO, or one strategy to use (falling back to the later
+ * ones if it isn't supported); nthreads is for FCOPY_MMAP.
+ * Returns the strategy that did the copy, or -1 on error.
+ */
+int
+fcopy(int fdin, int fdout, int how, int nthreads)
+{
+	struct stat			 sbuf;
+	struct fcopy_ext	*ep;
+	long				 next;
+	int					 r;
+
+	if (how < FCOPY_AUTO || how > FCOPY_RW) {
+		errno = EINVAL;
+		return(-1);
+	}
+	if (fstat(fdin, &sbuf) < 0)
+		return(-1);
+	if (!S_ISREG(sbuf.st_mode)) {
+		errno = EINVAL;
+		return(-1);
+	}
+	posix_fadvise(fdin, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if (how <= FCOPY_REFLINK) {
+		if (ioctl(fdout, FICLONE, fdin) == 0)
+			return(FCOPY_REFLINK);
+		if (!fcopy_unsupported(errno))
+			return(-1);
+		how = FCOPY_RANGE;
+	}
+
+	if ((next = fcopy_extents(fdin, sbuf.st_size, &ep)) < 0)
+		return(-1);
+	for (; how <= FCOPY_RW; how++) {
+		if ((r = fcopy_with(how, fdin, fdout, ep, next, nthreads)) == 0)
+			break;
+		if (r == -2) {
+			free(ep);
+			return(-1);
+		}
+	}
+	free(ep);
+
+	/*
+	 * Trailing holes, and the size of a file that's all hole.
+	 */
+	if (ftruncate(fdout, sbuf.st_size) < 0)
+		return(-1);
+	return(how);
+}
@@ -0,0 +1,204 @@
+/*
+ * Fork-safe locks.
+ *
+ * fork() in a threaded process copies only the calling thread.  A lock
+ * that another thread held at that moment is held forever in the child,
+ * whose first attempt to log or to touch the locked data deadlocks.
+ * {Prog atfork} fixes this for two locks with pthread_atfork() handlers
+ * that take both before the fork and release them afterwards.  Doing
+ * the same in each library module doesn't work: the handlers of
+ * different modules run in an order no one chose (prepare handlers in
+ * reverse order of registration), and a module that takes another
+ * module's lock while holding its own can deadlock against it in the
+ * prepare handlers.  And locks created at run time, one per object,
+ * can't each have their own handlers.
+ *
+ * So modules register their locks here with a rank, and one set of
+ * handlers takes all of them in increasing rank (registration order
+ * within a rank) before the fork and releases them in the reverse order
+ * in the parent and the child.  Ranks are those of the lock hierarchy:
+ * code holding a lock may only take locks of higher rank, which is also
+ * the order the prepare handler uses, so it can't deadlock with running
+ * threads.  Workers need not be stopped: the fork waits only for the
+ * critical sections in progress to end.  An application's locks rank
+ * below all of the library's, from FL_RANK_USER, since a program may
+ * call into the library with its own locks held; the library never
+ * calls out with one of its locks held.
+ *
+ * A lock may come with a function the child calls once all the locks
+ * are released, to drop state that made sense only with the parent's
+ * threads, such as a background thread that no longer exists.
+ * Process-shared locks ({Prog fsem}) must not be registered: the other
+ * processes using them keep running through the fork.
+ *
+ * The library registers all of its own process-private locks but two
+ * kinds.  rlock.c's shared wait-for table lock g_lock is process-shared.
+ * pwalk.c's queue locks live only for one pw_walk() call, and the walk
+ * exists only in the calling thread, which the child doesn't have.
+ *
+ *	fl_register(&lock, FL_MUTEX, FL_RANK_USER, NULL);
+ *	fl_register(&rwlock, FL_RWLOCK, FL_RANK_USER + 1, childfn);
+ *	fl_unregister(&lock);			# before destroying it
+ */
+
+#include "apue.h"
+#include "forklock.h"
+#include <errno.h>
+
+struct fl_ent {
+	void	 *e_lock;
+	int		  e_kind;
+	int		  e_rank;
+	void	(*e_child)(void);
+};
+
+static struct fl_ent	*fl_tab;		/* sorted by rank */
+static int				 fl_n;
+static int				 fl_max;
+static pthread_mutex_t	 fl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t	 fl_once = PTHREAD_ONCE_INIT;
+
+static void
+fl_acquire(struct fl_ent *ep)
+{
+	switch (ep->e_kind) {
+	case FL_MUTEX:
+		pthread_mutex_lock(ep->e_lock);
+		break;
+	case FL_RWLOCK:
+		pthread_rwlock_wrlock(ep->e_lock);
+		break;
+	case FL_SPIN:
+		pthread_spin_lock(ep->e_lock);
+		break;
+	}
+}
+
+static void
+fl_release(struct fl_ent *ep)
+{
+	switch (ep->e_kind) {
+	case FL_MUTEX:
+		pthread_mutex_unlock(ep->e_lock);
+		break;
+	case FL_RWLOCK:
+		pthread_rwlock_unlock(ep->e_lock);
+		break;
+	case FL_SPIN:
+		pthread_spin_unlock(ep->e_lock);
+		break;
+	}
+}
+
+/*
+ * The table's own lock is taken first, so nothing registers or
+ * unregisters while a fork is in progress.
+ */
+static void
+fl_prepare(void)
+{
+	int		i;
+
+	pthread_mutex_lock(&fl_lock);
+	for (i = 0; i < fl_n; i++)
+		fl_acquire(&fl_tab[i]);
+}
+
+static void
+fl_parent(void)
+{
+	int		i;
+
+	for (i = fl_n - 1; i >= 0; i--)
+		fl_release(&fl_tab[i]);
+	pthread_mutex_unlock(&fl_lock);
+}
+
+/*
+ * glibc knows a rwlock's writer by thread ID, which is new in the child,
+ * so unlocking it there would count as a read unlock; the child has one
+ * thread, so we make the rwlocks afresh instead.  Hence registered
+ * rwlocks must have the default attributes.
+ */
+static void
+fl_child(void)
+{
+	int		i;
+
+	for (i = fl_n - 1; i >= 0; i--) {
+		if (fl_tab[i].e_kind == FL_RWLOCK)
+			pthread_rwlock_init(fl_tab[i].e_lock, NULL);
+		else
+			fl_release(&fl_tab[i]);
+	}
+	pthread_mutex_unlock(&fl_lock);
+	for (i = 0; i < fl_n; i++)
+		if (fl_tab[i].e_child != NULL)
+			fl_tab[i].e_child();
+}
+
+static void
+fl_init(void)
+{
+	pthread_atfork(fl_prepare, fl_parent, fl_child);
+}
+
+/*
+ * Register a lock of the given kind and rank; child, if not null, is
+ * called in the child after every fork.  Returns 0, or -1 with errno
+ * set.
+ */
+int
+fl_register(void *lock, int kind, int rank, void (*child)(void))
+{
+	int				 i;
+	struct fl_ent	*tab;
+
+	if (kind < FL_MUTEX || kind > FL_SPIN) {
+		errno = EINVAL;
+		return(-1);
+	}
+	pthread_once(&fl_once, fl_init);
+	pthread_mutex_lock(&fl_lock);
+	if (fl_n == fl_max) {
+		if ((tab = realloc(fl_tab, (fl_max ? fl_max * 2 : 32) *
+		  sizeof(struct fl_ent))) == NULL) {
+			pthread_mutex_unlock(&fl_lock);
+			return(-1);
+		}
+		fl_tab = tab;
+		fl_max = fl_max ? fl_max * 2 : 32;
+	}
+	for (i = fl_n; i > 0 && fl_tab[i - 1].e_rank > rank; i--)
+		fl_tab[i] = fl_tab[i - 1];
+	fl_tab[i].e_lock = lock;
+	fl_tab[i].e_kind = kind;
+	fl_tab[i].e_rank = rank;
+	fl_tab[i].e_child = child;
+	fl_n++;
+	pthread_mutex_unlock(&fl_lock);
+	return(0);
+}
+
+/*
+ * Returns 0, or -1 with errno ENOENT if the lock isn't registered.
+ */
+int
+fl_unregister(void *lock)
+{
+	int		i;
+
+	pthread_mutex_lock(&fl_lock);
+	for (i = 0; i < fl_n; i++)
+		if (fl_tab[i].e_lock == lock)
+			break;
+	if (i == fl_n) {
+		pthread_mutex_unlock(&fl_lock);
+		errno = ENOENT;
+		return(-1);
+	}
+	fl_n--;
+	memmove(&fl_tab[i], &fl_tab[i + 1], (fl_n - i) * sizeof(struct fl_ent));
+	pthread_mutex_unlock(&fl_lock);
+	return(0);
+}
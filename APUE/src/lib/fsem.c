@@ -0,0 +1,366 @@
+/*
+ * A process-shared semaphore and mutex living in a shared memory
+ * segment, to replace the System V semaphores of semaph.c.
+ *
+ *	p = psync_map(name, size, &created);	# create or open the segment
+ *	fsem_init(sp, initval);			# creator only, then
+ *	psync_ready(p);				# let the openers in
+ *	fsem_wait(sp);				# wait = P = down by 1
+ *	fsem_post(sp);				# signal = V = up by 1
+ *	fsem_op(sp, amount);			# wait   if (amount < 0)
+ *						# signal if (amount > 0)
+ *	fmutex_lock(mp); fmutex_unlock(mp);	# robust mutual exclusion
+ *	psync_unmap(p, size);			# close
+ *
+ * With semaph.c every P and V is a semop() system call, even when no
+ * one has to wait.  Here the semaphore count is a futex word: P and V
+ * are an atomic compare-and-swap or add in user space, and we only enter
+ * the kernel to sleep when the count is zero, or to wake someone who is
+ * asleep.
+ *
+ * Creation no longer needs the lock member and the retry loop.  The
+ * creator is whoever wins shm_open(O_CREAT|O_EXCL); everyone else waits
+ * on a ready word at the front of the segment until the creator has
+ * initialized it.  Not forever, though: an opener gives up with
+ * EOWNERDEAD if the creator dies first, and with ETIMEDOUT if the
+ * segment isn't ready within PSYNC_WAITMS, as when the creator died
+ * before it could even size the segment.
+ *
+ * SEM_UNDO was used to recover when a process died holding the lock.
+ * For mutual exclusion use fmutex_lock(): a robust, process-shared
+ * mutex that the kernel hands to the next locker, with EOWNERDEAD, when
+ * its owner dies.  A counting semaphore has no owner, so, as with
+ * POSIX semaphores, there is no undo for fsem_wait().
+ */
+
+#include "apue.h"
+#include "fsem.h"
+#include "deadline.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define	PSYNC_HDRSZ	64		/* keeps the caller's data cache aligned */
+#define	FSEM_SPIN	100		/* tries before going to sleep */
+#define	PSYNC_WAITMS	5000	/* openers wait this long for the creator */
+#define	PSYNC_POLLMS	10		/* checking this often that it's alive */
+
+static int	fsem_spin = -1;	/* FSEM_SPIN, or 0 on a uniprocessor */
+
+/*
+ * The front of every segment.
+ */
+struct psync_hdr {
+	unsigned int	ready;		/* set once the creator has initialized */
+	pid_t			creator;	/* 0 until the creator has mapped it */
+};
+
+/*
+ * Has process pid exited?  A pidfd becomes readable when it does, which,
+ * unlike kill(pid, 0), tells a zombie from a live process.
+ */
+static int
+psync_gone(pid_t pid)
+{
+	int				fd, gone;
+	struct pollfd	pfd;
+
+	if ((fd = syscall(SYS_pidfd_open, pid, 0)) < 0)
+		return(errno == ESRCH);
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	gone = poll(&pfd, 1, 0) > 0;
+	close(fd);
+	return(gone);
+}
+
+/****************************************************************************
+ * Create or open a shared segment of "size" bytes for semaphores, mutexes
+ * and whatever they protect.  With a NULL name the segment is anonymous
+ * and shared with our children after fork().  *createdp is set nonzero if
+ * we created the segment, in which case the caller must initialize it and
+ * then call psync_ready().  We return the address, or NULL on error;
+ * errno EOWNERDEAD or ETIMEDOUT means the creator died or never finished.
+ */
+void *
+psync_map(const char *name, size_t size, int *createdp)
+{
+	int					 fd, created, err;
+	pid_t				 pid;
+	long long			 left;
+	struct stat			 sbuf;
+	struct timespec		 dl, ts;
+	struct psync_hdr	*hp;
+
+	size += PSYNC_HDRSZ;
+	if (name == NULL) {
+		hp = mmap(0, size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (hp == MAP_FAILED)
+			return(NULL);
+		*createdp = 1;
+		return((char *)hp + PSYNC_HDRSZ);
+	}
+
+	dl_after(&dl, PSYNC_WAITMS * 1000000LL);
+	created = 1;
+	if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, FILE_MODE)) < 0) {
+		if (errno != EEXIST)
+			return(NULL);
+		if ((fd = shm_open(name, O_RDWR, 0)) < 0)
+			return(NULL);
+		created = 0;
+	}
+	if (created) {
+		if (ftruncate(fd, size) < 0) {
+			close(fd);
+			shm_unlink(name);
+			return(NULL);
+		}
+	} else {
+		/*
+		 * The creator may not have sized the segment yet.
+		 */
+		for (;;) {
+			if (fstat(fd, &sbuf) < 0) {
+				close(fd);
+				return(NULL);
+			}
+			if ((size_t)sbuf.st_size >= size)
+				break;
+			if (dl_remaining(&dl) <= 0) {
+				close(fd);
+				errno = ETIMEDOUT;
+				return(NULL);
+			}
+			sleep_us(100);
+		}
+	}
+	hp = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hp == MAP_FAILED)
+		return(NULL);
+
+	if (created) {
+		__atomic_store_n(&hp->creator, getpid(), __ATOMIC_RELAXED);
+	} else {
+		while (__atomic_load_n(&hp->ready, __ATOMIC_ACQUIRE) == 0) {
+			pid = __atomic_load_n(&hp->creator, __ATOMIC_RELAXED);
+			if (pid != 0 && psync_gone(pid)) {
+				err = EOWNERDEAD;
+				goto errout;
+			}
+			if ((left = dl_remaining(&dl)) <= 0) {
+				err = ETIMEDOUT;
+				goto errout;
+			}
+			if (left > PSYNC_POLLMS * 1000000LL)
+				left = PSYNC_POLLMS * 1000000LL;
+			ts.tv_sec = left / 1000000000LL;
+			ts.tv_nsec = left % 1000000000LL;
+			futex_wait(&hp->ready, 0, &ts);
+		}
+	}
+	*createdp = created;
+	return((char *)hp + PSYNC_HDRSZ);
+
+errout:
+	munmap(hp, size);
+	errno = err;
+	return(NULL);
+}
+
+/****************************************************************************
+ * The creator has initialized the segment; let everyone else use it.
+ */
+void
+psync_ready(void *p)
+{
+	struct psync_hdr	*hp;
+
+	hp = (struct psync_hdr *)((char *)p - PSYNC_HDRSZ);
+	__atomic_store_n(&hp->ready, 1, __ATOMIC_RELEASE);
+	futex_wake(&hp->ready, INT_MAX);
+}
+
+/****************************************************************************
+ * Unmap a segment from psync_map().  Removing the name is up to the
+ * caller (shm_unlink()), as with sem_rm().
+ */
+int
+psync_unmap(void *p, size_t size)
+{
+	return(munmap((char *)p - PSYNC_HDRSZ, size + PSYNC_HDRSZ));
+}
+
+/****************************************************************************
+ * Set a semaphore's initial value.  Only the creator should do this.
+ */
+void
+fsem_init(struct fsem *sp, unsigned int initval)
+{
+	sp->value = initval;
+	sp->nwait = 0;
+}
+
+/****************************************************************************
+ * Try to take n units without waiting.  Returns 1 if we got them, else 0.
+ */
+static int
+fsem_take(struct fsem *sp, unsigned int n)
+{
+	unsigned int	v;
+
+	v = __atomic_load_n(&sp->value, __ATOMIC_RELAXED);
+	while (v >= n) {
+		if (__atomic_compare_exchange_n(&sp->value, &v, v - n, 1,
+		  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return(1);
+	}
+	return(0);
+}
+
+/****************************************************************************
+ * Wait until n units are available and take them.
+ * We spin briefly first, since the holder is often just about to post,
+ * unless there is only one CPU, where the holder can't run while we spin.
+ */
+static void
+fsem_down(struct fsem *sp, unsigned int n)
+{
+	int				i;
+	unsigned int	v;
+
+	if (fsem_spin < 0)
+		fsem_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? FSEM_SPIN : 0;
+	for (i = 0; i < fsem_spin; i++) {
+		if (fsem_take(sp, n))
+			return;
+		cpu_relax();
+	}
+	for (;;) {
+		if (fsem_take(sp, n))
+			return;
+
+		/*
+		 * Announce ourselves before checking the value one last time,
+		 * so a poster either sees us or we see its post.
+		 */
+		__atomic_fetch_add(&sp->nwait, 1, __ATOMIC_SEQ_CST);
+		v = __atomic_load_n(&sp->value, __ATOMIC_SEQ_CST);
+		if (v < n)
+			futex_wait(&sp->value, v, NULL);	/* EINTR: just retry */
+		__atomic_fetch_sub(&sp->nwait, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/****************************************************************************
+ * Add n units and wake whoever might now proceed.  Sleepers may be
+ * waiting for different amounts (fsem_op()), so we wake them all and let
+ * them race for the units; usually there is only one.
+ */
+static void
+fsem_up(struct fsem *sp, unsigned int n)
+{
+	__atomic_fetch_add(&sp->value, n, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&sp->nwait, __ATOMIC_SEQ_CST) != 0)
+		futex_wake(&sp->value, INT_MAX);
+}
+
+/****************************************************************************
+ * Wait until a semaphore's value is greater than 0, then decrement
+ * it by 1 and return.
+ * Dijkstra's P operation.  Tanenbaum's DOWN operation.
+ */
+void
+fsem_wait(struct fsem *sp)
+{
+	fsem_down(sp, 1);
+}
+
+/****************************************************************************
+ * Decrement the semaphore if that can be done without waiting.
+ * Returns 0 if OK, else -1 with errno set to EAGAIN.
+ */
+int
+fsem_trywait(struct fsem *sp)
+{
+	if (fsem_take(sp, 1))
+		return(0);
+	errno = EAGAIN;
+	return(-1);
+}
+
+/****************************************************************************
+ * Increment a semaphore by 1.
+ * Dijkstra's V operation.  Tanenbaum's UP operation.
+ */
+void
+fsem_post(struct fsem *sp)
+{
+	fsem_up(sp, 1);
+}
+
+/****************************************************************************
+ * General semaphore operation.  Increment or decrement by a user-specified
+ * amount (positive or negative; amount can't be zero).
+ */
+void
+fsem_op(struct fsem *sp, int value)
+{
+	if (value == 0)
+		err_quit("can't have value == 0");
+	if (value < 0)
+		fsem_down(sp, -value);
+	else
+		fsem_up(sp, value);
+}
+
+/****************************************************************************
+ * Initialize a mutex in shared memory: process-shared and robust.
+ * glibc implements these with a futex word too, so an uncontended
+ * lock and unlock never enter the kernel.
+ * Returns 0 if OK, else an error number.
+ */
+int
+fmutex_init(pthread_mutex_t *mp)
+{
+	int					err;
+	pthread_mutexattr_t	attr;
+
+	if ((err = pthread_mutexattr_init(&attr)) != 0)
+		return(err);
+	if ((err = pthread_mutexattr_setpshared(&attr,
+	  PTHREAD_PROCESS_SHARED)) == 0 &&
+	  (err = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST)) == 0)
+		err = pthread_mutex_init(mp, &attr);
+	pthread_mutexattr_destroy(&attr);
+	return(err);
+}
+
+/****************************************************************************
+ * Lock a mutex from fmutex_init().  If the previous owner died holding
+ * it, we mark the mutex consistent again and return EOWNERDEAD: the caller
+ * now holds the lock, but must repair whatever the dead owner left
+ * half-done.  Otherwise returns 0, or an error number.
+ */
+int
+fmutex_lock(pthread_mutex_t *mp)
+{
+	int		err;
+
+	if ((err = pthread_mutex_lock(mp)) == EOWNERDEAD) {
+		if (pthread_mutex_consistent(mp) != 0)
+			err_dump("can't make mutex consistent");
+	}
+	return(err);
+}
+
+int
+fmutex_unlock(pthread_mutex_t *mp)
+{
+	return(pthread_mutex_unlock(mp));
+}
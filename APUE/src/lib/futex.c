@@ -0,0 +1,38 @@
+/*
+ * Thin wrappers around the Linux futex(2) system call, shared by the
+ * process-shared semaphore, the shared-memory channel and anything else
+ * that sleeps on a 32-bit word.  We never use FUTEX_PRIVATE_FLAG, so the
+ * word may live in memory shared between processes.
+ */
+
+#include "apue.h"
+#include <errno.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/*
+ * Sleep as long as *addr still equals val.  A relative timeout may be
+ * given; NULL means forever.  Returns 0 when woken (or when *addr had
+ * already changed), -1 with errno set to ETIMEDOUT or EINTR otherwise.
+ */
+int
+futex_wait(unsigned int *addr, unsigned int val, const struct timespec *tsp)
+{
+	if (syscall(SYS_futex, addr, FUTEX_WAIT, val, tsp, NULL, 0) < 0) {
+		if (errno == EAGAIN)
+			return(0);		/* value changed before we slept */
+		return(-1);
+	}
+	return(0);
+}
+
+/*
+ * Wake up to n processes or threads sleeping on addr.
+ * Returns the number woken.
+ */
+int
+futex_wake(unsigned int *addr, int n)
+{
+	return(syscall(SYS_futex, addr, FUTEX_WAKE, n, NULL, NULL, 0));
+}
@@ -0,0 +1,214 @@
+/*
+ * Job dispatch with one queue per worker thread.
+ *
+ * In {Prog job_queue} a single reader-writer lock guards one doubly linked
+ * list of jobs: the master takes the write lock for every insert, and each
+ * worker takes the read lock and scans the whole list for jobs with its
+ * own thread ID, then takes the write lock again to remove each one.  All
+ * threads fight over one lock and one list, so adding cores adds contention.
+ *
+ * Here each worker registers and gets its own queue, found from its
+ * thread ID through a small hash table.  The master pushes a job onto the
+ * target worker's queue with a single compare-and-swap, with no lock at
+ * all; since there is exactly one consumer per queue, the worker empties
+ * its queue in one atomic exchange and gets every job pending for it in a
+ * batch, restored to arrival order.  An idle worker sleeps on a futex word
+ * in its queue; the master only makes the futex_wake() system call when
+ * the worker has said it is asleep.
+ *
+ *	dispatch_init(dp, maxworkers);
+ *	wq = dispatch_register(dp, pthread_self());	# in each worker
+ *	job_dispatch(dp, jp);				# master; jp->j_id picks the queue
+ *	list = job_takeall(wq, 1);			# worker; 1 = wait for work
+ */
+
+#include "apue.h"
+#include "jobq.h"
+#include "forklock.h"
+#include <errno.h>
+
+/*
+ * pthread_t is an integer or a pointer on the systems we care about.
+ */
+static unsigned int
+jobq_hash(pthread_t tid)
+{
+	unsigned long	h;
+
+	h = (unsigned long)tid;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdUL;
+	h ^= h >> 33;
+	return((unsigned int)h);
+}
+
+/*
+ * Set up a dispatcher for at most maxworkers workers.
+ * Returns 0 if OK, else an error number.
+ */
+int
+dispatch_init(struct dispatch *dp, int maxworkers)
+{
+	unsigned int	n;
+	int				err;
+
+	if (maxworkers <= 0)
+		return(EINVAL);
+	for (n = 1; n < 2 * (unsigned int)maxworkers; n <<= 1)
+		;
+	if ((err = posix_memalign((void **)&dp->d_queues, JOBQ_CACHELINE,
+	  maxworkers * sizeof(struct workq))) != 0)
+		return(err);
+	memset(dp->d_queues, 0, maxworkers * sizeof(struct workq));
+	if ((dp->d_hash = calloc(n, sizeof(int))) == NULL) {
+		free(dp->d_queues);
+		return(ENOMEM);
+	}
+	dp->d_hashmask = n - 1;
+	dp->d_max = maxworkers;
+	dp->d_nworkers = 0;
+	if ((err = pthread_mutex_init(&dp->d_lock, NULL)) != 0) {
+		free(dp->d_hash);
+		free(dp->d_queues);
+		return(err);
+	}
+	if (fl_register(&dp->d_lock, FL_MUTEX, FL_RANK_QUEUE, NULL) < 0) {
+		err = errno;
+		pthread_mutex_destroy(&dp->d_lock);
+		free(dp->d_hash);
+		free(dp->d_queues);
+		return(err);
+	}
+	return(0);
+}
+
+/*
+ * Free a dispatcher.  Jobs still queued are the caller's problem.
+ */
+void
+dispatch_destroy(struct dispatch *dp)
+{
+	fl_unregister(&dp->d_lock);
+	pthread_mutex_destroy(&dp->d_lock);
+	free(dp->d_hash);
+	free(dp->d_queues);
+}
+
+/*
+ * Give thread tid its own queue.  Returns the queue, or NULL with errno
+ * set to ENOSPC if all maxworkers queues are taken.
+ */
+struct workq *
+dispatch_register(struct dispatch *dp, pthread_t tid)
+{
+	unsigned int	 i;
+	struct workq	*wq;
+
+	if ((wq = dispatch_find(dp, tid)) != NULL)
+		return(wq);		/* already registered */
+	pthread_mutex_lock(&dp->d_lock);
+	if (dp->d_nworkers == dp->d_max) {
+		pthread_mutex_unlock(&dp->d_lock);
+		errno = ENOSPC;
+		return(NULL);
+	}
+	wq = &dp->d_queues[dp->d_nworkers];
+	wq->wq_tid = tid;
+	for (i = jobq_hash(tid) & dp->d_hashmask; dp->d_hash[i] != 0;
+	  i = (i + 1) & dp->d_hashmask)
+		;
+	/* publish the slot after wq_tid, for lock-free lookups */
+	__atomic_store_n(&dp->d_hash[i], ++dp->d_nworkers, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&dp->d_lock);
+	return(wq);
+}
+
+/*
+ * Find thread tid's queue, without locking.  Returns NULL if tid never
+ * registered.
+ */
+struct workq *
+dispatch_find(struct dispatch *dp, pthread_t tid)
+{
+	unsigned int	 i;
+	int				 slot;
+	struct workq	*wq;
+
+	for (i = jobq_hash(tid) & dp->d_hashmask;
+	  (slot = __atomic_load_n(&dp->d_hash[i], __ATOMIC_ACQUIRE)) != 0;
+	  i = (i + 1) & dp->d_hashmask) {
+		wq = &dp->d_queues[slot - 1];
+		if (pthread_equal(wq->wq_tid, tid))
+			return(wq);
+	}
+	return(NULL);
+}
+
+/*
+ * Hand a job to the thread named by jp->j_id.  Lock-free.
+ * Returns 0 if OK, or -1 with errno set to ESRCH if no such worker.
+ */
+int
+job_dispatch(struct dispatch *dp, struct job *jp)
+{
+	struct workq	*wq;
+	struct job		*head;
+
+	if ((wq = dispatch_find(dp, jp->j_id)) == NULL) {
+		errno = ESRCH;
+		return(-1);
+	}
+	head = __atomic_load_n(&wq->wq_head, __ATOMIC_RELAXED);
+	do {
+		jp->j_next = head;
+	} while (!__atomic_compare_exchange_n(&wq->wq_head, &head, jp, 1,
+	  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+	if (__atomic_load_n(&wq->wq_sleep, __ATOMIC_SEQ_CST) &&
+	  __atomic_exchange_n(&wq->wq_sleep, 0, __ATOMIC_SEQ_CST)) {
+		__atomic_fetch_add(&wq->wq_seq, 1, __ATOMIC_SEQ_CST);
+		futex_wake(&wq->wq_seq, 1);
+	}
+	return(0);
+}
+
+/*
+ * Take every job queued for this worker, oldest first, linked through
+ * j_next.  If wait is nonzero, sleep until there is at least one;
+ * otherwise return NULL if there are none.  Only the queue's own worker
+ * may call this.
+ */
+struct job *
+job_takeall(struct workq *wq, int wait)
+{
+	struct job		*jp, *next, *list;
+	unsigned int	 seq;
+
+	for (;;) {
+		if ((jp = __atomic_exchange_n(&wq->wq_head, NULL,
+		  __ATOMIC_ACQUIRE)) != NULL)
+			break;
+		if (!wait)
+			return(NULL);
+
+		/*
+		 * Say we're going to sleep, then look once more, so that
+		 * job_dispatch() either sees the flag or we see its job.
+		 */
+		seq = __atomic_load_n(&wq->wq_seq, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&wq->wq_sleep, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&wq->wq_head, __ATOMIC_SEQ_CST) == NULL)
+			futex_wait(&wq->wq_seq, seq, NULL);
+		__atomic_store_n(&wq->wq_sleep, 0, __ATOMIC_RELAXED);
+	}
+
+	/*
+	 * The list was pushed newest first; reverse it.
+	 */
+	for (list = NULL; jp != NULL; jp = next) {
+		next = jp->j_next;
+		jp->j_next = list;
+		list = jp;
+	}
+	return(list);
+}
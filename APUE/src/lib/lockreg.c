@@ -10,6 +10,7 @@ lock_reg(int fd, int cmd, int type, off_t offset, int whence, off_t len)
 	lock.l_start = offset;	/* byte offset, relative to l_whence */
 	lock.l_whence = whence;	/* SEEK_SET, SEEK_CUR, SEEK_END */
 	lock.l_len = len;		/* #bytes (0 means to EOF) */
+	lock.l_pid = 0;			/* must be 0 for F_OFD_SETLK and friends */
 
 	return(fcntl(fd, cmd, &lock));
 }
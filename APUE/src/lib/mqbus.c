@@ -0,0 +1,180 @@
+/*
+ * Fan-in from several message queues.
+ *
+ * System V message queues aren't descriptors, so {Prog 17-3} gives each
+ * queue a helper thread that blocks in msgrcv() and copies every message
+ * down a socketpair for the main thread to poll() and read().  That is
+ * a thread per queue, two copies and three system calls per message, and
+ * a context switch whenever a helper wakes.
+ *
+ * On Linux a POSIX message queue descriptor is a file descriptor, so here
+ * the reader polls the queues themselves.  The queues are opened
+ * nonblocking; mqb_recv() drains each readable queue into one buffer it
+ * reuses, up to b_batch messages a queue so a busy queue can't starve the
+ * others, and hands back the whole batch.  A queue that filled its share
+ * is remembered, and the next call then polls without waiting, so under
+ * load there is one poll() per batch and one mq_receive() per message.
+ *
+ *	bp = mqb_open(names, nq, maxmsg, msgsz, batch);
+ *						# 0 for the system defaults
+ *	n = mqb_recv(bp, timeout, &msgs);	# timeout as for poll()
+ *	for (i = 0; i < n; i++)
+ *		use(msgs[i].m_queue, msgs[i].m_data, msgs[i].m_len);
+ *	mqb_close(bp);				# mq_unlink() is up to the caller
+ *
+ * Senders just mq_open() a queue by name and mq_send() to it.
+ */
+
+#include "apue.h"
+#include "mqbus.h"
+#include <errno.h>
+#include <fcntl.h>
+
+/*
+ * Open (creating as necessary) the nq queues named, for reading.  New
+ * queues hold maxmsg messages of msgsz bytes.  Returns NULL on error.
+ */
+struct mqbus *
+mqb_open(const char *const names[], int nq, long maxmsg, long msgsz,
+  int batch)
+{
+	int				i, err;
+	struct mq_attr	attr, *ap;
+	struct mqbus	*bp;
+
+	if (nq <= 0) {
+		errno = EINVAL;
+		return(NULL);
+	}
+	if ((bp = calloc(1, sizeof(struct mqbus))) == NULL)
+		return(NULL);
+	bp->b_nq = nq;
+	bp->b_mq = malloc(nq * sizeof(mqd_t));
+	bp->b_pfd = malloc(nq * sizeof(struct pollfd));
+	bp->b_ready = calloc(nq, 1);
+	if (bp->b_mq == NULL || bp->b_pfd == NULL || bp->b_ready == NULL)
+		goto errout;
+	for (i = 0; i < nq; i++)
+		bp->b_mq[i] = (mqd_t)-1;
+
+	ap = NULL;
+	if (maxmsg > 0 && msgsz > 0) {
+		memset(&attr, 0, sizeof(attr));
+		attr.mq_maxmsg = maxmsg;
+		attr.mq_msgsize = msgsz;
+		ap = &attr;
+	}
+	for (i = 0; i < nq; i++) {
+		if ((bp->b_mq[i] = mq_open(names[i], O_RDONLY | O_CREAT | O_NONBLOCK,
+		  FILE_MODE, ap)) == (mqd_t)-1)
+			goto errout;
+		/*
+		 * A queue that already existed keeps its own attributes.
+		 */
+		if (mq_getattr(bp->b_mq[i], &attr) < 0)
+			goto errout;
+		if (attr.mq_msgsize > bp->b_msgsz)
+			bp->b_msgsz = attr.mq_msgsize;
+		if (batch <= 0 && attr.mq_maxmsg > bp->b_batch)
+			bp->b_batch = attr.mq_maxmsg;
+		bp->b_pfd[i].fd = bp->b_mq[i];
+		bp->b_pfd[i].events = POLLIN;
+	}
+	if (batch > 0)
+		bp->b_batch = batch;
+
+	bp->b_buf = malloc((size_t)nq * bp->b_batch * bp->b_msgsz);
+	bp->b_msgs = malloc((size_t)nq * bp->b_batch * sizeof(struct mqb_msg));
+	if (bp->b_buf == NULL || bp->b_msgs == NULL)
+		goto errout;
+	return(bp);
+
+errout:
+	err = errno;
+	mqb_close(bp);
+	errno = err;
+	return(NULL);
+}
+
+/*
+ * Wait up to timeout milliseconds (-1 for ever) for messages and return
+ * everything we took, through *msgpp.  Returns the number of messages, 0
+ * on timeout, or -1 on error.
+ */
+int
+mqb_recv(struct mqbus *bp, int timeout, struct mqb_msg **msgpp)
+{
+	int				i, j, n, nready;
+	char			*p;
+	ssize_t			len;
+	struct mqb_msg	*mp;
+
+	for (;;) {
+		/*
+		 * If a queue had more than its share last time, don't wait;
+		 * poll anyway, so the other queues get their turn.
+		 */
+		nready = 0;
+		for (i = 0; i < bp->b_nq; i++)
+			nready += bp->b_ready[i];
+		bp->b_npoll++;
+		if ((n = poll(bp->b_pfd, bp->b_nq, nready ? 0 : timeout)) < 0)
+			return(-1);
+		if (n == 0 && nready == 0)
+			return(0);			/* timed out */
+
+		mp = bp->b_msgs;
+		p = bp->b_buf;
+		n = 0;
+		for (i = 0; i < bp->b_nq; i++) {
+			if (!bp->b_ready[i] && bp->b_pfd[i].revents == 0)
+				continue;
+			bp->b_ready[i] = 0;
+			for (j = 0; j < bp->b_batch; j++) {
+				bp->b_nrecv++;
+				if ((len = mq_receive(bp->b_mq[i], p, bp->b_msgsz,
+				  &mp->m_prio)) < 0)
+					break;
+				mp->m_queue = i;
+				mp->m_len = len;
+				mp->m_data = p;
+				mp++;
+				p += bp->b_msgsz;
+				n++;
+			}
+			if (j == bp->b_batch) {
+				bp->b_ready[i] = 1;		/* there may be more */
+			} else if (errno != EAGAIN) {
+				if (n > 0)
+					break;		/* report it next time */
+				return(-1);
+			}
+		}
+		if (n > 0 || timeout == 0) {
+			bp->b_nmsg += n;
+			*msgpp = bp->b_msgs;
+			return(n);
+		}
+		/*
+		 * The queues we expected something from were empty after
+		 * all; now really wait.
+		 */
+	}
+}
+
+void
+mqb_close(struct mqbus *bp)
+{
+	int		i;
+
+	if (bp->b_mq != NULL)
+		for (i = 0; i < bp->b_nq; i++)
+			if (bp->b_mq[i] != (mqd_t)-1)
+				mq_close(bp->b_mq[i]);
+	free(bp->b_mq);
+	free(bp->b_pfd);
+	free(bp->b_ready);
+	free(bp->b_buf);
+	free(bp->b_msgs);
+	free(bp);
+}
@@ -0,0 +1,539 @@
+/*
+ * Walk a file tree with several threads.
+ *
+ * {Prog ftw8} descends one directory at a time on one thread, building
+ * every pathname in a single buffer and calling lstat() on it, so the
+ * kernel looks up every component of every pathname again, and nothing
+ * else happens while we wait for a directory block to come off the disk.
+ *
+ * Here the unit of work is a directory.  Each thread has its own queue
+ * of directories still to be read: it takes the newest one from its own
+ * queue (depth first, so few directories are held open), and when that
+ * is empty it steals the oldest one from some other thread, which is
+ * likely to be the top of a big subtree.  A queued directory is a name
+ * relative to its parent's open descriptor, and we use openat() and
+ * fstatat() on it, so there are no pathnames at all.  Directories are
+ * read with getdents64() into a big buffer, and the d_type the file
+ * system gives us in each entry saves the stat for everything but
+ * directories we couldn't open, unless the caller asks for PW_STAT.
+ *
+ *	pwalk(pathname, nthreads, flags, func, arg);
+ *
+ * func is called for every file, from any of the threads, with a
+ * struct pw_ent whose pe_thread lets the caller keep per-thread totals
+ * and add them up afterward, instead of sharing counters.  Directories
+ * are reported before anything in them.  We return 0 when the walk is
+ * done, the first other value func returned (after the other threads
+ * have stopped), or -1 with errno set if we couldn't start.
+ *
+ * A PW_D callback can leave a pointer in *pe_data, which the callbacks
+ * for everything in that directory get back as pe_pdata; and it can
+ * call pwalk_queue() to name subdirectories itself and return PW_SKIP,
+ * so that a directory known not to have changed isn't read again.
+ */
+
+#include "apue.h"
+#include "pwalk.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+
+#define	PW_BUFSIZE		(256 * 1024)	/* getdents64() buffer, per thread */
+#define	PW_CACHELINE	64
+
+struct linux_dirent64 {
+	uint64_t		d_ino;
+	int64_t			d_off;
+	unsigned short	d_reclen;
+	unsigned char	d_type;
+	char			d_name[];
+};
+
+/*
+ * An open directory.  It stays open until the last of its queued
+ * subdirectories has been opened relative to it.
+ */
+struct pw_dir {
+	int				 pd_fd;
+	int				 pd_depth;
+	int				 pd_refs;
+	void			*pd_data;	/* the caller's, from pe_data */
+	struct pw_dir	*pd_parent;
+};
+
+/*
+ * A directory waiting to be read: pi_name in pi_parent, or the
+ * pathname given to pwalk() if pi_parent is NULL.
+ */
+struct pw_item {
+	struct pw_dir	*pi_parent;
+	char			 pi_name[];
+};
+
+/*
+ * Each thread's queue.  The owner pushes and pops at the tail; thieves
+ * take from the head.
+ */
+struct pw_queue {
+	pthread_mutex_t	  pq_lock;
+	struct pw_item	**pq_items;
+	size_t			  pq_head;
+	size_t			  pq_tail;
+	size_t			  pq_size;
+} __attribute__((aligned(PW_CACHELINE)));
+
+struct pw_walk {
+	Pwfunc			*pw_func;
+	void			*pw_arg;
+	int				 pw_flags;
+	int				 pw_nthreads;
+	struct pw_queue	*pw_queues;
+	long			 pw_pending;	/* directories queued or being read */
+	unsigned int	 pw_seq;		/* futex word for idle threads */
+	int				 pw_nsleep;
+	int				 pw_stop;		/* func() said stop: drain the queues */
+	int				 pw_ret;
+};
+
+/*
+ * What pe_priv points to during a PW_D callback, for pwalk_queue().
+ */
+struct pw_ctx {
+	struct pw_walk	*pc_walk;
+	int				 pc_id;
+	struct pw_dir	*pc_dir;
+	int				 pc_npushed;
+};
+
+struct pw_thread {
+	struct pw_walk	*pt_walk;
+	int				 pt_id;
+};
+
+static void
+pw_release(struct pw_dir *dp)
+{
+	struct pw_dir	*parent;
+
+	while (dp != NULL &&
+	  __atomic_sub_fetch(&dp->pd_refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		parent = dp->pd_parent;
+		close(dp->pd_fd);
+		free(dp);
+		dp = parent;
+	}
+}
+
+/*
+ * Wake n idle threads, if there are any.
+ */
+static void
+pw_wakeup(struct pw_walk *wp, int n)
+{
+	if (__atomic_load_n(&wp->pw_nsleep, __ATOMIC_SEQ_CST) > 0) {
+		__atomic_fetch_add(&wp->pw_seq, 1, __ATOMIC_SEQ_CST);
+		futex_wake(&wp->pw_seq, n);
+	}
+}
+
+static int
+pw_push(struct pw_walk *wp, int id, struct pw_dir *parent, const char *name)
+{
+	size_t			 len, n;
+	struct pw_item	*ip, **items;
+	struct pw_queue	*qp;
+
+	len = strlen(name);
+	if ((ip = malloc(sizeof(struct pw_item) + len + 1)) == NULL)
+		return(-1);
+	ip->pi_parent = parent;
+	memcpy(ip->pi_name, name, len + 1);
+	if (parent != NULL)
+		__atomic_add_fetch(&parent->pd_refs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&wp->pw_pending, 1, __ATOMIC_RELAXED);
+
+	qp = &wp->pw_queues[id];
+	pthread_mutex_lock(&qp->pq_lock);
+	if (qp->pq_tail == qp->pq_size) {
+		if (qp->pq_head > 0) {		/* slide down over what was stolen */
+			n = qp->pq_tail - qp->pq_head;
+			memmove(qp->pq_items, qp->pq_items + qp->pq_head,
+			  n * sizeof(struct pw_item *));
+			__atomic_store_n(&qp->pq_head, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&qp->pq_tail, n, __ATOMIC_RELAXED);
+		}
+		if (qp->pq_tail == qp->pq_size) {
+			n = (qp->pq_size == 0) ? 256 : qp->pq_size * 2;
+			if ((items = realloc(qp->pq_items,
+			  n * sizeof(struct pw_item *))) == NULL) {
+				pthread_mutex_unlock(&qp->pq_lock);
+				__atomic_sub_fetch(&wp->pw_pending, 1, __ATOMIC_RELAXED);
+				if (parent != NULL)
+					pw_release(parent);
+				free(ip);
+				return(-1);
+			}
+			qp->pq_items = items;
+			qp->pq_size = n;
+		}
+	}
+	qp->pq_items[qp->pq_tail] = ip;
+	/* seq_cst, against the idle check in pw_worker() */
+	__atomic_store_n(&qp->pq_tail, qp->pq_tail + 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&qp->pq_lock);
+	return(0);
+}
+
+static struct pw_item *
+pw_pop(struct pw_walk *wp, int id)
+{
+	struct pw_item	*ip;
+	struct pw_queue	*qp;
+
+	qp = &wp->pw_queues[id];
+	ip = NULL;
+	pthread_mutex_lock(&qp->pq_lock);
+	if (qp->pq_tail != qp->pq_head) {
+		ip = qp->pq_items[qp->pq_tail - 1];
+		__atomic_store_n(&qp->pq_tail, qp->pq_tail - 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&qp->pq_lock);
+	return(ip);
+}
+
+static struct pw_item *
+pw_steal(struct pw_walk *wp, int id)
+{
+	int				 i, victim;
+	struct pw_item	*ip;
+	struct pw_queue	*qp;
+
+	for (i = 1; i < wp->pw_nthreads; i++) {
+		victim = (id + i) % wp->pw_nthreads;
+		qp = &wp->pw_queues[victim];
+		if (__atomic_load_n(&qp->pq_tail, __ATOMIC_RELAXED) ==
+		  __atomic_load_n(&qp->pq_head, __ATOMIC_RELAXED))
+			continue;		/* don't bother locking an empty queue */
+		ip = NULL;
+		pthread_mutex_lock(&qp->pq_lock);
+		if (qp->pq_tail != qp->pq_head) {
+			ip = qp->pq_items[qp->pq_head];
+			__atomic_store_n(&qp->pq_head, qp->pq_head + 1, __ATOMIC_RELAXED);
+		}
+		pthread_mutex_unlock(&qp->pq_lock);
+		if (ip != NULL)
+			return(ip);
+	}
+	return(NULL);
+}
+
+static int
+pw_anywork(struct pw_walk *wp)
+{
+	int				 i;
+	struct pw_queue	*qp;
+
+	for (i = 0; i < wp->pw_nthreads; i++) {
+		qp = &wp->pw_queues[i];
+		if (__atomic_load_n(&qp->pq_tail, __ATOMIC_SEQ_CST) !=
+		  __atomic_load_n(&qp->pq_head, __ATOMIC_SEQ_CST))
+			return(1);
+	}
+	return(0);
+}
+
+/*
+ * Call func, and remember the first value that says to stop.
+ */
+static int
+pw_call(struct pw_walk *wp, struct pw_ent *ep)
+{
+	int		ret, zero;
+
+	ret = wp->pw_func(ep, wp->pw_arg);
+	if (ret != 0 && ret != PW_SKIP) {
+		zero = 0;
+		__atomic_compare_exchange_n(&wp->pw_ret, &zero, ret, 0,
+		  __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+		__atomic_store_n(&wp->pw_stop, 1, __ATOMIC_RELEASE);
+	}
+	return(ret);
+}
+
+static mode_t
+pw_dtmode(unsigned char type)
+{
+	switch (type) {
+	case DT_REG:	return(S_IFREG);
+	case DT_DIR:	return(S_IFDIR);
+	case DT_LNK:	return(S_IFLNK);
+	case DT_BLK:	return(S_IFBLK);
+	case DT_CHR:	return(S_IFCHR);
+	case DT_FIFO:	return(S_IFIFO);
+	case DT_SOCK:	return(S_IFSOCK);
+	}
+	return(0);
+}
+
+/*
+ * Read one directory, reporting everything in it and queueing its
+ * subdirectories on our own queue.
+ */
+static void
+pw_readdir(struct pw_walk *wp, int id, struct pw_item *ip, char *buf)
+{
+	int						 dirfd, fd, depth, npushed, ret;
+	long					 n, off;
+	struct stat				 sbuf;
+	struct pw_dir			*dp, *parent;
+	struct pw_ent			 ent;
+	struct pw_ctx			 ctx;
+	struct linux_dirent64	*dep;
+
+	parent = ip->pi_parent;
+	dirfd = (parent == NULL) ? AT_FDCWD : parent->pd_fd;
+	depth = (parent == NULL) ? 0 : parent->pd_depth + 1;
+	ent.pe_dirfd = dirfd;
+	ent.pe_name = ip->pi_name;
+	ent.pe_depth = depth;
+	ent.pe_thread = id;
+	ent.pe_stat = &sbuf;
+	ent.pe_pdata = (parent == NULL) ? NULL : parent->pd_data;
+	ent.pe_data = NULL;
+	ent.pe_priv = NULL;
+
+	fd = openat(dirfd, ip->pi_name,
+	  O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		/*
+		 * Not a directory (the root, or something that was renamed
+		 * under us), or one we can't read: see which.
+		 */
+		if (fstatat(dirfd, ip->pi_name, &sbuf, AT_SYMLINK_NOFOLLOW) < 0) {
+			ent.pe_type = PW_NS;
+			ent.pe_mode = 0;
+			ent.pe_stat = NULL;
+		} else {
+			ent.pe_type = S_ISDIR(sbuf.st_mode) ? PW_DNR : PW_F;
+			ent.pe_mode = sbuf.st_mode & S_IFMT;
+		}
+		pw_call(wp, &ent);
+		return;
+	}
+
+	if (fstat(fd, &sbuf) < 0) {
+		close(fd);
+		ent.pe_type = PW_NS;
+		ent.pe_mode = 0;
+		ent.pe_stat = NULL;
+		pw_call(wp, &ent);
+		return;
+	}
+	if ((dp = malloc(sizeof(struct pw_dir))) == NULL) {
+		close(fd);
+		ent.pe_type = PW_DNR;
+		ent.pe_mode = S_IFDIR;
+		pw_call(wp, &ent);
+		return;
+	}
+	dp->pd_fd = fd;
+	dp->pd_depth = depth;
+	dp->pd_refs = 1;		/* ours, while we read it */
+	dp->pd_data = NULL;
+	dp->pd_parent = parent;
+	if (parent != NULL)
+		__atomic_add_fetch(&parent->pd_refs, 1, __ATOMIC_RELAXED);
+
+	ctx.pc_walk = wp;
+	ctx.pc_id = id;
+	ctx.pc_dir = dp;
+	ctx.pc_npushed = 0;
+	ent.pe_type = PW_D;
+	ent.pe_mode = S_IFDIR;
+	ent.pe_data = &dp->pd_data;
+	ent.pe_priv = &ctx;
+	ret = pw_call(wp, &ent);
+	if (ctx.pc_npushed > 0)
+		pw_wakeup(wp, ctx.pc_npushed);
+	if (ret != 0) {
+		pw_release(dp);		/* PW_SKIP, or stop */
+		return;
+	}
+
+	ent.pe_dirfd = fd;
+	ent.pe_depth = depth + 1;
+	ent.pe_pdata = dp->pd_data;
+	ent.pe_data = NULL;
+	ent.pe_priv = NULL;
+	while ((n = syscall(SYS_getdents64, fd, buf, PW_BUFSIZE)) > 0) {
+		npushed = 0;
+		for (off = 0; off < n; off += dep->d_reclen) {
+			dep = (struct linux_dirent64 *)(buf + off);
+			if (dep->d_name[0] == '.' && (dep->d_name[1] == 0 ||
+			  (dep->d_name[1] == '.' && dep->d_name[2] == 0)))
+				continue;
+			ent.pe_name = dep->d_name;
+			ent.pe_mode = pw_dtmode(dep->d_type);
+			ent.pe_stat = NULL;
+			if (ent.pe_mode == 0 || (wp->pw_flags & PW_STAT)) {
+				if (fstatat(fd, dep->d_name, &sbuf,
+				  AT_SYMLINK_NOFOLLOW) < 0) {
+					ent.pe_type = PW_NS;
+					ent.pe_mode = 0;
+					pw_call(wp, &ent);
+					continue;
+				}
+				ent.pe_stat = &sbuf;
+				ent.pe_mode = sbuf.st_mode & S_IFMT;
+			}
+			if (ent.pe_mode == S_IFDIR) {
+				/*
+				 * Reported when it is opened, with the stat
+				 * of what we actually opened.
+				 */
+				if (pw_push(wp, id, dp, dep->d_name) == 0)
+					npushed++;
+			} else {
+				ent.pe_type = PW_F;
+				pw_call(wp, &ent);
+			}
+		}
+		if (npushed > 0)
+			pw_wakeup(wp, npushed);
+		if (__atomic_load_n(&wp->pw_stop, __ATOMIC_RELAXED))
+			break;
+	}
+	pw_release(dp);
+}
+
+/*
+ * From a PW_D callback: queue the subdirectory name of the directory
+ * being reported, as if we had read it there.  With PW_SKIP, this walks
+ * just the subdirectories the caller already knows about, without
+ * reading the directory itself.  Returns 0 if OK, -1 on error.
+ */
+int
+pwalk_queue(const struct pw_ent *ep, const char *name)
+{
+	struct pw_ctx	*cp = ep->pe_priv;
+
+	if (cp == NULL) {
+		errno = EINVAL;
+		return(-1);
+	}
+	if (pw_push(cp->pc_walk, cp->pc_id, cp->pc_dir, name) < 0)
+		return(-1);
+	cp->pc_npushed++;
+	return(0);
+}
+
+static void *
+pw_worker(void *arg)
+{
+	struct pw_thread	*tp = arg;
+	struct pw_walk		*wp = tp->pt_walk;
+	struct pw_item		*ip;
+	struct pw_dir		*parent;
+	unsigned int		 seq;
+	char				*buf;
+
+	buf = malloc(PW_BUFSIZE);
+	for (;;) {
+		if ((ip = pw_pop(wp, tp->pt_id)) == NULL &&
+		  (ip = pw_steal(wp, tp->pt_id)) == NULL) {
+			if (__atomic_load_n(&wp->pw_pending, __ATOMIC_SEQ_CST) == 0)
+				break;
+
+			/*
+			 * Say we're idle, then look once more, so that a
+			 * thread queueing a directory either sees us or we
+			 * see its directory.
+			 */
+			seq = __atomic_load_n(&wp->pw_seq, __ATOMIC_SEQ_CST);
+			__atomic_add_fetch(&wp->pw_nsleep, 1, __ATOMIC_SEQ_CST);
+			if (!pw_anywork(wp) &&
+			  __atomic_load_n(&wp->pw_pending, __ATOMIC_SEQ_CST) != 0)
+				futex_wait(&wp->pw_seq, seq, NULL);
+			__atomic_sub_fetch(&wp->pw_nsleep, 1, __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		parent = ip->pi_parent;
+		if (buf != NULL && !__atomic_load_n(&wp->pw_stop, __ATOMIC_ACQUIRE))
+			pw_readdir(wp, tp->pt_id, ip, buf);
+		if (parent != NULL)
+			pw_release(parent);
+		free(ip);
+		if (__atomic_sub_fetch(&wp->pw_pending, 1, __ATOMIC_SEQ_CST) == 0)
+			pw_wakeup(wp, INT_MAX);		/* all done */
+	}
+	free(buf);
+	return(NULL);
+}
+
+int
+pwalk(const char *pathname, int nthreads, int flags, Pwfunc *func,
+      void *arg)
+{
+	int					 i, err, started;
+	struct pw_walk		 walk;
+	struct pw_thread	*thr;
+	pthread_t			*tids;
+
+	if (nthreads <= 0)
+		nthreads = 1;
+	memset(&walk, 0, sizeof(walk));
+	walk.pw_func = func;
+	walk.pw_arg = arg;
+	walk.pw_flags = flags;
+	walk.pw_nthreads = nthreads;
+	thr = calloc(nthreads, sizeof(struct pw_thread));
+	tids = calloc(nthreads, sizeof(pthread_t));
+	err = posix_memalign((void **)&walk.pw_queues, PW_CACHELINE,
+	  nthreads * sizeof(struct pw_queue));
+	if (thr == NULL || tids == NULL || err != 0) {
+		free(thr);
+		free(tids);
+		if (err == 0)
+			free(walk.pw_queues);
+		errno = ENOMEM;
+		return(-1);
+	}
+	memset(walk.pw_queues, 0, nthreads * sizeof(struct pw_queue));
+	for (i = 0; i < nthreads; i++) {
+		pthread_mutex_init(&walk.pw_queues[i].pq_lock, NULL);
+		thr[i].pt_walk = &walk;
+		thr[i].pt_id = i;
+	}
+
+	started = 0;
+	if (pw_push(&walk, 0, NULL, pathname) < 0) {
+		err = ENOMEM;
+	} else {
+		/* thread 0 is us */
+		for (started = 1; started < nthreads; started++)
+			if ((err = pthread_create(&tids[started], NULL, pw_worker,
+			  &thr[started])) != 0)
+				break;		/* walk with what we've got */
+		pw_worker(&thr[0]);
+		for (i = 1; i < started; i++)
+			pthread_join(tids[i], NULL);
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_mutex_destroy(&walk.pw_queues[i].pq_lock);
+		free(walk.pw_queues[i].pq_items);
+	}
+	free(walk.pw_queues);
+	free(thr);
+	free(tids);
+	if (started == 0) {
+		errno = err;
+		return(-1);
+	}
+	return(walk.pw_ret);
+}
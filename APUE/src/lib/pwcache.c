@@ -0,0 +1,442 @@
+/*
+ * getpwnam() and friends from a mapped, indexed copy of the files.
+ *
+ * {Prog getpwnam} rewinds the password file with setpwent(), parses
+ * every entry with getpwent() until the name matches, and closes it
+ * again, so each lookup reads and parses the file from the top.
+ *
+ * Here we map /etc/passwd and /etc/group, find where each line starts,
+ * and build two hash tables per file, one on the name and one on the
+ * numeric ID, that hold line numbers.  A lookup hashes the key, finds
+ * the line, and splits just that line into the caller's buffer, the
+ * way getpwnam_r() does.  As with getpwent(), the first entry for a
+ * name or ID wins, and only the local files are consulted.
+ *
+ * At most once every PWC_CHECK seconds a lookup stat()s the file; if
+ * its inode, size, mtime or ctime has changed, we map and index it
+ * again.  Readers share a rwlock on each file's index and only the
+ * rebuild takes it for writing.  Tools that edit these files (vipw,
+ * useradd, passwd) write a new file and rename() it into place, so a
+ * mapping we still hold keeps the old contents and stays valid.
+ *
+ * All four return 0 if found, ENOENT if there is no such entry, ERANGE
+ * if buflen is too small, or another error number if the file can't
+ * be read.
+ */
+
+#include "apue.h"
+#include "pwcache.h"
+#include "forklock.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define	PWC_CHECK	1		/* seconds between stat()s of a file */
+
+struct pwc_line {
+	uint32_t	l_off;		/* in the mapping */
+	uint32_t	l_len;		/* not counting the newline */
+	uint32_t	l_namelen;
+	uint32_t	l_id;
+};
+
+struct pwc_db {
+	const char			*d_path;
+	pthread_rwlock_t	 d_lock;
+	char				*d_map;
+	size_t				 d_size;
+	struct pwc_line		*d_lines;
+	uint32_t			*d_byname;	/* line index + 1, 0 if empty */
+	uint32_t			*d_byid;
+	uint32_t			 d_mask;	/* hash table size - 1 */
+	struct stat			 d_stat;	/* of the file we mapped */
+	time_t				 d_checked;	/* CLOCK_MONOTONIC seconds */
+	int					 d_err;		/* why there is no map */
+};
+
+static struct pwc_db	pwc_passwd = {
+	"/etc/passwd", PTHREAD_RWLOCK_INITIALIZER
+};
+static struct pwc_db	pwc_group = {
+	"/etc/group", PTHREAD_RWLOCK_INITIALIZER
+};
+static pthread_once_t	pwc_once = PTHREAD_ONCE_INIT;
+
+/*
+ * The two are never held together, so they can share a rank.
+ */
+static void
+pwc_init(void)
+{
+	fl_register(&pwc_passwd.d_lock, FL_RWLOCK, FL_RANK_PWC, NULL);
+	fl_register(&pwc_group.d_lock, FL_RWLOCK, FL_RANK_PWC, NULL);
+}
+
+static uint32_t
+pwc_hashname(const char *name, size_t len)
+{
+	uint32_t	h;
+	size_t		i;
+
+	h = 2166136261U;
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619U;
+	}
+	return(h);
+}
+
+static uint32_t
+pwc_hashid(uint32_t id)
+{
+	id ^= id >> 16;
+	id *= 0x45d9f3bU;
+	id ^= id >> 16;
+	return(id);
+}
+
+/*
+ * Throw away the current map and index.  Caller holds d_lock for writing.
+ */
+static void
+pwc_free(struct pwc_db *dp)
+{
+	if (dp->d_map != NULL)
+		munmap(dp->d_map, dp->d_size);
+	free(dp->d_lines);
+	free(dp->d_byname);
+	free(dp->d_byid);
+	dp->d_map = NULL;
+	dp->d_lines = NULL;
+	dp->d_byname = dp->d_byid = NULL;
+}
+
+/*
+ * Map the file and index it.  Caller holds d_lock for writing.
+ * Returns 0 or an error number.
+ */
+static int
+pwc_load(struct pwc_db *dp)
+{
+	int				 fd;
+	char			*p, *end, *nl, *colon;
+	uint32_t		 nlines, n, size, i, h;
+	struct stat		 sbuf;
+	struct pwc_line	*lp;
+
+	pwc_free(dp);
+	if ((fd = open(dp->d_path, O_RDONLY | O_CLOEXEC)) < 0)
+		return(errno);
+	if (fstat(fd, &sbuf) < 0) {
+		close(fd);
+		return(errno);
+	}
+	if (sbuf.st_size >= UINT32_MAX) {
+		close(fd);
+		return(EFBIG);
+	}
+	dp->d_stat = sbuf;
+	dp->d_size = sbuf.st_size;
+	if (dp->d_size > 0 && (dp->d_map = mmap(0, dp->d_size, PROT_READ,
+	  MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		dp->d_map = NULL;
+		close(fd);
+		return(errno);
+	}
+	close(fd);
+
+	/*
+	 * One pass to count lines and size the tables, one to index.
+	 */
+	end = dp->d_map + dp->d_size;
+	nlines = 0;
+	for (p = dp->d_map; p < end; p = nl + 1) {
+		if ((nl = memchr(p, '\n', end - p)) == NULL)
+			nl = end;
+		nlines++;
+	}
+	for (size = 16; size < 2 * nlines; size *= 2)
+		;	/* at most half full */
+	dp->d_lines = malloc((nlines + 1) * sizeof(struct pwc_line));
+	dp->d_byname = calloc(size, sizeof(uint32_t));
+	dp->d_byid = calloc(size, sizeof(uint32_t));
+	if (dp->d_lines == NULL || dp->d_byname == NULL || dp->d_byid == NULL) {
+		pwc_free(dp);
+		return(ENOMEM);
+	}
+	dp->d_mask = size - 1;
+
+	n = 0;
+	for (p = dp->d_map; p < end; p = nl + 1) {
+		if ((nl = memchr(p, '\n', end - p)) == NULL)
+			nl = end;
+		/* skip blank lines, comments and NIS +/- entries */
+		if (p == nl || *p == '#' || *p == '+' || *p == '-')
+			continue;
+		/* the ID is the third field in both files */
+		if ((colon = memchr(p, ':', nl - p)) == NULL ||
+		  (colon = memchr(colon + 1, ':', nl - colon - 1)) == NULL)
+			continue;
+		lp = &dp->d_lines[n];
+		lp->l_off = p - dp->d_map;
+		lp->l_len = nl - p;
+		lp->l_namelen = (char *)memchr(p, ':', nl - p) - p;
+		lp->l_id = strtoul(colon + 1, NULL, 10);
+
+		h = pwc_hashname(p, lp->l_namelen);
+		for (i = h & dp->d_mask; dp->d_byname[i] != 0; i = (i + 1) & dp->d_mask)
+			if (dp->d_lines[dp->d_byname[i] - 1].l_namelen == lp->l_namelen &&
+			  memcmp(dp->d_map + dp->d_lines[dp->d_byname[i] - 1].l_off,
+			  p, lp->l_namelen) == 0)
+				break;
+		if (dp->d_byname[i] == 0)
+			dp->d_byname[i] = n + 1;	/* first one wins */
+
+		h = pwc_hashid(lp->l_id);
+		for (i = h & dp->d_mask; dp->d_byid[i] != 0; i = (i + 1) & dp->d_mask)
+			if (dp->d_lines[dp->d_byid[i] - 1].l_id == lp->l_id)
+				break;
+		if (dp->d_byid[i] == 0)
+			dp->d_byid[i] = n + 1;
+		n++;
+	}
+	return(0);
+}
+
+/*
+ * Is the file still the one we mapped?
+ */
+static int
+pwc_same(struct pwc_db *dp)
+{
+	struct stat	sbuf;
+
+	return(stat(dp->d_path, &sbuf) == 0 &&
+	  sbuf.st_ino == dp->d_stat.st_ino && sbuf.st_dev == dp->d_stat.st_dev &&
+	  sbuf.st_size == dp->d_stat.st_size &&
+	  sbuf.st_mtim.tv_sec == dp->d_stat.st_mtim.tv_sec &&
+	  sbuf.st_mtim.tv_nsec == dp->d_stat.st_mtim.tv_nsec &&
+	  sbuf.st_ctim.tv_sec == dp->d_stat.st_ctim.tv_sec &&
+	  sbuf.st_ctim.tv_nsec == dp->d_stat.st_ctim.tv_nsec);
+}
+
+/*
+ * Take the read lock on an index that's up to date with the file.
+ * Returns 0, or an error number with no lock held.
+ */
+static int
+pwc_rdlock(struct pwc_db *dp)
+{
+	int				err;
+	time_t			last;
+	struct timespec	ts;
+
+	pthread_once(&pwc_once, pwc_init);
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		pthread_rwlock_rdlock(&dp->d_lock);
+		if (dp->d_lines != NULL) {
+			last = __atomic_load_n(&dp->d_checked, __ATOMIC_RELAXED);
+			if (ts.tv_sec - last < PWC_CHECK)
+				return(0);
+			/*
+			 * Time to look at the file again.  Only one thread
+			 * need stat() it; the rest carry on with what we have.
+			 */
+			if (!__atomic_compare_exchange_n(&dp->d_checked, &last,
+			  ts.tv_sec, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED) ||
+			  pwc_same(dp))
+				return(0);
+		}
+		pthread_rwlock_unlock(&dp->d_lock);
+
+		pthread_rwlock_wrlock(&dp->d_lock);
+		if (dp->d_lines == NULL || !pwc_same(dp)) {	/* not done already */
+			dp->d_err = pwc_load(dp);
+			__atomic_store_n(&dp->d_checked, ts.tv_sec, __ATOMIC_RELAXED);
+		}
+		err = (dp->d_lines == NULL) ? dp->d_err : 0;
+		pthread_rwlock_unlock(&dp->d_lock);
+		if (err != 0)
+			return(err);
+	}
+}
+
+static struct pwc_line *
+pwc_byname(struct pwc_db *dp, const char *name)
+{
+	uint32_t		 i, len;
+	struct pwc_line	*lp;
+
+	len = strlen(name);
+	for (i = pwc_hashname(name, len) & dp->d_mask; dp->d_byname[i] != 0;
+	  i = (i + 1) & dp->d_mask) {
+		lp = &dp->d_lines[dp->d_byname[i] - 1];
+		if (lp->l_namelen == len &&
+		  memcmp(dp->d_map + lp->l_off, name, len) == 0)
+			return(lp);
+	}
+	return(NULL);
+}
+
+static struct pwc_line *
+pwc_byid(struct pwc_db *dp, uint32_t id)
+{
+	uint32_t		 i;
+	struct pwc_line	*lp;
+
+	for (i = pwc_hashid(id) & dp->d_mask; dp->d_byid[i] != 0;
+	  i = (i + 1) & dp->d_mask) {
+		lp = &dp->d_lines[dp->d_byid[i] - 1];
+		if (lp->l_id == id)
+			return(lp);
+	}
+	return(NULL);
+}
+
+/*
+ * Copy a line into buf and split it at the colons into nf fields.
+ * Missing fields are empty strings.  Returns 0 or ERANGE.
+ */
+static int
+pwc_split(struct pwc_db *dp, struct pwc_line *lp, char *buf, size_t buflen,
+          char **fields, int nf)
+{
+	int		i;
+	char	*p;
+
+	if (lp->l_len + 1 > buflen)
+		return(ERANGE);
+	memcpy(buf, dp->d_map + lp->l_off, lp->l_len);
+	buf[lp->l_len] = 0;
+	for (i = 0, p = buf; i < nf; i++) {
+		fields[i] = p;
+		if ((p = strchr(p, ':')) != NULL)
+			*p++ = 0;
+		else
+			p = buf + lp->l_len;	/* points at the final null */
+	}
+	return(0);
+}
+
+static int
+pwc_passwd_fill(struct pwc_line *lp, struct passwd *pwd, char *buf,
+                size_t buflen)
+{
+	int		err;
+	char	*f[7];
+
+	if ((err = pwc_split(&pwc_passwd, lp, buf, buflen, f, 7)) != 0)
+		return(err);
+	pwd->pw_name = f[0];
+	pwd->pw_passwd = f[1];
+	pwd->pw_uid = strtoul(f[2], NULL, 10);
+	pwd->pw_gid = strtoul(f[3], NULL, 10);
+	pwd->pw_gecos = f[4];
+	pwd->pw_dir = f[5];
+	pwd->pw_shell = f[6];
+	return(0);
+}
+
+/*
+ * The member list goes in buf after the line, as a null-terminated
+ * array of pointers into the line.
+ */
+static int
+pwc_group_fill(struct pwc_line *lp, struct group *grp, char *buf,
+               size_t buflen)
+{
+	int		 err, n;
+	char	*f[4], *p, **mem;
+	size_t	 off;
+
+	if ((err = pwc_split(&pwc_group, lp, buf, buflen, f, 4)) != 0)
+		return(err);
+	for (n = 1, p = f[3]; *p != 0; p++)
+		if (*p == ',')
+			n++;
+	off = (lp->l_len + 1 + sizeof(char *) - 1) & ~(sizeof(char *) - 1);
+	if (off + (n + 1) * sizeof(char *) > buflen)
+		return(ERANGE);
+	mem = (char **)(buf + off);
+	n = 0;
+	for (p = f[3]; *p != 0; ) {
+		mem[n++] = p;
+		if ((p = strchr(p, ',')) == NULL)
+			break;
+		*p++ = 0;
+	}
+	mem[n] = NULL;
+	grp->gr_name = f[0];
+	grp->gr_passwd = f[1];
+	grp->gr_gid = strtoul(f[2], NULL, 10);
+	grp->gr_mem = mem;
+	return(0);
+}
+
+int
+pwc_getpwnam(const char *name, struct passwd *pwd, char *buf, size_t buflen)
+{
+	int				 err;
+	struct pwc_line	*lp;
+
+	if ((err = pwc_rdlock(&pwc_passwd)) != 0)
+		return(err);
+	if ((lp = pwc_byname(&pwc_passwd, name)) == NULL)
+		err = ENOENT;
+	else
+		err = pwc_passwd_fill(lp, pwd, buf, buflen);
+	pthread_rwlock_unlock(&pwc_passwd.d_lock);
+	return(err);
+}
+
+int
+pwc_getpwuid(uid_t uid, struct passwd *pwd, char *buf, size_t buflen)
+{
+	int				 err;
+	struct pwc_line	*lp;
+
+	if ((err = pwc_rdlock(&pwc_passwd)) != 0)
+		return(err);
+	if ((lp = pwc_byid(&pwc_passwd, uid)) == NULL)
+		err = ENOENT;
+	else
+		err = pwc_passwd_fill(lp, pwd, buf, buflen);
+	pthread_rwlock_unlock(&pwc_passwd.d_lock);
+	return(err);
+}
+
+int
+pwc_getgrnam(const char *name, struct group *grp, char *buf, size_t buflen)
+{
+	int				 err;
+	struct pwc_line	*lp;
+
+	if ((err = pwc_rdlock(&pwc_group)) != 0)
+		return(err);
+	if ((lp = pwc_byname(&pwc_group, name)) == NULL)
+		err = ENOENT;
+	else
+		err = pwc_group_fill(lp, grp, buf, buflen);
+	pthread_rwlock_unlock(&pwc_group.d_lock);
+	return(err);
+}
+
+int
+pwc_getgrgid(gid_t gid, struct group *grp, char *buf, size_t buflen)
+{
+	int				 err;
+	struct pwc_line	*lp;
+
+	if ((err = pwc_rdlock(&pwc_group)) != 0)
+		return(err);
+	if ((lp = pwc_byid(&pwc_group, gid)) == NULL)
+		err = ENOENT;
+	else
+		err = pwc_group_fill(lp, grp, buf, buflen);
+	pthread_rwlock_unlock(&pwc_group.d_lock);
+	return(err);
+}
@@ -0,0 +1,1234 @@
+/*
+ * A record-lock manager: byte-range locks between the threads of a
+ * process and between processes, with deadlock detection.
+ *
+ * lock_reg() is a bare fcntl(F_SETLK): every lock is a system call, even
+ * when nobody else wants the bytes; fcntl() locks belong to the process,
+ * so they do nothing between its threads; and in {Prog deadlock}, which
+ * uses the blocking versions, the two processes would just hang if the
+ * kernel didn't happen to check POSIX locks for deadlock.
+ *
+ * Here each file has an interval tree of the ranges held by the threads
+ * of this process, and a sorted list of what the process holds in the
+ * kernel.  A request that conflicts with another thread waits on the
+ * file's condition variable without entering the kernel, and a request
+ * for bytes the process already holds strongly enough (another thread
+ * has a read lock on them, say) is granted without a system call.  Only
+ * when the process must hold more than it does do we call fcntl(), with
+ * F_OFD_SETLK.  Open file description locks belong to the descriptor,
+ * not the process, so closing some other descriptor for the file doesn't
+ * drop them; it also means each process must open() the file itself,
+ * since a descriptor inherited across fork() shares its locks.
+ *
+ * A thread that has to wait for another thread records whom it waits
+ * for; before it sleeps we follow those wait-for edges, and if they lead
+ * back to it we return EDEADLK instead.  Between processes the kernel
+ * doesn't check OFD locks for deadlock, so after rl_init() each process
+ * publishes, in a table in shared memory, the ranges it holds in the
+ * kernel and the ones it is waiting for, and a process whose wait would
+ * close a cycle gets EDEADLK, as with F_SETLKW.  That graph has a node
+ * per process, so like the kernel's it can mistake a wait between
+ * different threads of the same processes for a deadlock.  Without
+ * rl_init(), a wait for another process just retries now and then.
+ *
+ *	rl_init(name);		# optional; NULL for a table shared
+ *				#   only with children forked later
+ *	rl_lock(fd, type, start, len, flags);	# F_RDLCK or F_WRLCK; RL_WAIT
+ *	rl_unlock(fd, start, len);	# len 0 means to EOF, as with fcntl()
+ *	rl_close(fd);			# before close(fd)
+ *	rl_getstats(&st);
+ *
+ * All return 0 if OK, or -1 with errno set: EAGAIN if the bytes are
+ * locked and RL_WAIT wasn't given, EDEADLK if waiting would deadlock.
+ * Offsets are from the start of the file.
+ */
+
+#include "apue.h"
+#include "forklock.h"
+#include "fsem.h"
+#include "rlock.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+#define	RL_NONE		0			/* lock levels, in order of strength */
+#define	RL_RD		1
+#define	RL_WR		2
+
+#define	RL_EOF		((off_t)LLONG_MAX)	/* end of a lock to EOF */
+#define	RL_NHASH	64			/* descriptor hash chains */
+#define	RL_NAPMAX	20			/* ms between retries for a process */
+#define	RL_GHOLD	4096		/* ranges held, in the shared table */
+#define	RL_GWAIT	256			/* ranges waited for */
+
+#define	RL_COUNT(op, f) \
+	__atomic_store_n(&(op)->o_stats.f, (op)->o_stats.f + 1, __ATOMIC_RELAXED)
+
+/*
+ * One per thread.  Never freed: a lock outlives the thread that took
+ * it, as fcntl() locks do.
+ */
+struct rl_owner {
+	struct rl_owner	 *o_next;		/* all owners */
+	struct rl_owner	 *o_wnext;		/* waiters on the same file */
+	struct rl_file	 *o_wfile;		/* waiting for a thread here, or NULL */
+	off_t			  o_wstart;		/* for this range */
+	off_t			  o_wend;
+	int				  o_wtype;
+	struct rl_owner	**o_block;		/* the threads we wait for */
+	int				  o_nblock;
+	int				  o_maxblock;
+	unsigned int	  o_mark;		/* visited by this search */
+	int				  o_gwait;		/* our slot in g_wait, or -1 */
+	unsigned int	  o_gseq;		/* g_seq when we last tried */
+	struct rl_stats	  o_stats;
+};
+
+/*
+ * A range held by one thread: a node of a treap ordered by start, in
+ * which each node also knows the largest end below it.
+ */
+struct rl_node {
+	off_t			 n_start;
+	off_t			 n_end;		/* one past the last byte */
+	off_t			 n_max;		/* largest n_end in this subtree */
+	int				 n_type;
+	unsigned int	 n_prio;
+	struct rl_owner	*n_owner;
+	struct rl_node	*n_left;
+	struct rl_node	*n_right;
+};
+
+/*
+ * A range the process holds in the kernel; or, while we work out what
+ * to change, a piece of the range we're changing.
+ */
+struct rl_seg {
+	off_t	s_start;
+	off_t	s_end;
+	int		s_have;		/* what we hold now */
+	int		s_want;		/* what we should hold */
+};
+
+struct rl_file {
+	struct rl_file	*f_next;		/* hash chain */
+	int				 f_fd;
+	int				 f_open;		/* f_dev and f_ino are valid */
+	dev_t			 f_dev;
+	ino_t			 f_ino;
+	pthread_mutex_t	 f_lock;
+	pthread_cond_t	 f_cond;
+	struct rl_node	*f_root;
+	int				 f_nnode;
+	struct rl_node	*f_spare[2];	/* so a change can't run out halfway */
+	struct rl_seg	*f_seg;			/* held in the kernel, sorted */
+	int				 f_nseg;
+	struct rl_owner	*f_waiters;		/* for another thread */
+	int				 f_nwait;		/* threads in rl_lock() */
+	unsigned int	 f_seed;		/* for node priorities */
+	int				 f_cap;			/* size of each array below */
+	struct rl_node	**f_tmp;		/* nodes that overlap a range */
+	int				 f_ntmp;
+	off_t			*f_pt;			/* boundaries within a range */
+	struct rl_seg	*f_pc;			/* pieces of a range */
+	int				 f_npc;
+	struct rl_seg	*f_newseg;		/* the next f_seg */
+};
+
+/*
+ * The shared wait-for table.  A record with g_pid 0 is free.
+ */
+struct rl_grec {
+	pid_t	g_pid;
+	int		g_type;
+	dev_t	g_dev;
+	ino_t	g_ino;
+	off_t	g_start;
+	off_t	g_end;
+};
+
+struct rl_graph {
+	pthread_mutex_t	g_lock;
+	unsigned int	g_seq;		/* futex word: bumped on every release */
+	unsigned int	g_nwait;	/* records in use in g_wait */
+	struct rl_grec	g_hold[RL_GHOLD];
+	struct rl_grec	g_wait[RL_GWAIT];
+};
+
+static struct rl_file		*rl_hash[RL_NHASH];
+static pthread_mutex_t		 rl_hashlock = PTHREAD_MUTEX_INITIALIZER;
+static struct rl_owner		*rl_owners;
+static pthread_mutex_t		 rl_graphlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t		 rl_once = PTHREAD_ONCE_INIT;
+static unsigned int			 rl_mark;
+static struct rl_graph		*rl_graph;
+static __thread struct rl_owner	*rl_me;
+
+/*
+ * Our locks nest hash, then file, then graph.  The shared table's g_lock
+ * is process-shared and isn't registered (see {Prog forklock}).
+ */
+static void
+rl_setup(void)
+{
+	fl_register(&rl_hashlock, FL_MUTEX, FL_RANK_RLHASH, NULL);
+	fl_register(&rl_graphlock, FL_MUTEX, FL_RANK_RLGRAPH, NULL);
+}
+
+/*
+ * Set up the shared wait-for table.  Processes that want deadlocks
+ * between them detected must all use the same name.
+ */
+int
+rl_init(const char *name)
+{
+	int				 created, err;
+	struct rl_graph	*gp;
+
+	if ((gp = psync_map(name, sizeof(struct rl_graph), &created)) == NULL)
+		return(-1);
+	if (created) {
+		memset(gp, 0, sizeof(struct rl_graph));
+		if ((err = fmutex_init(&gp->g_lock)) != 0) {
+			psync_unmap(gp, sizeof(struct rl_graph));
+			errno = err;
+			return(-1);
+		}
+		if (name != NULL)
+			psync_ready(gp);
+	}
+	rl_graph = gp;
+	return(0);
+}
+
+void
+rl_getstats(struct rl_stats *sp)
+{
+	struct rl_owner	*op;
+
+	memset(sp, 0, sizeof(struct rl_stats));
+	pthread_once(&rl_once, rl_setup);
+	pthread_mutex_lock(&rl_graphlock);
+	for (op = rl_owners; op != NULL; op = op->o_next) {
+		sp->rs_lock += __atomic_load_n(&op->o_stats.rs_lock, __ATOMIC_RELAXED);
+		sp->rs_local += __atomic_load_n(&op->o_stats.rs_local, __ATOMIC_RELAXED);
+		sp->rs_syscall +=
+		  __atomic_load_n(&op->o_stats.rs_syscall, __ATOMIC_RELAXED);
+		sp->rs_wait += __atomic_load_n(&op->o_stats.rs_wait, __ATOMIC_RELAXED);
+		sp->rs_kwait += __atomic_load_n(&op->o_stats.rs_kwait, __ATOMIC_RELAXED);
+		sp->rs_deadlock +=
+		  __atomic_load_n(&op->o_stats.rs_deadlock, __ATOMIC_RELAXED);
+		sp->rs_unlock += __atomic_load_n(&op->o_stats.rs_unlock, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&rl_graphlock);
+}
+
+static struct rl_owner *
+rl_self(void)
+{
+	struct rl_owner	*op;
+
+	if ((op = rl_me) != NULL)
+		return(op);
+	pthread_once(&rl_once, rl_setup);
+	if ((op = calloc(1, sizeof(struct rl_owner))) == NULL)
+		return(NULL);
+	op->o_gwait = -1;
+	pthread_mutex_lock(&rl_graphlock);
+	op->o_next = rl_owners;
+	rl_owners = op;
+	pthread_mutex_unlock(&rl_graphlock);
+	rl_me = op;
+	return(op);
+}
+
+/*
+ * Find the file for a descriptor, creating it if asked.  Files are never
+ * freed (rl_close() just empties one for the next descriptor with that
+ * number), so the chains can be read without a lock, and a file's lock,
+ * once registered with {Prog forklock}, stays registered.  It is
+ * registered before the file is published, and without rl_hashlock held,
+ * since fork() may be holding the registry and waiting for rl_hashlock.
+ */
+static struct rl_file *
+rl_file(int fd, int create)
+{
+	struct rl_file	*fp, *nfp, **hp;
+
+	hp = &rl_hash[(unsigned int)fd % RL_NHASH];
+	for (fp = __atomic_load_n(hp, __ATOMIC_ACQUIRE); fp != NULL;
+	  fp = fp->f_next)
+		if (fp->f_fd == fd)
+			return(fp);
+	if (!create)
+		return(NULL);
+
+	if ((nfp = calloc(1, sizeof(struct rl_file))) == NULL)
+		return(NULL);
+	nfp->f_fd = fd;
+	nfp->f_seed = 2463534242U;
+	pthread_mutex_init(&nfp->f_lock, NULL);
+	pthread_cond_init(&nfp->f_cond, NULL);
+	if (fl_register(&nfp->f_lock, FL_MUTEX, FL_RANK_RLFILE, NULL) < 0) {
+		pthread_mutex_destroy(&nfp->f_lock);
+		pthread_cond_destroy(&nfp->f_cond);
+		free(nfp);
+		return(NULL);
+	}
+
+	pthread_mutex_lock(&rl_hashlock);
+	for (fp = *hp; fp != NULL; fp = fp->f_next)
+		if (fp->f_fd == fd)
+			break;
+	if (fp == NULL) {
+		nfp->f_next = *hp;
+		__atomic_store_n(hp, nfp, __ATOMIC_RELEASE);
+		fp = nfp;
+		nfp = NULL;
+	}
+	pthread_mutex_unlock(&rl_hashlock);
+	if (nfp != NULL) {		/* another thread got there first */
+		fl_unregister(&nfp->f_lock);
+		pthread_mutex_destroy(&nfp->f_lock);
+		pthread_cond_destroy(&nfp->f_cond);
+		free(nfp);
+	}
+	return(fp);
+}
+
+/****************************************************************************
+ * The interval tree.  Ties on the start are broken by address, so every
+ * node has a distinct key.
+ */
+static int
+rl_less(struct rl_node *a, struct rl_node *b)
+{
+	return(a->n_start < b->n_start || (a->n_start == b->n_start && a < b));
+}
+
+static void
+rl_fix(struct rl_node *np)
+{
+	np->n_max = np->n_end;
+	if (np->n_left != NULL && np->n_left->n_max > np->n_max)
+		np->n_max = np->n_left->n_max;
+	if (np->n_right != NULL && np->n_right->n_max > np->n_max)
+		np->n_max = np->n_right->n_max;
+}
+
+/*
+ * Split t into the nodes before key and the rest.
+ */
+static void
+rl_split(struct rl_node *t, struct rl_node *key, struct rl_node **lp,
+  struct rl_node **rp)
+{
+	if (t == NULL) {
+		*lp = *rp = NULL;
+	} else if (rl_less(t, key)) {
+		rl_split(t->n_right, key, &t->n_right, rp);
+		*lp = t;
+		rl_fix(t);
+	} else {
+		rl_split(t->n_left, key, lp, &t->n_left);
+		*rp = t;
+		rl_fix(t);
+	}
+}
+
+static struct rl_node *
+rl_merge(struct rl_node *l, struct rl_node *r)
+{
+	if (l == NULL)
+		return(r);
+	if (r == NULL)
+		return(l);
+	if (l->n_prio > r->n_prio) {
+		l->n_right = rl_merge(l->n_right, r);
+		rl_fix(l);
+		return(l);
+	}
+	r->n_left = rl_merge(l, r->n_left);
+	rl_fix(r);
+	return(r);
+}
+
+static struct rl_node *
+rl_insert(struct rl_node *t, struct rl_node *np)
+{
+	if (t == NULL || np->n_prio > t->n_prio) {
+		rl_split(t, np, &np->n_left, &np->n_right);
+		rl_fix(np);
+		return(np);
+	}
+	if (rl_less(np, t))
+		t->n_left = rl_insert(t->n_left, np);
+	else
+		t->n_right = rl_insert(t->n_right, np);
+	rl_fix(t);
+	return(t);
+}
+
+static struct rl_node *
+rl_delete(struct rl_node *t, struct rl_node *np)
+{
+	if (t == np)
+		return(rl_merge(t->n_left, t->n_right));
+	if (rl_less(np, t))
+		t->n_left = rl_delete(t->n_left, np);
+	else
+		t->n_right = rl_delete(t->n_right, np);
+	rl_fix(t);
+	return(t);
+}
+
+/*
+ * Append the nodes that overlap [start, end) to f_tmp, in order.
+ */
+static void
+rl_overlap(struct rl_file *fp, struct rl_node *t, off_t start, off_t end)
+{
+	if (t == NULL || t->n_max <= start)
+		return;
+	rl_overlap(fp, t->n_left, start, end);
+	if (t->n_start < end) {
+		if (t->n_end > start)
+			fp->f_tmp[fp->f_ntmp++] = t;
+		rl_overlap(fp, t->n_right, start, end);
+	}
+}
+
+static void
+rl_freetree(struct rl_node *t)
+{
+	if (t != NULL) {
+		rl_freetree(t->n_left);
+		rl_freetree(t->n_right);
+		free(t);
+	}
+}
+
+/*
+ * Take a node from the spares; rl_reserve() made sure there is one.
+ */
+static struct rl_node *
+rl_newnode(struct rl_file *fp)
+{
+	struct rl_node	*np;
+
+	np = fp->f_spare[0];
+	fp->f_spare[0] = fp->f_spare[1];
+	fp->f_spare[1] = NULL;
+	fp->f_seed ^= fp->f_seed << 13;		/* xorshift */
+	fp->f_seed ^= fp->f_seed >> 17;
+	fp->f_seed ^= fp->f_seed << 5;
+	np->n_prio = fp->f_seed;
+	fp->f_nnode++;
+	return(np);
+}
+
+/****************************************************************************
+ * Make sure one change to the file can't run out of memory halfway:
+ * two spare nodes (a lock in the middle of one of our own ranges splits
+ * it in two), and scratch arrays big enough for every node and kernel
+ * range, before and after the change, to show up in a search.  The
+ * first call also records the device and inode of the file.  Called
+ * with f_lock held; returns 0 or an error number.
+ */
+static int
+rl_reserve(struct rl_file *fp)
+{
+	int				 i, cap;
+	void			*p;
+	struct stat		 sbuf;
+
+	if (!fp->f_open) {
+		if (fstat(fp->f_fd, &sbuf) < 0)
+			return(errno);
+		fp->f_dev = sbuf.st_dev;
+		fp->f_ino = sbuf.st_ino;
+		fp->f_open = 1;
+	}
+	for (i = 0; i < 2; i++)
+		if (fp->f_spare[i] == NULL &&
+		  (fp->f_spare[i] = malloc(sizeof(struct rl_node))) == NULL)
+			return(ENOMEM);
+	cap = 4 * (fp->f_nnode + fp->f_nseg) + 16;
+	if (cap <= fp->f_cap)
+		return(0);
+	cap *= 2;
+	if ((p = realloc(fp->f_tmp, cap * sizeof(struct rl_node *))) == NULL)
+		return(ENOMEM);
+	fp->f_tmp = p;
+	if ((p = realloc(fp->f_pt, cap * sizeof(off_t))) == NULL)
+		return(ENOMEM);
+	fp->f_pt = p;
+	if ((p = realloc(fp->f_pc, cap * sizeof(struct rl_seg))) == NULL)
+		return(ENOMEM);
+	fp->f_pc = p;
+	if ((p = realloc(fp->f_seg, cap * sizeof(struct rl_seg))) == NULL)
+		return(ENOMEM);
+	fp->f_seg = p;
+	if ((p = realloc(fp->f_newseg, cap * sizeof(struct rl_seg))) == NULL)
+		return(ENOMEM);
+	fp->f_newseg = p;
+	fp->f_cap = cap;
+	return(0);
+}
+
+/****************************************************************************
+ * What the process holds in the kernel.
+ */
+static int
+rl_cmpoff(const void *a, const void *b)
+{
+	off_t	x = *(const off_t *)a, y = *(const off_t *)b;
+
+	return(x < y ? -1 : x > y);
+}
+
+/*
+ * Cut [start, end) into pieces at every boundary of a kernel range and,
+ * if usetree, of a thread's range, and fill in f_pc with what the
+ * process holds of each piece and (if usetree) the strongest lock any
+ * thread holds on it.
+ */
+static void
+rl_pieces(struct rl_file *fp, off_t start, off_t end, int usetree)
+{
+	int				 i, j, k, n;
+	off_t			 s, e;
+	struct rl_seg	*pp;
+	struct rl_node	*np;
+
+	n = 0;
+	fp->f_pt[n++] = start;
+	fp->f_pt[n++] = end;
+	for (i = 0; i < fp->f_nseg; i++) {
+		if (fp->f_seg[i].s_start > start && fp->f_seg[i].s_start < end)
+			fp->f_pt[n++] = fp->f_seg[i].s_start;
+		if (fp->f_seg[i].s_end > start && fp->f_seg[i].s_end < end)
+			fp->f_pt[n++] = fp->f_seg[i].s_end;
+	}
+	fp->f_ntmp = 0;
+	if (usetree) {
+		rl_overlap(fp, fp->f_root, start, end);
+		for (i = 0; i < fp->f_ntmp; i++) {
+			np = fp->f_tmp[i];
+			if (np->n_start > start)
+				fp->f_pt[n++] = np->n_start;
+			if (np->n_end < end)
+				fp->f_pt[n++] = np->n_end;
+		}
+	}
+	qsort(fp->f_pt, n, sizeof(off_t), rl_cmpoff);
+
+	fp->f_npc = 0;
+	j = 0;
+	for (i = 0; i + 1 < n; i++) {
+		if ((s = fp->f_pt[i]) == (e = fp->f_pt[i + 1]))
+			continue;
+		pp = &fp->f_pc[fp->f_npc++];
+		pp->s_start = s;
+		pp->s_end = e;
+		pp->s_have = pp->s_want = RL_NONE;
+		while (j < fp->f_nseg && fp->f_seg[j].s_end <= s)
+			j++;
+		if (j < fp->f_nseg && fp->f_seg[j].s_start <= s)
+			pp->s_have = fp->f_seg[j].s_have;
+		for (k = 0; k < fp->f_ntmp; k++) {
+			np = fp->f_tmp[k];
+			if (np->n_start <= s && np->n_end > s && np->n_type > pp->s_want)
+				pp->s_want = np->n_type;
+		}
+	}
+}
+
+static void
+rl_append(struct rl_seg *v, int *np, struct rl_seg *sp)
+{
+	if (*np > 0 && v[*np - 1].s_end == sp->s_start &&
+	  v[*np - 1].s_have == sp->s_have)
+		v[*np - 1].s_end = sp->s_end;
+	else
+		v[(*np)++] = *sp;
+}
+
+/*
+ * Make f_seg agree with the pieces of [start, end), which now hold
+ * s_want, merging neighbors that hold the same.
+ */
+static void
+rl_apply(struct rl_file *fp, off_t start, off_t end)
+{
+	int				 i, n;
+	struct rl_seg	*sp, seg;
+
+	n = 0;
+	for (i = 0; i < fp->f_nseg && fp->f_seg[i].s_start < start; i++) {
+		seg = fp->f_seg[i];
+		if (seg.s_end > start)
+			seg.s_end = start;
+		rl_append(fp->f_newseg, &n, &seg);
+	}
+	for (i = 0; i < fp->f_npc; i++) {
+		seg = fp->f_pc[i];
+		if ((seg.s_have = seg.s_want) != RL_NONE)
+			rl_append(fp->f_newseg, &n, &seg);
+	}
+	for (i = 0; i < fp->f_nseg; i++) {
+		if (fp->f_seg[i].s_end <= end)
+			continue;
+		seg = fp->f_seg[i];
+		if (seg.s_start < end)
+			seg.s_start = end;
+		rl_append(fp->f_newseg, &n, &seg);
+	}
+	sp = fp->f_seg;
+	fp->f_seg = fp->f_newseg;
+	fp->f_newseg = sp;
+	fp->f_nseg = n;
+}
+
+/****************************************************************************
+ * Talking to the kernel and to the shared table.
+ */
+
+/*
+ * Set the process's lock on [start, end) to level.  Returns 0 or an
+ * error number, EAGAIN if another process is in the way.
+ */
+static int
+rl_klock(struct rl_file *fp, struct rl_owner *op, off_t start, off_t end,
+  int level)
+{
+	static const short	type[] = { F_UNLCK, F_RDLCK, F_WRLCK };
+
+	RL_COUNT(op, rs_syscall);
+	if (lock_reg(fp->f_fd, F_OFD_SETLK, type[level], start, SEEK_SET,
+	  end == RL_EOF ? 0 : end - start) == 0)
+		return(0);
+	return(errno == EACCES ? EAGAIN : errno);
+}
+
+/*
+ * Forget the records of processes that have gone away.
+ */
+static void
+rl_gsweep(void)
+{
+	int				 i;
+	struct rl_grec	*rp;
+
+	for (i = 0; i < RL_GHOLD + RL_GWAIT; i++) {
+		rp = (i < RL_GHOLD) ? &rl_graph->g_hold[i] :
+		  &rl_graph->g_wait[i - RL_GHOLD];
+		if (rp->g_pid != 0 && kill(rp->g_pid, 0) < 0 && errno == ESRCH) {
+			if (i >= RL_GHOLD)
+				rl_graph->g_nwait--;
+			rp->g_pid = 0;
+		}
+	}
+}
+
+static void
+rl_glock(void)
+{
+	if (fmutex_lock(&rl_graph->g_lock) == EOWNERDEAD)
+		rl_gsweep();	/* a process died in the middle of an update */
+}
+
+/*
+ * Replace our records of what we hold in this file with f_seg.  If the
+ * table fills up, some of our locks go unrecorded and deadlocks through
+ * them go undetected.  Called with g_lock held.
+ */
+static void
+rl_gpublish(struct rl_file *fp)
+{
+	int				 i, j;
+	pid_t			 pid;
+	struct rl_grec	*rp;
+
+	pid = getpid();
+	for (i = j = 0; i < RL_GHOLD; i++) {
+		rp = &rl_graph->g_hold[i];
+		if (rp->g_pid == pid && rp->g_dev == fp->f_dev &&
+		  rp->g_ino == fp->f_ino)
+			rp->g_pid = 0;
+		if (rp->g_pid == 0 && j < fp->f_nseg) {
+			rp->g_pid = pid;
+			rp->g_type = fp->f_seg[j].s_have;
+			rp->g_dev = fp->f_dev;
+			rp->g_ino = fp->f_ino;
+			rp->g_start = fp->f_seg[j].s_start;
+			rp->g_end = fp->f_seg[j].s_end;
+			j++;
+		}
+	}
+}
+
+/*
+ * Some process released something: wake up everyone waiting for one.
+ * Called with g_lock held.
+ */
+static void
+rl_gwake(void)
+{
+	__atomic_add_fetch(&rl_graph->g_seq, 1, __ATOMIC_SEQ_CST);
+	if (rl_graph->g_nwait > 0)
+		futex_wake(&rl_graph->g_seq, INT_MAX);
+}
+
+/*
+ * The search below runs with g_lock held, which also protects these.
+ */
+static pid_t	rl_gstack[RL_GHOLD], rl_gseen[RL_GHOLD];
+static int		rl_gn, rl_gnseen;
+
+/*
+ * Push the processes that hold what wp waits for, if not seen already.
+ */
+static void
+rl_gpush(struct rl_grec *wp)
+{
+	int				 i, j;
+	struct rl_grec	*rp;
+
+	for (i = 0; i < RL_GHOLD; i++) {
+		rp = &rl_graph->g_hold[i];
+		if (rp->g_pid == 0 || rp->g_pid == wp->g_pid ||
+		  rp->g_dev != wp->g_dev || rp->g_ino != wp->g_ino ||
+		  rp->g_start >= wp->g_end || wp->g_start >= rp->g_end ||
+		  (rp->g_type != RL_WR && wp->g_type != RL_WR))
+			continue;
+		for (j = 0; j < rl_gnseen && rl_gseen[j] != rp->g_pid; j++)
+			;
+		if (j == rl_gnseen) {
+			rl_gseen[rl_gnseen++] = rp->g_pid;
+			rl_gstack[rl_gn++] = rp->g_pid;
+		}
+	}
+}
+
+/*
+ * Would process wp->g_pid waiting for wp close a cycle?  From the
+ * processes that hold what it wants, follow the ranges they wait for to
+ * the processes that hold those, and so on, looking for it.
+ */
+static int
+rl_gcycle(struct rl_grec *wp)
+{
+	int		i;
+	pid_t	pid;
+
+	rl_gn = rl_gnseen = 0;
+	rl_gpush(wp);
+	while (rl_gn > 0) {
+		if ((pid = rl_gstack[--rl_gn]) == wp->g_pid)
+			return(1);
+		if (kill(pid, 0) < 0 && errno == ESRCH)
+			continue;		/* gone; rl_gsweep() will clean up */
+		for (i = 0; i < RL_GWAIT; i++)
+			if (rl_graph->g_wait[i].g_pid == pid)
+				rl_gpush(&rl_graph->g_wait[i]);
+	}
+	return(0);
+}
+
+/*
+ * Record that we wait for [start, end) of the file, unless that would
+ * deadlock.  Returns 0 or EDEADLK.  Called with g_lock held.
+ */
+static int
+rl_gwait(struct rl_file *fp, struct rl_owner *op, off_t start, off_t end,
+  int level)
+{
+	int				i;
+	struct rl_grec	w;
+
+	w.g_pid = getpid();
+	w.g_type = level;
+	w.g_dev = fp->f_dev;
+	w.g_ino = fp->f_ino;
+	w.g_start = start;
+	w.g_end = end;
+	if (rl_gcycle(&w))
+		return(EDEADLK);
+	for (i = 0; i < RL_GWAIT; i++) {
+		if (rl_graph->g_wait[i].g_pid == 0) {
+			rl_graph->g_wait[i] = w;
+			rl_graph->g_nwait++;
+			op->o_gwait = i;
+			break;
+		}
+	}
+	op->o_gseq = rl_graph->g_seq;	/* table full: wait, but unseen */
+	return(0);
+}
+
+static void
+rl_gunwait(struct rl_owner *op)
+{
+	if (op->o_gwait >= 0) {
+		rl_glock();
+		if (rl_graph->g_wait[op->o_gwait].g_pid != 0) {
+			rl_graph->g_wait[op->o_gwait].g_pid = 0;
+			rl_graph->g_nwait--;
+		}
+		fmutex_unlock(&rl_graph->g_lock);
+		op->o_gwait = -1;
+	}
+}
+
+/****************************************************************************
+ * Changing what the process holds in the kernel.
+ */
+
+/*
+ * Make sure the process holds at least level on [start, end).  Returns
+ * 0, or an error number: EAGAIN if another process is in the way, in
+ * which case, if wait, we're left recorded as waiting for it, or get
+ * EDEADLK if that would deadlock.
+ */
+static int
+rl_raise(struct rl_file *fp, struct rl_owner *op, off_t start, off_t end,
+  int level, int wait)
+{
+	int				 i, err, need;
+	struct rl_seg	*pp;
+
+	rl_pieces(fp, start, end, 0);
+	for (i = need = 0; i < fp->f_npc; i++) {
+		pp = &fp->f_pc[i];
+		if (pp->s_have < level)
+			need = 1;
+		pp->s_want = (pp->s_have < level) ? level : pp->s_have;
+	}
+	if (!need) {
+		RL_COUNT(op, rs_local);
+		return(0);
+	}
+
+	/*
+	 * Keep the shared table locked from the fcntl()s until it agrees
+	 * with them, so no one searches it in between.
+	 */
+	if (rl_graph != NULL)
+		rl_glock();
+	err = 0;
+	for (i = 0; i < fp->f_npc; i++) {
+		pp = &fp->f_pc[i];
+		if (pp->s_have < pp->s_want &&
+		  (err = rl_klock(fp, op, pp->s_start, pp->s_end, pp->s_want)) != 0)
+			break;
+	}
+	if (err != 0) {
+		while (--i >= 0) {			/* put back what we took */
+			pp = &fp->f_pc[i];
+			if (pp->s_have < pp->s_want)
+				rl_klock(fp, op, pp->s_start, pp->s_end, pp->s_have);
+		}
+	} else {
+		rl_apply(fp, start, end);
+	}
+	if (rl_graph != NULL) {
+		if (err == 0)
+			rl_gpublish(fp);
+		else if (err == EAGAIN && wait &&
+		  rl_gwait(fp, op, start, end, level) != 0)
+			err = EDEADLK;
+		fmutex_unlock(&rl_graph->g_lock);
+	}
+	return(err);
+}
+
+/*
+ * Give back what no thread needs any more on [start, end).
+ */
+static void
+rl_lower(struct rl_file *fp, struct rl_owner *op, off_t start, off_t end)
+{
+	int				 i, need;
+	struct rl_seg	*pp;
+
+	rl_pieces(fp, start, end, 1);
+	for (i = need = 0; i < fp->f_npc; i++)
+		if (fp->f_pc[i].s_want < fp->f_pc[i].s_have)
+			need = 1;
+	if (!need)
+		return;
+	if (rl_graph != NULL)
+		rl_glock();
+	for (i = 0; i < fp->f_npc; i++) {
+		pp = &fp->f_pc[i];
+		if (pp->s_want < pp->s_have)
+			rl_klock(fp, op, pp->s_start, pp->s_end, pp->s_want);
+		else
+			pp->s_want = pp->s_have;	/* leave it alone */
+	}
+	rl_apply(fp, start, end);
+	if (rl_graph != NULL) {
+		rl_gpublish(fp);
+		rl_gwake();
+		fmutex_unlock(&rl_graph->g_lock);
+	}
+}
+
+/****************************************************************************
+ * Between threads.
+ */
+
+/*
+ * Leave in f_tmp the ranges other threads hold that conflict with op
+ * taking level on [start, end), and return how many there are.
+ */
+static int
+rl_conflicts(struct rl_file *fp, struct rl_owner *op, off_t start, off_t end,
+  int level)
+{
+	int				 i, n;
+	struct rl_node	*np;
+
+	fp->f_ntmp = 0;
+	rl_overlap(fp, fp->f_root, start, end);
+	for (i = n = 0; i < fp->f_ntmp; i++) {
+		np = fp->f_tmp[i];
+		if (np->n_owner != op && (level == RL_WR || np->n_type == RL_WR))
+			fp->f_tmp[n++] = np;
+	}
+	return(fp->f_ntmp = n);
+}
+
+/*
+ * Work out whom a waiting thread waits for now.  Called with f_lock and
+ * rl_graphlock held.  Returns 0 or ENOMEM.
+ */
+static int
+rl_setblock(struct rl_file *fp, struct rl_owner *op)
+{
+	int				  i, j, n;
+	struct rl_owner	 *bp, **v;
+
+	n = rl_conflicts(fp, op, op->o_wstart, op->o_wend, op->o_wtype);
+	op->o_nblock = 0;
+	for (i = 0; i < n; i++) {
+		bp = fp->f_tmp[i]->n_owner;
+		for (j = 0; j < op->o_nblock && op->o_block[j] != bp; j++)
+			;
+		if (j < op->o_nblock)
+			continue;
+		if (op->o_nblock == op->o_maxblock) {
+			j = (op->o_maxblock == 0) ? 8 : 2 * op->o_maxblock;
+			if ((v = realloc(op->o_block, j * sizeof(*v))) == NULL)
+				return(ENOMEM);
+			op->o_block = v;
+			op->o_maxblock = j;
+		}
+		op->o_block[op->o_nblock++] = bp;
+	}
+	return(0);
+}
+
+/*
+ * Is there a path of wait-for edges from one thread to another?
+ * Called with rl_graphlock held, after bumping rl_mark.
+ */
+static int
+rl_reaches(struct rl_owner *from, struct rl_owner *to)
+{
+	int		i;
+
+	if (from == to)
+		return(1);
+	if (from->o_wfile == NULL || from->o_mark == rl_mark)
+		return(0);
+	from->o_mark = rl_mark;
+	for (i = 0; i < from->o_nblock; i++)
+		if (rl_reaches(from->o_block[i], to))
+			return(1);
+	return(0);
+}
+
+/*
+ * The ranges in a file have changed: bring the edges of the threads
+ * waiting on it up to date, so a search never follows one that's gone
+ * or misses a new one, and let them look again.
+ */
+static void
+rl_reblock(struct rl_file *fp)
+{
+	struct rl_owner	*wp;
+
+	if (fp->f_waiters == NULL)
+		return;
+	pthread_mutex_lock(&rl_graphlock);
+	for (wp = fp->f_waiters; wp != NULL; wp = wp->o_wnext)
+		rl_setblock(fp, wp);	/* ENOMEM: some edges are missing */
+	pthread_mutex_unlock(&rl_graphlock);
+	pthread_cond_broadcast(&fp->f_cond);
+}
+
+/*
+ * Wait for the threads holding what op wants to release something,
+ * unless that would deadlock.  Called with f_lock held.  Returns 0, or EDEADLK
+ * or ENOMEM without waiting.
+ */
+static int
+rl_wait(struct rl_file *fp, struct rl_owner *op, off_t start, off_t end,
+  int level)
+{
+	int				  i, err;
+	struct rl_owner	**opp;
+
+	pthread_mutex_lock(&rl_graphlock);
+	op->o_wfile = fp;
+	op->o_wstart = start;
+	op->o_wend = end;
+	op->o_wtype = level;
+	if ((err = rl_setblock(fp, op)) == 0) {
+		rl_mark++;
+		for (i = 0; i < op->o_nblock; i++) {
+			if (rl_reaches(op->o_block[i], op)) {
+				err = EDEADLK;
+				break;
+			}
+		}
+	}
+	if (err != 0) {
+		op->o_wfile = NULL;
+		op->o_nblock = 0;
+	}
+	pthread_mutex_unlock(&rl_graphlock);
+	if (err != 0)
+		return(err);
+
+	RL_COUNT(op, rs_wait);
+	op->o_wnext = fp->f_waiters;
+	fp->f_waiters = op;
+	pthread_cond_wait(&fp->f_cond, &fp->f_lock);
+	for (opp = &fp->f_waiters; *opp != op; opp = &(*opp)->o_wnext)
+		;
+	*opp = op->o_wnext;
+	pthread_mutex_lock(&rl_graphlock);
+	op->o_wfile = NULL;
+	op->o_nblock = 0;
+	pthread_mutex_unlock(&rl_graphlock);
+	return(0);
+}
+
+/*
+ * Another process is in the way: let go of the file and sleep until
+ * some process using the shared table releases something, or, without
+ * one, for a while.  Processes that lock the file without us don't wake
+ * anyone, so we never sleep longer than RL_NAPMAX either way.
+ */
+static void
+rl_kwait(struct rl_file *fp, struct rl_owner *op, int *napp)
+{
+	struct timespec	ts;
+
+	RL_COUNT(op, rs_kwait);
+	pthread_mutex_unlock(&fp->f_lock);
+	if (rl_graph != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = RL_NAPMAX * 1000000L;
+		futex_wait(&rl_graph->g_seq, op->o_gseq, &ts);
+		rl_gunwait(op);
+	} else {
+		ts.tv_sec = 0;
+		ts.tv_nsec = *napp * 1000000L;
+		nanosleep(&ts, NULL);
+		if (*napp < RL_NAPMAX)
+			*napp *= 2;
+	}
+	pthread_mutex_lock(&fp->f_lock);
+}
+
+/*
+ * Remove op's ranges from [start, end), splitting any that stick out.
+ */
+static void
+rl_cut(struct rl_file *fp, struct rl_owner *op, off_t start, off_t end)
+{
+	int				 i;
+	struct rl_node	*np, *rp;
+
+	fp->f_ntmp = 0;
+	rl_overlap(fp, fp->f_root, start, end);
+	for (i = 0; i < fp->f_ntmp; i++) {
+		np = fp->f_tmp[i];
+		if (np->n_owner != op)
+			continue;
+		fp->f_root = rl_delete(fp->f_root, np);
+		if (np->n_start < start && np->n_end > end) {
+			rp = rl_newnode(fp);	/* keep both ends */
+			rp->n_start = end;
+			rp->n_end = np->n_end;
+			rp->n_type = np->n_type;
+			rp->n_owner = op;
+			fp->f_root = rl_insert(fp->f_root, rp);
+		}
+		if (np->n_start < start) {
+			np->n_end = start;
+			fp->f_root = rl_insert(fp->f_root, np);
+		} else if (np->n_end > end) {
+			np->n_start = end;
+			fp->f_root = rl_insert(fp->f_root, np);
+		} else {
+			fp->f_nnode--;
+			if (fp->f_spare[1] == NULL)
+				fp->f_spare[1] = np;
+			else
+				free(np);
+		}
+	}
+}
+
+/****************************************************************************
+ * The interface.
+ */
+int
+rl_lock(int fd, int type, off_t start, off_t len, int flags)
+{
+	int				 err, level, nap;
+	off_t			 end;
+	struct rl_file	*fp;
+	struct rl_owner	*op;
+	struct rl_node	*np;
+
+	if ((type != F_RDLCK && type != F_WRLCK) || start < 0 || len < 0) {
+		errno = EINVAL;
+		return(-1);
+	}
+	level = (type == F_WRLCK) ? RL_WR : RL_RD;
+	end = (len == 0 || len > RL_EOF - start) ? RL_EOF : start + len;
+	if ((op = rl_self()) == NULL || (fp = rl_file(fd, 1)) == NULL) {
+		errno = ENOMEM;
+		return(-1);
+	}
+	RL_COUNT(op, rs_lock);
+
+	nap = 1;
+	pthread_mutex_lock(&fp->f_lock);
+	fp->f_nwait++;
+	for (;;) {
+		if ((err = rl_reserve(fp)) != 0)
+			break;
+		if (rl_conflicts(fp, op, start, end, level) > 0) {
+			if (!(flags & RL_WAIT))
+				err = EAGAIN;
+			else if ((err = rl_wait(fp, op, start, end, level)) == 0)
+				continue;
+			break;
+		}
+		err = rl_raise(fp, op, start, end, level, flags & RL_WAIT);
+		if (err != EAGAIN || !(flags & RL_WAIT))
+			break;
+		rl_kwait(fp, op, &nap);
+	}
+	fp->f_nwait--;
+	if (err == 0) {
+		rl_cut(fp, op, start, end);
+		np = rl_newnode(fp);
+		np->n_start = start;
+		np->n_end = end;
+		np->n_type = level;
+		np->n_owner = op;
+		fp->f_root = rl_insert(fp->f_root, np);
+		rl_lower(fp, op, start, end);		/* if it was a downgrade */
+		rl_reblock(fp);
+	} else if (err == EDEADLK) {
+		RL_COUNT(op, rs_deadlock);
+	}
+	pthread_mutex_unlock(&fp->f_lock);
+	if (err != 0) {
+		errno = err;
+		return(-1);
+	}
+	return(0);
+}
+
+int
+rl_unlock(int fd, off_t start, off_t len)
+{
+	int				 err;
+	off_t			 end;
+	struct rl_file	*fp;
+	struct rl_owner	*op;
+
+	if (start < 0 || len < 0) {
+		errno = EINVAL;
+		return(-1);
+	}
+	end = (len == 0 || len > RL_EOF - start) ? RL_EOF : start + len;
+	if ((op = rl_self()) == NULL) {
+		errno = ENOMEM;
+		return(-1);
+	}
+	RL_COUNT(op, rs_unlock);
+	if ((fp = rl_file(fd, 0)) == NULL)
+		return(0);		/* never locked anything */
+	pthread_mutex_lock(&fp->f_lock);
+	if ((err = rl_reserve(fp)) == 0) {
+		rl_cut(fp, op, start, end);
+		rl_lower(fp, op, start, end);
+		rl_reblock(fp);
+	}
+	pthread_mutex_unlock(&fp->f_lock);
+	if (err != 0) {
+		errno = err;
+		return(-1);
+	}
+	return(0);
+}
+
+/*
+ * Drop every thread's locks on fd and forget the file, so the
+ * descriptor can be closed and its number used for another file.
+ * Returns -1 with errno EBUSY if a thread is waiting for a lock on it.
+ */
+int
+rl_close(int fd)
+{
+	int				 err;
+	struct rl_file	*fp;
+	struct rl_owner	*op;
+
+	if ((op = rl_self()) == NULL) {
+		errno = ENOMEM;
+		return(-1);
+	}
+	if ((fp = rl_file(fd, 0)) == NULL)
+		return(0);
+	err = 0;
+	pthread_mutex_lock(&fp->f_lock);
+	if (fp->f_nwait > 0) {
+		err = EBUSY;
+	} else if (fp->f_open) {
+		rl_freetree(fp->f_root);
+		fp->f_root = NULL;
+		fp->f_nnode = 0;
+		if (fp->f_nseg > 0) {
+			if (rl_graph != NULL)
+				rl_glock();
+			rl_klock(fp, op, 0, RL_EOF, RL_NONE);
+			fp->f_nseg = 0;
+			if (rl_graph != NULL) {
+				rl_gpublish(fp);
+				rl_gwake();
+				fmutex_unlock(&rl_graph->g_lock);
+			}
+		}
+		fp->f_open = 0;
+	}
+	pthread_mutex_unlock(&fp->f_lock);
+	if (err != 0) {
+		errno = err;
+		return(-1);
+	}
+	return(0);
+}
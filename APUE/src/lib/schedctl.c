@@ -0,0 +1,338 @@
+/*
+ * Scheduling control.
+ *
+ * {Prog nice} shows that nice() changes how two busy processes share a
+ * CPU, and that is all it shows.  A server wants more say: an event loop
+ * should not wait behind a batch job, should not share its CPU with the
+ * one taking the network card's interrupts, and on a NUMA machine should
+ * stay next to its memory.  Linux has the means, in sched_setaffinity(),
+ * sched_setscheduler() and per-thread nice values; here they are
+ * wrapped so that a thread's placement is one short string:
+ *
+ *	class[:prio][@cpus]
+ *
+ * class is one of
+ *
+ *	normal		SCHED_OTHER, prio is the nice value (default 0)
+ *	batch		SCHED_BATCH: like normal, but never preempts to wake
+ *	idle		SCHED_IDLE: runs only when nothing else wants the CPU
+ *	fifo, rr	SCHED_FIFO or SCHED_RR, prio 1-99 (default 1); needs
+ *			privilege, and a fifo thread that never blocks
+ *			starves everything else on its CPU
+ *
+ * or one of the nice bands interactive (nice -5), background (nice 10) or
+ * bulk (SCHED_BATCH, nice 19).  cpus is a CPU list like "0-3,8" as in
+ * /sys and taskset, "node<n>" for the CPUs of a NUMA node, "quiet" for the
+ * CPUs that aren't busy with device interrupts, or "irq" for those that
+ * are.  Interrupt load comes from /proc/interrupts, counting device
+ * interrupts only (not timer or IPI lines), since boot.
+ *
+ * Everything applies to one thread: pid 0 is the calling thread, and
+ * any other pid is a thread id (a process id names its main thread).
+ * Threads a thread creates and children it forks inherit its settings.
+ *
+ *	sc_apply(0, "fifo:10@quiet");		# event loop
+ *	sc_apply(tid, "idle@irq");		# housekeeping thread
+ *	sc_describe(0, buf, sizeof(buf));	# "normal:0@0-7"
+ */
+
+#include "apue.h"
+#include "schedctl.h"
+#include <ctype.h>
+#include <errno.h>
+#include <sys/resource.h>
+
+static struct {
+	const char	*c_name;
+	int			 c_policy;
+	int			 c_prio;	/* default nice or real-time priority */
+} sc_classes[] = {
+	{ "normal",			SCHED_OTHER,	0 },
+	{ "batch",			SCHED_BATCH,	0 },
+	{ "idle",			SCHED_IDLE,		0 },
+	{ "fifo",			SCHED_FIFO,		1 },
+	{ "rr",				SCHED_RR,		1 },
+	{ "interactive",	SCHED_OTHER,	-5 },
+	{ "background",		SCHED_OTHER,	10 },
+	{ "bulk",			SCHED_BATCH,	19 },
+};
+
+#define	NCLASS	(sizeof(sc_classes) / sizeof(sc_classes[0]))
+
+/*
+ * Parse a CPU list such as "0-3,8".  Returns 0, or -1 with errno EINVAL.
+ */
+int
+sc_parsecpus(const char *s, cpu_set_t *set)
+{
+	long	lo, hi;
+	char	*end;
+
+	CPU_ZERO(set);
+	for (;;) {
+		if (!isdigit((unsigned char)*s))
+			goto bad;
+		lo = hi = strtol(s, &end, 10);
+		if (*end == '-') {
+			s = end + 1;
+			if (!isdigit((unsigned char)*s))
+				goto bad;
+			hi = strtol(s, &end, 10);
+		}
+		if (lo > hi || hi >= CPU_SETSIZE)
+			goto bad;
+		while (lo <= hi)
+			CPU_SET(lo++, set);
+		s = end;
+		if (*s == '\0' || *s == '\n')
+			return(0);
+		if (*s++ != ',')
+			goto bad;
+	}
+bad:
+	errno = EINVAL;
+	return(-1);
+}
+
+/*
+ * Format a set as a CPU list.  Returns buf, truncated if need be.
+ */
+char *
+sc_fmtcpus(const cpu_set_t *set, char *buf, size_t size)
+{
+	int		i, j;
+	size_t	len;
+
+	len = 0;
+	buf[0] = 0;
+	for (i = 0; i < CPU_SETSIZE && len < size; i = j) {
+		if (!CPU_ISSET(i, set)) {
+			j = i + 1;
+			continue;
+		}
+		for (j = i + 1; j < CPU_SETSIZE && CPU_ISSET(j, set); j++)
+			;
+		if (j - 1 == i)
+			len += snprintf(buf + len, size - len, "%s%d", len ? "," : "", i);
+		else
+			len += snprintf(buf + len, size - len, "%s%d-%d", len ? "," : "",
+			  i, j - 1);
+	}
+	return(buf);
+}
+
+/*
+ * The CPUs of NUMA node node.  Returns 0, or -1 with errno ENOENT if
+ * there is no such node.
+ */
+int
+sc_nodecpus(int node, cpu_set_t *set)
+{
+	FILE	*fp;
+	char	path[64], line[MAXLINE];
+	int		rv;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+	  node);
+	if ((fp = fopen(path, "r")) == NULL)
+		return(-1);
+	rv = fgets(line, sizeof(line), fp) == NULL ? -1 : sc_parsecpus(line, set);
+	fclose(fp);
+	return(rv);
+}
+
+/*
+ * The CPUs that have taken at least pct percent of all device
+ * interrupts.  Returns the number of them, or -1 on error.
+ */
+int
+sc_irqcpus(int pct, cpu_set_t *set)
+{
+	FILE				*fp;
+	char				line[4096], *p, *end;
+	int					i, ncpu, n;
+	unsigned long long	*cnt, total, c;
+
+	CPU_ZERO(set);
+	if ((fp = fopen("/proc/interrupts", "r")) == NULL)
+		return(-1);
+	if (fgets(line, sizeof(line), fp) == NULL) {	/* CPU0 CPU1 ... */
+		fclose(fp);
+		errno = EINVAL;
+		return(-1);
+	}
+	for (ncpu = 0, p = line; (p = strstr(p, "CPU")) != NULL; p += 3)
+		ncpu++;
+	if ((cnt = calloc(ncpu, sizeof(unsigned long long))) == NULL) {
+		fclose(fp);
+		return(-1);
+	}
+	total = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		for (p = line; *p == ' '; p++)
+			;
+		if (!isdigit((unsigned char)*p))
+			continue;				/* LOC:, RES:, ... */
+		if ((p = strchr(p, ':')) == NULL)
+			continue;
+		for (i = 0, p++; i < ncpu; i++, p = end) {
+			c = strtoull(p, &end, 10);
+			if (end == p)
+				break;
+			cnt[i] += c;
+			total += c;
+		}
+	}
+	fclose(fp);
+	for (n = 0, i = 0; i < ncpu && i < CPU_SETSIZE; i++) {
+		if (total > 0 && cnt[i] * 100 >= total * pct) {
+			CPU_SET(i, set);
+			n++;
+		}
+	}
+	free(cnt);
+	return(n);
+}
+
+/*
+ * The CPUs we may run on that aren't busy with interrupts, or all of
+ * them if they all are.  Returns the number, or -1 on error.
+ */
+int
+sc_quietcpus(cpu_set_t *set)
+{
+	cpu_set_t	irq, quiet;
+
+	if (sched_getaffinity(0, sizeof(cpu_set_t), set) < 0)
+		return(-1);
+	if (sc_irqcpus(SC_IRQPCT, &irq) > 0) {
+		CPU_XOR(&quiet, set, &irq);
+		CPU_AND(&quiet, &quiet, set);
+		if (CPU_COUNT(&quiet) > 0)
+			*set = quiet;
+	}
+	return(CPU_COUNT(set));
+}
+
+int
+sc_pin(pid_t tid, const cpu_set_t *set)
+{
+	return(sched_setaffinity(tid, sizeof(cpu_set_t), set));
+}
+
+/*
+ * Set the scheduling policy of a thread; prio is the real-time priority
+ * for SCHED_FIFO and SCHED_RR and the nice value otherwise.
+ */
+int
+sc_setclass(pid_t tid, int policy, int prio)
+{
+	struct sched_param	sp;
+
+	memset(&sp, 0, sizeof(sp));
+	if (policy == SCHED_FIFO || policy == SCHED_RR) {
+		sp.sched_priority = prio;
+		return(sched_setscheduler(tid, policy, &sp));
+	}
+	if (sched_setscheduler(tid, policy, &sp) < 0)
+		return(-1);
+	if (tid == 0)
+		tid = gettid();			/* setpriority(0) means the process */
+	return(setpriority(PRIO_PROCESS, tid, prio));
+}
+
+/*
+ * Apply a "class[:prio][@cpus]" spec to a thread.  Returns 0, or -1
+ * with errno set: EINVAL for a bad spec, EPERM if we may not.
+ */
+int
+sc_apply(pid_t tid, const char *spec)
+{
+	int			i, prio, node;
+	size_t		len;
+	char		*end;
+	const char	*p;
+	cpu_set_t	set;
+
+	len = strcspn(spec, ":@");
+	for (i = 0; i < (int)NCLASS; i++)
+		if (strlen(sc_classes[i].c_name) == len &&
+		  strncmp(spec, sc_classes[i].c_name, len) == 0)
+			break;
+	if (i == NCLASS)
+		goto bad;
+	p = spec + len;
+	prio = sc_classes[i].c_prio;
+	if (*p == ':') {
+		prio = strtol(p + 1, &end, 10);
+		if (end == p + 1)
+			goto bad;
+		p = end;
+	}
+	if (*p == '@') {
+		p++;
+		if (strcmp(p, "quiet") == 0) {
+			if (sc_quietcpus(&set) < 0)
+				return(-1);
+		} else if (strcmp(p, "irq") == 0) {
+			if (sc_irqcpus(SC_IRQPCT, &set) < 0)
+				return(-1);
+		} else if (strncmp(p, "node", 4) == 0) {
+			node = strtol(p + 4, &end, 10);
+			if (end == p + 4 || *end != '\0')
+				goto bad;
+			if (sc_nodecpus(node, &set) < 0)
+				return(-1);
+		} else if (sc_parsecpus(p, &set) < 0) {
+			return(-1);
+		}
+		if (CPU_COUNT(&set) == 0)
+			goto bad;
+		if (sc_pin(tid, &set) < 0)
+			return(-1);
+	} else if (*p != '\0') {
+		goto bad;
+	}
+	return(sc_setclass(tid, sc_classes[i].c_policy, prio));
+
+bad:
+	errno = EINVAL;
+	return(-1);
+}
+
+/*
+ * Describe a thread's policy and affinity as a spec sc_apply() takes.
+ */
+char *
+sc_describe(pid_t tid, char *buf, size_t size)
+{
+	int					i, policy, prio;
+	size_t				len;
+	cpu_set_t			set;
+	struct sched_param	sp;
+
+	if ((policy = sched_getscheduler(tid)) < 0)
+		return(NULL);
+	policy &= ~SCHED_RESET_ON_FORK;
+	if (policy == SCHED_FIFO || policy == SCHED_RR) {
+		if (sched_getparam(tid, &sp) < 0)
+			return(NULL);
+		prio = sp.sched_priority;
+	} else {
+		errno = 0;
+		prio = getpriority(PRIO_PROCESS, tid == 0 ? gettid() : tid);
+		if (prio == -1 && errno != 0)
+			return(NULL);
+	}
+	for (i = 0; i < (int)NCLASS; i++)
+		if (sc_classes[i].c_policy == policy)
+			break;
+	len = snprintf(buf, size, "%s:%d@", i < (int)NCLASS ?
+	  sc_classes[i].c_name : "?", prio);
+	if (len >= size)
+		return(buf);
+	if (sched_getaffinity(tid, sizeof(cpu_set_t), &set) < 0)
+		return(NULL);
+	sc_fmtcpus(&set, buf + len, size - len);
+	return(buf);
+}
@@ -25,6 +25,10 @@
  * The third member, [2], of the semaphore set is used as a lock variable
  * to avoid any race conditions in the sem_create() and sem_close()
  * functions.
+ *
+ * Every operation here is a semop() system call; fsem.c provides the same
+ * operations on a futex word in shared memory, with no system call unless
+ * someone has to sleep or be woken.
  */
 
 #include "apue.h"
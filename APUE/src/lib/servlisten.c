@@ -11,6 +11,15 @@
  */
 int
 serv_listen(const char *name)
+{
+	return(serv_listen_type(name, SOCK_STREAM));
+}
+
+/*
+ * Same, for a socket of the given type: SOCK_STREAM or SOCK_SEQPACKET.
+ */
+int
+serv_listen_type(const char *name, int type)
 {
 	int					fd, len, err, rval;
 	struct sockaddr_un	un;
@@ -20,8 +29,8 @@ serv_listen(const char *name)
 		return(-1);
 	}
 
-	/* create a UNIX domain stream socket */
-	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	/* create a UNIX domain socket */
+	if ((fd = socket(AF_UNIX, type, 0)) < 0)
 		return(-2);
 
 	unlink(name);	/* in case it already exists */
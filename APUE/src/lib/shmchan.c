@@ -0,0 +1,203 @@
+/*
+ * A single-producer, single-consumer message channel in shared memory.
+ * Generalizes the /dev/zero mapping of {Prog devzero}: instead of one
+ * shared counter and a TELL_XXX/WAIT_XXX round trip (two pipe writes or
+ * two signals) per step, the two sides pass fixed-size messages through a
+ * ring of slots and only enter the kernel when one of them must sleep.
+ *
+ *	cp = chan_open(NULL, msgsz, nslots);	# before fork(), or
+ *	cp = chan_open(name, msgsz, nslots);	# peers that share a name
+ *	chan_send(cp, msg);			# blocks while the ring is full
+ *	chan_recv(cp, msg);			# blocks while the ring is empty
+ *	chan_close(cp);
+ *
+ * A side that has to wait first spins for a while, then sleeps on the
+ * other side's counter with futex_wait().  The spin budget adapts: it
+ * doubles each time spinning was enough and halves each time we had to
+ * sleep anyway.  On a uniprocessor we never spin, since the other side
+ * can't run while we do.  The sleeping flags let the other side skip
+ * futex_wake() when nobody is asleep, so a busy channel makes no system
+ * calls at all.
+ */
+
+#include "apue.h"
+#include "fsem.h"
+#include "shmchan.h"
+#include <errno.h>
+
+#define	CHAN_SPIN_MIN	64
+#define	CHAN_SPIN_MAX	16384
+
+static int	chan_mp = -1;		/* nonzero if more than one CPU */
+
+#define	CHAN_SLOT(cp, i) \
+	((char *)(cp) + sizeof(struct shmchan) + \
+	  (size_t)((i) & ((cp)->nslots - 1)) * (cp)->msgsz)
+
+static size_t
+chan_size(unsigned int msgsz, unsigned int nslots)
+{
+	return(sizeof(struct shmchan) + (size_t)msgsz * nslots);
+}
+
+/*
+ * Create (or, for a name that already exists, open) a channel of nslots
+ * messages of msgsz bytes each.  nslots is rounded up to a power of 2.
+ * Returns NULL on error.
+ */
+struct shmchan *
+chan_open(const char *name, unsigned int msgsz, unsigned int nslots)
+{
+	unsigned int	 n;
+	int				 created;
+	struct shmchan	*cp;
+
+	if (msgsz == 0 || nslots == 0 || nslots > (1U << 30)) {
+		errno = EINVAL;
+		return(NULL);
+	}
+	for (n = 1; n < nslots; n <<= 1)
+		;
+	if (chan_mp < 0)
+		chan_mp = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+	if ((cp = psync_map(name, chan_size(msgsz, n), &created)) == NULL)
+		return(NULL);
+	if (created) {
+		memset(cp, 0, sizeof(struct shmchan));
+		cp->nslots = n;
+		cp->msgsz = msgsz;
+		cp->rspin = cp->wspin = CHAN_SPIN_MIN;
+		if (name != NULL)
+			psync_ready(cp);
+	} else if (cp->msgsz != msgsz || cp->nslots != n) {
+		psync_unmap(cp, chan_size(msgsz, n));
+		errno = EINVAL;		/* opened with a different shape */
+		return(NULL);
+	}
+	return(cp);
+}
+
+int
+chan_close(struct shmchan *cp)
+{
+	return(psync_unmap(cp, chan_size(cp->msgsz, cp->nslots)));
+}
+
+/*
+ * Wait until *word no longer equals old.  *spinp is our spin budget and
+ * *sleepp the flag telling the other side to wake us.
+ */
+static void
+chan_wait(unsigned int *word, unsigned int old, unsigned int *spinp,
+  unsigned int *sleepp)
+{
+	unsigned int	i, spin;
+
+	spin = chan_mp ? *spinp : 0;
+	for (i = 0; i < spin; i++) {
+		if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != old) {
+			if (spin < CHAN_SPIN_MAX)
+				*spinp = spin * 2;
+			return;
+		}
+		cpu_relax();
+	}
+	if (spin > CHAN_SPIN_MIN)
+		*spinp = spin / 2;
+
+	/*
+	 * Raise the flag before each last look, so the other side either
+	 * sees the flag or we see its update.  The waker clears the flag, so
+	 * raise it again if we wake up to find nothing changed.
+	 */
+	for (;;) {
+		__atomic_store_n(sleepp, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(word, __ATOMIC_SEQ_CST) != old)
+			break;
+		futex_wait(word, old, NULL);
+	}
+	__atomic_store_n(sleepp, 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * Publish a new value of our counter and wake the other side if needed.
+ * We clear the flag ourselves, so that a sleeper that hasn't been
+ * scheduled yet costs us one futex_wake(), not one per message.
+ */
+static void
+chan_publish(unsigned int *word, unsigned int val, unsigned int *sleepp)
+{
+	__atomic_store_n(word, val, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(sleepp, __ATOMIC_SEQ_CST) &&
+	  __atomic_exchange_n(sleepp, 0, __ATOMIC_SEQ_CST))
+		futex_wake(word, 1);
+}
+
+/*
+ * Copy one message into the ring.  Returns 0 if OK, or -1 with errno set
+ * to EAGAIN if the ring is full.
+ */
+int
+chan_trysend(struct shmchan *cp, const void *msg)
+{
+	unsigned int	h;
+
+	h = cp->head;
+	if (h - __atomic_load_n(&cp->tail, __ATOMIC_ACQUIRE) == cp->nslots) {
+		errno = EAGAIN;
+		return(-1);
+	}
+	memcpy(CHAN_SLOT(cp, h), msg, cp->msgsz);
+	chan_publish(&cp->head, h + 1, &cp->rsleep);
+	return(0);
+}
+
+/*
+ * Copy one message into the ring, waiting for a free slot if necessary.
+ */
+int
+chan_send(struct shmchan *cp, const void *msg)
+{
+	unsigned int	t;
+
+	while (chan_trysend(cp, msg) < 0) {
+		t = __atomic_load_n(&cp->tail, __ATOMIC_ACQUIRE);
+		if (cp->head - t == cp->nslots)
+			chan_wait(&cp->tail, t, &cp->wspin, &cp->wsleep);
+	}
+	return(0);
+}
+
+/*
+ * Take one message from the ring.  Returns 0 if OK, or -1 with errno set
+ * to EAGAIN if the ring is empty.
+ */
+int
+chan_tryrecv(struct shmchan *cp, void *msg)
+{
+	unsigned int	t;
+
+	t = cp->tail;
+	if (__atomic_load_n(&cp->head, __ATOMIC_ACQUIRE) == t) {
+		errno = EAGAIN;
+		return(-1);
+	}
+	memcpy(msg, CHAN_SLOT(cp, t), cp->msgsz);
+	chan_publish(&cp->tail, t + 1, &cp->wsleep);
+	return(0);
+}
+
+/*
+ * Take one message from the ring, waiting for one if necessary.
+ */
+int
+chan_recv(struct shmchan *cp, void *msg)
+{
+	unsigned int	t;
+
+	while (chan_tryrecv(cp, msg) < 0) {
+		t = cp->tail;
+		chan_wait(&cp->head, t, &cp->rspin, &cp->rsleep);
+	}
+	return(0);
+}
@@ -0,0 +1,270 @@
+/*
+ * Signals as events.
+ *
+ * The usual way to get a signal into an event loop is a handler that
+ * writes the signal number down a pipe the loop watches.  The handler
+ * runs between any two instructions of the program, so it may only call
+ * async-signal-safe functions and must save errno; every signal costs a
+ * write(), and a burst of them can fill the pipe.  {Prog sigwait} avoids
+ * the handler by dedicating a thread to sigwait(), which then has to
+ * hand each signal to the rest of the program with a mutex and a
+ * condition variable.
+ *
+ * Here the signals we handle are blocked and read from a signalfd, which
+ * the loop watches like any other descriptor.  sigfd_dispatch() drains
+ * it, many signals to a read(), counts the arrivals of each, and calls
+ * each signal's function once, from the loop, where it may do anything.
+ * One SIGCHLD can stand for any number of children, so for it we can
+ * instead reap with waitid() until none of ours that exited is left.
+ * Only the children given to sigfd_watch() are ours: popen(), spopen()
+ * and system() wait for their own by pid, and reaping those first would
+ * leave pclose() failing with ECHILD and the exit status lost.  So we
+ * peek at the next exited child with WNOWAIT and reap it only if it's
+ * ours; if it isn't, it stays for its owner, and we ask after each of
+ * ours by pid instead.  (To wait for one particular child, poll its
+ * pidfd; see {Prog spopen}.)
+ *
+ * Signals are blocked only in the calling thread and threads it creates
+ * afterwards, so set up before creating threads.  The blocked mask
+ * survives fork() and exec(), so a child should call sigfd_close() first.
+ *
+ *	fd = sigfd_open();			# watch for readable
+ *	sigfd_handle(signo, func, arg);		# func(signo, count, &ssi, arg)
+ *						#   func NULL: just swallow it
+ *	sigfd_children(func, arg);		# func(&siginfo, arg) per child
+ *	sigfd_watch(pid);			# after fork(): pid is one of ours
+ *	sigfd_dispatch();			# when fd is readable
+ *	sigfd_close();				# give the signals back
+ */
+
+#include "apue.h"
+#include "sigfd.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#define	SIGFD_BATCH	32			/* signals per read() */
+#define	SIGFD_NPID	16			/* initial size of the child table */
+
+static int			 sigfd_fd = -1;
+static sigset_t		 sigfd_mask;	/* signals we've taken over */
+static sigset_t		 sigfd_omask;	/* the mask before that */
+static Sigfdfunc	*sigfd_func[NSIG];
+static void			*sigfd_arg[NSIG];
+static Childfunc	*sigfd_child;
+static void			*sigfd_childarg;
+static pid_t		*sigfd_pids;	/* children to reap */
+static int			 sigfd_npid, sigfd_maxpid;
+
+/*
+ * Returns the descriptor, or -1 on error.
+ */
+int
+sigfd_open(void)
+{
+	int		err;
+
+	if (sigfd_fd >= 0)
+		return(sigfd_fd);
+	sigemptyset(&sigfd_mask);
+	if ((err = pthread_sigmask(SIG_BLOCK, &sigfd_mask, &sigfd_omask)) != 0) {
+		errno = err;
+		return(-1);
+	}
+	sigfd_fd = signalfd(-1, &sigfd_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	return(sigfd_fd);
+}
+
+/*
+ * Route signo to func.  Returns 0 if OK, -1 on error.
+ */
+int
+sigfd_handle(int signo, Sigfdfunc *func, void *arg)
+{
+	int			err;
+	sigset_t	set;
+
+	if (signo <= 0 || signo >= NSIG || signo == SIGKILL || signo == SIGSTOP) {
+		errno = EINVAL;
+		return(-1);
+	}
+	if (sigfd_open() < 0)
+		return(-1);
+	sigfd_func[signo] = func;
+	sigfd_arg[signo] = arg;
+	sigemptyset(&set);
+	sigaddset(&set, signo);
+	if ((err = pthread_sigmask(SIG_BLOCK, &set, NULL)) != 0) {
+		errno = err;
+		return(-1);
+	}
+	sigaddset(&sigfd_mask, signo);
+	if (signalfd(sigfd_fd, &sigfd_mask, 0) < 0)
+		return(-1);
+	return(0);
+}
+
+/*
+ * Reap the child in sigfd_pids[i] if it has exited, and pass it on.
+ * Returns 1 if it's gone from the table, else 0.
+ */
+static int
+sigfd_reapone(int i)
+{
+	int			n;
+	siginfo_t	si;
+
+	si.si_pid = 0;
+	while ((n = waitid(P_PID, sigfd_pids[i], &si, WEXITED | WNOHANG)) < 0 &&
+	  errno == EINTR)
+		;
+	if (n == 0 && si.si_pid == 0)
+		return(0);
+	sigfd_pids[i] = sigfd_pids[--sigfd_npid];
+	if (n == 0)
+		(*sigfd_child)(&si, sigfd_childarg);
+	return(1);				/* or ECHILD: reaped elsewhere */
+}
+
+/*
+ * Reap every child of ours that has exited, leaving the others alone.
+ */
+static void
+sigfd_reap(void)
+{
+	int			i;
+	siginfo_t	si;
+
+	while (sigfd_npid > 0) {
+		si.si_pid = 0;
+		if (waitid(P_ALL, 0, &si, WEXITED | WNOHANG | WNOWAIT) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;				/* ECHILD: no children at all */
+		}
+		if (si.si_pid == 0)
+			return;				/* none has exited */
+		for (i = 0; i < sigfd_npid; i++)
+			if (sigfd_pids[i] == si.si_pid)
+				break;
+		if (i == sigfd_npid)
+			break;				/* not ours: look for ours */
+		sigfd_reapone(i);
+	}
+	for (i = 0; i < sigfd_npid; )
+		if (!sigfd_reapone(i))
+			i++;
+}
+
+/*
+ * Reap the children given to sigfd_watch() as they exit and pass each
+ * to func.  Those that exited before we took SIGCHLD over are reaped now.
+ */
+int
+sigfd_children(Childfunc *func, void *arg)
+{
+	sigfd_child = func;
+	sigfd_childarg = arg;
+	if (!sigismember(&sigfd_mask, SIGCHLD) &&
+	  sigfd_handle(SIGCHLD, NULL, NULL) < 0)
+		return(-1);
+	sigfd_reap();
+	return(0);
+}
+
+/*
+ * Reap child pid when it exits.  Call it before the loop next calls
+ * sigfd_dispatch().  Returns 0 if OK, -1 on error.
+ */
+int
+sigfd_watch(pid_t pid)
+{
+	int		n;
+	pid_t	*pp;
+
+	if (pid <= 0) {
+		errno = EINVAL;
+		return(-1);
+	}
+	if (sigfd_npid == sigfd_maxpid) {
+		n = sigfd_maxpid ? 2 * sigfd_maxpid : SIGFD_NPID;
+		if ((pp = realloc(sigfd_pids, n * sizeof(pid_t))) == NULL)
+			return(-1);
+		sigfd_pids = pp;
+		sigfd_maxpid = n;
+	}
+	sigfd_pids[sigfd_npid++] = pid;
+	return(0);
+}
+
+/*
+ * Handle whatever signals have arrived.  Returns how many did, or -1 on
+ * error.
+ */
+int
+sigfd_dispatch(void)
+{
+	int						i, n, signo, total;
+	int						count[NSIG];
+	ssize_t					nr;
+	struct signalfd_siginfo	buf[SIGFD_BATCH], last[NSIG];
+
+	memset(count, 0, sizeof(count));
+	total = 0;
+	for (;;) {
+		if ((nr = read(sigfd_fd, buf, sizeof(buf))) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			return(-1);
+		}
+		n = nr / sizeof(struct signalfd_siginfo);
+		for (i = 0; i < n; i++) {
+			signo = buf[i].ssi_signo;
+			if (signo > 0 && signo < NSIG) {
+				count[signo]++;
+				last[signo] = buf[i];
+			}
+		}
+		total += n;
+		if (nr < (ssize_t)sizeof(buf))
+			break;				/* a short read means it's empty */
+	}
+
+	for (signo = 1; signo < NSIG; signo++) {
+		if (count[signo] == 0)
+			continue;
+		if (signo == SIGCHLD && sigfd_child != NULL)
+			sigfd_reap();
+		if (sigfd_func[signo] != NULL)
+			(*sigfd_func[signo])(signo, count[signo], &last[signo],
+			  sigfd_arg[signo]);
+	}
+	return(total);
+}
+
+/*
+ * Close the descriptor and unblock the signals we blocked.
+ */
+void
+sigfd_close(void)
+{
+	int			signo;
+	sigset_t	set;
+
+	if (sigfd_fd < 0)
+		return;
+	close(sigfd_fd);
+	sigfd_fd = -1;
+	sigemptyset(&set);
+	for (signo = 1; signo < NSIG; signo++)
+		if (sigismember(&sigfd_mask, signo) &&
+		  !sigismember(&sigfd_omask, signo))
+			sigaddset(&set, signo);
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+	sigemptyset(&sigfd_mask);
+	memset(sigfd_func, 0, sizeof(sigfd_func));
+	sigfd_child = NULL;
+	sigfd_npid = 0;
+}
@@ -1,46 +1,23 @@
 #include "apue.h"
-
-static void
-sig_alrm(int signo)
-{
-	/* nothing to do, just returning wakes up sigsuspend() */
-}
-
+#include "deadline.h"
+#include <errno.h>
+
+/*
+ * sleep() without SIGALRM: sleep until an absolute time, so the caller's
+ * handler and any alarm() it has pending are left alone.  As before we
+ * return early when a signal is caught, with the seconds not slept
+ * (rounded up, so 0 only means we slept the whole time).
+ */
 unsigned int
 sleep(unsigned int seconds)
 {
-	struct sigaction	newact, oldact;
-	sigset_t			newmask, oldmask, suspmask;
-	unsigned int		unslept;
-
-	/* set our handler, save previous information */
-	newact.sa_handler = sig_alrm;
-	sigemptyset(&newact.sa_mask);
-	newact.sa_flags = 0;
-	sigaction(SIGALRM, &newact, &oldact);
-
-	/* block SIGALRM and save current signal mask */
-	sigemptyset(&newmask);
-	sigaddset(&newmask, SIGALRM);
-	sigprocmask(SIG_BLOCK, &newmask, &oldmask);
-
-	alarm(seconds);
-	suspmask = oldmask;
-
-	/* make sure SIGALRM isn't blocked */
-	sigdelset(&suspmask, SIGALRM);
-
-	/* wait for any signal to be caught */
-	sigsuspend(&suspmask);
-
-	/* some signal has been caught, SIGALRM is now blocked */
-
-	unslept = alarm(0);
-
-	/* reset previous action */
-	sigaction(SIGALRM, &oldact, NULL);
-
-	/* reset signal mask, which unblocks SIGALRM */
-	sigprocmask(SIG_SETMASK, &oldmask, NULL);
-	return(unslept);
+	struct timespec	dl;
+	long long		left;
+
+	dl_after(&dl, seconds * 1000000000LL);
+	if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &dl, NULL) != EINTR)
+		return(0);
+	if ((left = dl_remaining(&dl)) <= 0)
+		return(0);
+	return((left + 999999999) / 1000000000);
 }
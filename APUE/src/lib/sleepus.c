@@ -1,12 +1,16 @@
 #include "apue.h"
-#include <sys/time.h>
+#include "deadline.h"
 
+/*
+ * Sleep for nusecs microseconds.  The deadline is fixed on entry, so a
+ * caught signal doesn't cut the sleep short or stretch it; see
+ * {Prog deadline}.
+ */
 void
 sleep_us(unsigned int nusecs)
 {
-	struct timeval	tval;
+	struct timespec	dl;
 
-	tval.tv_sec = nusecs / 1000000;
-	tval.tv_usec = nusecs % 1000000;
-	select(0, NULL, NULL, NULL, &tval);
+	dl_after(&dl, nusecs * 1000LL);
+	dl_sleep(&dl);
 }
@@ -0,0 +1,350 @@
+/*
+ * popen() built on posix_spawn().
+ *
+ * {Prog popen} calls fork(), which copies the parent's page tables and
+ * marks every private page copy-on-write, only for the child to throw
+ * them all away in exec.  In a server with a big resident set that is
+ * most of the cost of running a small command.  posix_spawn() in glibc
+ * clones with the parent's memory shared (the vfork() way), so what it
+ * costs doesn't depend on how big we are.
+ *
+ * Our pipe descriptors are all close-on-exec, so children don't inherit
+ * the other streams we have open, and we don't need the open_max() table
+ * of {Prog popen} to find them; we still need to find the pid from the
+ * FILE in spclose(), in a table that grows as needed.
+ *
+ * For an event loop, sp_start() starts the command and returns at once
+ * with a nonblocking pipe and a pidfd (a descriptor that becomes readable
+ * when the child exits), so both go into the same select/poll/epoll set
+ * as everything else; sp_reap() then collects the status without ever
+ * blocking in waitpid().
+ *
+ *	sp_start(&sp, cmdstring, "r");		# sp.sp_fd, sp.sp_pidfd
+ *	sp_reap(&sp, 0);			# -1/EAGAIN if it's still running
+ *	fp = spopen(cmdstring, "r");		# like popen()
+ *	spclose(fp);
+ *
+ * Commands like uptime are run again and again for the same answer.
+ * sp_cached() runs one only if the output we have is older than ttl
+ * milliseconds; sp_cache_get() and sp_cache_put() are the two halves,
+ * for callers that run the command themselves with sp_start().
+ */
+
+#include "apue.h"
+#include "spopen.h"
+#include "forklock.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define	SP_NCACHE	16		/* commands whose output we keep */
+
+extern char	**environ;
+
+struct sp_cache {
+	char	*c_cmd;
+	char	*c_out;
+	size_t	 c_len;
+	long	 c_when;		/* ms, CLOCK_MONOTONIC */
+};
+
+static pthread_mutex_t	sp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t	sp_once = PTHREAD_ONCE_INIT;
+static pid_t		   *sp_pids;	/* pid for each spopen() descriptor */
+static int				sp_npids;
+static struct sp_cache	sp_cache[SP_NCACHE];
+
+static void
+sp_init(void)
+{
+	fl_register(&sp_lock, FL_MUTEX, FL_RANK_SPOPEN, NULL);
+}
+
+/*
+ * Start "sh -c cmdstring" with its standard output (type "r") or input
+ * (type "w") on a pipe.  Returns 0 if OK, -1 with errno set on error.
+ */
+int
+sp_start(struct spproc *sp, const char *cmdstring, const char *type)
+{
+	int							 pfd[2], ours, theirs, target, err;
+	char						*argv[4];
+	posix_spawn_file_actions_t	 fa;
+
+	if ((type[0] != 'r' && type[0] != 'w') || type[1] != 0) {
+		errno = EINVAL;
+		return(-1);
+	}
+	if (pipe2(pfd, O_CLOEXEC) < 0)
+		return(-1);
+	if (type[0] == 'r') {
+		ours = pfd[0];
+		theirs = pfd[1];
+		target = STDOUT_FILENO;
+	} else {
+		ours = pfd[1];
+		theirs = pfd[0];
+		target = STDIN_FILENO;
+	}
+
+	/*
+	 * dup2() clears close-on-exec in the child; if the pipe already
+	 * has the right descriptor number, there is no dup2() to do it.
+	 */
+	if (theirs == target)
+		fcntl(theirs, F_SETFD, 0);
+	if ((err = posix_spawn_file_actions_init(&fa)) != 0)
+		goto fail;
+	if (theirs != target &&
+	  (err = posix_spawn_file_actions_adddup2(&fa, theirs, target)) != 0) {
+		posix_spawn_file_actions_destroy(&fa);
+		goto fail;
+	}
+	argv[0] = "sh";
+	argv[1] = "-c";
+	argv[2] = (char *)cmdstring;
+	argv[3] = NULL;
+	err = posix_spawn(&sp->sp_pid, "/bin/sh", &fa, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&fa);
+	if (err != 0)
+		goto fail;
+
+	close(theirs);
+	set_fl(ours, O_NONBLOCK);
+	sp->sp_fd = ours;
+	sp->sp_status = 0;
+	/* the child can't be reaped yet, so the pid can't have been reused */
+	sp->sp_pidfd = syscall(SYS_pidfd_open, sp->sp_pid, 0);
+	return(0);
+
+fail:
+	close(pfd[0]);
+	close(pfd[1]);
+	errno = err;
+	return(-1);
+}
+
+/*
+ * Collect the child's status into sp_status and close the pidfd.
+ * If wait is zero and the child hasn't exited, return -1 with errno
+ * set to EAGAIN.  sp_fd is left for the caller to close.
+ */
+int
+sp_reap(struct spproc *sp, int wait)
+{
+	pid_t	pid;
+	int		status;
+
+	while ((pid = waitpid(sp->sp_pid, &status, wait ? 0 : WNOHANG)) < 0)
+		if (errno != EINTR)
+			return(-1);
+	if (pid == 0) {
+		errno = EAGAIN;
+		return(-1);
+	}
+	sp->sp_status = status;
+	if (sp->sp_pidfd >= 0) {
+		close(sp->sp_pidfd);
+		sp->sp_pidfd = -1;
+	}
+	return(0);
+}
+
+FILE *
+spopen(const char *cmdstring, const char *type)
+{
+	int				 fd, n;
+	pid_t			*pids;
+	FILE			*fp;
+	struct spproc	 sp;
+
+	if (sp_start(&sp, cmdstring, type) < 0)
+		return(NULL);
+	if (sp.sp_pidfd >= 0)
+		close(sp.sp_pidfd);		/* spclose() will block in waitpid() */
+	fd = sp.sp_fd;
+	clr_fl(fd, O_NONBLOCK);
+
+	pthread_once(&sp_once, sp_init);
+	pthread_mutex_lock(&sp_lock);
+	if (fd >= sp_npids) {
+		for (n = (sp_npids == 0) ? 64 : sp_npids; n <= fd; n *= 2)
+			;
+		if ((pids = realloc(sp_pids, n * sizeof(pid_t))) == NULL) {
+			pthread_mutex_unlock(&sp_lock);
+			goto fail;
+		}
+		memset(pids + sp_npids, 0, (n - sp_npids) * sizeof(pid_t));
+		sp_pids = pids;
+		sp_npids = n;
+	}
+	sp_pids[fd] = sp.sp_pid;
+	pthread_mutex_unlock(&sp_lock);
+
+	if ((fp = fdopen(fd, type)) == NULL) {
+		pthread_mutex_lock(&sp_lock);
+		sp_pids[fd] = 0;
+		pthread_mutex_unlock(&sp_lock);
+		goto fail;
+	}
+	return(fp);
+
+fail:
+	close(fd);
+	sp.sp_pidfd = -1;
+	sp_reap(&sp, 1);
+	errno = ENOMEM;
+	return(NULL);
+}
+
+int
+spclose(FILE *fp)
+{
+	int				fd;
+	pid_t			pid;
+	struct spproc	sp;
+
+	fd = fileno(fp);
+	pthread_once(&sp_once, sp_init);
+	pthread_mutex_lock(&sp_lock);
+	if (fd < 0 || fd >= sp_npids || (pid = sp_pids[fd]) == 0) {
+		pthread_mutex_unlock(&sp_lock);
+		errno = EINVAL;
+		return(-1);		/* fp wasn't opened by spopen() */
+	}
+	sp_pids[fd] = 0;
+	pthread_mutex_unlock(&sp_lock);
+
+	if (fclose(fp) == EOF)
+		return(-1);
+	sp.sp_pid = pid;
+	sp.sp_pidfd = -1;
+	if (sp_reap(&sp, 1) < 0)
+		return(-1);
+	return(sp.sp_status);	/* child's termination status */
+}
+
+static long
+sp_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/*
+ * Copy out what cmdstring printed, if we have it from less than ttl
+ * milliseconds ago.  Returns the number of bytes copied, or -1 if we
+ * have nothing that recent.
+ */
+ssize_t
+sp_cache_get(const char *cmdstring, long ttl, char *buf, size_t size)
+{
+	int				 i;
+	ssize_t			 n;
+	struct sp_cache	*cp;
+
+	n = -1;
+	pthread_once(&sp_once, sp_init);
+	pthread_mutex_lock(&sp_lock);
+	for (i = 0; i < SP_NCACHE; i++) {
+		cp = &sp_cache[i];
+		if (cp->c_cmd != NULL && strcmp(cp->c_cmd, cmdstring) == 0) {
+			if (sp_now() - cp->c_when < ttl) {
+				n = min(cp->c_len, size);
+				memcpy(buf, cp->c_out, n);
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sp_lock);
+	return(n);
+}
+
+/*
+ * Remember what cmdstring printed, replacing the oldest entry if the
+ * cache is full.
+ */
+void
+sp_cache_put(const char *cmdstring, const char *out, size_t len)
+{
+	int				 i;
+	char			*copy;
+	struct sp_cache	*cp, *old;
+
+	if ((copy = malloc(len)) == NULL)
+		return;
+	memcpy(copy, out, len);
+	pthread_once(&sp_once, sp_init);
+	pthread_mutex_lock(&sp_lock);
+	old = &sp_cache[0];
+	for (i = 0; i < SP_NCACHE; i++) {
+		cp = &sp_cache[i];
+		if (cp->c_cmd == NULL || strcmp(cp->c_cmd, cmdstring) == 0) {
+			old = cp;
+			break;
+		}
+		if (cp->c_when < old->c_when)
+			old = cp;
+	}
+	if (old->c_cmd == NULL || strcmp(old->c_cmd, cmdstring) != 0) {
+		free(old->c_cmd);
+		if ((old->c_cmd = strdup(cmdstring)) == NULL) {
+			free(old->c_out);
+			old->c_out = NULL;
+			pthread_mutex_unlock(&sp_lock);
+			free(copy);
+			return;
+		}
+	}
+	free(old->c_out);
+	old->c_out = copy;
+	old->c_len = len;
+	old->c_when = sp_now();
+	pthread_mutex_unlock(&sp_lock);
+}
+
+/*
+ * Run cmdstring and return up to size bytes of what it prints, unless
+ * it printed that less than ttl milliseconds ago.  Output is only kept
+ * if the command exits with status 0.  Returns the number of bytes in
+ * buf, or -1 on error.
+ */
+ssize_t
+sp_cached(const char *cmdstring, long ttl, char *buf, size_t size)
+{
+	ssize_t			n, total;
+	char			junk[512];
+	struct spproc	sp;
+
+	if ((total = sp_cache_get(cmdstring, ttl, buf, size)) >= 0)
+		return(total);
+
+	if (sp_start(&sp, cmdstring, "r") < 0)
+		return(-1);
+	clr_fl(sp.sp_fd, O_NONBLOCK);
+	total = 0;
+	for (;;) {
+		if (total < (ssize_t)size)
+			n = read(sp.sp_fd, buf + total, size - total);
+		else
+			n = read(sp.sp_fd, junk, sizeof(junk));	/* let it finish */
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		if (total < (ssize_t)size)
+			total += n;
+	}
+	close(sp.sp_fd);
+	if (sp_reap(&sp, 1) < 0)
+		return(-1);
+	if (WIFEXITED(sp.sp_status) && WEXITSTATUS(sp.sp_status) == 0)
+		sp_cache_put(cmdstring, buf, total);
+	return(total);
+}
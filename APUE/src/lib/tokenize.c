@@ -0,0 +1,233 @@
+/*
+ * Split a line into arguments.
+ *
+ * {Prog bufargs} used strtok(), which keeps its position in a static
+ * variable: two threads tokenizing at once corrupt each other, and so
+ * does a function that tokenizes while its caller is between strtok()
+ * calls.  strtok() also tests every byte against every delimiter, knows
+ * nothing of quoting, and buf_args() gave up without saying why when a
+ * line had too many arguments.
+ *
+ * tok_split() keeps its state on the stack and fills an array the caller
+ * provides, so it allocates nothing.  Arguments are separated by blanks,
+ * tabs and newlines.  'single quotes' take everything literally, "double
+ * quotes" take everything but \" and \\, and outside quotes a backslash
+ * takes the next character literally, as in the shell.  Each argument is
+ * unquoted and null terminated in place.  That needs a byte after the
+ * last argument, which a null-terminated string has.
+ *
+ * Most of the work is finding the next byte that matters: the next
+ * nonblank, or the next blank, quote or backslash.  We classify the line
+ * 64 bytes at a time into bit masks, one bit per byte, for white space,
+ * each quote and backslash (with SSE2, a compare per character and a
+ * movemask per 16 bytes), and then move from one argument to the next
+ * with bit scans over the masks.  Only arguments that really contain
+ * quotes or backslashes are copied, a run at a time.
+ */
+
+#include "apue.h"
+#include "tokenize.h"
+#include <errno.h>
+#include <stdint.h>
+#ifdef	__SSE2__
+#include <emmintrin.h>
+#endif
+
+#define	TOK_SKIP	0	/* looking for the next nonwhite byte */
+#define	TOK_WORD	1	/* white space, quote or backslash */
+#define	TOK_DQUOTE	2	/* closing double quote or backslash */
+#define	TOK_SQUOTE	3	/* closing single quote */
+
+#define	ISWHITE(c)	((c) == ' ' || (c) == '\t' || (c) == '\n')
+
+/*
+ * The classified 64-byte block of the line we're in.
+ */
+struct tokblk {
+	const char	*b_buf;
+	size_t		 b_len;
+	size_t		 b_off;		/* offset of the block */
+	uint64_t	 b_white;	/* a bit per byte */
+	uint64_t	 b_dquote;
+	uint64_t	 b_squote;
+	uint64_t	 b_bslash;
+	uint64_t	 b_word;	/* any of the above: ends a plain run */
+};
+
+#ifdef	__SSE2__
+static inline uint64_t
+tok_eq(const __m128i v[4], char c)
+{
+	__m128i	cv = _mm_set1_epi8(c);
+
+	return((uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v[0], cv)) |
+	  (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v[1], cv)) << 16 |
+	  (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v[2], cv)) << 32 |
+	  (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v[3], cv)) << 48);
+}
+#endif
+
+static inline void
+tok_classify(struct tokblk *bp, size_t off)
+{
+	int			i;
+	size_t		n;
+	const char	*p;
+	char		pad[64];
+#ifdef	__SSE2__
+	__m128i		v[4];
+#else
+	uint64_t	bit;
+#endif
+
+	bp->b_off = off;
+	p = bp->b_buf + off;
+	if ((n = bp->b_len - off) < 64) {
+		memcpy(pad, p, n);		/* don't read past the end */
+		memset(pad + n, 'x', 64 - n);
+		p = pad;
+	}
+#ifdef	__SSE2__
+	for (i = 0; i < 4; i++)
+		v[i] = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+	bp->b_white = tok_eq(v, ' ') | tok_eq(v, '\t') | tok_eq(v, '\n');
+	bp->b_dquote = tok_eq(v, '"');
+	bp->b_squote = tok_eq(v, '\'');
+	bp->b_bslash = tok_eq(v, '\\');
+#else
+	bp->b_white = bp->b_dquote = bp->b_squote = bp->b_bslash = 0;
+	for (i = 0, bit = 1; i < 64; i++, bit <<= 1) {
+		if (ISWHITE(p[i]))
+			bp->b_white |= bit;
+		else if (p[i] == '"')
+			bp->b_dquote |= bit;
+		else if (p[i] == '\'')
+			bp->b_squote |= bit;
+		else if (p[i] == '\\')
+			bp->b_bslash |= bit;
+	}
+#endif
+	bp->b_word = bp->b_white | bp->b_dquote | bp->b_squote | bp->b_bslash;
+}
+
+/*
+ * Returns the index of the first byte at or after i in class cls, else
+ * the length of the line.
+ */
+static inline __attribute__((always_inline)) size_t
+tok_scan(struct tokblk *bp, size_t i, int cls)
+{
+	uint64_t	bits;
+
+	while (i < bp->b_len) {
+		if ((i & ~(size_t)63) != bp->b_off)
+			tok_classify(bp, i & ~(size_t)63);
+		switch (cls) {
+		case TOK_SKIP:
+			bits = ~bp->b_white;
+			break;
+		case TOK_WORD:
+			bits = bp->b_word;
+			break;
+		case TOK_DQUOTE:
+			bits = bp->b_dquote | bp->b_bslash;
+			break;
+		default:
+			bits = bp->b_squote;
+			break;
+		}
+		if ((bits >>= (i & 63)) != 0) {
+			i += __builtin_ctzll(bits);
+			return(i < bp->b_len ? i : bp->b_len);
+		}
+		i = (i | 63) + 1;
+	}
+	return(bp->b_len);
+}
+
+/*
+ * Split the len bytes at buf into at most maxtok arguments, stored in
+ * tv[].  Returns the number of arguments, or -1 with errno set to E2BIG
+ * if there were more (the first maxtok are stored), or EINVAL for an
+ * unterminated quote or a backslash at the end.
+ */
+int
+tok_split(char *buf, size_t len, struct tok *tv, int maxtok)
+{
+	int				ntok;
+	size_t			i, j, k, start;
+	struct tokblk	blk;
+
+	blk.b_buf = buf;
+	blk.b_len = len;
+	blk.b_off = 1;			/* no block classified yet */
+	ntok = 0;
+	i = 0;					/* where we read */
+	for (;;) {
+		i = tok_scan(&blk, i, TOK_SKIP);
+		if (i >= len)
+			return(ntok);
+		if (ntok >= maxtok) {
+			errno = E2BIG;
+			return(-1);
+		}
+
+		/*
+		 * Collect one argument at j, which falls behind i once
+		 * we've dropped a quote or backslash.
+		 */
+		start = j = i;
+		for (;;) {
+			k = tok_scan(&blk, i, TOK_WORD) - i;
+			if (j != i)
+				memmove(buf + j, buf + i, k);
+			i += k;
+			j += k;
+			if (i >= len || ISWHITE(buf[i]))
+				break;
+			switch (buf[i++]) {
+			case '\\':
+				if (i >= len)
+					goto badquote;
+				buf[j++] = buf[i++];
+				break;
+
+			case '\'':
+				k = tok_scan(&blk, i, TOK_SQUOTE) - i;
+				if (i + k >= len)
+					goto badquote;
+				memmove(buf + j, buf + i, k);
+				i += k + 1;
+				j += k;
+				break;
+
+			case '"':
+				for (;;) {
+					k = tok_scan(&blk, i, TOK_DQUOTE) - i;
+					memmove(buf + j, buf + i, k);
+					i += k;
+					j += k;
+					if (i >= len)
+						goto badquote;
+					if (buf[i++] == '"')
+						break;
+					if (i < len && (buf[i] == '"' || buf[i] == '\\'))
+						buf[j++] = buf[i++];
+					else
+						buf[j++] = '\\';	/* not an escape here */
+				}
+				break;
+			}
+		}
+		tv[ntok].t_ptr = buf + start;
+		tv[ntok].t_len = j - start;
+		ntok++;
+		buf[j] = 0;
+		if (i < len)
+			i++;			/* the white space ending it, maybe just nulled */
+	}
+
+badquote:
+	errno = EINVAL;
+	return(-1);
+}
@@ -0,0 +1,835 @@
+/*
+ * Local RPC over UNIX domain sockets.
+ *
+ * serv_listen(), serv_accept() and cli_conn() give us a connected pair of
+ * sockets and nothing more: the open server of Chapter 17 frames its
+ * requests as one line per write and serves one client at a time.  Here
+ * each message carries a fixed header with its length, so a stream
+ * socket can be read in large chunks and split into messages, and a
+ * correlation id, so a client can have many requests outstanding and
+ * match each reply to its request however they are interleaved.
+ * SOCK_SEQPACKET sockets work too: there the kernel keeps the message
+ * boundaries, so each message is one record.
+ *
+ * Output is queued and sent in bulk: urpc_send() just appends, and the
+ * queue goes out when it grows large, on urpc_flush(), or before
+ * urpc_recv() has to wait for input.  A client that sends a hundred
+ * requests and then reads the replies makes one write, not a hundred;
+ * on a SOCK_SEQPACKET socket the records go out through sendmmsg().
+ * A blocking client that is kept waiting to send reads the replies that
+ * arrive meanwhile into its input buffer, where urpc_recv() finds them,
+ * since the server may have stopped reading it until they're read; so a
+ * client can send any number of requests before reading a reply.
+ *
+ * A payload larger than URPC_INLINE isn't copied through the socket at
+ * all.  It travels in a memfd, passed with SCM_RIGHTS like send_fd(), and
+ * the receiver maps it.  A sender can build the payload in place with
+ * urpc_memfd(), which makes the transfer zero-copy; otherwise urpc_send()
+ * copies the data into a memfd once.  The memfd is sealed against
+ * shrinking, so the sender can't pull pages out from under the mapping.
+ *
+ * The server is a single epoll loop over the listening socket and every
+ * connection, all nonblocking, so thousands of clients cost a descriptor
+ * and two buffers each.  Each time a connection is readable, it handles
+ * every complete request in its input, then sends all the replies
+ * together.  A connection whose replies pile up unread isn't read from
+ * until they drain.  Thousands of clients need RLIMIT_NOFILE raised to
+ * match; when the server runs out of descriptors it stops accepting, and
+ * new clients wait in the listen queue until a connection closes.
+ *
+ * Client:
+ *	c = urpc_connect(name, SOCK_STREAM);	# or SOCK_SEQPACKET
+ *	m.m_id = 0; m.m_op = op; m.m_data = buf; m.m_len = n; m.m_fd = -1;
+ *	urpc_send(c, &m);			# assigns m.m_id
+ *	urpc_recv(c, &r);			# r.m_id says which request
+ *	urpc_release(&r);			# if r.m_fd != -1
+ *	urpc_call(c, &m, &r);			# send and wait for its reply
+ *	urpc_close(c);
+ *
+ * Server:
+ *	s = urpc_listen(name, SOCK_STREAM, func, arg);
+ *	urpc_run(s);				# until func calls urpc_stop(s)
+ *	urpc_shutdown(s);
+ *	func(c, req, arg) {			# for each request
+ *		urpc_reply(c, req, status, data, len);
+ *	}
+ */
+
+#include "apue.h"
+#include "urpc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+
+#define	URPC_HDRLEN	sizeof(struct urpc_hdr)
+#define	URPC_BUFSZ	4096		/* initial size of each buffer */
+#define	URPC_WMAX	65536		/* send once this much output is queued */
+#define	URPC_WHIGH	(16 * URPC_WMAX)	/* stop reading a client past this */
+#define	URPC_MAXFD	8			/* descriptors per recvmsg() */
+#define	URPC_BATCH	64			/* records per sendmmsg() */
+#define	URPC_NEVENT	256			/* events per epoll_wait() */
+#define	URPC_FULLMS	100			/* retry accept() after EMFILE, ms */
+
+/*
+ * Make sure *bufp holds at least need bytes.
+ */
+static int
+urpc_reserve(char **bufp, size_t *sizep, size_t need)
+{
+	size_t	size;
+	char	*p;
+
+	if (*sizep >= need)
+		return(0);
+	for (size = *sizep ? *sizep : URPC_BUFSZ; size < need; size *= 2)
+		;
+	if ((p = realloc(*bufp, size)) == NULL)
+		return(-1);
+	*bufp = p;
+	*sizep = size;
+	return(0);
+}
+
+static struct urpc_conn *
+urpc_newconn(int fd, int type)
+{
+	struct urpc_conn	*c;
+
+	if ((c = calloc(1, sizeof(struct urpc_conn))) == NULL)
+		return(NULL);
+	c->c_fd = fd;
+	c->c_type = type;
+	c->c_nextid = 1;
+	c->c_rneed = URPC_HDRLEN;
+	return(c);
+}
+
+/*
+ * Connect to the server listening on name.  Returns NULL on error.
+ */
+struct urpc_conn *
+urpc_connect(const char *name, int type)
+{
+	int					fd, err;
+	struct urpc_conn	*c;
+
+	if ((fd = cli_conn_type(name, type)) < 0)
+		return(NULL);
+	if ((c = urpc_newconn(fd, type)) == NULL) {
+		err = errno;
+		close(fd);
+		errno = err;
+	}
+	return(c);
+}
+
+/*
+ * Send what we can of any queued output, then close.
+ */
+void
+urpc_close(struct urpc_conn *c)
+{
+	int		i;
+
+	if (c->c_wbeg < c->c_wend)
+		urpc_flush(c);
+	close(c->c_fd);
+	for (i = 0; i < c->c_nrfd; i++)
+		close(c->c_rfds[i]);
+	for (i = 0; i < c->c_nwfd; i++)
+		close(c->c_wfds[i].w_fd);
+	free(c->c_rbuf);
+	free(c->c_wbuf);
+	free(c->c_rfds);
+	free(c->c_wfds);
+	free(c);
+}
+
+/*
+ * Create a memfd of len bytes, sealed at that size, and map it for
+ * writing at *datap.  Returns the descriptor, or -1 on error.
+ */
+int
+urpc_memfd(size_t len, void **datap)
+{
+	int		fd, err;
+	void	*p;
+
+	if ((fd = memfd_create("urpc", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+		return(-1);
+	p = NULL;
+	if (ftruncate(fd, len) < 0 ||
+	  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0)
+		goto errout;
+	if (len > 0 && (p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+	  fd, 0)) == MAP_FAILED)
+		goto errout;
+	*datap = p;
+	return(fd);
+
+errout:
+	err = errno;
+	close(fd);
+	errno = err;
+	return(-1);
+}
+
+/*
+ * Unmap and close the memfd of a message, if it has one.
+ */
+void
+urpc_release(struct urpc_msg *m)
+{
+	if (m->m_fd < 0)
+		return;
+	if (m->m_data != NULL && m->m_len > 0)
+		munmap(m->m_data, m->m_len);
+	close(m->m_fd);
+	m->m_fd = -1;
+	m->m_data = NULL;
+}
+
+/*
+ * Queue a message; m->m_id 0 means assign it the next id.  The message
+ * and any memfd in it remain the caller's.  Returns 0 if OK, -1 on error.
+ */
+int
+urpc_send(struct urpc_conn *c, struct urpc_msg *m)
+{
+	int				fd, err, n;
+	size_t			need;
+	void			*p, *wp;
+	struct urpc_hdr	h;
+
+	fd = -1;
+	if (m->m_fd >= 0) {
+		if ((fd = fcntl(m->m_fd, F_DUPFD_CLOEXEC, 0)) < 0)
+			return(-1);
+	} else if (m->m_len > URPC_INLINE) {
+		if ((fd = urpc_memfd(m->m_len, &p)) < 0)
+			return(-1);
+		memcpy(p, m->m_data, m->m_len);
+		munmap(p, m->m_len);
+	}
+	if (fd >= 0 && c->c_nwfd == c->c_maxwfd) {
+		n = c->c_maxwfd ? 2 * c->c_maxwfd : URPC_MAXFD;
+		if ((wp = realloc(c->c_wfds, n * sizeof(struct urpc_wfd))) == NULL)
+			goto errout;
+		c->c_wfds = wp;
+		c->c_maxwfd = n;
+	}
+
+	need = URPC_HDRLEN + (fd >= 0 ? 0 : m->m_len);
+	if (c->c_wbeg == c->c_wend) {
+		c->c_wbeg = c->c_wend = 0;
+	} else if (c->c_wbeg > 0 && c->c_wend + need > c->c_wsize) {
+		memmove(c->c_wbuf, c->c_wbuf + c->c_wbeg, c->c_wend - c->c_wbeg);
+		c->c_wend -= c->c_wbeg;
+		c->c_wbeg = 0;
+	}
+	if (urpc_reserve(&c->c_wbuf, &c->c_wsize, c->c_wend + need) < 0)
+		goto errout;
+
+	if (m->m_id == 0)
+		m->m_id = c->c_nextid++;
+	memset(&h, 0, sizeof(h));
+	h.h_id = m->m_id;
+	h.h_len = m->m_len;
+	h.h_op = m->m_op;
+	h.h_status = m->m_status;
+	if (fd >= 0) {
+		h.h_flags = URPC_FD;
+		c->c_wfds[c->c_nwfd].w_pos = c->c_wsent + (c->c_wend - c->c_wbeg);
+		c->c_wfds[c->c_nwfd++].w_fd = fd;
+	}
+	memcpy(c->c_wbuf + c->c_wend, &h, URPC_HDRLEN);
+	if (fd < 0 && m->m_len > 0)
+		memcpy(c->c_wbuf + c->c_wend + URPC_HDRLEN, m->m_data, m->m_len);
+	c->c_wend += need;
+
+	if (c->c_wend - c->c_wbeg >= URPC_WMAX && urpc_flush(c) < 0 &&
+	  errno != EAGAIN)
+		return(-1);
+	return(0);
+
+errout:
+	err = errno;
+	if (fd >= 0)
+		close(fd);
+	errno = err;
+	return(-1);
+}
+
+/*
+ * The descriptor at the front of the queue has been sent.
+ */
+static void
+urpc_popwfd(struct urpc_conn *c)
+{
+	close(c->c_wfds[0].w_fd);
+	memmove(&c->c_wfds[0], &c->c_wfds[1],
+	  --c->c_nwfd * sizeof(struct urpc_wfd));
+}
+
+static void
+urpc_setfd(struct msghdr *msg, void *cbuf, int fd)
+{
+	struct cmsghdr	*cmp;
+
+	msg->msg_control = cbuf;
+	msg->msg_controllen = CMSG_SPACE(sizeof(int));
+	cmp = CMSG_FIRSTHDR(msg);
+	cmp->cmsg_level = SOL_SOCKET;
+	cmp->cmsg_type = SCM_RIGHTS;
+	cmp->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmp), &fd, sizeof(int));
+}
+
+/*
+ * Stream socket: send as much as we can in one go, but a descriptor has
+ * to go with the first byte of its message, so stop short of the next
+ * message that has one.
+ */
+static ssize_t
+urpc_sendstream(struct urpc_conn *c)
+{
+	ssize_t			n;
+	size_t			len;
+	struct iovec	iov;
+	struct msghdr	msg;
+	union {
+		struct cmsghdr	hdr;
+		char			buf[CMSG_SPACE(sizeof(int))];
+	} cm;
+
+	len = c->c_wend - c->c_wbeg;
+	if (c->c_nwfd == 0 || c->c_wfds[0].w_pos != c->c_wsent) {
+		if (c->c_nwfd > 0)
+			len = c->c_wfds[0].w_pos - c->c_wsent;
+		return(send(c->c_fd, c->c_wbuf + c->c_wbeg, len,
+		  MSG_NOSIGNAL | MSG_DONTWAIT));
+	}
+	if (c->c_nwfd > 1)
+		len = c->c_wfds[1].w_pos - c->c_wsent;
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = c->c_wbuf + c->c_wbeg;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	urpc_setfd(&msg, cm.buf, c->c_wfds[0].w_fd);
+	if ((n = sendmsg(c->c_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT)) > 0)
+		urpc_popwfd(c);
+	return(n);
+}
+
+/*
+ * Sequenced-packet socket: one record per message, a batch of them per
+ * system call.
+ */
+static ssize_t
+urpc_sendrecs(struct urpc_conn *c)
+{
+	int				i, n, nfd;
+	size_t			off, sent;
+	struct urpc_hdr	h;
+	struct iovec	iov[URPC_BATCH];
+	struct mmsghdr	msgs[URPC_BATCH];
+	union {
+		struct cmsghdr	hdr;
+		char			buf[CMSG_SPACE(sizeof(int))];
+	} cm[URPC_BATCH];
+
+	off = c->c_wbeg;
+	nfd = 0;
+	for (n = 0; n < URPC_BATCH && off < c->c_wend; n++) {
+		memcpy(&h, c->c_wbuf + off, URPC_HDRLEN);
+		iov[n].iov_base = c->c_wbuf + off;
+		iov[n].iov_len = URPC_HDRLEN + ((h.h_flags & URPC_FD) ? 0 : h.h_len);
+		memset(&msgs[n], 0, sizeof(struct mmsghdr));
+		msgs[n].msg_hdr.msg_iov = &iov[n];
+		msgs[n].msg_hdr.msg_iovlen = 1;
+		if (h.h_flags & URPC_FD)
+			urpc_setfd(&msgs[n].msg_hdr, cm[n].buf, c->c_wfds[nfd++].w_fd);
+		off += iov[n].iov_len;
+	}
+	if ((n = sendmmsg(c->c_fd, msgs, n, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0)
+		return(-1);
+	for (sent = 0, i = 0; i < n; i++) {
+		sent += iov[i].iov_len;
+		if (msgs[i].msg_hdr.msg_controllen != 0)
+			urpc_popwfd(c);
+	}
+	return(sent);
+}
+
+/*
+ * Take the next message out of the input, if it's all there.
+ * Returns 1 if so, 0 if not, -1 if the input makes no sense.
+ */
+static int
+urpc_parse(struct urpc_conn *c, struct urpc_msg *m)
+{
+	int				fd, seals, err;
+	size_t			avail;
+	void			*p;
+	struct stat		sb;
+	struct urpc_hdr	h;
+
+	avail = c->c_rend - c->c_rbeg;
+	if (avail < URPC_HDRLEN) {
+		c->c_rneed = URPC_HDRLEN;
+		return(0);
+	}
+	memcpy(&h, c->c_rbuf + c->c_rbeg, URPC_HDRLEN);
+	if (h.h_flags & URPC_FD) {
+		/*
+		 * The descriptor arrived with the first byte of the header.
+		 */
+		if (c->c_nrfd == 0) {
+			errno = EBADMSG;
+			return(-1);
+		}
+		fd = c->c_rfds[0];
+		memmove(&c->c_rfds[0], &c->c_rfds[1], --c->c_nrfd * sizeof(int));
+		if (fstat(fd, &sb) < 0 || (uint64_t)sb.st_size < h.h_len ||
+		  (seals = fcntl(fd, F_GET_SEALS)) < 0 || !(seals & F_SEAL_SHRINK)) {
+			close(fd);
+			errno = EBADMSG;
+			return(-1);
+		}
+		p = NULL;
+		if (h.h_len > 0 && (p = mmap(NULL, h.h_len, PROT_READ, MAP_SHARED,
+		  fd, 0)) == MAP_FAILED) {
+			err = errno;
+			close(fd);
+			errno = err;
+			return(-1);
+		}
+		m->m_data = p;
+		m->m_fd = fd;
+		c->c_rbeg += URPC_HDRLEN;
+	} else {
+		if (h.h_len > URPC_INLINE) {
+			errno = EBADMSG;
+			return(-1);
+		}
+		if (avail < URPC_HDRLEN + h.h_len) {
+			c->c_rneed = URPC_HDRLEN + h.h_len;
+			return(0);
+		}
+		m->m_data = c->c_rbuf + c->c_rbeg + URPC_HDRLEN;
+		m->m_fd = -1;
+		c->c_rbeg += URPC_HDRLEN + h.h_len;
+	}
+	m->m_id = h.h_id;
+	m->m_op = h.h_op;
+	m->m_status = h.h_status;
+	m->m_len = h.h_len;
+	c->c_rneed = URPC_HDRLEN;
+	return(1);
+}
+
+/*
+ * Read more input, and any descriptors that come with it; flags go to
+ * recvmsg().  Returns 1 if we got some, 0 if a nonblocking socket had
+ * none, -1 on error or end of file (errno ECONNRESET).
+ */
+static int
+urpc_fill(struct urpc_conn *c, int flags)
+{
+	int				i, fd, nfd, max, *ip;
+	ssize_t			n;
+	size_t			need;
+	struct iovec	iov;
+	struct msghdr	msg;
+	struct cmsghdr	*cmp;
+	union {
+		struct cmsghdr	hdr;
+		char			buf[CMSG_SPACE(URPC_MAXFD * sizeof(int))];
+	} cm;
+
+	if (c->c_rbeg > 0) {
+		memmove(c->c_rbuf, c->c_rbuf + c->c_rbeg, c->c_rend - c->c_rbeg);
+		c->c_rend -= c->c_rbeg;
+		c->c_rbeg = 0;
+	}
+	if (c->c_type == SOCK_SEQPACKET)
+		need = c->c_rend + URPC_HDRLEN + URPC_INLINE;	/* a whole record */
+	else if (c->c_rend < c->c_rneed)
+		need = c->c_rneed;
+	else
+		need = c->c_rend + URPC_BUFSZ;	/* from urpc_wait(): more replies */
+	if (urpc_reserve(&c->c_rbuf, &c->c_rsize, need) < 0)
+		return(-1);
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = c->c_rbuf + c->c_rend;
+	iov.iov_len = c->c_rsize - c->c_rend;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cm.buf;
+	msg.msg_controllen = sizeof(cm.buf);
+	if ((n = recvmsg(c->c_fd, &msg, MSG_CMSG_CLOEXEC | flags)) < 0)
+		return((errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1);
+
+	for (cmp = CMSG_FIRSTHDR(&msg); cmp != NULL;
+	  cmp = CMSG_NXTHDR(&msg, cmp)) {
+		if (cmp->cmsg_level != SOL_SOCKET || cmp->cmsg_type != SCM_RIGHTS)
+			continue;
+		nfd = (cmp->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < nfd; i++) {
+			memcpy(&fd, CMSG_DATA(cmp) + i * sizeof(int), sizeof(int));
+			if (c->c_nrfd == c->c_maxrfd) {
+				max = c->c_maxrfd ? 2 * c->c_maxrfd : URPC_MAXFD;
+				if ((ip = realloc(c->c_rfds, max * sizeof(int))) == NULL) {
+					close(fd);
+					continue;	/* its message will fail to parse */
+				}
+				c->c_rfds = ip;
+				c->c_maxrfd = max;
+			}
+			c->c_rfds[c->c_nrfd++] = fd;
+		}
+	}
+	if (n == 0) {
+		errno = ECONNRESET;
+		return(-1);
+	}
+	if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+		errno = EMSGSIZE;
+		return(-1);
+	}
+	c->c_rend += n;
+	return(1);
+}
+
+/*
+ * The socket is full.  If it's blocking, wait until we can send more,
+ * but read whatever arrives meanwhile: the other side may be waiting for
+ * us to read its replies before it reads any more requests, as
+ * urpc_serve() does past URPC_WHIGH.  Returns 0 to try again, else -1;
+ * errno EAGAIN means the socket is nonblocking.
+ */
+static int
+urpc_wait(struct urpc_conn *c)
+{
+	int				fl;
+	struct pollfd	pfd;
+
+	if ((fl = fcntl(c->c_fd, F_GETFL)) < 0)
+		return(-1);
+	if (fl & O_NONBLOCK) {
+		errno = EAGAIN;
+		return(-1);
+	}
+	pfd.fd = c->c_fd;
+	pfd.events = POLLIN | POLLOUT;
+	if (poll(&pfd, 1, -1) < 0)
+		return(errno == EINTR ? 0 : -1);
+	if ((pfd.revents & POLLIN) && urpc_fill(c, MSG_DONTWAIT) < 0 &&
+	  errno != EINTR)
+		return(-1);
+	return(0);
+}
+
+/*
+ * Send queued output.  Returns 0 once it's all gone, else -1; errno
+ * EAGAIN means the socket is nonblocking and full.  A message urpc_recv()
+ * returned may be moved, as by urpc_recv().
+ */
+int
+urpc_flush(struct urpc_conn *c)
+{
+	ssize_t	n;
+
+	while (c->c_wbeg < c->c_wend) {
+		if (c->c_type == SOCK_SEQPACKET)
+			n = urpc_sendrecs(c);
+		else
+			n = urpc_sendstream(c);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+			  urpc_wait(c) == 0)
+				continue;
+			return(-1);
+		}
+		c->c_wbeg += n;
+		c->c_wsent += n;
+	}
+	c->c_wbeg = c->c_wend = 0;
+	return(0);
+}
+
+/*
+ * Get the next message.  Blocks unless the socket is nonblocking.
+ * Returns 1 if we got one, 0 if a nonblocking socket has none yet, -1 on
+ * error or end of file.
+ */
+int
+urpc_recv(struct urpc_conn *c, struct urpc_msg *m)
+{
+	int		n;
+
+	for (;;) {
+		if ((n = urpc_parse(c, m)) != 0)
+			return(n);
+		/*
+		 * Before waiting for input, send what the other side may
+		 * be waiting for.
+		 */
+		if (c->c_wbeg < c->c_wend) {
+			if (urpc_flush(c) < 0 && errno != EAGAIN)
+				return(-1);
+			if ((n = urpc_parse(c, m)) != 0)
+				return(n);		/* it came while we were sending */
+		}
+		if ((n = urpc_fill(c, 0)) < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return(n);
+	}
+}
+
+/*
+ * Send a request and wait for its reply, for a connection with no other
+ * requests outstanding.  Returns 0 if OK, -1 on error.
+ */
+int
+urpc_call(struct urpc_conn *c, struct urpc_msg *req, struct urpc_msg *rep)
+{
+	req->m_id = 0;
+	if (urpc_send(c, req) < 0)
+		return(-1);
+	for (;;) {
+		if (urpc_recv(c, rep) < 0)
+			return(-1);
+		if (rep->m_id == req->m_id)
+			return(0);
+		urpc_release(rep);			/* someone else's; drop it */
+	}
+}
+
+/*
+ * Queue the reply to req.  Returns 0 if OK, -1 on error.
+ */
+int
+urpc_reply(struct urpc_conn *c, const struct urpc_msg *req, int status,
+  const void *data, size_t len)
+{
+	struct urpc_msg	m;
+
+	m.m_id = req->m_id;
+	m.m_op = req->m_op;
+	m.m_status = status;
+	m.m_data = (void *)data;
+	m.m_len = len;
+	m.m_fd = -1;
+	return(urpc_send(c, &m));
+}
+
+/*
+ * Create the server on name.  Returns NULL on error.
+ */
+struct urpc_server *
+urpc_listen(const char *name, int type, Urpcfunc *func, void *arg)
+{
+	int					err;
+	struct epoll_event	ev;
+	struct urpc_server	*s;
+
+	if ((s = calloc(1, sizeof(struct urpc_server))) == NULL)
+		return(NULL);
+	s->s_type = type;
+	s->s_func = func;
+	s->s_arg = arg;
+	s->s_epfd = -1;
+	if ((s->s_lfd = serv_listen_type(name, type)) < 0) {
+		free(s);
+		return(NULL);
+	}
+	if (fcntl(s->s_lfd, F_SETFL, O_NONBLOCK) < 0 ||
+	  (s->s_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		goto errout;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;			/* the listening socket */
+	if (epoll_ctl(s->s_epfd, EPOLL_CTL_ADD, s->s_lfd, &ev) < 0)
+		goto errout;
+	return(s);
+
+errout:
+	err = errno;
+	urpc_shutdown(s);
+	errno = err;
+	return(NULL);
+}
+
+/*
+ * Stop or resume watching the listening socket.  It stays readable while
+ * connections wait, so when we're out of descriptors and can't accept
+ * them, watching it would have urpc_run() spin; we stop until one of our
+ * connections closes, or for URPC_FULLMS if the descriptors went elsewhere.
+ */
+static void
+urpc_listening(struct urpc_server *s, int on)
+{
+	struct epoll_event	ev;
+
+	ev.events = on ? EPOLLIN : 0;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(s->s_epfd, EPOLL_CTL_MOD, s->s_lfd, &ev) == 0)
+		s->s_full = !on;
+}
+
+/*
+ * Accept every connection that's waiting.
+ */
+static void
+urpc_accept(struct urpc_server *s)
+{
+	int					fd;
+	uid_t				uid;
+	struct epoll_event	ev;
+	struct urpc_conn	*c;
+
+	for (;;) {
+		if ((fd = serv_accept(s->s_lfd, &uid)) < 0) {
+			if (fd == -2 && (errno == EINTR || errno == ECONNABORTED))
+				continue;
+			if (fd == -2 && (errno == EMFILE || errno == ENFILE))
+				urpc_listening(s, 0);
+			if (fd == -1 || fd == -2)
+				return;		/* none left, or out of descriptors */
+			continue;		/* a client that failed the checks */
+		}
+		if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0 ||
+		  (c = urpc_newconn(fd, s->s_type)) == NULL) {
+			close(fd);
+			continue;
+		}
+		c->c_uid = uid;
+		c->c_events = EPOLLIN;
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if (epoll_ctl(s->s_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			urpc_close(c);
+			continue;
+		}
+		c->c_next = s->s_conns;
+		s->s_conns = c;
+		s->s_nconn++;
+	}
+}
+
+static void
+urpc_drop(struct urpc_server *s, struct urpc_conn *c)
+{
+	struct urpc_conn	**cpp;
+
+	for (cpp = &s->s_conns; *cpp != NULL; cpp = &(*cpp)->c_next) {
+		if (*cpp == c) {
+			*cpp = c->c_next;
+			break;
+		}
+	}
+	epoll_ctl(s->s_epfd, EPOLL_CTL_DEL, c->c_fd, NULL);
+	urpc_close(c);
+	s->s_nconn--;
+	if (s->s_full)
+		urpc_listening(s, 1);	/* a descriptor is free again */
+}
+
+/*
+ * Handle the requests a connection has sent, then send the replies.
+ * Returns -1 if the connection should be dropped.
+ */
+static int
+urpc_serve(struct urpc_server *s, struct urpc_conn *c)
+{
+	int					n, want;
+	struct urpc_msg		m;
+	struct epoll_event	ev;
+
+	n = 0;
+	while (c->c_wend - c->c_wbeg < URPC_WHIGH &&
+	  (n = urpc_recv(c, &m)) > 0) {
+		s->s_ncall++;
+		(*s->s_func)(c, &m, s->s_arg);
+		urpc_release(&m);
+	}
+	if (n < 0)
+		return(-1);
+	if (urpc_flush(c) < 0 && errno != EAGAIN)
+		return(-1);
+
+	want = 0;
+	if (c->c_wend - c->c_wbeg < URPC_WHIGH)
+		want |= EPOLLIN;
+	if (c->c_wbeg < c->c_wend)
+		want |= EPOLLOUT;
+	if (want != c->c_events) {
+		ev.events = want;
+		ev.data.ptr = c;
+		if (epoll_ctl(s->s_epfd, EPOLL_CTL_MOD, c->c_fd, &ev) < 0)
+			return(-1);
+		c->c_events = want;
+	}
+	return(0);
+}
+
+/*
+ * Serve until urpc_stop().  Returns 0, or -1 on error.
+ */
+int
+urpc_run(struct urpc_server *s)
+{
+	int					i, n;
+	struct urpc_conn	*c;
+	struct epoll_event	ev[URPC_NEVENT];
+
+	s->s_stop = 0;
+	while (!s->s_stop) {
+		if ((n = epoll_wait(s->s_epfd, ev, URPC_NEVENT,
+		  s->s_full ? URPC_FULLMS : -1)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return(-1);
+		}
+		if (n == 0 && s->s_full)
+			urpc_listening(s, 1);		/* try accepting again */
+		s->s_nwake++;
+		for (i = 0; i < n; i++) {
+			if ((c = ev[i].data.ptr) == NULL)
+				urpc_accept(s);
+			else if (urpc_serve(s, c) < 0)
+				urpc_drop(s, c);
+		}
+	}
+	return(0);
+}
+
+/*
+ * Make urpc_run() return, from a request handler or a signal handler.
+ */
+void
+urpc_stop(struct urpc_server *s)
+{
+	s->s_stop = 1;
+}
+
+/*
+ * Close every connection and the server itself.
+ */
+void
+urpc_shutdown(struct urpc_server *s)
+{
+	while (s->s_conns != NULL)
+		urpc_drop(s, s->s_conns);
+	if (s->s_epfd >= 0)
+		close(s->s_epfd);
+	close(s->s_lfd);
+	free(s);
+}
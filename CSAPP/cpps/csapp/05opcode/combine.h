@@ -0,0 +1,264 @@
+﻿/* 合并运算的各种实现，按 data_t、IDENT、OP 和 NAME 生成。
+ * 这个文件没有包含保护：每包含一次就按当时的宏生成一份，optvec.c 用 optvec.h 里的默认值（long、+），
+ * optbench.c 对每种类型和运算各生成一份。
+ * 另外定义了 HAVE_sse、HAVE_avx2、HAVE_avx512 的话，用 vecops.h 里的 <isa>_<op>_<TYPE> 等宏生成显式 SIMD 的版本。
+ * 不用宏、一个程序支持所有类型和运算的 C++ 版本见 ../reduce/reduce.hpp */
+
+typedef struct {
+	long len;
+	data_t* data;
+} NAME(vec_rec), * NAME(vec_ptr);
+
+NAME(vec_ptr) NAME(new_vec)(long len) {
+	/* 分配头结构 */
+	NAME(vec_ptr) result = (NAME(vec_ptr))malloc(sizeof(NAME(vec_rec)));
+	data_t* data = NULL;
+	if (!result) {
+		return NULL;/* 无法分配内存 */
+	}
+	result->len = len;
+	/* 分配数组 */
+	if (len > 0) {
+		data = (data_t*)calloc(len, sizeof(data_t));
+		if (!data) {
+			free((void*)result);
+			return NULL;/* 无法分配内存 */
+		}
+	}
+
+	/* Data 为null或者分配一个数组 */
+	result->data = data;
+	return result;
+}
+
+/// <summary>
+/// 检索向量元素并存储在目标 dest 中
+/// </summary>
+/// <param name="v"></param>
+/// <param name="index"></param>
+/// <param name="dest"></param>
+/// <returns>返回0（越界）或者1（成功）</returns>
+int NAME(get_vec_element)(NAME(vec_ptr) v, long index, data_t* dest) {
+	if (index < 0 || index >= v->len)	/* 做边界检查，提高了程序的安全性，但是作为代价，性能会有的损失 */
+		return 0;
+	*dest = v->data[index];
+	return 1;
+}
+
+/// <summary>
+/// 返回向量的长度
+/// </summary>
+/// <param name="v"></param>
+/// <returns></returns>
+long NAME(vec_length)(NAME(vec_ptr) v) {
+	return v->len;
+}
+
+data_t* NAME(get_vec_start)(NAME(vec_ptr) v) {
+	return v->data;
+}
+
+/* 以下是上面优化的程序实例，合并程序 */
+void NAME(combine1)(NAME(vec_ptr) v, data_t* dest) {
+	long i;
+	*dest = IDENT;
+	for (i = 0; i < NAME(vec_length)(v); i++)
+	{
+		data_t val;
+		NAME(get_vec_element)(v, i, &val);
+		*dest = *dest OP val;
+	}
+}
+
+void NAME(combine2)(NAME(vec_ptr) v, data_t* dest) {
+	long i;
+	long length = NAME(vec_length)(v);
+	*dest = IDENT;
+	for (i = 0; i < length; i++)
+	{
+		data_t val;
+		NAME(get_vec_element)(v, i, &val);
+		*dest = *dest OP val;
+	}
+}
+
+/* 直接访问数组结构 */
+void NAME(combine3)(NAME(vec_ptr) v, data_t* dest) {
+	long i;
+	long length = NAME(vec_length)(v);
+	data_t* data = NAME(get_vec_start)(v);
+	*dest = IDENT;
+	for (i = 0; i < length; i++)
+	{
+		*dest = *dest OP data[i];
+	}
+}
+
+/* 累积在局部变量里，消除不必要的内存引用 */
+void NAME(combine4)(NAME(vec_ptr) v, data_t* dest) {
+	long i;
+	long length = NAME(vec_length)(v);
+	data_t* data = NAME(get_vec_start)(v);
+	data_t acc = IDENT;
+
+	for (i = 0; i < length; i++)
+	{
+		acc = acc OP data[i];
+	}
+	*dest = acc;
+}
+
+/* 2×1 循环展开 */
+void NAME(combine5)(NAME(vec_ptr) v, data_t* dest) {
+	long i = 0;
+	long length = NAME(vec_length)(v);
+	long limit = length - 1;
+	data_t* data = NAME(get_vec_start)(v);
+	data_t acc = IDENT;
+
+	/* 一次计算两个元素 */
+	for (i = 0; i < limit; i += 2)
+	{
+		acc = (acc OP data[i]) OP data[i + 1];
+	}
+	/* 完成剩下的元素 */
+	for (; i < length; i++)
+	{
+		acc = acc OP data[i];
+	}
+	*dest = acc;
+}
+
+/* 2×2 循环展开：两个累积变量，两条关键路径可以并行 */
+void NAME(combine6)(NAME(vec_ptr) v, data_t* dest) {
+	long i = 0;
+	long length = NAME(vec_length)(v);
+	long limit = length - 1;
+	data_t* data = NAME(get_vec_start)(v);
+	data_t acc0 = IDENT;
+	data_t acc1 = IDENT;
+
+	for (i = 0; i < limit; i += 2)
+	{
+		acc0 = acc0 OP data[i];
+		acc1 = acc1 OP data[i + 1];
+	}
+	// 剩下的
+	for (; i < length; i++)
+	{
+		acc0 = acc0 OP data[i];
+	}
+	*dest = acc0 OP acc1;
+}
+
+/* 2×1a 重新结合变换：data[i] OP data[i + 1] 不在关键路径上 */
+void NAME(combine7)(NAME(vec_ptr) v, data_t* dest) {
+	long i = 0;
+	long length = NAME(vec_length)(v);
+	long limit = length - 1;
+	data_t* data = NAME(get_vec_start)(v);
+	data_t acc = IDENT;
+
+	for (i = 0; i < limit; i += 2)
+	{
+		acc = acc OP (data[i] OP data[i + 1]);
+	}
+	for (; i < length; i++)
+	{
+		acc = acc OP data[i];
+	}
+	*dest = acc;
+}
+
+/* k×k 循环展开：k 个累积变量。k 要不小于 运算的延迟×功能单元数 才能达到吞吐量界限。
+ * 累积变量要一个个写出来，写成数组的话编译器可能把它们留在栈上，每次都经过内存 */
+#ifndef COMBINE_KXK
+#define KXK_ACC4(X) X(0) X(1) X(2) X(3)
+#define KXK_ACC8(X) KXK_ACC4(X) X(4) X(5) X(6) X(7)
+#define KXK_ACC10(X) KXK_ACC8(X) X(8) X(9)
+#define KXK_DECL(j) data_t acc##j = IDENT;
+#define KXK_STEP(j) acc##j = acc##j OP data[i + j];
+#define KXK_SUM(j) acc = acc OP acc##j;
+#define COMBINE_KXK(k)										\
+void NAME(combine##k##x##k)(NAME(vec_ptr) v, data_t* dest) {			\
+	long i;													\
+	long length = NAME(vec_length)(v);						\
+	long limit = length - (k - 1);							\
+	data_t* data = NAME(get_vec_start)(v);					\
+	data_t acc = IDENT;										\
+	KXK_ACC##k(KXK_DECL)									\
+															\
+	for (i = 0; i < limit; i += k) {						\
+		KXK_ACC##k(KXK_STEP)								\
+	}														\
+	KXK_ACC##k(KXK_SUM)										\
+	for (; i < length; i++)									\
+		acc = acc OP data[i];								\
+	*dest = acc;											\
+}
+#endif
+
+COMBINE_KXK(4)
+COMBINE_KXK(8)
+COMBINE_KXK(10)
+
+/* OpenMP 归约：每个线程一个累积变量，最后再合并。没有打开 OpenMP 时就是 combine4 */
+void NAME(combine_omp)(NAME(vec_ptr) v, data_t* dest) {
+	long i;
+	long length = NAME(vec_length)(v);
+	data_t* data = NAME(get_vec_start)(v);
+	data_t acc = IDENT;
+
+#pragma omp parallel for reduction(OP:acc)
+	for (i = 0; i < length; i++)
+	{
+		acc = acc OP data[i];
+	}
+	*dest = acc;
+}
+
+/* 显式 SIMD：8 个向量累积变量（每个向量 w 个元素，相当于 8w×8w 展开），最后把各条通道合并 */
+#ifndef SIMD_COMBINE
+#define SIMD_CAT_(a, b, c) a##_##b##_##c
+#define SIMD_CAT(a, b, c) SIMD_CAT_(a, b, c)
+#define SIMD_STEP(isa, j) \
+	a##j = SIMD_CAT(isa, OPNAME, TYPE)(a##j, SIMD_CAT(isa, load, TYPE)(data + i + j * w))
+#define SIMD_COMBINE(isa)										\
+TARGET_##isa void NAME(combine_##isa)(NAME(vec_ptr) v, data_t* dest) {	\
+	long i, j;													\
+	long length = NAME(vec_length)(v);							\
+	data_t* data = NAME(get_vec_start)(v);						\
+	const long w = sizeof(SIMD_CAT(isa, t, TYPE)) / sizeof(data_t);	\
+	SIMD_CAT(isa, t, TYPE) a0, a1, a2, a3, a4, a5, a6, a7;		\
+	data_t lanes[64];											\
+	data_t acc = IDENT;											\
+																\
+	a0 = a1 = a2 = a3 = a4 = a5 = a6 = a7 = SIMD_CAT(isa, set1, TYPE)(IDENT);	\
+	for (i = 0; i + 8 * w <= length; i += 8 * w) {				\
+		SIMD_STEP(isa, 0); SIMD_STEP(isa, 1);					\
+		SIMD_STEP(isa, 2); SIMD_STEP(isa, 3);					\
+		SIMD_STEP(isa, 4); SIMD_STEP(isa, 5);					\
+		SIMD_STEP(isa, 6); SIMD_STEP(isa, 7);					\
+	}															\
+	a0 = SIMD_CAT(isa, OPNAME, TYPE)(SIMD_CAT(isa, OPNAME, TYPE)(a0, a1),	\
+	  SIMD_CAT(isa, OPNAME, TYPE)(a2, a3));						\
+	a4 = SIMD_CAT(isa, OPNAME, TYPE)(SIMD_CAT(isa, OPNAME, TYPE)(a4, a5),	\
+	  SIMD_CAT(isa, OPNAME, TYPE)(a6, a7));						\
+	SIMD_CAT(isa, store, TYPE)(lanes, SIMD_CAT(isa, OPNAME, TYPE)(a0, a4));	\
+	for (j = 0; j < w; j++)										\
+		acc = acc OP lanes[j];									\
+	for (; i < length; i++)										\
+		acc = acc OP data[i];									\
+	*dest = acc;												\
+}
+#endif
+
+#ifdef HAVE_sse
+SIMD_COMBINE(sse)
+#endif
+#ifdef HAVE_avx2
+SIMD_COMBINE(avx2)
+#endif
+#ifdef HAVE_avx512
+SIMD_COMBINE(avx512)
+#endif
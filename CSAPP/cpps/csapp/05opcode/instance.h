@@ -0,0 +1,65 @@
+﻿/* 为 TYPE 和 OPNO（0 为 +，1 为 *）生成一份 combine.h 和它的函数表 kernels_<TYPE>_<add|mul>。
+ * TYPE_WIDE 非 0 表示 TYPE 是 64 位整数（没有 SSE、AVX2 乘法）。用完以后这些宏都被取消定义 */
+#define data_t TYPE
+#if OPNO == 0
+#define OP +
+#define IDENT 0
+#define OPNAME add
+#else
+#define OP *
+#define IDENT 1
+#define OPNAME mul
+#endif
+#define NAME_(f, t, o) f##_##t##_##o
+#define NAME__(f, t, o) NAME_(f, t, o)
+#define NAME(f) NAME__(f, TYPE, OPNAME)
+#if !(OPNO == 1 && TYPE_WIDE)
+#define HAVE_sse
+#define HAVE_avx2
+#endif
+#define HAVE_avx512
+
+#include "combine.h"
+
+static void NAME(fill)(void* p, long n) {
+	long i;
+	for (i = 0; i < n; i++)
+		((data_t*)p)[i] = OPNO ? (data_t)1 : (data_t)(i & 7);
+}
+
+static const struct kernel NAME(kernels)[] = {
+	{ "combine1", (kfunc)NAME(combine1), ISA_NONE },
+	{ "combine2", (kfunc)NAME(combine2), ISA_NONE },
+	{ "combine3", (kfunc)NAME(combine3), ISA_NONE },
+	{ "combine4", (kfunc)NAME(combine4), ISA_NONE },
+	{ "combine5 (2x1)", (kfunc)NAME(combine5), ISA_NONE },
+	{ "combine6 (2x2)", (kfunc)NAME(combine6), ISA_NONE },
+	{ "combine7 (2x1a)", (kfunc)NAME(combine7), ISA_NONE },
+	{ "4x4", (kfunc)NAME(combine4x4), ISA_NONE },
+	{ "8x8", (kfunc)NAME(combine8x8), ISA_NONE },
+	{ "10x10", (kfunc)NAME(combine10x10), ISA_NONE },
+#ifdef HAVE_sse
+	{ "SSE", (kfunc)NAME(combine_sse), ISA_SSE },
+#else
+	{ "SSE", NULL, ISA_SSE },
+#endif
+#ifdef HAVE_avx2
+	{ "AVX2", (kfunc)NAME(combine_avx2), ISA_AVX2 },
+#else
+	{ "AVX2", NULL, ISA_AVX2 },
+#endif
+	{ "AVX-512", (kfunc)NAME(combine_avx512), ISA_AVX512 },
+	{ "OpenMP", (kfunc)NAME(combine_omp), ISA_NONE },
+};
+
+#undef data_t
+#undef OP
+#undef IDENT
+#undef OPNAME
+#undef NAME
+#undef HAVE_sse
+#undef HAVE_avx2
+#undef HAVE_avx512
+#undef TYPE
+#undef TYPE_WIDE
+#undef OPNO
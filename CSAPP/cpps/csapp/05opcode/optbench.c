@@ -0,0 +1,230 @@
+﻿/* 测量合并函数各个版本的 CPE（每元素的周期数）：
+ * combine1 ~ combine7，k×k 循环展开（k = 4、8、10），SSE、AVX2、AVX-512 显式 SIMD，OpenMP 归约，
+ * 数据类型 long、double、float、int 和运算 +、* 的每一种组合。
+ * 对长度 STEP、2×STEP、…、NLEN×STEP 的向量各运行 REPS 次取最少的周期数，再用最小二乘法拟合一条直线，斜率就是 CPE。
+ * 周期数用 __rdtsc 测，是时间戳计数器的参考周期，CPU 睿频时和核心周期不完全一致，但各版本之间可以比较。
+ * 每列 CPE 最低的版本标上 *，它最接近吞吐量界限；结果和 combine4 不一致的标上 !。
+ * CPU 不支持的指令集（运行时用 CPUID 检查）和没有对应向量指令的组合（64 位整数乘法只有 AVX-512）显示 -。
+ * 用法：optbench [重复次数] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vecops.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define STEP 128
+#define NLEN 16
+#define REPS 50
+
+enum { ISA_NONE, ISA_SSE, ISA_AVX2, ISA_AVX512 };
+
+typedef void (*kfunc)(void*, void*);
+
+struct kernel {
+	const char* name;
+	kfunc f;	/* NULL 表示这种类型和运算没有这个版本 */
+	int isa;
+};
+
+#define NKERNEL 14
+
+/* 每种类型和运算各生成一份 */
+#define TYPE long
+#define TYPE_WIDE LONG_WIDE
+#define OPNO 0
+#include "instance.h"
+#define TYPE long
+#define TYPE_WIDE LONG_WIDE
+#define OPNO 1
+#include "instance.h"
+#define TYPE double
+#define TYPE_WIDE 0
+#define OPNO 0
+#include "instance.h"
+#define TYPE double
+#define TYPE_WIDE 0
+#define OPNO 1
+#include "instance.h"
+#define TYPE float
+#define TYPE_WIDE 0
+#define OPNO 0
+#include "instance.h"
+#define TYPE float
+#define TYPE_WIDE 0
+#define OPNO 1
+#include "instance.h"
+#define TYPE int
+#define TYPE_WIDE 0
+#define OPNO 0
+#include "instance.h"
+#define TYPE int
+#define TYPE_WIDE 0
+#define OPNO 1
+#include "instance.h"
+
+struct instance {
+	const char* name;
+	size_t size;
+	void (*fill)(void*, long);
+	const struct kernel* k;
+};
+
+static const struct instance instances[] = {
+	{ "long +", sizeof(long), fill_long_add, kernels_long_add },
+	{ "long *", sizeof(long), fill_long_mul, kernels_long_mul },
+	{ "double +", sizeof(double), fill_double_add, kernels_double_add },
+	{ "double *", sizeof(double), fill_double_mul, kernels_double_mul },
+	{ "float +", sizeof(float), fill_float_add, kernels_float_add },
+	{ "float *", sizeof(float), fill_float_mul, kernels_float_mul },
+	{ "int +", sizeof(int), fill_int_add, kernels_int_add },
+	{ "int *", sizeof(int), fill_int_mul, kernels_int_mul },
+};
+
+#define NINST (sizeof(instances) / sizeof(instances[0]))
+
+/* 所有类型的 vec_rec 布局都一样 */
+struct vec {
+	long len;
+	void* data;
+};
+
+/// <summary>
+/// 运行时检查 CPU 和操作系统支持的最高指令集
+/// </summary>
+/// <returns>ISA_NONE ~ ISA_AVX512</returns>
+static int cpu_isa(void) {
+#ifdef _MSC_VER
+	int r[4];
+	unsigned long long xcr0 = 0;
+	int sse41, avx2, avx512;
+
+	__cpuid(r, 0);
+	if (r[0] < 7)
+		return ISA_NONE;
+	__cpuid(r, 1);
+	sse41 = (r[2] >> 19) & 1;
+	if ((r[2] >> 27) & 1)	/* OSXSAVE：操作系统会保存 YMM、ZMM 寄存器才能用 AVX */
+		xcr0 = _xgetbv(0);
+	__cpuidex(r, 7, 0);
+	avx2 = ((r[1] >> 5) & 1) && (xcr0 & 0x06) == 0x06;
+	avx512 = ((r[1] >> 16) & 1) && ((r[1] >> 17) & 1) && (xcr0 & 0xe6) == 0xe6;	/* F 和 DQ */
+#else
+	int sse41, avx2, avx512;
+
+	__builtin_cpu_init();
+	sse41 = __builtin_cpu_supports("sse4.1");
+	avx2 = __builtin_cpu_supports("avx2");
+	avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+#endif
+	if (avx512 && avx2 && sse41)
+		return ISA_AVX512;
+	if (avx2 && sse41)
+		return ISA_AVX2;
+	return sse41 ? ISA_SSE : ISA_NONE;
+}
+
+/// <summary>
+/// 测量一个合并函数的 CPE
+/// </summary>
+/// <param name="f">合并函数</param>
+/// <param name="v">向量，长度至少 NLEN×STEP</param>
+/// <param name="dest">结果</param>
+/// <param name="reps">每个长度运行的次数</param>
+/// <returns>最小二乘法拟合的斜率</returns>
+static double cpe(kfunc f, struct vec* v, void* dest, int reps) {
+	long len = v->len;
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	unsigned long long t, best;
+	int k, r;
+
+	for (k = 1; k <= NLEN; k++) {
+		v->len = (long)k * STEP;
+		best = ~0ULL;
+		for (r = 0; r < reps; r++) {
+			t = __rdtsc();
+			f(v, dest);
+			t = __rdtsc() - t;
+			if (t < best)
+				best = t;
+		}
+		sx += v->len;
+		sy += (double)best;
+		sxx += (double)v->len * v->len;
+		sxy += (double)v->len * best;
+	}
+	v->len = len;
+	return (NLEN * sxy - sx * sy) / (NLEN * sxx - sx * sx);
+}
+
+int main(int argc, char* argv[]) {
+	static const char* isas[] = { "", "SSE4.1", "AVX2", "AVX-512" };
+	double c[NKERNEL][NINST];
+	char ok[NKERNEL][NINST];
+	unsigned char ref[8], res[8];
+	struct vec v;
+	size_t i, j;
+	int isa, reps;
+
+	reps = argc > 1 ? atoi(argv[1]) : REPS;
+	if (reps <= 0) {
+		fprintf(stderr, "usage: optbench [reps]\n");
+		return 1;
+	}
+	isa = cpu_isa();
+	v.len = NLEN * STEP;
+	if ((v.data = malloc(NLEN * STEP * sizeof(double))) == NULL) {
+		fprintf(stderr, "malloc error\n");
+		return 1;
+	}
+
+	for (j = 0; j < NINST; j++) {
+		const struct instance* in = &instances[j];
+
+		/* 加法用 0 ~ 7，乘法用 1，结果都是精确的，每个版本都应当和 combine4 完全一样 */
+		in->fill(v.data, v.len);
+		in->k[3].f(&v, ref);
+		for (i = 0; i < NKERNEL; i++) {
+			c[i][j] = -1;
+			if (in->k[i].f == NULL || in->k[i].isa > isa)
+				continue;
+			c[i][j] = cpe(in->k[i].f, &v, res, reps);
+			in->k[i].f(&v, res);
+			ok[i][j] = memcmp(ref, res, in->size) == 0;
+		}
+	}
+
+	printf("CPE, %d..%d elements, CPU up to %s", STEP, NLEN * STEP, isa ? isas[isa] : "no SSE4.1");
+#ifdef _OPENMP
+	printf(", %d OpenMP threads", omp_get_max_threads());
+#else
+	printf(", no OpenMP");
+#endif
+	printf("\n%-16s", "");
+	for (j = 0; j < NINST; j++)
+		printf("%10s", instances[j].name);
+	printf("\n");
+	for (i = 0; i < NKERNEL; i++) {
+		printf("%-16s", instances[0].k[i].name);
+		for (j = 0; j < NINST; j++) {
+			size_t b = 0, m;
+
+			for (m = 1; m < NKERNEL; m++)
+				if (c[m][j] >= 0 && c[m][j] < c[b][j])
+					b = m;
+			if (c[i][j] < 0)
+				printf("%10s", "-");
+			else
+				printf("%8.2f%c%c", c[i][j], !ok[i][j] ? '!' : ' ', i == b ? '*' : ' ');
+		}
+		printf("\n");
+	}
+	free(v.data);
+	return 0;
+}
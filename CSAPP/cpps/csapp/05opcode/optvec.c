@@ -1,144 +1,8 @@
 #include "optvec.h"
+#include <stdlib.h>
 #include <crtdbg.h>
-vec_ptr new_vec(long len) {
-	/* ͷṹ */
-	vec_ptr result = (vec_ptr)malloc(sizeof(vec_rec));
-	data_t* data = NULL;
-	if (!result) {
-		return NULL;/* ޷ڴ */
-	}
-	result->len = len;
-	/*  */
-	if (len > 0) {
-		data = (data_t*)calloc(len, sizeof(data_t));
-		if (!data) {
-			free((void*)result);
-			return NULL;/* ޷ڴ */
-		}
-	}
-
-	/* Data Ϊnull߷һ */
-	result->data = data;
-	return result;
-}
-
-/// <summary>
-/// Ԫز洢Ŀ dest 
-/// </summary>
-/// <param name="v"></param>
-/// <param name="index"></param>
-/// <param name="dest"></param>
-/// <returns>0Խ磩1ɹ</returns>
-int get_vec_element(vec_ptr v, long index, data_t* dest) {
-	if (index < 0 || index >= v->len)	/* ߽飬˳İȫԣΪۣܻеʧ */
-		return 0;
-	*dest = v->data[index];
-	return 1;
-}
-
-/// <summary>
-/// ĳ
-/// </summary>
-/// <param name="v"></param>
-/// <returns></returns>
-long vec_length(vec_ptr v) {
-	return v->len;
-}
-
-#define IDENT 0
-#define OP +
-/* Żĳʵϲ */
-void combine1(vec_ptr v, data_t* dest) {
-	long i;
-	*dest = IDENT;
-	for (i = 0; i < vec_length(v); i++)
-	{
-		data_t val;
-		get_vec_element(v, i, &val);
-		*dest = *dest OP val;
-	}
-}
-
-void combine2(vec_ptr v, data_t* dest) {
-	long i;
-	long length = vec_length(v);
-	*dest = IDENT;
-	for (i = 0; i < length; i++)
-	{
-		data_t val;
-		get_vec_element(v, i, &val);
-		*dest = *dest OP val;
-	}
-}
-
-data_t* get_vec_start(vec_ptr v) {
-	return v->data;
-}
-
-/* ֱӷṹ */
-void combine3(vec_ptr v, data_t* dest) {
-	long i;
-	long length = vec_length(v);
-	data_t* data = get_vec_start(v);
-	*dest = IDENT;
-	for (size_t i = 0; i < length; i++)
-	{
-		*dest = *dest OP data[i];
-	}
-}
-
-void combine4(vec_ptr v, data_t* dest) {
-	long i;
-	long length = vec_length(v);
-	data_t* data = get_vec_start(v);
-	data_t acc = IDENT;
-
-	for (size_t i = 0; i < length; i++)
-	{
-		acc = acc OP data[i];
-	}
-	*dest = acc;
-}
-
-void combine5(vec_ptr v, data_t* dest) {
-	long i = 0;
-	long length = vec_length(v);
-	long limit = length - 1;
-	data_t* data = get_vec_start(v);
-	data_t acc = IDENT;
-
-	/* һμԪ */
-	for (i = 0; i < limit; i += 2)
-	{
-		acc = (acc OP data[i]) OP data[i + 1];
-	}
-	/* ʣµԪ */
-	for (; i < length; i++)
-	{
-		acc = acc OP data[i];
-	}
-}
-
-void combine6(vec_ptr v, data_t* dest) {
-	long i = 0;
-	long length = vec_length(v);
-	long limit = length - 1;
-	data_t* data = get_vec_start(v);
-	data_t acc0 = IDENT;
-	data_t acc1 = IDENT;
-
-	for (i = 0; i < limit; i + 2)
-	{
-		acc0 = acc0 OP data[i];
-		acc1 = acc1 OP data[i + 1];
-	}
-	// ʣµ
-	for (; i < length; i++)
-	{
-		acc0 = acc0 OP data[i];
-	}
-	*dest = acc0 OP acc1;
-}
+/*  combine1 ~ combine7 Ⱥϲ */
+#include "combine.h"
 
 void lower1(char* s) {
 	long i;
@@ -1,9 +1,7 @@
 #pragma once
 
+/* combine.h ⼸ɺϲoptbench.c ﻻɱͺ */
 typedef long data_t;
-
-typedef struct {
-	long len;
-	data_t* data;
-} vec_rec, * vec_ptr;
-
+#define IDENT 0
+#define OP +
+#define NAME(f) f
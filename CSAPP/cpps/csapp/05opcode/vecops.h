@@ -0,0 +1,138 @@
+﻿#pragma once
+/* combine.h 里显式 SIMD 版本用到的向量运算：<isa>_<运算>_<类型>，isa 为 sse、avx2、avx512。
+ * GCC/Clang 要给每个函数指定目标指令集才能使用对应的内建函数；MSVC 不需要 */
+#include <immintrin.h>
+#include <limits.h>
+
+#if defined(_MSC_VER)
+#define TARGET_sse
+#define TARGET_avx2
+#define TARGET_avx512
+#else
+#define TARGET_sse __attribute__((target("sse4.1")))
+#define TARGET_avx2 __attribute__((target("avx2")))
+#define TARGET_avx512 __attribute__((target("avx512f,avx512dq")))
+#endif
+
+/* double */
+#define sse_t_double __m128d
+#define sse_set1_double _mm_set1_pd
+#define sse_load_double _mm_loadu_pd
+#define sse_store_double _mm_storeu_pd
+#define sse_add_double _mm_add_pd
+#define sse_mul_double _mm_mul_pd
+#define avx2_t_double __m256d
+#define avx2_set1_double _mm256_set1_pd
+#define avx2_load_double _mm256_loadu_pd
+#define avx2_store_double _mm256_storeu_pd
+#define avx2_add_double _mm256_add_pd
+#define avx2_mul_double _mm256_mul_pd
+#define avx512_t_double __m512d
+#define avx512_set1_double _mm512_set1_pd
+#define avx512_load_double _mm512_loadu_pd
+#define avx512_store_double _mm512_storeu_pd
+#define avx512_add_double _mm512_add_pd
+#define avx512_mul_double _mm512_mul_pd
+
+/* float */
+#define sse_t_float __m128
+#define sse_set1_float _mm_set1_ps
+#define sse_load_float _mm_loadu_ps
+#define sse_store_float _mm_storeu_ps
+#define sse_add_float _mm_add_ps
+#define sse_mul_float _mm_mul_ps
+#define avx2_t_float __m256
+#define avx2_set1_float _mm256_set1_ps
+#define avx2_load_float _mm256_loadu_ps
+#define avx2_store_float _mm256_storeu_ps
+#define avx2_add_float _mm256_add_ps
+#define avx2_mul_float _mm256_mul_ps
+#define avx512_t_float __m512
+#define avx512_set1_float _mm512_set1_ps
+#define avx512_load_float _mm512_loadu_ps
+#define avx512_store_float _mm512_storeu_ps
+#define avx512_add_float _mm512_add_ps
+#define avx512_mul_float _mm512_mul_ps
+
+/* 32 位和 64 位整数 */
+#define sse_t_i32 __m128i
+#define sse_set1_i32 _mm_set1_epi32
+#define sse_load_i32(p) _mm_loadu_si128((const __m128i*)(p))
+#define sse_store_i32(p, v) _mm_storeu_si128((__m128i*)(p), v)
+#define sse_add_i32 _mm_add_epi32
+#define sse_mul_i32 _mm_mullo_epi32
+#define avx2_t_i32 __m256i
+#define avx2_set1_i32 _mm256_set1_epi32
+#define avx2_load_i32(p) _mm256_loadu_si256((const __m256i*)(p))
+#define avx2_store_i32(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define avx2_add_i32 _mm256_add_epi32
+#define avx2_mul_i32 _mm256_mullo_epi32
+#define avx512_t_i32 __m512i
+#define avx512_set1_i32 _mm512_set1_epi32
+#define avx512_load_i32(p) _mm512_loadu_si512((const void*)(p))
+#define avx512_store_i32(p, v) _mm512_storeu_si512((void*)(p), v)
+#define avx512_add_i32 _mm512_add_epi32
+#define avx512_mul_i32 _mm512_mullo_epi32
+
+#define sse_t_i64 __m128i
+#define sse_set1_i64 _mm_set1_epi64x
+#define sse_load_i64 sse_load_i32
+#define sse_store_i64 sse_store_i32
+#define sse_add_i64 _mm_add_epi64
+#define avx2_t_i64 __m256i
+#define avx2_set1_i64 _mm256_set1_epi64x
+#define avx2_load_i64 avx2_load_i32
+#define avx2_store_i64 avx2_store_i32
+#define avx2_add_i64 _mm256_add_epi64
+#define avx512_t_i64 __m512i
+#define avx512_set1_i64 _mm512_set1_epi64
+#define avx512_load_i64 avx512_load_i32
+#define avx512_store_i64 avx512_store_i32
+#define avx512_add_i64 _mm512_add_epi64
+#define avx512_mul_i64 _mm512_mullo_epi64	/* AVX-512DQ；SSE 和 AVX2 没有 64 位整数乘法 */
+
+/* int 是 32 位；long 在 Linux 上是 64 位，在 Windows 上是 32 位 */
+#define sse_t_int sse_t_i32
+#define sse_set1_int sse_set1_i32
+#define sse_load_int sse_load_i32
+#define sse_store_int sse_store_i32
+#define sse_add_int sse_add_i32
+#define sse_mul_int sse_mul_i32
+#define avx2_t_int avx2_t_i32
+#define avx2_set1_int avx2_set1_i32
+#define avx2_load_int avx2_load_i32
+#define avx2_store_int avx2_store_i32
+#define avx2_add_int avx2_add_i32
+#define avx2_mul_int avx2_mul_i32
+#define avx512_t_int avx512_t_i32
+#define avx512_set1_int avx512_set1_i32
+#define avx512_load_int avx512_load_i32
+#define avx512_store_int avx512_store_i32
+#define avx512_add_int avx512_add_i32
+#define avx512_mul_int avx512_mul_i32
+
+#if LONG_MAX == INT_MAX
+#define LONG_WIDE 0
+#define LONG_VEC(isa, what) isa##_##what##_i32
+#else
+#define LONG_WIDE 1
+#define LONG_VEC(isa, what) isa##_##what##_i64
+#endif
+#define sse_t_long LONG_VEC(sse, t)
+#define sse_set1_long LONG_VEC(sse, set1)
+#define sse_load_long LONG_VEC(sse, load)
+#define sse_store_long LONG_VEC(sse, store)
+#define sse_add_long LONG_VEC(sse, add)
+#define sse_mul_long LONG_VEC(sse, mul)
+#define avx2_t_long LONG_VEC(avx2, t)
+#define avx2_set1_long LONG_VEC(avx2, set1)
+#define avx2_load_long LONG_VEC(avx2, load)
+#define avx2_store_long LONG_VEC(avx2, store)
+#define avx2_add_long LONG_VEC(avx2, add)
+#define avx2_mul_long LONG_VEC(avx2, mul)
+#define avx512_t_long LONG_VEC(avx512, t)
+#define avx512_set1_long LONG_VEC(avx512, set1)
+#define avx512_load_long LONG_VEC(avx512, load)
+#define avx512_store_long LONG_VEC(avx512, store)
+#define avx512_add_long LONG_VEC(avx512, add)
+#define avx512_mul_long LONG_VEC(avx512, mul)
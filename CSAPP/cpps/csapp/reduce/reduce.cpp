@@ -0,0 +1,142 @@
+﻿// reduce.cpp：测量 reduce.hpp 各个内核的 CPE（每元素的周期数），同一个程序覆盖各种类型和运算
+// 类型 short、int、long、long long、float、double，运算 +、*、max，
+// 各版本：combine4（一个累积变量）、8×8 展开、SSE、AVX2、AVX-512，以及 combine 实际选中的内核。
+// 测法和 05opcode 的 optbench 一样：对长度 STEP、2×STEP、…、NLEN×STEP 各运行 REPS 次取最少的周期数，
+// 用最小二乘法拟合直线的斜率；周期数是 __rdtsc 的参考周期。
+// 没有向量版本或 CPU 不支持的显示 -；结果和 combine4 不一致的标上 !。
+// 用法：reduce [重复次数]
+#include "reduce.hpp"
+#include <cstdio>
+#include <cstdlib>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+constexpr long STEP = 128;
+constexpr long NLEN = 16;
+constexpr int REPS = 50;
+
+static int reps = REPS;
+
+/// <summary>
+/// 测量一个内核的 CPE，不可用时返回 -1
+/// </summary>
+template <class T>
+double cpe(reduce::kernel_fn<T> f, const std::vector<T>& v, const T& ref, bool* ok) {
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+
+	if (f == nullptr)
+		return -1;
+	for (long k = 1; k <= NLEN; k++) {
+		long n = k * STEP;
+		unsigned long long best = ~0ULL;
+
+		for (int r = 0; r < reps; r++) {
+			unsigned long long t = __rdtsc();
+			volatile T sink = f(v.data(), n);
+			t = __rdtsc() - t;
+			(void)sink;
+			if (t < best)
+				best = t;
+		}
+		sx += n;
+		sy += (double)best;
+		sxx += (double)n * n;
+		sxy += (double)n * best;
+	}
+	*ok = f(v.data(), (long)v.size()) == ref;
+	return (NLEN * sxy - sx * sy) / (NLEN * sxx - sx * sx);
+}
+
+/// <summary>
+/// 运算 Op 在指令集 i 上的 SIMD 内核，没有或 CPU 不支持时返回 nullptr
+/// </summary>
+template <class T, class Op>
+reduce::kernel_fn<T> simd(reduce::isa i) {
+	using namespace reduce;
+	constexpr lane L = lane_of<T>();
+
+	if (i > cpu_isa())
+		return nullptr;
+	if constexpr (vops<isa::sse, L>::template has<Op>) {
+		if (i == isa::sse)
+			return combine_sse<T, Op>;
+	}
+	if constexpr (vops<isa::avx2, L>::template has<Op>) {
+		if (i == isa::avx2)
+			return combine_avx2<T, Op>;
+	}
+	if constexpr (vops<isa::avx512, L>::template has<Op>) {
+		if (i == isa::avx512)
+			return combine_avx512<T, Op>;
+	}
+	return nullptr;
+}
+
+template <class T, class Op>
+void run(const char* name) {
+	using namespace reduce;
+	std::vector<T> v(NLEN * STEP);
+	kernel_fn<T> fns[6];
+	bool ok = true;
+
+	/* 加法和 max 用 0 ~ 7，乘法用 1，结果都是精确的 */
+	for (long i = 0; i < (long)v.size(); i++)
+		v[i] = std::is_same_v<Op, times> ? T(1) : T(i & 7);
+	fns[0] = combine_unrolled<1, T, Op>;
+	fns[1] = combine_unrolled<8, T, Op>;
+	fns[2] = simd<T, Op>(isa::sse);
+	fns[3] = simd<T, Op>(isa::avx2);
+	fns[4] = simd<T, Op>(isa::avx512);
+	fns[5] = kernel<T, Op>(cpu_isa());
+
+	T ref = fns[0](v.data(), (long)v.size());
+	std::printf("%-14s", name);
+	for (auto f : fns) {
+		double c = cpe(f, v, ref, &ok);
+		if (c < 0)
+			std::printf("%9s", "-");
+		else
+			std::printf("%8.2f%c", c, ok ? ' ' : '!');
+	}
+	/* combine 实际用的是哪个 */
+	for (int i = 4; i >= 1; i--)
+		if (fns[5] == fns[i]) {
+			std::printf("  %s", i == 1 ? "8x8" : isa_name((isa)(i - 1)));
+			break;
+		}
+	if (combine<Op>(v) != ref)
+		std::printf(" !");
+	std::printf("\n");
+}
+
+template <class T>
+void run_all(const char* type) {
+	char name[32];
+
+	std::snprintf(name, sizeof(name), "%s +", type);
+	run<T, reduce::plus>(name);
+	std::snprintf(name, sizeof(name), "%s *", type);
+	run<T, reduce::times>(name);
+	std::snprintf(name, sizeof(name), "%s max", type);
+	run<T, reduce::maximum>(name);
+}
+
+int main(int argc, char* argv[]) {
+	reps = argc > 1 ? std::atoi(argv[1]) : REPS;
+	if (reps <= 0) {
+		std::fprintf(stderr, "usage: reduce [reps]\n");
+		return 1;
+	}
+	std::printf("CPE, %ld..%ld elements, CPU up to %s\n", STEP, NLEN * STEP, reduce::isa_name(reduce::cpu_isa()));
+	std::printf("%-14s%9s%9s%9s%9s%9s%9s  %s\n", "", "combine4", "8x8", "SSE", "AVX2", "AVX-512", "combine", "uses");
+	run_all<short>("short");
+	run_all<int>("int");
+	run_all<long>("long");
+	run_all<long long>("long long");
+	run_all<float>("float");
+	run_all<double>("double");
+	return 0;
+}
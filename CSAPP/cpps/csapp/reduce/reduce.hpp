@@ -0,0 +1,267 @@
+﻿#pragma once
+// 泛型的合并（归约），只有头文件，需要 C++17。
+// 05opcode 的 combine.h 靠 data_t、IDENT、OP 宏生成，每生成一次只有一种类型和一种运算；这里换成模板：
+//   reduce::combine<reduce::plus>(data, n)		// data 是任意算术类型的数组
+//   reduce::combine<reduce::times>(v)			// v 是 std::vector
+// 运算是一个函数对象，带一个编译期的单位元 ident<T>()（对应 IDENT）。
+// 编译期按元素类型和运算挑选内核：有对应向量指令的用 SIMD 内核（8 个向量累积变量），
+// 否则用 k×k 展开的标量内核（unroll<T, Op> 个累积变量）；
+// 运行时第一次调用时用 CPUID 检查 CPU 支持的最高指令集，选好的内核缓存在函数指针里，以后直接调用。
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// GCC/Clang 要给用到向量指令的函数指定目标指令集；MSVC 不需要
+#if defined(_MSC_VER) && !defined(__clang__)
+#define REDUCE_TARGET_SSE
+#define REDUCE_TARGET_AVX2
+#define REDUCE_TARGET_AVX512
+#else
+#define REDUCE_TARGET_SSE __attribute__((target("sse4.1")))
+#define REDUCE_TARGET_AVX2 __attribute__((target("avx2")))
+#define REDUCE_TARGET_AVX512 __attribute__((target("avx512f,avx512dq")))
+#endif
+
+namespace reduce {
+
+	/* 运算 */
+
+	struct plus {
+		template <class T> static constexpr T ident() { return T(0); }
+		template <class T> constexpr T operator()(T a, T b) const { return a + b; }
+	};
+
+	struct times {
+		template <class T> static constexpr T ident() { return T(1); }
+		template <class T> constexpr T operator()(T a, T b) const { return a * b; }
+	};
+
+	// 没有向量版本，总是用标量内核
+	struct maximum {
+		template <class T> static constexpr T ident() { return std::numeric_limits<T>::lowest(); }
+		template <class T> constexpr T operator()(T a, T b) const { return a < b ? b : a; }
+	};
+
+	/* 运行时检查指令集 */
+
+	enum class isa { none, sse, avx2, avx512 };
+
+	inline const char* isa_name(isa i) {
+		static const char* names[] = { "scalar", "SSE4.1", "AVX2", "AVX-512" };
+		return names[(int)i];
+	}
+
+	/// <summary>
+	/// 用 CPUID 检查 CPU 和操作系统支持的最高指令集
+	/// </summary>
+	inline isa detect_isa() {
+		bool sse41, avx2, avx512;
+#ifdef _MSC_VER
+		int r[4];
+		unsigned long long xcr0 = 0;
+
+		__cpuid(r, 0);
+		if (r[0] < 7)
+			return isa::none;
+		__cpuid(r, 1);
+		sse41 = (r[2] >> 19) & 1;
+		if ((r[2] >> 27) & 1)	/* OSXSAVE：操作系统会保存 YMM、ZMM 寄存器才能用 AVX */
+			xcr0 = _xgetbv(0);
+		__cpuidex(r, 7, 0);
+		avx2 = ((r[1] >> 5) & 1) && (xcr0 & 0x06) == 0x06;
+		avx512 = ((r[1] >> 16) & 1) && ((r[1] >> 17) & 1) && (xcr0 & 0xe6) == 0xe6;	/* F 和 DQ */
+#else
+		__builtin_cpu_init();
+		sse41 = __builtin_cpu_supports("sse4.1");
+		avx2 = __builtin_cpu_supports("avx2");
+		avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+#endif
+		if (avx512 && avx2 && sse41)
+			return isa::avx512;
+		if (avx2 && sse41)
+			return isa::avx2;
+		return sse41 ? isa::sse : isa::none;
+	}
+
+	inline isa cpu_isa() {
+		static const isa best = detect_isa();
+		return best;
+	}
+
+	/* 向量运算 */
+
+	// 元素在向量寄存器里的表示。整数只看宽度：有符号和无符号的加法、乘法（低位）结果一样
+	enum class lane { none, f32, f64, i32, i64 };
+
+	template <class T>
+	constexpr lane lane_of() {
+		if constexpr (std::is_same_v<T, float>)
+			return lane::f32;
+		else if constexpr (std::is_same_v<T, double>)
+			return lane::f64;
+		else if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool> && sizeof(T) == 4)
+			return lane::i32;
+		else if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool> && sizeof(T) == 8)
+			return lane::i64;
+		else
+			return lane::none;
+	}
+
+	// vops<指令集, 表示>：has<Op> 表示有没有运算 Op 的向量指令，op<Op> 做这个运算
+	template <isa I, lane L>
+	struct vops {
+		template <class Op> static constexpr bool has = false;
+	};
+
+#define REDUCE_VOPS(I, L, TARGET, REG, PTR, SET1, LOAD, STORE, ADD, MUL, HASMUL)	\
+	template <>																	\
+	struct vops<isa::I, lane::L> {												\
+		using reg = REG;														\
+		template <class Op> static constexpr bool has =							\
+			std::is_same_v<Op, plus> || (HASMUL && std::is_same_v<Op, times>);	\
+		template <class T> TARGET static reg set1(T x) { return SET1(x); }		\
+		TARGET static reg load(const void* p) { return LOAD((const PTR*)p); }	\
+		TARGET static void store(void* p, reg v) { STORE((PTR*)p, v); }		\
+		template <class Op> TARGET static reg op(reg a, reg b) {				\
+			if constexpr (std::is_same_v<Op, plus>)								\
+				return ADD(a, b);												\
+			else																\
+				return MUL(a, b);												\
+		}																		\
+	};
+
+	/* SSE 和 AVX2 没有 64 位整数乘法；nomul 只声明，has<times> 为 false 时不会用到 */
+	__m128i nomul(__m128i, __m128i);
+	__m256i nomul(__m256i, __m256i);
+
+	REDUCE_VOPS(sse, f64, REDUCE_TARGET_SSE, __m128d, double, _mm_set1_pd, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, _mm_mul_pd, true)
+	REDUCE_VOPS(sse, f32, REDUCE_TARGET_SSE, __m128, float, _mm_set1_ps, _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps, _mm_mul_ps, true)
+	REDUCE_VOPS(sse, i32, REDUCE_TARGET_SSE, __m128i, __m128i, _mm_set1_epi32, _mm_loadu_si128, _mm_storeu_si128, _mm_add_epi32, _mm_mullo_epi32, true)
+	REDUCE_VOPS(sse, i64, REDUCE_TARGET_SSE, __m128i, __m128i, _mm_set1_epi64x, _mm_loadu_si128, _mm_storeu_si128, _mm_add_epi64, nomul, false)
+	REDUCE_VOPS(avx2, f64, REDUCE_TARGET_AVX2, __m256d, double, _mm256_set1_pd, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, _mm256_mul_pd, true)
+	REDUCE_VOPS(avx2, f32, REDUCE_TARGET_AVX2, __m256, float, _mm256_set1_ps, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps, _mm256_mul_ps, true)
+	REDUCE_VOPS(avx2, i32, REDUCE_TARGET_AVX2, __m256i, __m256i, _mm256_set1_epi32, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_add_epi32, _mm256_mullo_epi32, true)
+	REDUCE_VOPS(avx2, i64, REDUCE_TARGET_AVX2, __m256i, __m256i, _mm256_set1_epi64x, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_add_epi64, nomul, false)
+	REDUCE_VOPS(avx512, f64, REDUCE_TARGET_AVX512, __m512d, double, _mm512_set1_pd, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd, _mm512_mul_pd, true)
+	REDUCE_VOPS(avx512, f32, REDUCE_TARGET_AVX512, __m512, float, _mm512_set1_ps, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_add_ps, _mm512_mul_ps, true)
+	REDUCE_VOPS(avx512, i32, REDUCE_TARGET_AVX512, __m512i, void, _mm512_set1_epi32, _mm512_loadu_si512, _mm512_storeu_si512, _mm512_add_epi32, _mm512_mullo_epi32, true)
+	REDUCE_VOPS(avx512, i64, REDUCE_TARGET_AVX512, __m512i, void, _mm512_set1_epi64, _mm512_loadu_si512, _mm512_storeu_si512, _mm512_add_epi64, _mm512_mullo_epi64, true)
+
+#undef REDUCE_VOPS
+
+	/* 内核 */
+
+	// k×k 展开的累积变量个数。k 要不小于 运算的延迟×功能单元数 才能达到吞吐量界限，
+	// 8 够得上常见 x86 处理器上的加法和乘法（浮点加法延迟 4、两个单元）；可以对别的类型或运算特化
+	template <class T, class Op>
+	struct unroll : std::integral_constant<int, 8> {};
+
+	template <class T, class Op, std::size_t... J>
+	T combine_unrolled(const T* data, long length, std::index_sequence<J...>) {
+		constexpr long k = sizeof...(J);
+		Op op;
+		T acc[k] = { ((void)J, Op::template ident<T>())... };
+		T r = Op::template ident<T>();
+		long i;
+
+		for (i = 0; i + k <= length; i += k)
+			((acc[J] = op(acc[J], data[i + J])), ...);
+		((r = op(r, acc[J])), ...);
+		for (; i < length; i++)
+			r = op(r, data[i]);
+		return r;
+	}
+
+	/// <summary>
+	/// k×k 循环展开的标量内核，K 为 1 时就是 combine4
+	/// </summary>
+	template <int K, class T, class Op>
+	T combine_unrolled(const T* data, long length) {
+		return combine_unrolled<T, Op>(data, length, std::make_index_sequence<K>());
+	}
+
+	// SIMD 内核：8 个向量累积变量（每个向量 w 个元素，相当于 8w×8w 展开），最后把各条通道合并
+#define REDUCE_SIMD_STEP(j) a##j = V::template op<Op>(a##j, V::load(data + i + j * w))
+#define REDUCE_SIMD_KERNEL(I, TARGET)												\
+	template <class T, class Op>													\
+	TARGET T combine_##I(const T* data, long length) {							\
+		using V = vops<isa::I, lane_of<T>()>;										\
+		using reg = typename V::reg;												\
+		constexpr long w = sizeof(reg) / sizeof(T);									\
+		Op op;																		\
+		reg a0, a1, a2, a3, a4, a5, a6, a7;											\
+		T lanes[w];																	\
+		T acc = Op::template ident<T>();											\
+		long i, j;																	\
+																					\
+		a0 = a1 = a2 = a3 = a4 = a5 = a6 = a7 = V::set1(Op::template ident<T>());	\
+		for (i = 0; i + 8 * w <= length; i += 8 * w) {								\
+			REDUCE_SIMD_STEP(0); REDUCE_SIMD_STEP(1);								\
+			REDUCE_SIMD_STEP(2); REDUCE_SIMD_STEP(3);								\
+			REDUCE_SIMD_STEP(4); REDUCE_SIMD_STEP(5);								\
+			REDUCE_SIMD_STEP(6); REDUCE_SIMD_STEP(7);								\
+		}																			\
+		a0 = V::template op<Op>(V::template op<Op>(a0, a1), V::template op<Op>(a2, a3));	\
+		a4 = V::template op<Op>(V::template op<Op>(a4, a5), V::template op<Op>(a6, a7));	\
+		V::store(lanes, V::template op<Op>(a0, a4));								\
+		for (j = 0; j < w; j++)														\
+			acc = op(acc, lanes[j]);												\
+		for (; i < length; i++)														\
+			acc = op(acc, data[i]);													\
+		return acc;																	\
+	}
+
+	REDUCE_SIMD_KERNEL(sse, REDUCE_TARGET_SSE)
+	REDUCE_SIMD_KERNEL(avx2, REDUCE_TARGET_AVX2)
+	REDUCE_SIMD_KERNEL(avx512, REDUCE_TARGET_AVX512)
+
+#undef REDUCE_SIMD_STEP
+#undef REDUCE_SIMD_KERNEL
+
+	/* 选择内核 */
+
+	template <class T>
+	using kernel_fn = T(*)(const T*, long);
+
+	/// <summary>
+	/// 指令集不超过 best 时最快的内核：编译期排除没有向量版本的类型和运算，运行时按 best 选
+	/// </summary>
+	template <class T, class Op>
+	kernel_fn<T> kernel(isa best) {
+		constexpr lane L = lane_of<T>();
+
+		if constexpr (vops<isa::avx512, L>::template has<Op>) {
+			if (best >= isa::avx512)
+				return combine_avx512<T, Op>;
+		}
+		if constexpr (vops<isa::avx2, L>::template has<Op>) {
+			if (best >= isa::avx2)
+				return combine_avx2<T, Op>;
+		}
+		if constexpr (vops<isa::sse, L>::template has<Op>) {
+			if (best >= isa::sse)
+				return combine_sse<T, Op>;
+		}
+		return combine_unrolled<unroll<T, Op>::value, T, Op>;
+	}
+
+	/// <summary>
+	/// 用运算 Op 合并 data[0] ~ data[length - 1]，空数组返回单位元
+	/// </summary>
+	template <class Op, class T>
+	T combine(const T* data, long length) {
+		static const kernel_fn<T> fn = kernel<T, Op>(cpu_isa());
+		return fn(data, length);
+	}
+
+	template <class Op, class T>
+	T combine(const std::vector<T>& v) {
+		return combine<Op>(v.data(), (long)v.size());
+	}
+}
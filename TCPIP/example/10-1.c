@@ -12,8 +12,8 @@
 #include <stdlib.h>
 #include <sys/epoll.h>
 #include <pthread.h>
+#include "sigfd.h"
 #define MAX_EVENT_NUMBER 1024
-static int pipefd[2];
 int setnonblocking(int fd)
 {
     int old_option = fcntl(fd, F_GETFL);
@@ -29,24 +29,11 @@ void addfd(int epollfd, int fd)
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
     setnonblocking(fd);
 }
-/*信号处理函数*/
-void sig_handler(int sig)
+/*SIGTERM、SIGINT的处理函数：由sigfd_dispatch在主循环中调用，不在信号处理程序的上下文中，
+所以不必保存errno，也可以调用任何函数*/
+void stop_handler(int sig, int count, const struct signalfd_siginfo *si, void *arg)
 {
-    /*保留原来的errno，在函数最后恢复，以保证函数的可重入性*/
-    int save_errno = errno;
-    int msg = sig;
-    send(pipefd[1], (char *)&msg, 1, 0); /*将信号值写入管道，以通知主循环*/
-    errno = save_errno;
-}
-/*设置信号的处理函数*/
-void addsig(int sig)
-{
-    struct sigaction sa;
-    memset(&sa, '\0', sizeof(sa));
-    sa.sa_handler = sig_handler;
-    sa.sa_flags |= SA_RESTART;
-    sigfillset(&sa.sa_mask);
-    assert(sigaction(sig, &sa, NULL) != -1);
+    *(bool *)arg = true;
 }
 int main(int argc, char *argv[])
 {
@@ -77,17 +64,15 @@ int main(int argc, char *argv[])
     int epollfd = epoll_create(5);
     assert(epollfd != -1);
     addfd(epollfd, listenfd);
-    /*使用socketpair创建管道，注册pipefd[0]上的可读事件*/
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
-    assert(ret != -1);
-    setnonblocking(pipefd[1]);
-    addfd(epollfd, pipefd[0]);
-    /*设置一些信号的处理函数*/
-    addsig(SIGHUP);
-    addsig(SIGCHLD);
-    addsig(SIGTERM);
-    addsig(SIGINT);
+    /*阻塞要处理的信号，改由signalfd送达，注册它上面的可读事件。SIGHUP和SIGCHLD只是读走，
+    SIGTERM和SIGINT让主循环退出*/
     bool stop_server = false;
+    ret = sigfd_handle(SIGHUP, NULL, NULL) | sigfd_handle(SIGCHLD, NULL, NULL) |
+          sigfd_handle(SIGTERM, stop_handler, &stop_server) | sigfd_handle(SIGINT, stop_handler, &stop_server);
+    assert(ret != -1);
+    int sigfd = sigfd_open();
+    assert(sigfd != -1);
+    addfd(epollfd, sigfd);
     while (!stop_server)
     {
         int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
@@ -107,41 +92,10 @@ int main(int argc, char *argv[])
                 int connfd = accept(listenfd, (struct sockaddr *)&client_address, &client_addrlength);
                 addfd(epollfd, connfd);
             }
-            /*如果就绪的文件描述符是pipefd[0]，则处理信号*/
-            else if ((sockfd == pipefd[0]) && (events[i].events & EPOLLIN))
+            /*如果就绪的文件描述符是sigfd，则处理信号：一次读出所有到达的信号，每种信号调用一次处理函数*/
+            else if ((sockfd == sigfd) && (events[i].events & EPOLLIN))
             {
-                int sig;
-                char signals[1024];
-                ret = recv(pipefd[0], signals, sizeof(signals), 0);
-                if (ret == -1)
-                {
-                    continue;
-                }
-                else if (ret == 0)
-                {
-                    continue;
-                }
-                else
-                {
-                    /*因为每个信号值占1字节，所以按字节来逐个接收信号。我们以SIGTERM为例，来说
-                    明如何安全地终止服务器主循环*/
-                    for (int i = 0; i < ret; ++i)
-                    {
-                        switch (signals[i])
-                        {
-                        case SIGCHLD:
-                        case SIGHUP:
-                        {
-                            continue;
-                        }
-                        case SIGTERM:
-                        case SIGINT:
-                        {
-                            stop_server = true;
-                        }
-                        }
-                    }
-                }
+                sigfd_dispatch();
             }
             else
             {
@@ -150,7 +104,6 @@ int main(int argc, char *argv[])
     }
     printf("close fds\n");
     close(listenfd);
-    close(pipefd[1]);
-    close(pipefd[0]);
+    sigfd_close();
     return 0;
 }
\ No newline at end of file
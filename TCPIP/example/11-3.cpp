@@ -13,10 +13,10 @@
 #include <sys/epoll.h>
 #include <pthread.h>
 #include "lst_timer.h"
+#include "sigfd.h"
 #define FD_LIMIT 65535
 #define MAX_EVENT_NUMBER 1024
 #define TIMESLOT 5
-static int pipefd[2];
 /*利用代码清单11-2中的升序链表来管理定时器*/
 static sort_timer_lst timer_lst;
 static int epollfd = 0;
@@ -35,21 +35,10 @@ void addfd(int epollfd, int fd)
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
     setnonblocking(fd);
 }
-void sig_handler(int sig)
+/*信号的处理函数：由sigfd_dispatch在主循环中调用，arg指向要设置的标志*/
+void flag_handler(int sig, int count, const struct signalfd_siginfo *si, void *arg)
 {
-    int save_errno = errno;
-    int msg = sig;
-    send(pipefd[1], (char *)&msg, 1, 0);
-    errno = save_errno;
-}
-void addsig(int sig)
-{
-    struct sigaction sa;
-    memset(&sa, '\0', sizeof(sa));
-    sa.sa_handler = sig_handler;
-    sa.sa_flags |= SA_RESTART;
-    sigfillset(&sa.sa_mask);
-    assert(sigaction(sig, &sa, NULL) != -1);
+    *(bool *)arg = true;
 }
 void timer_handler()
 {
@@ -92,16 +81,16 @@ int main(int argc, char *argv[])
     int epollfd = epoll_create(5);
     assert(epollfd != -1);
     addfd(epollfd, listenfd);
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
-    assert(ret != -1);
-    setnonblocking(pipefd[1]);
-    addfd(epollfd, pipefd[0]);
-    /*设置信号处理函数*/
-    addsig(SIGALRM);
-    addsig(SIGTERM);
     bool stop_server = false;
     client_data *users = new client_data[FD_LIMIT];
     bool timeout = false;
+    /*两个信号都由signalfd送达。SIGALRM只设置timeout标志，但不立即处理定时任务，这是因为定时任务的
+    优先级不是很高，我们优先处理其他更重要的任务；SIGTERM让主循环退出*/
+    ret = sigfd_handle(SIGALRM, flag_handler, &timeout) | sigfd_handle(SIGTERM, flag_handler, &stop_server);
+    assert(ret != -1);
+    int sigfd = sigfd_open();
+    assert(sigfd != -1);
+    addfd(epollfd, sigfd);
     alarm(TIMESLOT); /*定时*/
     while (!stop_server)
     {
@@ -133,41 +122,10 @@ int main(int argc, char *argv[])
                 users[connfd].timer = timer;
                 timer_lst.add_timer(timer);
             }
-            /*处理信号*/
-            else if ((sockfd == pipefd[0]) && (events[i].events & EPOLLIN))
+            /*处理信号：SIGALRM连续到达多次也只设置一次timeout标志*/
+            else if ((sockfd == sigfd) && (events[i].events & EPOLLIN))
             {
-                int sig;
-                char signals[1024];
-                ret = recv(pipefd[0], signals, sizeof(signals), 0);
-                if (ret == -1)
-                {
-                    // handle the error
-                    continue;
-                }
-                else if (ret == 0)
-                {
-                    continue;
-                }
-                else
-                {
-                    for (int i = 0; i < ret; ++i)
-                    {
-                        switch (signals[i])
-                        {
-                        case SIGALRM:
-                        {
-                            /*用timeout变量标记有定时任务需要处理，但不立即处理定时任务。这是因为定时任
-                            务的优先级不是很高，我们优先处理其他更重要的任务*/
-                            timeout = true;
-                            break;
-                        }
-                        case SIGTERM:
-                        {
-                            stop_server = true;
-                        }
-                        }
-                    }
-                }
+                sigfd_dispatch();
             }
             /*处理客户连接上接收到的数据*/
             else if (events[i].events & EPOLLIN)
@@ -225,8 +183,7 @@ int main(int argc, char *argv[])
         }
     }
     close(listenfd);
-    close(pipefd[1]);
-    close(pipefd[0]);
+    sigfd_close();
     delete[] users;
     return 0;
 }
\ No newline at end of file
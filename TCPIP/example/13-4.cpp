@@ -15,6 +15,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include "sigfd.h"
 #define USER_LIMIT 5
 #define BUFFER_SIZE 1024
 #define FD_LIMIT 65535
@@ -29,7 +30,7 @@ struct client_data
     int pipefd[2];       /*和父进程通信用的管道*/
 };
 static const char *shm_name = "/my_shm";
-int sig_pipefd[2];
+int sigfd;
 int epollfd;
 int listenfd;
 int shmfd;
@@ -41,6 +42,8 @@ int *sub_process = 0;
 /*当前客户数量*/
 int user_count = 0;
 bool stop_child = false;
+bool stop_server = false;
+bool terminate = false;
 int setnonblocking(int fd)
 {
     int old_option = fcntl(fd, F_GETFL);
@@ -56,13 +59,6 @@ void addfd(int epollfd, int fd)
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
     setnonblocking(fd);
 }
-void sig_handler(int sig)
-{
-    int save_errno = errno;
-    int msg = sig;
-    send(sig_pipefd[1], (char *)&msg, 1, 0);
-    errno = save_errno;
-}
 void addsig(int sig, void (*handler)(int), bool restart = true)
 {
     struct sigaction sa;
@@ -77,14 +73,50 @@ void addsig(int sig, void (*handler)(int), bool restart = true)
 }
 void del_resource()
 {
-    close(sig_pipefd[0]);
-    close(sig_pipefd[1]);
+    sigfd_close();
     close(listenfd);
     close(epollfd);
     shm_unlink(shm_name);
     delete[] users;
     delete[] sub_process;
 }
+/*回收了一个退出的子进程，表示有某个客户端关闭了连接。由sigfd_dispatch在主循环中调用，
+一个SIGCHLD可能对应多个子进程，每回收一个就调用一次*/
+void child_exit(const siginfo_t *si, void *arg)
+{
+    /*用子进程的pid取得被关闭的客户连接的编号*/
+    int del_user = sub_process[si->si_pid];
+    sub_process[si->si_pid] = -1;
+    if ((del_user < 0) || (del_user > USER_LIMIT))
+    {
+        return;
+    }
+    /*清除第del_user个客户连接使用的相关数据*/
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, users[del_user].pipefd[0], 0);
+    close(users[del_user].pipefd[0]);
+    users[del_user] = users[--user_count];
+    sub_process[users[del_user].pid] = del_user;
+    if (terminate && user_count == 0)
+    {
+        stop_server = true;
+    }
+}
+/*SIGTERM、SIGINT：结束服务器程序*/
+void term_handler(int sig, int count, const struct signalfd_siginfo *si, void *arg)
+{
+    printf("kill all the clild now\n");
+    if (user_count == 0)
+    {
+        stop_server = true;
+        return;
+    }
+    for (int i = 0; i < user_count; ++i)
+    {
+        int pid = users[i].pid;
+        kill(pid, SIGTERM);
+    }
+    terminate = true;
+}
 /*停止一个子进程*/
 void child_term_handler(int sig)
 {
@@ -209,16 +241,14 @@ int main(int argc, char *argv[])
     epollfd = epoll_create(5);
     assert(epollfd != -1);
     addfd(epollfd, listenfd);
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sig_pipefd);
+    /*SIGCHLD、SIGTERM、SIGINT由signalfd送达，在主循环里处理*/
+    ret = sigfd_children(child_exit, NULL) | sigfd_handle(SIGTERM, term_handler, NULL) |
+          sigfd_handle(SIGINT, term_handler, NULL);
     assert(ret != -1);
-    setnonblocking(sig_pipefd[1]);
-    addfd(epollfd, sig_pipefd[0]);
-    addsig(SIGCHLD, sig_handler);
-    addsig(SIGTERM, sig_handler);
-    addsig(SIGINT, sig_handler);
+    sigfd = sigfd_open();
+    assert(sigfd != -1);
+    addfd(epollfd, sigfd);
     addsig(SIGPIPE, SIG_IGN);
-    bool stop_server = false;
-    bool terminate = false;
     /*创建共享内存，作为所有客户socket连接的读缓存*/
     shmfd = shm_open(shm_name, O_CREAT | O_RDWR, 0666);
     assert(shmfd != -1);
@@ -275,8 +305,7 @@ int main(int argc, char *argv[])
                     close(epollfd);
                     close(listenfd);
                     close(users[user_count].pipefd[0]);
-                    close(sig_pipefd[0]);
-                    close(sig_pipefd[1]);
+                    sigfd_close(); /*子进程要自己处理SIGTERM，先解除继承来的信号屏蔽*/
                     run_child(user_count, users, share_mem);
                     munmap((void *)share_mem, USER_LIMIT * BUFFER_SIZE);
                     exit(0);
@@ -287,6 +316,7 @@ int main(int argc, char *argv[])
                     close(users[user_count].pipefd[1]);
                     addfd(epollfd, users[user_count].pipefd[0]);
                     users[user_count].pid = pid;
+                    sigfd_watch(pid); /*它退出时由sigfd_dispatch回收并调用child_exit*/
                     /*记录新的客户连接在数组users中的索引值，建立进程pid和该索引值之间的映射关系
                      */
                     sub_process[pid] = user_count;
@@ -294,76 +324,9 @@ int main(int argc, char *argv[])
                 }
             }
             /*处理信号事件*/
-            else if ((sockfd == sig_pipefd[0]) && (events[i].events & EPOLLIN))
+            else if ((sockfd == sigfd) && (events[i].events & EPOLLIN))
             {
-                int sig;
-                char signals[1024];
-                ret = recv(sig_pipefd[0], signals, sizeof(signals), 0);
-                if (ret == -1)
-                {
-                    continue;
-                }
-                else if (ret == 0)
-                {
-                    continue;
-                }
-                else
-                {
-                    for (int i = 0; i < ret; ++i)
-                    {
-                        switch (signals[i])
-                        {
-                        /*子进程退出，表示有某个客户端关闭了连接*/
-                        case SIGCHLD:
-                        {
-                            pid_t pid;
-                            int stat;
-                            while ((pid = waitpid(-1, &stat, WNOHANG)) > 0)
-                            {
-                                /*用子进程的pid取得被关闭的客户连接的编号*/
-                                int del_user = sub_process[pid];
-                                sub_process[pid] = -1;
-                                if ((del_user < 0) || (del_user > USER_LIMIT))
-                                {
-                                    continue;
-                                }
-                                /*清除第del_user个客户连接使用的相关数据*/
-                                epoll_ctl(epollfd, EPOLL_CTL_DEL, users[del_user].pipefd[0], 0);
-                                close(users[del_user].pipefd[0]);
-                                users[del_user] = users[--user_count];
-                                sub_process[users[del_user].pid] = del_user;
-                            }
-                            if (terminate && user_count == 0)
-                            {
-                                stop_server = true;
-                            }
-                            break;
-                        }
-                        case SIGTERM:
-                        case SIGINT:
-                        {
-                            /*结束服务器程序*/
-                            printf("kill all the clild now\n");
-                            if (user_count == 0)
-                            {
-                                stop_server = true;
-                                break;
-                            }
-                            for (int i = 0; i < user_count; ++i)
-                            {
-                                int pid = users[i].pid;
-                                kill(pid, SIGTERM);
-                            }
-                            terminate = true;
-                            break;
-                        }
-                        default:
-                        {
-                            break;
-                        }
-                        }
-                    }
-                }
+                sigfd_dispatch();
             }
             /*某个子进程向父进程写入了数据*/
             else if (events[i].events & EPOLLIN)
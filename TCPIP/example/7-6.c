@@ -1,15 +1,72 @@
 // 将程序后台服务化，以下是 deamon 的实现方式
+// 在书中代码的基础上：
+// 1. 用 close_range 一次关闭其它所有描述符，不用逐个 close 到描述符上限（上限是 1M 时就是 1M 次系统调用）
+// 2. 可选的 pid 文件：加写锁并一直持有，第二个实例启动时会失败
+// 3. 启动它的进程不马上退出，而是等守护进程绑定好端口、预热好缓存、调用 daemon_ready 之后才以 0 退出，
+//    守护进程在就绪之前退出的话它以 1 退出，脚本和监控进程据此就知道服务是否已经可用
+#define _GNU_SOURCE
 #include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/stat.h>
 
-bool daemonize()
+static int ready_fd = -1; /*通向启动进程的管道写端*/
+
+/*把描述符挪到 2 以上：0、1、2 已经关闭（init 或监控进程启动时常见）的话，管道和 pid 文件会占用它们，
+  后面关闭标准输入、输出、错误时就被一起关掉了。失败时关闭 fd 返回 -1*/
+static int above2(int fd)
+{
+    int nfd;
+    if(fd > 2)
+    {
+        return fd;
+    }
+    nfd = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+    close(fd);
+    return nfd;
+}
+
+/*关闭 [lo, hi] 之间的描述符*/
+static void close_fds(int lo, unsigned int hi)
+{
+    if(lo >= 0 && (unsigned int)lo <= hi)
+    {
+        close_range(lo, hi, 0);
+    }
+}
+
+bool daemonize(const char *pidfile)
 {
+    int pipefd[2];
+    if(pipe2(pipefd, O_CLOEXEC) < 0)
+    {
+        return false;
+    }
+    if((pipefd[0] = above2(pipefd[0])) < 0)
+    {
+        close(pipefd[1]);
+        return false;
+    }
+    if((pipefd[1] = above2(pipefd[1])) < 0)
+    {
+        close(pipefd[0]);
+        return false;
+    }
     /*创建子进程，关闭父进程，这样可以使程序在后台运行*/
     pid_t pid = fork();
     if(pid < 0) {
         return false;
     }else if(pid > 0) {
-        exit(0)
+        /*父进程等子进程就绪：读到一个字节说明已就绪；读到文件结束说明子进程在就绪之前就退出了*/
+        char c;
+        close(pipefd[1]);
+        exit(read(pipefd[0], &c, 1) == 1 ? 0 : 1);
     }
+    close(pipefd[0]);
+    ready_fd = pipefd[1];
 
     /*设置文件权限掩码。当进程创建新文件（使用open(const char*pathname,int flags,mode_t mode)系统调用）时，文件的权限将是 mode＆0777*/
     umask(0);
@@ -24,14 +81,57 @@ bool daemonize()
     {
         return false;
     }
+    /*pid 文件：加写锁，锁一直持有到进程退出；已经被锁住说明另一个实例正在运行。
+      关闭这个文件的任何一个描述符都会释放锁，所以要在加锁之前挪到 2 以上*/
+    int lockfd = -1;
+    if(pidfile != NULL)
+    {
+        struct flock fl;
+        char buf[32];
+        memset(&fl, 0, sizeof(fl));
+        fl.l_type = F_WRLCK;
+        fl.l_whence = SEEK_SET;
+        if((lockfd = open(pidfile, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0 || (lockfd = above2(lockfd)) < 0
+           || fcntl(lockfd, F_SETLK, &fl) < 0)
+        {
+            return false;
+        }
+        snprintf(buf, sizeof(buf), "%ld\n", (long)getpid());
+        if(ftruncate(lockfd, 0) < 0 || write(lockfd, buf, strlen(buf)) < 0)
+        {
+            return false;
+        }
+    }
     /*关闭标准输入、输出、错误设备*/
     close(STDIN_FILENO);
     close(STDOUT_FILENO);
     close(STDERR_FILENO);
-    /*关闭其它已经打开的文件描述符，代码省略*/
+    /*关闭其它已经打开的文件描述符，只留下管道和 pid 文件*/
+    int lo = ready_fd < lockfd ? ready_fd : lockfd;
+    int hi = ready_fd < lockfd ? lockfd : ready_fd;
+    if(lo < 0)
+    {
+        close_fds(3, hi - 1);
+    }else
+    {
+        close_fds(3, lo - 1);
+        close_fds(lo + 1, hi - 1);
+    }
+    close_fds(hi + 1, ~0U);
     /*将标准输入、输出、错误都输出到指定的文件路径*/
     open("/dev/null",O_RDONLY);
     open("/dev/null",O_RDWR);
     open("/dev/null",O_RDWR);
     return true;
-}
\ No newline at end of file
+}
+
+/*初始化完成（端口已绑定、缓存已预热）后调用，启动进程随之以 0 退出*/
+void daemon_ready()
+{
+    if(ready_fd >= 0)
+    {
+        write(ready_fd, "", 1);
+        close(ready_fd);
+        ready_fd = -1;
+    }
+}
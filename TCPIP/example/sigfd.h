@@ -0,0 +1,241 @@
+#ifndef SIGFD_H
+#define SIGFD_H
+/*用signalfd把信号变成epoll中的一个可读事件，接口和APUE的lib/sigfd.c相同。
+代码清单10-1等例子的做法是：信号处理函数把信号值send到socketpair里，主循环再逐字节读出来。
+处理函数随时可能打断程序，只能调用异步信号安全的函数，还要保存errno；每个信号都是一次系统调用，
+信号多了还可能把管道写满。这里把要处理的信号阻塞起来，由signalfd送达：sigfd_dispatch一次read
+读出多个信号，同一个信号来了多次只调用一次处理函数（count是次数），处理函数在主循环里运行，
+可以调用任何函数。一个SIGCHLD可能对应多个子进程，所以用waitid把已退出的子进程一次全部回收。
+只回收用sigfd_watch登记过的子进程：popen、system等按pid等待自己的子进程，先被这里回收掉的话，
+pclose会以ECHILD失败，退出状态也丢了。所以先用WNOWAIT看一眼下一个已退出的子进程，是登记过的才回收；
+不是的话留给它的主人，改为按pid逐个查询登记过的子进程。
+注意：信号屏蔽字会被fork和exec继承，子进程要先调用sigfd_close；多线程程序要在创建线程之前设置*/
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#define SIGFD_BATCH 32 /*每次read最多读出的信号数*/
+#define SIGFD_NPID 16  /*子进程表的初始大小*/
+/*信号处理函数：信号值、这次到达的次数、最后一个信号的信息、注册时的参数*/
+typedef void Sigfdfunc(int, int, const struct signalfd_siginfo *, void *);
+/*子进程回收函数：waitid填好的子进程信息、注册时的参数*/
+typedef void Childfunc(const siginfo_t *, void *);
+static int sigfd_fd = -1;
+static sigset_t sigfd_mask;  /*已经接管的信号*/
+static sigset_t sigfd_omask; /*接管之前的信号屏蔽字*/
+static Sigfdfunc *sigfd_func[NSIG];
+static void *sigfd_arg[NSIG];
+static Childfunc *sigfd_child;
+static void *sigfd_childarg;
+static pid_t *sigfd_pids; /*要回收的子进程*/
+static int sigfd_npid, sigfd_maxpid;
+/*返回signalfd，把它加入epoll监听可读事件*/
+static inline int sigfd_open()
+{
+    if (sigfd_fd >= 0)
+    {
+        return sigfd_fd;
+    }
+    sigemptyset(&sigfd_mask);
+    sigprocmask(SIG_BLOCK, &sigfd_mask, &sigfd_omask);
+    sigfd_fd = signalfd(-1, &sigfd_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    return sigfd_fd;
+}
+/*把信号sig交给func处理；func为NULL表示只是读走这个信号*/
+static inline int sigfd_handle(int sig, Sigfdfunc *func, void *arg)
+{
+    sigset_t set;
+    if (sig <= 0 || sig >= NSIG || sig == SIGKILL || sig == SIGSTOP)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (sigfd_open() < 0)
+    {
+        return -1;
+    }
+    sigfd_func[sig] = func;
+    sigfd_arg[sig] = arg;
+    sigemptyset(&set);
+    sigaddset(&set, sig);
+    if (sigprocmask(SIG_BLOCK, &set, NULL) < 0)
+    {
+        return -1;
+    }
+    sigaddset(&sigfd_mask, sig);
+    return signalfd(sigfd_fd, &sigfd_mask, 0) < 0 ? -1 : 0;
+}
+/*sigfd_pids[i]已经退出的话回收它并交给处理函数。返回1表示它已从表里删掉，否则返回0*/
+static inline int sigfd_reapone(int i)
+{
+    siginfo_t si;
+    int ret;
+    si.si_pid = 0;
+    while ((ret = waitid(P_PID, sigfd_pids[i], &si, WEXITED | WNOHANG)) < 0 && errno == EINTR)
+    {
+    }
+    if (ret == 0 && si.si_pid == 0)
+    {
+        return 0;
+    }
+    sigfd_pids[i] = sigfd_pids[--sigfd_npid];
+    if (ret == 0)
+    {
+        sigfd_child(&si, sigfd_childarg);
+    }
+    return 1; /*或者ECHILD：已经在别处回收了*/
+}
+/*回收登记过的、已经退出的子进程，其他子进程不动*/
+static inline void sigfd_reap()
+{
+    siginfo_t si;
+    int i;
+    while (sigfd_npid > 0)
+    {
+        si.si_pid = 0;
+        if (waitid(P_ALL, 0, &si, WEXITED | WNOHANG | WNOWAIT) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break; /*ECHILD：没有子进程了*/
+        }
+        if (si.si_pid == 0)
+        {
+            return; /*没有已退出的子进程*/
+        }
+        for (i = 0; i < sigfd_npid && sigfd_pids[i] != si.si_pid; ++i)
+        {
+        }
+        if (i == sigfd_npid)
+        {
+            break; /*不是登记过的：改为逐个查询登记过的*/
+        }
+        sigfd_reapone(i);
+    }
+    for (i = 0; i < sigfd_npid;)
+    {
+        if (!sigfd_reapone(i))
+        {
+            ++i;
+        }
+    }
+}
+/*sigfd_watch登记过的子进程退出时逐个回收并交给func；注册之前就已退出的马上回收*/
+static inline int sigfd_children(Childfunc *func, void *arg)
+{
+    sigfd_child = func;
+    sigfd_childarg = arg;
+    if (!sigismember(&sigfd_mask, SIGCHLD) && sigfd_handle(SIGCHLD, NULL, NULL) < 0)
+    {
+        return -1;
+    }
+    sigfd_reap();
+    return 0;
+}
+/*fork之后登记子进程pid，要在下一次sigfd_dispatch之前调用*/
+static inline int sigfd_watch(pid_t pid)
+{
+    if (pid <= 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (sigfd_npid == sigfd_maxpid)
+    {
+        int n = sigfd_maxpid ? 2 * sigfd_maxpid : SIGFD_NPID;
+        pid_t *pp = (pid_t *)realloc(sigfd_pids, n * sizeof(pid_t));
+        if (!pp)
+        {
+            return -1;
+        }
+        sigfd_pids = pp;
+        sigfd_maxpid = n;
+    }
+    sigfd_pids[sigfd_npid++] = pid;
+    return 0;
+}
+/*signalfd可读时调用：读出所有到达的信号，每种信号调用一次处理函数。返回到达的信号数*/
+static inline int sigfd_dispatch()
+{
+    int count[NSIG];
+    struct signalfd_siginfo buf[SIGFD_BATCH], last[NSIG];
+    int total = 0;
+    memset(count, 0, sizeof(count));
+    for (;;)
+    {
+        ssize_t ret = read(sigfd_fd, buf, sizeof(buf));
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN)
+            {
+                break;
+            }
+            return -1;
+        }
+        int n = ret / sizeof(struct signalfd_siginfo);
+        for (int i = 0; i < n; ++i)
+        {
+            int sig = buf[i].ssi_signo;
+            if (sig > 0 && sig < NSIG)
+            {
+                count[sig]++;
+                last[sig] = buf[i];
+            }
+        }
+        total += n;
+        if (ret < (ssize_t)sizeof(buf))
+        {
+            break; /*没读满，说明已经读空了*/
+        }
+    }
+    for (int sig = 1; sig < NSIG; ++sig)
+    {
+        if (count[sig] == 0)
+        {
+            continue;
+        }
+        if (sig == SIGCHLD && sigfd_child)
+        {
+            sigfd_reap();
+        }
+        if (sigfd_func[sig])
+        {
+            sigfd_func[sig](sig, count[sig], &last[sig], sigfd_arg[sig]);
+        }
+    }
+    return total;
+}
+/*关闭signalfd，解除我们阻塞的信号（比如fork出的子进程要自己处理信号时）*/
+static inline void sigfd_close()
+{
+    sigset_t set;
+    if (sigfd_fd < 0)
+    {
+        return;
+    }
+    close(sigfd_fd);
+    sigfd_fd = -1;
+    sigemptyset(&set);
+    for (int sig = 1; sig < NSIG; ++sig)
+    {
+        if (sigismember(&sigfd_mask, sig) && !sigismember(&sigfd_omask, sig))
+        {
+            sigaddset(&set, sig);
+        }
+    }
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
+    sigemptyset(&sigfd_mask);
+    memset(sigfd_func, 0, sizeof(sigfd_func));
+    sigfd_child = NULL;
+    sigfd_npid = 0;
+}
+#endif